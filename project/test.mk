@@ -22,6 +22,9 @@ TEST_AEROSPIKE += test.c
 TEST_AEROSPIKE += test_common.c
 TEST_AEROSPIKE += types/*.c
 TEST_AEROSPIKE += msgpack/*.c
+TEST_AEROSPIKE += hash/*.c
+TEST_AEROSPIKE += queue/*.c
+TEST_AEROSPIKE += thread/*.c
 TEST_AEROSPIKE += util/*.c
 
 TEST_SOURCE = $(wildcard $(addprefix $(SOURCE_TEST)/, $(TEST_AEROSPIKE)))
@@ -61,3 +64,22 @@ $(TARGET_TEST)/common: CFLAGS = $(TEST_CFLAGS)
 $(TARGET_TEST)/common: LDFLAGS += $(TEST_LDFLAGS)
 $(TARGET_TEST)/common: $(TEST_OBJECT) $(wildcard $(TARGET_OBJ)/*) | modules build prepare
 	$(executable) $(TEST_DEPS)
+
+###############################################################################
+##  BENCHMARK TARGETS                                                 		 ##
+###############################################################################
+
+BENCH_DEPS =
+BENCH_DEPS += $(TARGET_LIB)/libaerospike-common.a
+
+.PHONY: bench
+bench: bench-build
+	$(TARGET_TEST)/bench/shash_bench
+
+.PHONY: bench-build
+bench-build: $(TARGET_TEST)/bench/shash_bench
+
+$(TARGET_TEST)/bench/%: CFLAGS = $(TEST_CFLAGS)
+$(TARGET_TEST)/bench/%: LDFLAGS += $(TEST_LDFLAGS)
+$(TARGET_TEST)/bench/%: $(TARGET_TEST)/bench/%.o $(TARGET_TEST)/util/cf_alloc.o $(wildcard $(TARGET_OBJ)/*) | modules build prepare
+	$(executable) $(BENCH_DEPS)
@@ -0,0 +1,156 @@
+/******************************************************************************
+ *	Copyright 2008-2013 by Aerospike.
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy 
+ *	of this software and associated documentation files (the "Software"), to 
+ *	deal in the Software without restriction, including without limitation the 
+ *	rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ *	sell copies of the Software, and to permit persons to whom the Software is 
+ *	furnished to do so, subject to the following conditions:
+ * 
+ *	The above copyright notice and this permission notice shall be included in 
+ *	all copies or substantial portions of the Software.
+ * 
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ *	FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *	IN THE SOFTWARE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************************************************
+ *	CONSTANTS
+ *****************************************************************************/
+
+/**
+ *	Default number of bytes in each block of an arena.
+ */
+#define AS_ARENA_BLOCK_SIZE 8192
+
+/******************************************************************************
+ *	TYPES
+ *****************************************************************************/
+
+/**
+ *	Region allocator for building a tree of values which is released all 
+ *	at once.
+ *
+ *	Memory is handed out from large blocks, and individual allocations are 
+ *	never freed. Destroying the arena releases every block, and with them
+ *	every value allocated from the arena.
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_arena arena;
+ *	as_arena_init(&arena, AS_ARENA_BLOCK_SIZE);
+ *
+ *	as_arraylist * list = as_arraylist_new_arena(&arena, 2, 0);
+ *	as_arraylist_append(list, (as_val *) as_integer_new_arena(&arena, 1));
+ *	as_arraylist_append(list, (as_val *) as_string_new_arena(&arena, "a", 1));
+ *
+ *	as_arena_destroy(&arena);
+ *	~~~~~~~~~~
+ *
+ *	Values created by the `*_new_arena()` constructors are marked as owned
+ *	by the arena (`as_val.arena`). Calling `as_val_destroy()` on one only 
+ *	drops a reference: neither the value nor anything it refers to is 
+ *	released until the arena is. So a list or map allocated from an arena 
+ *	should only hold values from the same arena, or constants such as 
+ *	`as_nil`, and no value from the arena may be used once the arena has 
+ *	been destroyed.
+ *
+ *	An arena is not synchronized, and must only be used by one thread at 
+ *	a time.
+ *
+ *	@ingroup aerospike_t
+ */
+typedef struct as_arena_s {
+
+	/**
+	 *	@private
+	 *	The block being allocated from, followed by the blocks already used.
+	 */
+	struct as_arena_block_s * head;
+
+	/**
+	 *	The number of bytes in each block.
+	 */
+	uint32_t block_size;
+
+	/**
+	 *	If true, then as_arena_destroy() will free the arena itself.
+	 */
+	bool free;
+
+} as_arena;
+
+/******************************************************************************
+ *	INSTANCE FUNCTIONS
+ *****************************************************************************/
+
+/**
+ *	Initialize a stack allocated arena. No memory is allocated until the 
+ *	first call to as_arena_alloc().
+ *
+ *	@param arena		The arena to initialize.
+ *	@param block_size	The number of bytes in each block. If 0 (zero), then
+ *						AS_ARENA_BLOCK_SIZE is used.
+ *
+ *	@return On success, the initialized arena. Otherwise NULL.
+ *
+ *	@relatesalso as_arena
+ */
+as_arena * as_arena_init(as_arena * arena, uint32_t block_size);
+
+/**
+ *	Create a new heap allocated arena.
+ *
+ *	@param block_size	The number of bytes in each block. If 0 (zero), then
+ *						AS_ARENA_BLOCK_SIZE is used.
+ *
+ *	@return On success, the new arena. Otherwise NULL.
+ *
+ *	@relatesalso as_arena
+ */
+as_arena * as_arena_new(uint32_t block_size);
+
+/**
+ *	Release all memory allocated from the arena, including all values 
+ *	created from it.
+ *
+ *	@param arena	The arena to destroy.
+ *
+ *	@relatesalso as_arena
+ */
+void as_arena_destroy(as_arena * arena);
+
+/**
+ *	Release all memory allocated from the arena, keeping one block for 
+ *	reuse, so an arena which is reset between requests rarely needs to 
+ *	call malloc().
+ *
+ *	@param arena	The arena to reset.
+ *
+ *	@relatesalso as_arena
+ */
+void as_arena_reset(as_arena * arena);
+
+/**
+ *	Allocate memory from the arena. The memory is aligned for any of the 
+ *	value types, and is not zeroed.
+ *
+ *	@param arena	The arena to allocate from.
+ *	@param size		The number of bytes to allocate.
+ *
+ *	@return On success, the allocated memory. Otherwise NULL.
+ *
+ *	@relatesalso as_arena
+ */
+void * as_arena_alloc(as_arena * arena, size_t size);
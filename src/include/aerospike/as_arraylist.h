@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <aerospike/as_arena.h>
 #include <aerospike/as_integer.h>
 #include <aerospike/as_string.h>
 #include <aerospike/as_bytes.h>
@@ -132,6 +133,12 @@ typedef struct as_arraylist_s {
 	 */
 	bool free;
 
+	/**
+	 *	If not NULL, the list and its elements were allocated from this 
+	 *	arena, and the elements are grown within it.
+	 */
+	as_arena * arena;
+
 } as_arraylist;
 
 /**
@@ -213,6 +220,21 @@ as_arraylist * as_arraylist_init(as_arraylist * list, uint32_t capacity, uint32_
  */
 as_arraylist * as_arraylist_new(uint32_t capacity, uint32_t block_size);
 
+/**
+ *	Create and initialize a list as as_arraylist, allocated from an arena.
+ *	The list and its element storage are released when the arena is 
+ *	destroyed, so the list should only hold values from the same arena.
+ *	
+ *	@param arena		The arena to allocate from.
+ *	@param capacity		The number of elements to allocate to the list.
+ *	@param block_size	The number of elements to grow the list by, when the 
+ *						capacity has been reached.
+ *  
+ *	@return On success, the new list. Otherwise NULL.
+ *	@relatesalso as_arraylist
+ */
+as_arraylist * as_arraylist_new_arena(as_arena * arena, uint32_t capacity, uint32_t block_size);
+
 /**
  *	Destoy the list and release resources.
  *
@@ -535,7 +557,8 @@ static inline int as_arraylist_set_map(as_arraylist * list, const uint32_t index
 int as_arraylist_append(as_arraylist * list, as_val * value);
 
 /**
- *  Add an int64_t to the end of the list.
+ *  Add an int64_t to the end of the list. Small values are added as 
+ *	immediate values (see as_integer_new_imm()), so nothing is allocated.
  *
  *	@param list 	The list.
  *	@param value 	The value to prepend.
@@ -108,6 +108,23 @@ as_boolean * as_boolean_init(as_boolean * boolean, bool value);
  */
 as_boolean * as_boolean_new(bool value);
 
+/**
+ *	Creates a boolean value encoded in the `as_val *` itself, so nothing is
+ *	allocated. 
+ *
+ *	The value must only be read via as_boolean_get() and the other value 
+ *	functions, never via `as_boolean.value`.
+ *
+ *	@param value	The bool value.
+ *
+ *	@return The value.
+ *
+ *	@relatesalso as_boolean
+ */
+static inline as_val * as_boolean_new_imm(bool value) {
+	return as_val_imm(AS_BOOLEAN, value ? 1 : 0);
+}
+
 /**
  *	Destroy the `as_boolean` and release associated resources.
  *
@@ -129,6 +146,7 @@ static inline void as_boolean_destroy(as_boolean * boolean) {
  *	@relatesalso as_boolean
  */
 static inline bool as_boolean_getorelse(const as_boolean * boolean, bool fallback) {
+	if ( as_val_isimm(boolean) ) return as_val_imm_bit(boolean);
 	return boolean ? boolean->value : fallback;
 }
 
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <aerospike/as_arena.h>
 #include <aerospike/as_util.h>
 #include <aerospike/as_val.h>
 
@@ -376,6 +377,25 @@ as_bytes * as_bytes_new(uint32_t capacity);
  */
 as_bytes * as_bytes_new_wrap(uint8_t * value, uint32_t size, bool free);
 
+/**
+ *	Create a new `as_bytes` allocated from an arena, as an empty buffer of 
+ *	capacity size. The buffer is allocated from the arena as well, and both 
+ *	are released when the arena is destroyed. The buffer can't be resized 
+ *	by `as_bytes_ensure()`.
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_bytes * bytes = as_bytes_new_arena(&arena, 10);
+ *	~~~~~~~~~~
+ *
+ *	@param arena	The arena to allocate from.
+ *	@param capacity	The number of bytes to allocate.
+ *
+ *	@return On success, the initializes bytes. Otherwise NULL.
+ *
+ *	@relatesalso as_bytes
+ */
+as_bytes * as_bytes_new_arena(as_arena * arena, uint32_t capacity);
+
 /**
  *	Destroy the `as_bytes` and release associated resources.
  *
@@ -22,8 +22,11 @@
 
 #pragma once
 
+#include <aerospike/as_arena.h>
 #include <aerospike/as_map.h>
+#include <aerospike/as_pair.h>
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -31,6 +34,27 @@
  *	TYPES
  ******************************************************************************/
 
+/**
+ *	@private
+ *	A slot in the as_hashmap table.
+ *
+ *	The (key,value) is held in an inline `as_pair`, so setting an entry does
+ *	not allocate, and iterators can hand out the pair directly.
+ */
+typedef struct as_hashmap_entry_s {
+
+	/**
+	 *	The (key,value) of the entry.
+	 */
+	as_pair pair;
+
+	/**
+	 *	The full hash of the key.
+	 */
+	uint32_t hash;
+
+} as_hashmap_entry;
+
 /**
  *	A hashtable based implementation of `as_map`.
  *
@@ -57,6 +81,15 @@
  *	~~~~~~~~~~
  *
  *
+ *	A map created with `as_hashmap_init()` or `as_hashmap_new()` is not 
+ *	synchronized, and must only be used by one thread at a time. If a map 
+ *	is to be shared between threads, then use `as_hashmap_init_concurrent()` 
+ *	or `as_hashmap_new_concurrent()` instead:
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_hashmap * map = as_hashmap_new_concurrent(32);
+ *	~~~~~~~~~~
+ *
  *	The `as_hashmap` is a subtype of `as_map`. This allows you to alternatively
  *	use `as_map` functions, by typecasting `as_hashmap` to `as_map`.
  *
@@ -88,9 +121,51 @@ typedef struct as_hashmap_s {
 	as_map _;
 
 	/**
-	 *	Hashtable
+	 *	The number of slots in the table.
+	 *	Either 0 (zero) or a power of 2.
+	 */
+	uint32_t capacity;
+
+	/**
+	 *	The number of entries in the table.
+	 */
+	uint32_t count;
+
+	/**
+	 *	The number of empty slots that can be used before the table 
+	 *	has to be rehashed.
+	 */
+	uint32_t growth_left;
+
+	/**
+	 *	Control bytes, one for each slot. The high bit is clear for a slot 
+	 *	in use, in which case the remaining bits are taken from the hash of
+	 *	the key. The first bytes are repeated at the end, so a probe can 
+	 *	always read a whole group of control bytes.
+	 */
+	uint8_t * ctrl;
+
+	/**
+	 *	The slots.
+	 */
+	as_hashmap_entry * entries;
+
+	/**
+	 *	If true, then operations on the map are serialized by `lock`.
+	 */
+	bool concurrent;
+
+	/**
+	 *	Lock for multithreaded access.
+	 *	Only initialized for a concurrent map.
+	 */
+	pthread_mutex_t lock;
+
+	/**
+	 *	If not NULL, the map and its table were allocated from this arena, 
+	 *	and the table is grown within it.
 	 */
-	void * htable;
+	as_arena * arena;
 
 } as_hashmap;
 
@@ -102,7 +177,7 @@ typedef struct as_hashmap_s {
  *	Initialize a stack allocated hashmap.
  *
  *	@param map 			The map to initialize.
- *	@param buckets		The number of hash buckets to allocate.
+ *	@param buckets		The number of entries to allocate space for.
  *
  *	@return On success, the initialized map. Otherwise NULL.
  *
@@ -113,7 +188,7 @@ as_hashmap * as_hashmap_init(as_hashmap * map, uint32_t buckets);
 /**
  *	Creates a new map as a hashmap.
  *
- *	@param buckets		The number of hash buckets to allocate.
+ *	@param buckets		The number of entries to allocate space for.
  *
  *	@return On success, the new map. Otherwise NULL.
  *
@@ -121,6 +196,49 @@ as_hashmap * as_hashmap_init(as_hashmap * map, uint32_t buckets);
  */
 as_hashmap * as_hashmap_new(uint32_t buckets);
 
+/**
+ *	Creates a new map as a hashmap, allocated from an arena.
+ *
+ *	The map and its table are released when the arena is destroyed, so the
+ *	map should only hold keys and values from the same arena. The map is not
+ *	synchronized.
+ *
+ *	@param arena		The arena to allocate from.
+ *	@param buckets		The number of entries to allocate space for.
+ *
+ *	@return On success, the new map. Otherwise NULL.
+ *
+ *	@relatesalso as_hashmap
+ */
+as_hashmap * as_hashmap_new_arena(as_arena * arena, uint32_t buckets);
+
+/**
+ *	Initialize a stack allocated hashmap, which can be shared between threads.
+ *
+ *	Each operation on the map will hold the map's lock.
+ *
+ *	@param map 			The map to initialize.
+ *	@param buckets		The number of entries to allocate space for.
+ *
+ *	@return On success, the initialized map. Otherwise NULL.
+ *
+ *	@relatesalso as_hashmap
+ */
+as_hashmap * as_hashmap_init_concurrent(as_hashmap * map, uint32_t buckets);
+
+/**
+ *	Creates a new map as a hashmap, which can be shared between threads.
+ *
+ *	Each operation on the map will hold the map's lock.
+ *
+ *	@param buckets		The number of entries to allocate space for.
+ *
+ *	@return On success, the new map. Otherwise NULL.
+ *
+ *	@relatesalso as_hashmap
+ */
+as_hashmap * as_hashmap_new_concurrent(uint32_t buckets);
+
 /**
  *	Free the map and associated resources.
  *
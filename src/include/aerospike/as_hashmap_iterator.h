@@ -94,25 +94,20 @@ typedef struct as_hashmap_iterator_s {
 	/**
 	 *	The hashmap
 	 */
-	void * htable;
+	const as_hashmap * map;
 
 	/**
 	 *	Current entry
 	 */
 	void * curr;
 
-	/**
-	 *	Next entry
-	 */
-	void * next;
-
 	/**
 	 *	Position
 	 */
 	uint32_t pos;
 
 	/**
-	 *	Number of entries
+	 *	Number of slots
 	 */
 	uint32_t size;
 
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <aerospike/as_arena.h>
 #include <aerospike/as_util.h>
 #include <aerospike/as_val.h>
 
@@ -167,6 +168,50 @@ as_integer * as_integer_init(as_integer * integer, int64_t value);
  */
 as_integer * as_integer_new(int64_t value);
 
+/**
+ *	Creates a new `as_integer` allocated from an arena. It is released when 
+ *	the arena is destroyed.
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_integer * i = as_integer_new_arena(&arena, 123);
+ *	~~~~~~~~~~
+ *
+ *	@param arena		The arena to allocate from.
+ *	@param value		The integer value.
+ *
+ *	@return On success, the initialized value. Otherwise NULL.
+ *
+ *	@relatesalso as_integer
+ */
+as_integer * as_integer_new_arena(as_arena * arena, int64_t value);
+
+/**
+ *	Creates an integer value without allocating, if the value is small 
+ *	enough to be encoded in the `as_val *` itself (63 bits on 64 bit 
+ *	platforms). Otherwise, creates a new heap allocated `as_integer`.
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_val * v = as_integer_new_imm(123);
+ *	as_arraylist_append(list, v);
+ *	~~~~~~~~~~
+ *
+ *	The value must only be read via as_integer_get() and the other value 
+ *	functions, never via `as_integer.value`. It is released as usual, with
+ *	as_val_destroy().
+ *
+ *	@param value		The integer value.
+ *
+ *	@return On success, the value. Otherwise NULL.
+ *
+ *	@relatesalso as_integer
+ */
+static inline as_val * as_integer_new_imm(int64_t value) {
+	if ( value >= AS_VAL_IMM_INT_MIN && value <= AS_VAL_IMM_INT_MAX ) {
+		return as_val_imm_int(value);
+	}
+	return (as_val *) as_integer_new(value);
+}
+
 /**
  *	Destroy the `as_integer` and release resources.
  *
@@ -192,6 +237,7 @@ static inline void as_integer_destroy(as_integer * integer) {
  *	@relatesalso as_integer
  */
 static inline int64_t as_integer_getorelse(const as_integer * integer, int64_t fallback) {
+	if ( as_val_isimm(integer) ) return as_val_imm_int_value(integer);
 	return integer ? integer->value : fallback;
 }
 
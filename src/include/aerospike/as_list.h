@@ -579,7 +579,7 @@ static inline as_bytes * as_list_get_bytes(const as_list * list, const uint32_t
 static inline as_list * as_list_get_list(const as_list * list, const uint32_t i) 
 {
 	as_val * v = as_list_get(list, i);
-	return (as_list *) (v && v->type == AS_LIST ? v : NULL);
+	return (as_list *) (as_val_type(v) == AS_LIST ? v : NULL);
 }
 
 /**
@@ -594,7 +594,7 @@ static inline as_list * as_list_get_list(const as_list * list, const uint32_t i)
 static inline struct as_map_s * as_list_get_map(const as_list * list, const uint32_t i) 
 {
 	as_val * v = as_list_get(list, i);
-	return (struct as_map_s *) (v && v->type == AS_MAP ? v : NULL);
+	return (struct as_map_s *) (as_val_type(v) == AS_MAP ? v : NULL);
 }
 
 
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <aerospike/as_arena.h>
 #include <aerospike/as_serializer.h>
 
 #include <msgpack.h>
@@ -34,6 +35,16 @@ as_serializer * as_msgpack_new();
 
 as_serializer * as_msgpack_init(as_serializer *);
 
+/**
+ *	A msgpack serializer which deserializes into values allocated from the
+ *	arena. The values are released when the arena is destroyed.
+ */
+as_serializer * as_msgpack_new_arena(as_arena *);
+
+as_serializer * as_msgpack_init_arena(as_serializer *, as_arena *);
+
 int as_msgpack_pack_val(msgpack_packer *, as_val *);
 
 int as_msgpack_object_to_val(msgpack_object *, as_val **);
+
+int as_msgpack_object_to_val_arena(msgpack_object *, as_arena *, as_val **);
@@ -36,6 +36,12 @@
  */
 extern const as_val as_nil;
 
+/**
+ *	NIL value encoded in the `as_val *` itself. Like `as_nil`, it needs no 
+ *	allocation and is never freed.
+ */
+#define as_nil_imm ( as_val_imm(AS_NIL, 0) )
+
 /******************************************************************************
  *	FUNCTIONS
  *****************************************************************************/
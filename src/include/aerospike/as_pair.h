@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <aerospike/as_arena.h>
 #include <aerospike/as_util.h>
 #include <aerospike/as_val.h>
 
@@ -78,6 +79,21 @@ typedef struct as_pair_s {
  */
 as_pair * as_pair_new(as_val * _1, as_val * _2);
 
+/**
+ *	Create and initializes a new `as_pair` allocated from an arena. It is 
+ *	released when the arena is destroyed, so the values should be from the 
+ *	same arena.
+ *
+ *	@param arena	The arena to allocate from.
+ *	@param _1		The first value.
+ *	@param _2		The second value.
+ *
+ *	@return On success, the new pair. Otherwise NULL.
+ *
+ *	@relatesalso as_pair
+ */
+as_pair * as_pair_new_arena(as_arena * arena, as_val * _1, as_val * _2);
+
 /**
  *	Initializes a stack allocated `as_pair`.
  *
@@ -478,7 +478,7 @@ static inline int as_rec_set_int64(const as_rec * rec, const char * name, int64_
  */
 static inline int as_rec_set_str(const as_rec * rec, const char * name, const char * value) 
 {
-	return as_util_hook(set, 1, rec, name, (as_val *) as_string_new(strdup(value), true));
+	return as_util_hook(set, 1, rec, name, (as_val *) as_string_new_strdup(value));
 }
 
 /**
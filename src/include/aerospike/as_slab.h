@@ -0,0 +1,67 @@
+/******************************************************************************
+ *	Copyright 2008-2013 by Aerospike.
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy 
+ *	of this software and associated documentation files (the "Software"), to 
+ *	deal in the Software without restriction, including without limitation the 
+ *	rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ *	sell copies of the Software, and to permit persons to whom the Software is 
+ *	furnished to do so, subject to the following conditions:
+ * 
+ *	The above copyright notice and this permission notice shall be included in 
+ *	all copies or substantial portions of the Software.
+ * 
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ *	FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *	IN THE SOFTWARE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+
+/******************************************************************************
+ *	CONSTANTS
+ *****************************************************************************/
+
+/**
+ *	The largest allocation served from the slabs.
+ */
+#define AS_SLAB_MAX_SIZE 64
+
+/******************************************************************************
+ *	FUNCTIONS
+ *****************************************************************************/
+
+/**
+ *	@private
+ *	Allocate a small fixed size value header, such as an `as_integer`.
+ *
+ *	Each thread keeps a free list for each size class, so allocation and
+ *	release are usually a couple of pointer operations, without a lock. 
+ *	Memory freed by another thread is handed back in batches.
+ *
+ *	@param size		The number of bytes, at most AS_SLAB_MAX_SIZE.
+ *
+ *	@return On success, the allocated memory. Otherwise NULL.
+ */
+void * as_slab_alloc(size_t size);
+
+/**
+ *	@private
+ *	Release memory allocated by as_slab_alloc(). May be called from any 
+ *	thread.
+ */
+void as_slab_free(void * p);
+
+/**
+ *	@private
+ *	Hand the calling thread's cached memory back for use by other threads.
+ *	This is done when a thread exits, but a long lived thread which has 
+ *	finished with a burst of values can call it sooner.
+ */
+void as_slab_flush();
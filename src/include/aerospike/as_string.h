@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <aerospike/as_arena.h>
 #include <aerospike/as_util.h>
 #include <aerospike/as_val.h>
 
@@ -29,12 +30,25 @@
 #include <stdint.h>
 #include <string.h>
 
+/******************************************************************************
+ *	CONSTANTS
+ ******************************************************************************/
+
+/**
+ *	Size of the buffer within `as_string`, which holds copies of strings 
+ *	of up to `AS_STRING_INLINE_SIZE - 1` characters, so they need no 
+ *	separate allocation.
+ */
+#define AS_STRING_INLINE_SIZE 24
+
 /******************************************************************************
  *	TYPES
  ******************************************************************************/
 
 /**
- *	Container for NULL-terminates string values.
+ *	Container for NULL-terminates string values. The length is set when
+ *	the string is constructed, so a string may contain NULL characters if
+ *	it is constructed with an explicit length.
  *
  *	## Initialization
  *	
@@ -58,6 +72,14 @@
  *	as_string * s = as_string_new("abc", false);
  *	~~~~~~~~~~
  *
+ *	To create a heap allocated as_string holding a copy of a string, use
+ *	as_string_new_strdup() or as_string_new_strndup(). Short strings are 
+ *	copied into the as_string itself, so need no second allocation:
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_string * s = as_string_new_strdup(name);
+ *	~~~~~~~~~~
+ *
  *	## Destruction
  *
  *	When the as_string instance is no longer required, then you should
@@ -130,6 +152,14 @@ typedef struct as_string_s {
 	 */
 	size_t len;
 
+	/**
+	 *	@private
+	 *	Holds the value of a short copied string, in which case 
+	 *	`as_string.value` points here. So an as_string must not be copied
+	 *	by value.
+	 */
+	char inline_value[AS_STRING_INLINE_SIZE];
+
 } as_string;
 
 /******************************************************************************
@@ -165,6 +195,82 @@ as_string * as_string_init(as_string * string, char * value, bool free);
  */
 as_string * as_string_new(char * value, bool free);
 
+/**
+ *	Initialize a stack allocated `as_string`, with the length of the value.
+ *	The value may contain NULL characters, but must be NULL terminated.
+ *
+ *	@param string	The stack allocated as_string to initialize
+ *	@param value 	The string of characters.
+ *	@param len		The number of characters in value.
+ *	@param free		If true, then the value will be freed when as_string is destroyed.
+ *
+ *	@return On success, the initialized string. Otherwise NULL.
+ *
+ *	@relatesalso as_string
+ */
+as_string * as_string_init_wlen(as_string * string, char * value, size_t len, bool free);
+
+/**
+ *	Create and initialize a new heap allocated `as_string`, with the length
+ *	of the value. The value may contain NULL characters, but must be NULL 
+ *	terminated.
+ *
+ *	@param value 	The string of characters.
+ *	@param len		The number of characters in value.
+ *	@param free		If true, then the value will be freed when as_string is destroyed.
+ *
+ *	@return On success, the new string. Otherwise NULL.
+ *
+ *	@relatesalso as_string
+ */
+as_string * as_string_new_wlen(char * value, size_t len, bool free);
+
+/**
+ *	Create a new heap allocated `as_string`, holding a copy of a NULL 
+ *	terminated string. 
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_string * s = as_string_new_strdup("abc");
+ *	~~~~~~~~~~
+ *
+ *	@param value 	The NULL terminated string to copy.
+ *
+ *	@return On success, the new string. Otherwise NULL.
+ *
+ *	@relatesalso as_string
+ */
+as_string * as_string_new_strdup(const char * value);
+
+/**
+ *	Create a new heap allocated `as_string`, holding a NULL terminated copy 
+ *	of the first len characters of value, which may include NULL characters.
+ *	A copy of up to `AS_STRING_INLINE_SIZE - 1` characters is held within
+ *	the `as_string`, otherwise it is allocated separately.
+ *
+ *	@param value 	The characters to copy.
+ *	@param len		The number of characters to copy.
+ *
+ *	@return On success, the new string. Otherwise NULL.
+ *
+ *	@relatesalso as_string
+ */
+as_string * as_string_new_strndup(const char * value, size_t len);
+
+/**
+ *	Create a new `as_string` allocated from an arena, holding a copy of 
+ *	the first len characters of value. Both are released when the arena is
+ *	destroyed.
+ *
+ *	@param arena	The arena to allocate from.
+ *	@param value 	The characters to copy.
+ *	@param len		The number of characters to copy.
+ *
+ *	@return On success, the new string. Otherwise NULL.
+ *
+ *	@relatesalso as_string
+ */
+as_string * as_string_new_arena(as_arena * arena, const char * value, size_t len);
+
 /**
  *	Destroy the as_string and associated resources.
  *
@@ -66,6 +66,27 @@ typedef struct as_val_s {
      */
     bool free;
 
+    /**
+     *	Value was allocated from an `as_arena`.
+     *	The value, and the values it refers to, are released with the arena
+     *	rather than when the count reaches 0 (zero).
+     */
+    bool arena : 1;
+
+    /**
+     *	@private
+     *	Value was allocated by `as_slab_alloc()`, so is released by 
+     *	`as_slab_free()` rather than `free()`.
+     */
+    bool slab : 1;
+
+    /**
+     *	Reference count is local to one thread, so is changed without 
+     *	atomic operations. Use `as_val_share()` before the value is 
+     *	referenced by another thread.
+     */
+    bool local : 1;
+
     /**
      *	Reference count
      *	Values are ref counted.
@@ -75,10 +96,76 @@ typedef struct as_val_s {
 
 } as_val;
 
+/******************************************************************************
+ *	VARIABLES
+ *****************************************************************************/
+
+/**
+ *	@private
+ *	If true, values constructed by the calling thread have a local 
+ *	reference count. Set with `as_val_set_local()`.
+ */
+extern __thread bool as_val_local_default;
+
 /******************************************************************************
  *	MACROS
  *****************************************************************************/
  
+/**
+ *	@private
+ *	Small integers, booleans and nil may be immediate values, encoded in 
+ *	the `as_val *` itself rather than pointing to an `as_val`. Values are 
+ *	at least 4 byte aligned, so a pointer with either of its low two bits 
+ *	set is an immediate:
+ *	- `...1` is an integer, held in the remaining bits.
+ *	- `...10` is a boolean or nil, with the `as_val_t` from bit 3 up, and 
+ *	  the boolean value in bit 2.
+ *
+ *	Immediates are not reference counted, so reserving or destroying one
+ *	does nothing. Only the type and value may be read from one, never the
+ *	`as_val` fields.
+ */
+#define AS_VAL_IMM_MASK		((uintptr_t) 3)
+#define AS_VAL_IMM_INT		((uintptr_t) 1)
+#define AS_VAL_IMM_OTHER	((uintptr_t) 2)
+
+/**
+ *	@private
+ *	Range of the integers which can be immediate values.
+ */
+#define AS_VAL_IMM_INT_MIN	((int64_t) (INTPTR_MIN >> 1))
+#define AS_VAL_IMM_INT_MAX	((int64_t) (INTPTR_MAX >> 1))
+
+/**
+ *	@private
+ *	True if the value is an immediate value.
+ */
+#define as_val_isimm(__v) ( ((uintptr_t) (__v) & AS_VAL_IMM_MASK) != 0 )
+
+/**
+ *	@private
+ *	Encode an integer, which must be in range, as an immediate value.
+ */
+#define as_val_imm_int(__i) ( (as_val *) (((uintptr_t) (__i) << 1) | AS_VAL_IMM_INT) )
+
+/**
+ *	@private
+ *	Decode the integer from an immediate integer value.
+ */
+#define as_val_imm_int_value(__v) ( (int64_t) ((intptr_t) (__v) >> 1) )
+
+/**
+ *	@private
+ *	Encode a boolean or nil as an immediate value.
+ */
+#define as_val_imm(__type, __bit) ( (as_val *) (((uintptr_t) (__type) << 3) | ((uintptr_t) (__bit) << 2) | AS_VAL_IMM_OTHER) )
+
+/**
+ *	@private
+ *	Decode the boolean value from an immediate boolean value.
+ */
+#define as_val_imm_bit(__v) ( (((uintptr_t) (__v) >> 2) & 1) != 0 )
+
 /**
  *	Returns the `as_val.type` of a value.
  *
@@ -87,7 +174,7 @@ typedef struct as_val_s {
  *	@return An as_val_t value. If the type is unknown, then it will 
  *	be AS_UNKNOWN.
  */
-#define as_val_type(__v) (__v ? ((as_val *)__v)->type : AS_UNDEF)
+#define as_val_type(__v) ( as_val_val_type((const as_val *)__v) )
 
 /**
  *	Increment the `as_val.count` of a value.
@@ -100,7 +187,8 @@ typedef struct as_val_s {
 
 /**
  *	Decrement the `as_val.count` of a value. If `as_val.count` reaches 0 (zero) and
- *	`as_val.free` is true, then free the `as_val` instance.
+ *	`as_val.free` is true, then free the `as_val` instance. A value allocated 
+ *	from an `as_arena` is left for the arena to release.
  *
  *	@param __v 	The `as_val` to be decremented.
  *
@@ -108,6 +196,17 @@ typedef struct as_val_s {
  */
 #define as_val_destroy(__v) ( as_val_val_destroy((as_val *)__v) )
 
+/**
+ *	Switch a value, and all values it contains, to atomic reference counting,
+ *	so references may be reserved and destroyed by other threads. Must be 
+ *	called by the thread which built the value, before it is handed over.
+ *
+ *	@param __v 	The `as_val` to share.
+ *
+ *	@return The value.
+ */
+#define as_val_share(__v) ( as_val_val_share((as_val *)__v) )
+
 /**
  *	Get the hashcode value for the value.
  *
@@ -143,6 +242,34 @@ as_val * as_val_val_reserve(as_val *);
  */
 as_val * as_val_val_destroy(as_val *);
 
+/**
+ *	@private
+ *	Helper function for switching a value, and all values it contains, 
+ *	to atomic reference counting.
+ */
+as_val * as_val_val_share(as_val *);
+
+/**
+ *	Set whether values constructed by the calling thread from now on have 
+ *	a local reference count. A thread which builds and destroys value trees
+ *	on its own can avoid the cost of atomic operations, and call 
+ *	`as_val_share()` on any value it hands to another thread.
+ *
+ *	~~~~~~~~~~{.c}
+ *	bool prev = as_val_set_local(true);
+ *	as_arraylist * list = as_arraylist_new(10, 10);
+ *	...
+ *	as_val_set_local(prev);
+ *	~~~~~~~~~~
+ *
+ *	Values allocated from an `as_arena` always have a local reference count.
+ *
+ *	@param local	If true, new values have a local reference count.
+ *
+ *	@return The previous setting.
+ */
+bool as_val_set_local(bool local);
+
 /**
  *	@private
  *	Helper function for calculating the hash value.
@@ -155,6 +282,19 @@ uint32_t as_val_val_hashcode(const as_val *);
  */
 char * as_val_val_tostring(const as_val *);
 
+/**
+ *	@private
+ *	Helper function for getting the type of a value, which may be an 
+ *	immediate value.
+ */
+static inline as_val_t as_val_val_type(const as_val * v)
+{
+	if ( !v ) return AS_UNDEF;
+	if ( (uintptr_t) v & AS_VAL_IMM_INT ) return AS_INTEGER;
+	if ( (uintptr_t) v & AS_VAL_IMM_OTHER ) return (as_val_t) ((uintptr_t) v >> 3);
+	return v->type;
+}
+
 /******************************************************************************
  *	INSTANCE FUNCTIONS
  *****************************************************************************/
@@ -169,6 +309,9 @@ static inline void as_val_init(as_val * v, as_val_t type, bool free)
 {
     v->type = type; 
     v->free = free; 
+    v->arena = false;
+    v->slab = false;
+    v->local = as_val_local_default;
     v->count = 1;
 }
 
@@ -184,6 +327,9 @@ static inline as_val * as_val_cons(as_val * val, as_val_t type, bool free)
 
     val->type = type; 
     val->free = free; 
+    val->arena = false;
+    val->slab = false;
+    val->local = as_val_local_default;
     val->count = 1;
     return val;
 }
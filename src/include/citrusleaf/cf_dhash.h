@@ -0,0 +1,163 @@
+/******************************************************************************
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to 
+ * deal in the Software without restriction, including without limitation the 
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ * sell copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+#pragma once
+
+/*
+ * A hash table keyed by cf_digest
+ * Digests are already uniformly random, so there's no hash function - the
+ * buckets are indexed straight from digest bits. A bucket is a cache line
+ * holding CF_DHASH_BUCKET_SLOTS digests, and a bucket that fills up spills
+ * into the next (open addressing), so a lookup usually reads one line of
+ * digests and one value. The values are all value_len bytes, and are
+ * copied in and out, as with shash.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <citrusleaf/cf_digest.h>
+#include <citrusleaf/cf_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+#define CF_DHASH_ERR_FOUND -4
+#define CF_DHASH_ERR_NOTFOUND -3
+#define CF_DHASH_ERR -1
+#define CF_DHASH_OK 0
+
+/**
+ * support multithreaded access with a single big lock
+ */
+#define CF_DHASH_CR_MT_BIGLOCK 0x04
+
+/**
+ * support multithreaded access with CF_DHASH_N_REGIONS independently locked
+ * regions
+ */
+#define CF_DHASH_CR_MT_MANYLOCK 0x08
+
+/**
+ * indicate that a delete should be done during reduction
+ */
+#define CF_DHASH_REDUCE_DELETE (1)
+
+/**
+ * number of digests in a (64 byte) bucket
+ */
+#define CF_DHASH_BUCKET_SLOTS 3
+
+/**
+ * number of regions of a CF_DHASH_CR_MT_MANYLOCK table - a power of 2
+ */
+#define CF_DHASH_N_REGIONS 64
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef struct cf_dhash_s cf_dhash;
+
+/**
+ * Typedef for a "reduce" fuction that is called on every element - return
+ * non-zero to stop the reduce, or CF_DHASH_REDUCE_DELETE from a
+ * cf_dhash_reduce_delete() to delete the element
+ */
+typedef int (*cf_dhash_reduce_fn) (const cf_digest *d, void *value, void *udata);
+
+/**
+ * The table is split into regions, each an open addressing table with its
+ * own lock, which grows (doubles) on its own when it gets 3/4 full.
+ */
+struct cf_dhash_s {
+	uint32_t					value_len;
+	uint						flags;
+	uint						n_regions;
+	uint						region_shift;	// log2(n_regions)
+	struct cf_dhash_region_s *	regions;
+};
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+/*
+ * Create a table
+ * sz is the number of elements expected - regions grow past it as needed
+ */
+int cf_dhash_create(cf_dhash **h, uint32_t value_len, uint32_t sz, uint flags);
+
+/*
+ * Place a value into the table, replacing any value already there
+ * The value is copied into the table
+ */
+int cf_dhash_put(cf_dhash *h, const cf_digest *d, const void *value);
+
+/*
+ * Place a value into the table - CF_DHASH_ERR_FOUND if the digest is there
+ * already
+ */
+int cf_dhash_put_unique(cf_dhash *h, const cf_digest *d, const void *value);
+
+/*
+ * Copy the digest's value out of the table - value may be NULL to just
+ * check the digest is there
+ */
+int cf_dhash_get(cf_dhash *h, const cf_digest *d, void *value);
+
+int cf_dhash_delete(cf_dhash *h, const cf_digest *d);
+
+/*
+ * Get the number of elements currently in the table - only an estimate
+ * while other threads are changing it
+ */
+uint32_t cf_dhash_get_size(cf_dhash *h);
+
+/*
+ * Call the function on every element of the table, a region at a time,
+ * holding the region's lock
+ */
+int cf_dhash_reduce(cf_dhash *h, cf_dhash_reduce_fn reduce_fn, void *udata);
+
+/*
+ * As cf_dhash_reduce(), but the elements for which the function returns
+ * CF_DHASH_REDUCE_DELETE are deleted
+ */
+int cf_dhash_reduce_delete(cf_dhash *h, cf_dhash_reduce_fn reduce_fn, void *udata);
+
+/*
+ * Destroy the table - all memory will be freed
+ */
+void cf_dhash_destroy(cf_dhash *h);
+
+/******************************************************************************/
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -44,6 +44,7 @@ extern "C" {
 #define CF_QUEUE_ERR -1
 #define CF_QUEUE_EMPTY -2
 #define CF_QUEUE_NOMATCH -3 // used in cf_queue_priority_reduce_pop
+#define CF_QUEUE_FULL -4 // a ring queue has no free slot
 
 // mswait < 0 wait forever
 // mswait == 0 wait not at all
@@ -61,6 +62,12 @@ typedef int (*cf_queue_reduce_fn) (void *buf, void *udata);
 /**
  * cf_queue
  * A queue 
+ *
+ * A queue made with cf_queue_create() is a growable circular buffer guarded
+ * by a mutex. A queue made with cf_queue_create_ring() is a fixed-capacity
+ * lock-free ring, and one made with cf_queue_create_spsc() a fixed-capacity
+ * wait-free ring for one producer and one consumer - see there. All kinds
+ * share the push/pop/sz API.
  */
 struct cf_queue_s {
     bool            threadsafe;     // sometimes it's good to live dangerously
@@ -76,6 +83,8 @@ struct cf_queue_s {
     pthread_cond_t  CV;             // hte condvar
 #endif // EXTERNAL_LOCKS
     byte *          queue;          // the actual bytes that make up the queue
+    struct cf_queue_ring_s * ring;  // non-null for a lock-free ring queue
+    struct cf_queue_spsc_s * spsc;  // non-null for a single-producer/consumer ring
 };
 
 typedef struct cf_queue_s cf_queue;
@@ -86,6 +95,33 @@ typedef struct cf_queue_s cf_queue;
 
 cf_queue * cf_queue_create(size_t elementsz, bool threadsafe);
 
+/**
+ * Create a bounded, lock-free, multi-producer/multi-consumer ring queue.
+ * Capacity is rounded up to a power of 2. Each slot carries a sequence
+ * number, so producers and consumers only contend on the ring positions,
+ * never on a lock.
+ *
+ * Push never blocks - it returns CF_QUEUE_FULL when every slot is taken.
+ * A waiting pop parks on a futex only when the ring is empty, and producers
+ * only issue a wake when someone is parked.
+ *
+ * reduce and delete are not supported on a ring, and the CF_Q_* macros
+ * below do not apply to it.
+ */
+cf_queue * cf_queue_create_ring(size_t elementsz, uint capacity);
+
+/**
+ * Create a bounded, wait-free, single-producer/single-consumer ring queue.
+ * Capacity is rounded up to a power of 2. Only one thread may push and only
+ * one thread may pop (they may be the same thread) - nothing checks this.
+ *
+ * Producer and consumer positions sit on their own cache lines, and each
+ * side caches the other's, so in the steady state neither touches the
+ * other's line. Push returns CF_QUEUE_FULL when the ring is full; waits
+ * behave as for cf_queue_create_ring(), and so do the restrictions.
+ */
+cf_queue * cf_queue_create_spsc(size_t elementsz, uint capacity);
+
 void cf_queue_destroy(cf_queue *q);
 
 /** 
@@ -93,8 +129,18 @@ void cf_queue_destroy(cf_queue *q);
  */
 int cf_queue_push(cf_queue *q, void *ptr);
 
+/**
+ * Push n elements, laid out back to back at ptr, under one lock acquisition
+ * (or one ring reservation), with at most one wakeup.
+ * Returns the number pushed - always n for a growable queue, but a ring may
+ * take fewer - or CF_QUEUE_FULL if a ring has no free slot, or CF_QUEUE_ERR.
+ * Pushing 0 elements does nothing, and returns 0.
+ */
+int cf_queue_push_n(cf_queue *q, void *ptr, uint n);
+
 /**
  * Push element on the queue only if size < limit.
+ * Returns false if the queue is at the limit (or a ring queue is full).
  */
 bool cf_queue_push_limit(cf_queue *q, void *ptr, uint limit);
 
@@ -104,12 +150,22 @@ bool cf_queue_push_limit(cf_queue *q, void *ptr, uint limit);
 int cf_queue_sz(cf_queue *q);
 
 /**
- * POP pops from the end of the queue, which is the most efficient
- * But understand this makes it LIFO, the least fair of queues
- * Elements added at the very beginning might not make it out
+ * Pop the oldest element of the queue into buf - the queue is FIFO.
+ * Returns CF_QUEUE_EMPTY if nothing arrived within mswait.
+ *
+ * With EXTERNAL_LOCKS there is no condvar, so a (non-ring) pop never waits.
  */
 int cf_queue_pop(cf_queue *q, void *buf, int mswait);
 
+/**
+ * Pop up to n of the oldest elements into buf, under one lock acquisition
+ * (or one ring reservation). Waits as long as mswait for the first element
+ * only, then takes whatever is there.
+ * Returns the number popped, or CF_QUEUE_EMPTY or CF_QUEUE_ERR. Popping 0
+ * elements does nothing (and doesn't wait), and returns 0.
+ */
+int cf_queue_pop_n(cf_queue *q, void *buf, uint n, int mswait);
+
 /**
  * Queue Reduce
  * Run the entire queue, calling the callback, with the lock held
@@ -128,7 +184,11 @@ int cf_queue_reduce(cf_queue *q, cf_queue_reduce_fn cb, void *udata);
  */
 int cf_queue_delete(cf_queue *q, void *buf, bool only_one);
 
-
+/**
+ * Delete the element at the given (absolute) offset, as passed to
+ * CF_Q_ELEM_PTR - where read_offset <= index < write_offset. For use with
+ * the lock held, e.g. from code that walks the queue itself.
+ */
 void cf_queue_delete_offset(cf_queue *q, uint index);
 
 int cf_queue_test();
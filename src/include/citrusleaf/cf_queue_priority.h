@@ -23,8 +23,13 @@
 
 /*
  * A simple priority queue implementation, which is simply a set of queues
- * underneath
- * This currently doesn't support 'delete' and 'reduce' functionality
+ * underneath, one per priority level
+ *
+ * By default pop is strictly by priority - the highest level that has
+ * anything is served. Under sustained high priority load that starves the
+ * lower levels, so a queue can instead be given a weight per level, and pop
+ * then takes turns between levels (deficit round robin) - a level gets up to
+ * its weight in pops per round, and levels with nothing queued are skipped.
  */
 
 #include "cf_queue.h"
@@ -41,6 +46,8 @@ extern "C" {
 #define CF_QUEUE_PRIORITY_MEDIUM 2
 #define CF_QUEUE_PRIORITY_LOW 3
 
+#define CF_QUEUE_PRIORITY_MAX_LEVELS 64
+
 /******************************************************************************
  * TYPES
  ******************************************************************************/
@@ -49,9 +56,12 @@ typedef struct cf_queue_priority_s cf_queue_priority;
 
 struct cf_queue_priority_s {
     bool            threadsafe;
-    cf_queue *      low_q;
-    cf_queue *      medium_q;
-    cf_queue *      high_q;
+    uint            n_levels;       // priority levels - 1 is the highest
+    cf_queue **     queues;         // queue for level i is queues[i - 1]
+    uint *          weights;        // pops per round for each level, or null for strict priority
+    uint            cursor;         // index of the level whose turn it is
+    uint            credit;         // pops left in its turn
+    uint            n_elements;     // elements across all levels
 #ifdef EXTERNAL_LOCKS
     void *          LOCK;
 #else   
@@ -64,17 +74,48 @@ struct cf_queue_priority_s {
  * FUNCTIONS
  ******************************************************************************/
 
+/**
+ * Create a queue with the three levels CF_QUEUE_PRIORITY_HIGH/MEDIUM/LOW,
+ * popped in strict priority order.
+ */
 cf_queue_priority *cf_queue_priority_create(size_t elementsz, bool threadsafe);
+
+/**
+ * Create a queue with n_levels levels (1 to n_levels, 1 the highest). If
+ * weights is null, pop is strictly by priority, otherwise weights[i - 1] is
+ * the number of pops level i gets per round - every weight must be at least
+ * 1. The weights are copied.
+ */
+cf_queue_priority *cf_queue_priority_create_n(size_t elementsz, bool threadsafe, uint n_levels, const uint *weights);
+
 void cf_queue_priority_destroy(cf_queue_priority *q);
+
+/**
+ * Push onto level pri. Returns CF_QUEUE_ERR if there is no such level.
+ */
 int cf_queue_priority_push(cf_queue_priority *q, void *ptr, int pri);
+
 int cf_queue_priority_pop(cf_queue_priority *q, void *buf, int mswait);
 int cf_queue_priority_sz(cf_queue_priority *q);
 
+/**
+ * Run the callback over every element, with the lock held, from the highest
+ * level down - and oldest first within a level. As for cf_queue_reduce(),
+ * return -2 from the callback to delete the element, -1 to stop.
+ */
+int cf_queue_priority_reduce(cf_queue_priority *q, cf_queue_reduce_fn cb, void *udata);
+
+/**
+ * Delete elements matching buf, from the highest level down - or only the
+ * first one found. Returns CF_QUEUE_EMPTY if there was none.
+ */
+int cf_queue_priority_delete(cf_queue_priority *q, void *buf, bool only_one);
+
 /******************************************************************************
  * MACROS
  ******************************************************************************/
 
-#define CF_Q_PRI_EMPTY(__q) (CF_Q_EMPTY(__q->low_q) && CF_Q_EMPTY(__q->medium_q) && CF_Q_EMPTY(__q->high_q))
+#define CF_Q_PRI_EMPTY(__q) (__q->n_elements == 0)
  
 /******************************************************************************/
 
@@ -0,0 +1,124 @@
+/******************************************************************************
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to 
+ * deal in the Software without restriction, including without limitation the 
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ * sell copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+#pragma once
+
+/*
+ * A timer queue - elements are pushed with an absolute deadline, and only
+ * come out once it has passed, earliest deadline first. Elements with the
+ * same deadline come out in no particular order.
+ *
+ * Deadlines are in cf_getms() time. The elements are kept in a 4-ary heap,
+ * so push, pop and cancel are all O(log n).
+ */
+
+#include "cf_clock.h"
+#include "cf_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// never a valid handle
+#define CF_QUEUE_TIMER_NO_HANDLE 0
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * Identifies one pushed element, for cancel. Once the element is popped or
+ * cancelled the handle is stale, and cancel will not match it - even if
+ * the element's storage has been reused.
+ */
+typedef uint64_t cf_queue_timer_handle;
+
+typedef struct cf_queue_timer_s cf_queue_timer;
+
+struct cf_queue_timer_s {
+    bool            threadsafe;
+    size_t          elementsz;      // number of bytes in an element
+    uint            n_elements;     // elements pending
+    uint            allocsz;        // elements allocated
+    uint32_t        free_slot;      // head of the free slot list
+    struct cf_queue_timer_entry_s * heap;
+    struct cf_queue_timer_slot_s * slots;
+    byte *          elements;       // element storage, by slot
+#ifdef EXTERNAL_LOCKS
+    void *          LOCK;
+#else
+    pthread_mutex_t LOCK;
+    pthread_cond_t  CV;             // on CLOCK_MONOTONIC, like cf_getms()
+#endif
+};
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_queue_timer * cf_queue_timer_create(size_t elementsz, bool threadsafe);
+
+void cf_queue_timer_destroy(cf_queue_timer *q);
+
+/**
+ * Push an element to come out at (cf_getms() time) deadline. If handle_r is
+ * not null, it is set to the handle for cf_queue_timer_cancel().
+ */
+int cf_queue_timer_push(cf_queue_timer *q, void *ptr, cf_clock deadline, cf_queue_timer_handle *handle_r);
+
+/**
+ * Remove a pending element, copying it to buf if buf is not null.
+ * Returns CF_QUEUE_NOMATCH if the element was already popped or cancelled.
+ */
+int cf_queue_timer_cancel(cf_queue_timer *q, cf_queue_timer_handle handle, void *buf);
+
+/**
+ * Pop the element with the earliest deadline, if that has passed. Waits as
+ * long as mswait for one to expire - sleeping until the earliest deadline,
+ * or until a push brings in an earlier one.
+ *
+ * With EXTERNAL_LOCKS there is no condvar, so pop never waits.
+ */
+int cf_queue_timer_pop(cf_queue_timer *q, void *buf, int mswait);
+
+/**
+ * Pop up to n elements whose deadline is at or before now, earliest first,
+ * into buf. Never waits. Returns the number popped.
+ */
+int cf_queue_timer_pop_expired(cf_queue_timer *q, void *buf, uint n, cf_clock now);
+
+/**
+ * The earliest pending deadline, or 0 if nothing is pending - e.g. to size
+ * an event loop's poll timeout.
+ */
+cf_clock cf_queue_timer_next_deadline(cf_queue_timer *q);
+
+int cf_queue_timer_sz(cf_queue_timer *q);
+
+/******************************************************************************/
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
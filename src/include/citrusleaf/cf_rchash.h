@@ -31,6 +31,7 @@
 #include <citrusleaf/cf_alloc.h>
 #include <citrusleaf/cf_types.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -50,7 +51,9 @@ extern "C" {
 #define CF_RCHASH_OK 0
 
 /**
- * support resizes (will sometimes hang for long periods)
+ * support resizes - the table doubles when it has more elements than
+ * buckets, and the writers move the elements over a few buckets at a time
+ * (not with CF_RCHASH_CR_EPOCH)
  */
 #define CF_RCHASH_CR_RESIZE 0x01
 
@@ -75,7 +78,23 @@ extern "C" {
 #define CF_RCHASH_CR_NOSIZE 0x10
 
 /**
- * support resizes (will sometimes hang for long periods)
+ * keep statistics on the table - see cf_rchash_get_stats()
+ */
+#define CF_RCHASH_CR_STATS 0x20
+
+/**
+ * lock-free gets - writers still lock, but unlinked elements, and the
+ * table's references to their objects, are kept until no get can be
+ * looking at them (epoch based reclamation). So an object's reference is
+ * only released - and the destructor called - some time after its delete
+ * (or replacement) returns, by a later writer.
+ */
+#define CF_RCHASH_CR_EPOCH 0x40
+
+/**
+ * support resizes - the table doubles when it has more elements than
+ * buckets, and the writers move the elements over a few buckets at a time
+ * (not with CF_RCHASH_CR_EPOCH)
  */
 #define CF_RCHASH_CR_RESIZE 0x01
 
@@ -94,6 +113,18 @@ extern "C" {
  */
 #define CF_RCHASH_REDUCE_DELETE (1)
 
+/**
+ * number of bins in the chain length histogram of cf_rchash_stats - the last
+ * bin also counts all longer chains
+ */
+#define CF_RCHASH_STATS_CHAIN_BINS 8
+
+/**
+ * with CF_RCHASH_CR_STATS, one lock acquisition in this many (per thread) is
+ * timed
+ */
+#define CF_RCHASH_STATS_LOCK_SAMPLE 64
+
 /******************************************************************************
  * TYPES
  ******************************************************************************/
@@ -114,6 +145,13 @@ typedef uint32_t (*cf_rchash_hash_fn) (void *value, uint32_t value_len);
  */
 typedef int (*cf_rchash_reduce_fn) (void *key, uint32_t keylen, void *object, void *udata);
 
+/**
+ * Typedef for a function that folds the udata of one thread of a parallel
+ * reduce into the caller's udata. Called once per thread, by the calling
+ * thread, after all the threads are done.
+ */
+typedef void (*cf_rchash_combine_fn) (void *udata, void *thread_udata);
+
 /**
  * need a destructor for the object.
  *
@@ -129,14 +167,16 @@ typedef int (*cf_rchash_reduce_fn) (void *key, uint32_t keylen, void *object, vo
 typedef void (*cf_rchash_destructor_fn) (void *object);
 
 /**
- * Simple (and slow) element is when
- * everything is variable (although a very nicely packed structure for 32 or 64
+ * Element for when the key size is variable - the buckets are pointers, and
+ * the key is stored inline, along with its full hash so most mismatches are
+ * rejected without a memcmp
  */
 struct cf_rchash_elem_v_s {
 	cf_rchash_elem_v *	next;
 	void *				object; // this is a reference counted object
+	uint32_t			hash;	// full hash of the key
 	uint32_t 			key_len;
-	void *				key; 
+	uint8_t				key[];
 };
 
 /**
@@ -149,6 +189,22 @@ struct cf_rchash_elem_f_s {
 };
 
 
+/**
+ * A snapshot of a table's statistics, see cf_rchash_get_stats(). The
+ * counters are totals since the table was created.
+ */
+typedef struct cf_rchash_stats_s {
+	uint32_t				elements;
+	uint32_t				table_len;
+	uint32_t				max_chain;			// longest chain seen by the walk
+	uint64_t				chains[CF_RCHASH_STATS_CHAIN_BINS];	// buckets by number of elements - only filled in by a walk
+	uint64_t				collisions;			// puts of new keys that found their bucket taken
+	uint64_t				resizes;
+	uint64_t				lock_samples;		// lock acquisitions timed
+	uint64_t				lock_wait_ns;		// total wait of the timed acquisitions
+	uint64_t				lock_wait_max_ns;
+} cf_rchash_stats;
+
 /**
  * An interesting tradeoff regarding 'get_size'
  * In the case of many-locks, there's no real size at any given instant,
@@ -169,9 +225,12 @@ struct cf_rchash_s {
 	uint 					table_len; 			// number of elements currently in the table
 	void *					table;
 	pthread_mutex_t			biglock;
-	int						lock_table_len;
+	int						lock_table_len;		// the table size at creation - a bucket's lock is hash % lock_table_len
 	int						buckets_per_lock; 	// precompute: buckets / locks
 	pthread_mutex_t * 		lock_table;
+	struct cf_rchash_stats_data_s *stats;		// counters (CF_RCHASH_CR_STATS only)
+	struct cf_rchash_epoch_s *epoch;			// readers and retired elements (CF_RCHASH_CR_EPOCH only)
+	struct cf_rchash_resize_s *resize;			// old table being moved from (CF_RCHASH_CR_RESIZE only)
 };
 
 
@@ -203,6 +262,7 @@ int cf_rchash_put_unique(cf_rchash *h, void *key, uint32_t key_len, void *value)
  * call with the buffer you want filled
  * If you're wrong about the space, you'll get a BUFSZ error, but the *value_len
  * will be filled in with the value you should have passed
+ * With CF_RCHASH_CR_EPOCH, no lock is taken.
  */
 int cf_rchash_get(cf_rchash *h, void *key, uint32_t key_len, void **object);
 
@@ -232,6 +292,33 @@ void cf_rchash_reduce(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata);
 */
 void cf_rchash_reduce_delete(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata);
 
+/*
+** Map/Reduce pattern, run by n_threads threads (the calling thread being one)
+** The threads claim ranges of buckets, and in the manylock case hold only the
+** lock of the bucket they're on. Otherwise the big lock (if any) is held for
+** the whole traversal.
+** If udata_sz is 0, all the threads share udata, so the reduce_fn must be
+** thread safe. Otherwise each thread starts with its own copy of the udata_sz
+** bytes at udata, and the copies are merged back into udata by combine_fn -
+** so udata should hold the starting state of the reduction (e.g. zero counts).
+** As with cf_rchash_reduce(), a non-zero return from the reduce_fn stops the
+** traversal (in all the threads).
+*/
+int cf_rchash_reduce_parallel(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, size_t udata_sz, cf_rchash_combine_fn combine_fn, uint n_threads);
+
+/*
+** Parallel version of cf_rchash_reduce_delete() - see cf_rchash_reduce_parallel()
+*/
+int cf_rchash_reduce_delete_parallel(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, size_t udata_sz, cf_rchash_combine_fn combine_fn, uint n_threads);
+
+
+/*
+** Get the statistics of a table created with CF_RCHASH_CR_STATS. The counters
+** are read without taking any lock, so this is cheap. If walk is set, the
+** table is also walked, a bucket at a time, to fill in the chain histogram -
+** that's as expensive as a reduce.
+*/
+int cf_rchash_get_stats(cf_rchash *h, cf_rchash_stats *stats, bool walk);
 
 /*
  * Destroy the entire hash - all memory will be freed
@@ -50,7 +50,8 @@ extern "C" {
 #define SHASH_OK 0
 
 /**
- * support resizes (will sometimes hang for long periods)
+ * support resizes - the table doubles once there are more elements than
+ * buckets, and the old buckets are migrated a few at a time by later calls
  */
 #define SHASH_CR_RESIZE 0x01
 
@@ -65,7 +66,8 @@ extern "C" {
 #define SHASH_CR_MT_BIGLOCK 0x04
 
 /**
- * support multithreaded access with a pool of object loccks
+ * support multithreaded access with a pool of object locks
+ * (SHASH_N_LOCKS of them, unless set with shash_set_nlocks())
  */
 #define SHASH_CR_MT_MANYLOCK 0x08
 
@@ -75,11 +77,51 @@ extern "C" {
  */
 #define SHASH_CR_UNTRACKED 0x10
 
+/**
+ * use open addressing - keys and values live in a flat array of slots, and a
+ * collision probes linearly for a free slot rather than allocating a chained
+ * element. Without SHASH_CR_RESIZE, the table holds at most sz elements.
+ * With SHASH_CR_MT_MANYLOCK, each lock's keys probe their own region of
+ * the table, so SHASH_CR_RESIZE is required.
+ */
+#define SHASH_CR_OPEN 0x20
+
+/**
+ * optimize for a read-mostly table - shash_get() doesn't lock, but reads
+ * optimistically and retries if a writer changed the stripe meanwhile.
+ * Requires SHASH_CR_MT_BIGLOCK or SHASH_CR_MT_MANYLOCK. As readers may
+ * still be in them, old tables and deleted chained elements are kept for
+ * reuse, until shash_destroy() or shash_deleteall_lockfree().
+ */
+#define SHASH_CR_READ_MOSTLY 0x40
+
+/**
+ * keep statistics on the table - see shash_get_stats()
+ */
+#define SHASH_CR_STATS 0x80
+
 /**
  * indicate that a delete should be done during the reduction
  */
 #define SHASH_REDUCE_DELETE (1)
 
+/**
+ * default number of locks in the pool of a manylock table
+ * (fewer if the table has fewer buckets)
+ */
+#define SHASH_N_LOCKS 256
+
+/**
+ * number of bins in the chain length histogram of shash_stats - the last
+ * bin also counts all longer chains
+ */
+#define SHASH_STATS_CHAIN_BINS 8
+
+/**
+ * with SHASH_CR_STATS, one lock acquisition in this many (per thread) is timed
+ */
+#define SHASH_STATS_LOCK_SAMPLE 64
+
 /******************************************************************************
  * TYPES
  ******************************************************************************/
@@ -104,6 +146,13 @@ typedef void (*shash_update_fn) (void *key, void *value_old, void *value_new, vo
  */
 typedef int (*shash_reduce_fn) (void *key, void *data, void *udata);
 
+/**
+ * Typedef for a function that folds the udata of one thread of a parallel
+ * reduce into the caller's udata. Called once per thread, by the calling
+ * thread, after all the threads are done.
+ */
+typedef void (*shash_combine_fn) (void *udata, void *thread_udata);
+
 /**
  * Simple (and slow) element is when
  * everything is variable (although a very nicely packed structure for 32 or 64
@@ -111,13 +160,44 @@ typedef int (*shash_reduce_fn) (void *key, void *data, void *udata);
 struct shash_elem_s {
 	struct 			shash_elem_s *next;
 	bool			in_use;
+	bool			deleted;  // open addressing only - an unused slot that probes must skip
 	uint8_t			data[];   // key_len bytes of key, value_len bytes of value
 };
 
 typedef struct shash_elem_s shash_elem;
 
+/**
+ * A lock of the pool, and the state it protects. Each stripe gets its own
+ * cache line, so threads working under different locks don't share lines.
+ * In the manylock case, stripe i covers the buckets whose index is i modulo
+ * the number of locks - or with open addressing, the i'th contiguous region
+ * of slots. Otherwise there's a single stripe, and its lock is not used.
+ */
+struct shash_stripe_s {
+	pthread_mutex_t		lock;
+	uint32_t			migrate_pos;	// number of the stripe's old buckets migrated
+	uint32_t			elements;		// number of elements in the stripe's buckets (manylock only)
+	uint32_t			tombstones;		// at least the number of deleted slots (open addressing only)
+	uint32_t			seq;			// odd while a writer is changing the stripe (read-mostly only)
+	struct shash_elem_s *free_elems;	// deleted chained elements, for reuse (read-mostly only)
+} __attribute__ ((aligned(64)));
+
+typedef struct shash_stripe_s shash_stripe;
+
+/**
+ * While a resize is in progress, an element lives in its bucket in the old
+ * table until that bucket is migrated, then in its bucket in the new table.
+ * In the manylock case, the lock for a key is chosen by hash % n_locks, and
+ * table sizes are always multiples of n_locks, so the key keeps its lock
+ * across resizes. Each stripe has its own migration position, so a call only
+ * ever migrates buckets covered by the lock it already holds.
+ * With open addressing, a key probes linearly through its stripe's region of
+ * table_len / n_locks slots (the whole table without manylock), starting at
+ * slot (hash / n_locks) of the region. Deleted and migrated slots are left as
+ * tombstones, so that later probes carry on past them.
+ */
 struct shash_s {
-	uint 				elements; 		// INVALID in manylocks case - see notes under get_size
+	uint 				elements; 		// INVALID in manylocks case - counted per stripe, see notes under get_size
 	uint32_t 			key_len;
 	uint32_t 			value_len;
 	uint 				flags;
@@ -125,11 +205,41 @@ struct shash_s {
 	uint 				table_len; 		// number of elements currently in the table
 	void *				table;
 	pthread_mutex_t		biglock;
-	pthread_mutex_t	*	lock_table;
+	shash_stripe *		stripes;		// n_locks of them if manylock, else 1 if resize or open
+	uint				n_locks;		// number of locks in the pool
+	void *				old_table;		// table being migrated during a resize, or NULL
+	uint				old_table_len;
+	uint32_t			migrate_left;	// number of stripes with old buckets left to migrate
+	void *				retired;		// old tables kept until destroy (read-mostly only)
+	struct shash_stats_data_s *stats;	// counters (SHASH_CR_STATS only)
 };
 
 typedef struct shash_s shash;
 
+/**
+ * A snapshot of a table's statistics, see shash_get_stats(). The counters
+ * are totals since the table was created.
+ * With open addressing, the chain histogram counts the elements by how far
+ * they are from the slot their probe starts at (bin 0 - in that slot).
+ * Otherwise it counts the buckets by the number of elements chained in
+ * them (bin 0 - empty buckets).
+ */
+typedef struct shash_stats_s {
+	uint32_t			elements;
+	uint32_t			table_len;		// buckets (or slots) in the current table
+	uint32_t			n_stripes;		// locks in the pool if manylock, else 1
+	uint32_t			max_chain;		// longest chain (or probe distance) seen by the walk
+	uint64_t			chains[SHASH_STATS_CHAIN_BINS];	// only filled in by a walk
+	uint64_t			collisions;		// puts of new keys that found their bucket (or first slot) taken
+	uint64_t			resizes;		// resizes started
+	uint64_t			purges;			// open addressing regions rehashed to clear out tombstones
+	uint64_t			lock_samples;	// lock acquisitions timed
+	uint64_t			lock_wait_ns;	// total wait of the timed acquisitions
+	uint64_t			lock_wait_max_ns;
+	uint32_t			hot_stripe;		// the stripe with the most total timed wait
+	uint64_t			hot_stripe_wait_ns;
+} shash_stats;
+
 /******************************************************************************
  * FUNCTIONS
  ******************************************************************************/
@@ -144,12 +254,27 @@ typedef struct shash_s shash;
  */
 int shash_create(shash **h, shash_hash_fn h_fn, uint32_t key_len, uint32_t value_len, uint32_t sz, uint flags);
 
+/**
+ * Set the number of locks in the pool of a manylock table.
+ * The number of buckets is rounded up to a multiple of the number of locks.
+ * Must be called before the table is used.
+ */
+int shash_set_nlocks(shash *h, uint n_locks);
+
 /**
  * Place a value into the hash
  * Value will be copied into the hash
  */
 int shash_put(shash *h, void *key, void *value);
 
+/**
+ * Place a batch of values into the hash
+ * keys and values are arrays of n_keys keys and values, and results, if not
+ * NULL, gets the shash_put() return code for each key.
+ * Returns SHASH_ERR if any of the puts failed.
+ */
+int shash_put_many(shash *h, void *keys, void *values, uint n_keys, int *results);
+
 /**
  * Place a unique value into the hash
  * Value will be copied into the hash
@@ -165,9 +290,21 @@ int shash_put_duplicate(shash *h, void *key, void *value);
 /**
  * call with the buffer you want filled; if you just want to check for
  * existence, call with value set to NULL
+ * In a read-mostly table, no lock is taken unless writers keep getting in
+ * the way.
  */
 int shash_get(shash *h, void *key, void *value);
 
+/**
+ * Get the values of a batch of keys.
+ * keys is an array of n_keys keys, values is filled with the n_keys values
+ * (or pass NULL to just check existence), and results, if not NULL, gets the
+ * shash_get() return code for each key.
+ * Faster than calling shash_get() for each key, as the buckets are
+ * prefetched, and the keys are grouped so each lock is taken once per group.
+ */
+int shash_get_many(shash *h, void *keys, void *values, uint n_keys, int *results);
+
 /**
  * Returns the pointer to the internal item, and a locked-lock
  * which allows the touching of internal state. If non-lock hash table,
@@ -176,6 +313,8 @@ int shash_get(shash *h, void *key, void *value);
  * Note that the vlock is passed back only when the return code is BB_OK.
  * In the case where nothing is found, no lock is held.
  * It might be better to do it the other way, but you can change it later if you want
+ * In a read-mostly table, shash_get() doesn't take the lock, so it may see
+ * a value being changed in place - use shash_put() or shash_update() instead.
  */
 int shash_get_vlock(shash *h, void *key, void **value,pthread_mutex_t **vlock);
 
@@ -239,6 +378,33 @@ int shash_reduce(shash *h, shash_reduce_fn reduce_fn, void *udata);
  */
 int shash_reduce_delete(shash *h, shash_reduce_fn reduce_fn, void *udata);
 
+/**
+ * Map/Reduce pattern, run by n_threads threads (the calling thread being one)
+ * In the manylock case, the threads take the stripes one at a time and only
+ * hold that stripe's lock. Otherwise, the big lock (if any) is held for the
+ * whole traversal and the threads split up the buckets.
+ * If udata_sz is 0, all the threads share udata, so the reduce_fn must be
+ * thread safe. Otherwise each thread starts with its own copy of the udata_sz
+ * bytes at udata, and the copies are merged back into udata by combine_fn -
+ * so udata should hold the starting state of the reduction (e.g. zero counts).
+ * A non-zero return from the reduce_fn stops all the threads, and is returned.
+ */
+int shash_reduce_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_sz, shash_combine_fn combine_fn, uint n_threads);
+
+/**
+ * Parallel version of shash_reduce_delete() - see shash_reduce_parallel()
+ */
+int shash_reduce_delete_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_sz, shash_combine_fn combine_fn, uint n_threads);
+
+/**
+ * Get the statistics of a table created with SHASH_CR_STATS. The counters
+ * are read without taking any lock, so this is cheap - but with several
+ * threads at work, they're only an estimate. If walk is set, the table is
+ * also walked, a stripe at a time under the stripe's lock, to fill in the
+ * chain histogram - that's as expensive as a reduce.
+ */
+int shash_get_stats(shash *h, shash_stats *stats, bool walk);
+
 /**
  * Delete all the data from the entire hash - complete cleanup
  */
@@ -0,0 +1,117 @@
+/******************************************************************************
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to 
+ * deal in the Software without restriction, including without limitation the 
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ * sell copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+#pragma once
+
+/*
+ * A work-stealing thread pool.
+ *
+ * Each worker has its own deque (Chase-Lev) - tasks a worker submits go on
+ * its own deque, which it runs newest first, while idle workers steal the
+ * oldest from the others. Tasks submitted from outside the pool go on a
+ * shared injection queue (a cf_queue). Idle workers park on a futex, and a
+ * submit only wakes one if some are idle.
+ */
+
+#include <stdint.h>
+
+#include "cf_atomic.h"
+#include "cf_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+#define CF_THREAD_POOL_OK 0
+#define CF_THREAD_POOL_ERR -1
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef void (*cf_thread_pool_fn) (void *udata);
+
+/**
+ * Called by cf_thread_pool_parallel_for() for each chunk [begin, end).
+ */
+typedef void (*cf_thread_pool_range_fn) (uint64_t begin, uint64_t end, void *udata);
+
+/**
+ * A set of tasks that can be waited for together. Initialize before
+ * submitting tasks with it - it needs no destroy.
+ */
+typedef struct cf_thread_pool_group_s {
+    cf_atomic32     pending;        // tasks submitted but not finished
+} cf_thread_pool_group;
+
+typedef struct cf_thread_pool_s cf_thread_pool;
+
+struct cf_thread_pool_s {
+    uint            n_threads;
+    struct cf_thread_pool_worker_s * workers;
+    cf_queue *      inject;         // tasks submitted from outside the pool
+    cf_atomic32     wake_seq;       // the futex idle workers park on
+    cf_atomic32     n_idle;         // workers parked, or about to park
+    cf_atomic32     shutdown;
+};
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_thread_pool * cf_thread_pool_create(uint n_threads);
+
+/**
+ * Runs every task already submitted, then stops and frees the pool.
+ */
+void cf_thread_pool_destroy(cf_thread_pool *pool);
+
+/**
+ * Run fn(udata) on the pool. If group is not null, the task is added to it.
+ */
+int cf_thread_pool_submit(cf_thread_pool *pool, cf_thread_pool_fn fn, void *udata, cf_thread_pool_group *group);
+
+void cf_thread_pool_group_init(cf_thread_pool_group *group);
+
+/**
+ * Wait until every task in the group has finished. The caller runs pool
+ * tasks while it waits, rather than just blocking - so a task may itself
+ * submit tasks and wait for them.
+ */
+void cf_thread_pool_group_wait(cf_thread_pool *pool, cf_thread_pool_group *group);
+
+/**
+ * Call fn over [begin, end) in chunks of at most grain (0 means 1), in
+ * parallel, and wait for them all. The range is split in halves down to
+ * grain - the caller keeps one half and pushes the other for idle workers
+ * to steal.
+ */
+int cf_thread_pool_parallel_for(cf_thread_pool *pool, uint64_t begin, uint64_t end, uint64_t grain, cf_thread_pool_range_fn fn, void *udata);
+
+/******************************************************************************/
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -0,0 +1,156 @@
+/******************************************************************************
+ *	Copyright 2008-2013 by Aerospike.
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy 
+ *	of this software and associated documentation files (the "Software"), to 
+ *	deal in the Software without restriction, including without limitation the 
+ *	rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ *	sell copies of the Software, and to permit persons to whom the Software is 
+ *	furnished to do so, subject to the following conditions:
+ * 
+ *	The above copyright notice and this permission notice shall be included in 
+ *	all copies or substantial portions of the Software.
+ * 
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ *	FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *	IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdlib.h>
+
+#include <aerospike/as_arena.h>
+
+/******************************************************************************
+ *	CONSTANTS
+ *****************************************************************************/
+
+#define AS_ARENA_ALIGN 8
+
+/******************************************************************************
+ *	TYPES
+ *****************************************************************************/
+
+typedef struct as_arena_block_s {
+
+	struct as_arena_block_s * next;
+
+	/**
+	 *	The number of bytes in data, and the number handed out.
+	 */
+	size_t capacity;
+	size_t used;
+
+	uint8_t data[];
+
+} as_arena_block;
+
+/******************************************************************************
+ *	STATIC FUNCTIONS
+ *****************************************************************************/
+
+static as_arena_block * as_arena_block_new(size_t capacity)
+{
+	as_arena_block * block = (as_arena_block *) malloc(sizeof(as_arena_block) + capacity);
+	if ( !block ) return block;
+
+	block->next = NULL;
+	block->capacity = capacity;
+	block->used = 0;
+	return block;
+}
+
+/******************************************************************************
+ *	INSTANCE FUNCTIONS
+ *****************************************************************************/
+
+static as_arena * as_arena_cons(as_arena * arena, bool free, uint32_t block_size)
+{
+	if ( !arena ) return arena;
+
+	arena->head = NULL;
+	arena->block_size = block_size ? block_size : AS_ARENA_BLOCK_SIZE;
+	arena->free = free;
+	return arena;
+}
+
+as_arena * as_arena_init(as_arena * arena, uint32_t block_size)
+{
+	return as_arena_cons(arena, false, block_size);
+}
+
+as_arena * as_arena_new(uint32_t block_size)
+{
+	as_arena * arena = (as_arena *) malloc(sizeof(as_arena));
+	return as_arena_cons(arena, true, block_size);
+}
+
+void as_arena_destroy(as_arena * arena)
+{
+	as_arena_block * block = arena->head;
+	while ( block ) {
+		as_arena_block * next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head = NULL;
+
+	if ( arena->free ) {
+		free(arena);
+	}
+}
+
+void as_arena_reset(as_arena * arena)
+{
+	as_arena_block * keep = NULL;
+	as_arena_block * block = arena->head;
+	while ( block ) {
+		as_arena_block * next = block->next;
+		if ( !keep && block->capacity == arena->block_size ) {
+			keep = block;
+		}
+		else {
+			free(block);
+		}
+		block = next;
+	}
+
+	if ( keep ) {
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	arena->head = keep;
+}
+
+void * as_arena_alloc(as_arena * arena, size_t size)
+{
+	size = (size + AS_ARENA_ALIGN - 1) & ~((size_t) AS_ARENA_ALIGN - 1);
+
+	as_arena_block * head = arena->head;
+	if ( head && head->capacity - head->used >= size ) {
+		void * p = head->data + head->used;
+		head->used += size;
+		return p;
+	}
+
+	// a large allocation gets a block of its own, behind the head, so the
+	// rest of the head is still used
+	if ( head && size > arena->block_size / 4 ) {
+		as_arena_block * block = as_arena_block_new(size);
+		if ( !block ) return NULL;
+		block->used = size;
+		block->next = head->next;
+		head->next = block;
+		return block->data;
+	}
+
+	as_arena_block * block = as_arena_block_new(size > arena->block_size ? size : arena->block_size);
+	if ( !block ) return NULL;
+	block->used = size;
+	block->next = head;
+	arena->head = block;
+	return block->data;
+}
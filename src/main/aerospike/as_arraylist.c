@@ -43,6 +43,25 @@ extern const as_list_hooks as_arraylist_list_hooks;
  *	INLINE FUNCTIONS
  ******************************************************************************/
 
+/**
+ *	Values created by the typed helpers come from the list's arena, if it has
+ *	one, so they are released along with the list.
+ */
+static inline as_val * as_arraylist_integer_new(const as_arraylist * list, int64_t value)
+{
+	if ( list->arena && (value < AS_VAL_IMM_INT_MIN || value > AS_VAL_IMM_INT_MAX) ) {
+		return (as_val *) as_integer_new_arena(list->arena, value);
+	}
+	return as_integer_new_imm(value);
+}
+
+static inline as_val * as_arraylist_string_new(const as_arraylist * list, const char * value)
+{
+	if ( list->arena ) {
+		return (as_val *) as_string_new_arena(list->arena, value, strlen(value));
+	}
+	return (as_val *) as_string_new_strdup(value);
+}
 
 /*******************************************************************************
  *	INSTANCE FUNCTIONS
@@ -61,6 +80,7 @@ as_arraylist * as_arraylist_init(as_arraylist * list, uint32_t capacity, uint32_
 	list->block_size = block_size;
 	list->capacity = capacity;
 	list->size = 0;
+	list->arena = NULL;
 	if ( list->capacity > 0 ) {
 		list->free = true;
 		list->elements = (as_val **) calloc( capacity, sizeof(as_val *) );
@@ -86,6 +106,7 @@ as_arraylist * as_arraylist_new(uint32_t capacity, uint32_t block_size)
 	list->block_size = block_size;
 	list->capacity = capacity;
 	list->size = 0;
+	list->arena = NULL;
 	if ( list->capacity > 0 ) {
 		list->free = true;
 		list->elements = (as_val **) calloc( capacity, sizeof(as_val *) );
@@ -97,6 +118,31 @@ as_arraylist * as_arraylist_new(uint32_t capacity, uint32_t block_size)
 	return list;
 }
 
+/**
+ *	Create a new arraylist allocated from an arena, with room for "capacity" 
+ *	number of elements and with the new (delta) allocation amount of 
+ *	"block_size" elements. The element memory is zeroed, as for calloc().
+ */
+as_arraylist * as_arraylist_new_arena(as_arena * arena, uint32_t capacity, uint32_t block_size) 
+{
+	as_arraylist * list = (as_arraylist *) as_arena_alloc(arena, sizeof(as_arraylist) + sizeof(as_val *) * capacity);
+	if ( !list ) return list;
+
+	as_list_cons((as_list *) list, false, NULL, &as_arraylist_list_hooks);
+	((as_val *) list)->arena = true;
+	((as_val *) list)->local = true;
+	list->block_size = block_size;
+	list->capacity = capacity;
+	list->size = 0;
+	list->free = false;
+	list->arena = arena;
+	list->elements = capacity > 0 ? (as_val **) (list + 1) : NULL;
+	if ( capacity > 0 ) {
+		memset(list->elements, 0, sizeof(as_val *) * capacity);
+	}
+	return list;
+}
+
 /**
  *	@private
  *	Release resources allocated to the list.
@@ -161,7 +207,18 @@ static int as_arraylist_ensure(as_arraylist * list, uint32_t delta)
 			// This will get us (conservatively) at least one block
 			int new_blocks = (new_room + list->block_size) / list->block_size;
 			int new_capacity = list->capacity + (new_blocks * list->block_size);
-			as_val ** elements = (as_val **) realloc(list->elements, sizeof(as_val *) * new_capacity);
+			as_val ** elements = NULL;
+			if ( list->arena ) {
+				// the old elements are left behind, to be released with the arena
+				elements = (as_val **) as_arena_alloc(list->arena, sizeof(as_val *) * new_capacity);
+				if ( elements != NULL ) {
+					memcpy(elements, list->elements, sizeof(as_val *) * list->capacity);
+					memset(elements + list->capacity, 0, sizeof(as_val *) * (new_capacity - list->capacity));
+				}
+			}
+			else {
+				elements = (as_val **) realloc(list->elements, sizeof(as_val *) * new_capacity);
+			}
 			if ( elements != NULL ) {
 				// Looks like it worked, so fill in the new values
 				list->elements = elements;
@@ -258,12 +315,12 @@ int as_arraylist_set(as_arraylist * list, const uint32_t index, as_val * value)
 
 int as_arraylist_set_int64(as_arraylist * list, const uint32_t i, int64_t value) 
 {
-	return as_arraylist_set(list, i, (as_val *) as_integer_new(value));
+	return as_arraylist_set(list, i, as_arraylist_integer_new(list, value));
 }
 
 int as_arraylist_set_str(as_arraylist * list, const uint32_t i, const char * value) 
 {
-	return as_arraylist_set(list, i, (as_val *) as_string_new(strdup(value), true));
+	return as_arraylist_set(list, i, as_arraylist_string_new(list, value));
 }
 
 extern inline int as_arraylist_set_integer(as_arraylist * list, const uint32_t i, as_integer * value);
@@ -289,12 +346,12 @@ int as_arraylist_append(as_arraylist * list, as_val * value)
 
 int as_arraylist_append_int64(as_arraylist * list, int64_t value) 
 {
-	return as_arraylist_append(list, (as_val *) as_integer_new(value));
+	return as_arraylist_append(list, as_arraylist_integer_new(list, value));
 }
 
 int as_arraylist_append_str(as_arraylist * list, const char * value) 
 {
-	return as_arraylist_append(list, (as_val *) as_string_new(strdup(value), true));
+	return as_arraylist_append(list, as_arraylist_string_new(list, value));
 }
 
 extern inline int as_arraylist_append_integer(as_arraylist * list, as_integer * value);
@@ -327,12 +384,12 @@ int as_arraylist_prepend(as_arraylist * list, as_val * value)
 
 int as_arraylist_prepend_int64(as_arraylist * list, int64_t value) 
 {
-	return as_arraylist_prepend(list, (as_val *) as_integer_new(value));
+	return as_arraylist_prepend(list, as_arraylist_integer_new(list, value));
 }
 
 int as_arraylist_prepend_str(as_arraylist * list, const char * value) 
 {
-	return as_arraylist_prepend(list, (as_val *) as_string_new(strdup(value), true));
+	return as_arraylist_prepend(list, as_arraylist_string_new(list, value));
 }
 
 
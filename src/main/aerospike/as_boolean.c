@@ -26,6 +26,7 @@
 
 #include <citrusleaf/cf_alloc.h>
 #include <aerospike/as_boolean.h>
+#include <aerospike/as_slab.h>
 
 /******************************************************************************
  *	CONSTANTS
@@ -52,6 +53,7 @@ const as_boolean as_false = {
  ******************************************************************************/
  
 extern inline void          as_boolean_destroy(as_boolean * boolean);
+extern inline as_val *      as_boolean_new_imm(bool value);
 
 extern inline bool          as_boolean_getorelse(const as_boolean * boolean, bool fallback);
 extern inline bool          as_boolean_get(const as_boolean * boolean);
@@ -80,8 +82,12 @@ as_boolean * as_boolean_init(as_boolean * boolean, bool value)
 
 as_boolean * as_boolean_new(bool value)
 {
-	as_boolean * boolean = (as_boolean *) malloc(sizeof(as_boolean));
-	return as_boolean_cons(boolean, true, value);
+	as_boolean * boolean = (as_boolean *) as_slab_alloc(sizeof(as_boolean));
+	if ( !boolean ) return boolean;
+
+	as_boolean_cons(boolean, true, value);
+	boolean->_.slab = true;
+	return boolean;
 }
 
 /******************************************************************************
@@ -99,7 +105,7 @@ void as_boolean_val_destroy(as_val * v)
 uint32_t as_boolean_val_hashcode(const as_val * v)
 {
 	as_boolean * boolean = as_boolean_fromval(v);
-	return boolean != NULL && boolean->value ? 1 : 0;
+	return boolean != NULL && as_boolean_get(boolean) ? 1 : 0;
 }
 
 char * as_boolean_val_tostring(const as_val * v)
@@ -110,7 +116,7 @@ char * as_boolean_val_tostring(const as_val * v)
 	char * str = (char *) malloc(sizeof(char) * 6);
     if (!str) return str;
 	bzero(str,6);
-	if ( b->value ) {
+	if ( as_boolean_get(b) ) {
 		strcpy(str,"true");
 	}
 	else {
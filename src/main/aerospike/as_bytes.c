@@ -22,6 +22,7 @@
 
 #include <citrusleaf/cf_alloc.h>
 #include <aerospike/as_bytes.h>
+#include <aerospike/as_slab.h>
 
 #include <stdbool.h>
 #include <stdlib.h>
@@ -146,9 +147,11 @@ as_bytes * as_bytes_init_wrap(as_bytes * bytes, uint8_t * value, uint32_t size,
  */
 as_bytes * as_bytes_new(uint32_t capacity)
 {
-    as_bytes * bytes = (as_bytes *) malloc(sizeof(as_bytes));
+    as_bytes * bytes = (as_bytes *) as_slab_alloc(sizeof(as_bytes));
     if ( !bytes ) return bytes;
-	return as_bytes_cons(bytes, true, capacity, 0, NULL, true, AS_BYTES_BLOB);
+	as_bytes_cons(bytes, true, capacity, 0, NULL, true, AS_BYTES_BLOB);
+	bytes->_.slab = true;
+	return bytes;
 }
 
 /**
@@ -168,9 +171,36 @@ as_bytes * as_bytes_new(uint32_t capacity)
  */
 as_bytes * as_bytes_new_wrap(uint8_t * value, uint32_t size, bool free)
 {
-    as_bytes * bytes = (as_bytes *) malloc(sizeof(as_bytes));
+    as_bytes * bytes = (as_bytes *) as_slab_alloc(sizeof(as_bytes));
     if ( !bytes ) return bytes;
-	return as_bytes_cons(bytes, true, size, size, value, free, AS_BYTES_BLOB);
+	as_bytes_cons(bytes, true, size, size, value, free, AS_BYTES_BLOB);
+	bytes->_.slab = true;
+	return bytes;
+}
+
+/**
+ *	Creates a new `as_bytes` allocated from an arena, as an empty buffer of
+ *	capacity size, also allocated from the arena.
+ *
+ *	~~~~~~~~~~{.c}
+ *	as_bytes * bytes = as_bytes_new_arena(&arena, 10);
+ *	~~~~~~~~~~
+ *	
+ *	@param arena	The arena to allocate from.
+ *	@param capacity	The number of bytes to allocate.
+ *
+ *	@return On success, the initializes bytes. Otherwise NULL.
+ */
+as_bytes * as_bytes_new_arena(as_arena * arena, uint32_t capacity)
+{
+	as_bytes * bytes = (as_bytes *) as_arena_alloc(arena, sizeof(as_bytes) + capacity);
+	if ( !bytes ) return bytes;
+
+	uint8_t * value = capacity > 0 ? (uint8_t *) (bytes + 1) : NULL;
+	as_bytes_cons(bytes, false, capacity, 0, value, false, AS_BYTES_BLOB);
+	bytes->_.arena = true;
+	bytes->_.local = true;
+	return bytes;
 }
 
 /******************************************************************************
@@ -321,6 +351,9 @@ bool as_bytes_ensure(as_bytes * bytes, uint32_t capacity, bool resize)
 	if ( capacity <= bytes->capacity ) return true;
 	if ( !resize ) return false;
 
+	// an arena value is never destroyed, so a heap buffer would be leaked
+	if ( bytes->_.arena ) return false;
+
 	uint8_t * buffer = NULL;
 
 	if ( bytes->free ) {
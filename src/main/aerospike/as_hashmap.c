@@ -20,20 +20,24 @@
  *	IN THE SOFTWARE.
  *****************************************************************************/
 
+#include <aerospike/as_boolean.h>
+#include <aerospike/as_bytes.h>
 #include <aerospike/as_hashmap.h>
 #include <aerospike/as_hashmap_iterator.h>
+#include <aerospike/as_integer.h>
 #include <aerospike/as_map.h>
 #include <aerospike/as_pair.h>
+#include <aerospike/as_string.h>
 #include <aerospike/as_val.h>
 
-#include <citrusleaf/cf_shash.h>
-
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "internal.h"
 
-
 /*******************************************************************************
  *	EXTERNS
  ******************************************************************************/
@@ -41,38 +45,332 @@
 extern const as_map_hooks as_hashmap_map_hooks;
 
 /******************************************************************************
- *	TYPES
+ *	CONSTANTS
  ******************************************************************************/
 
-typedef struct {
-	void *                  udata;
-	as_map_foreach_callback callback;
-} as_hashmap_shash_foreach_context;
+/**
+ *	Control bytes. A slot in use has the high bit clear, and holds the low 
+ *	7 bits of the hash of the key (the "tag").
+ */
+#define CTRL_EMPTY		((uint8_t) 0x80)
+#define CTRL_DELETED	((uint8_t) 0xFE)
+
+/**
+ *	Control bytes are probed a group at a time, as a single 64-bit word.
+ */
+#define GROUP_WIDTH		8
+
+#define GROUP_LSBS		0x0101010101010101ULL
+#define GROUP_MSBS		0x8080808080808080ULL
 
 /******************************************************************************
  *	STATIC FUNCTIONS
  ******************************************************************************/
 
-static uint32_t as_hashmap_shash_hash(void * k) {
-	return *((uint32_t *) k);
+/**
+ *	Finalizer for the hash of the key, so both the tag and the probe position
+ *	depend on all bits of the hashcode. (The hashcode of an as_integer is the
+ *	value itself.)
+ */
+static inline uint32_t as_hashmap_hash(const as_val * k)
+{
+	uint32_t h = as_val_hashcode(k);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline uint32_t as_hashmap_h1(uint32_t hash)
+{
+	return hash >> 7;
+}
+
+static inline uint8_t as_hashmap_h2(uint32_t hash)
+{
+	return (uint8_t) (hash & 0x7F);
+}
+
+static inline uint64_t as_hashmap_group_load(const uint8_t * ctrl)
+{
+	uint64_t g;
+	memcpy(&g, ctrl, sizeof(g));
+	return g;
+}
+
+/**
+ *	Bitmask of the slots in the group having the tag. May report a slot
+ *	which doesn't match, so the key must still be compared.
+ */
+static inline uint64_t as_hashmap_group_match(uint64_t g, uint8_t h2)
+{
+	uint64_t x = g ^ (GROUP_LSBS * h2);
+	return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
 }
 
-static int as_hashmap_shash_clear(void * key, void * data, void * udata) {
-	as_pair * pair = *((as_pair **) data);
-	as_pair_destroy(pair);
-	return SHASH_REDUCE_DELETE;
+static inline uint64_t as_hashmap_group_match_empty(uint64_t g)
+{
+	return (g & (~g << 6)) & GROUP_MSBS;
 }
 
-static int as_hashmap_shash_destroy(void * key, void * data, void * udata) {
-	as_pair * pair = *((as_pair **) data);
-	as_pair_destroy(pair);
+static inline uint64_t as_hashmap_group_match_empty_or_deleted(uint64_t g)
+{
+	return (g & ~(g << 7)) & GROUP_MSBS;
+}
+
+static inline uint32_t as_hashmap_mask_first(uint64_t mask)
+{
+	return (uint32_t) (__builtin_ctzll(mask) >> 3);
+}
+
+static inline void as_hashmap_set_ctrl(as_hashmap * map, uint32_t i, uint8_t c)
+{
+	map->ctrl[i] = c;
+	if ( i < GROUP_WIDTH ) {
+		map->ctrl[map->capacity + i] = c;
+	}
+}
+
+/**
+ *	The number of entries the table can hold before it must grow.
+ *	Keep 1/8th of the slots empty, so probes always terminate quickly.
+ */
+static inline uint32_t as_hashmap_max_load(uint32_t capacity)
+{
+	return capacity - capacity / 8;
+}
+
+/**
+ *	Keys are equal when they are the same value, or are scalars of the same 
+ *	type with the same contents. Lists, maps, records and pairs only compare
+ *	equal to themselves.
+ */
+static bool as_hashmap_key_equals(const as_val * a, const as_val * b)
+{
+	if ( a == b ) return true;
+	if ( a == NULL || b == NULL ) return false;
+
+	as_val_t t = as_val_type(a);
+	if ( t != as_val_type(b) ) return false;
+
+	switch ( t ) {
+		case AS_NIL:
+			return true;
+		case AS_BOOLEAN:
+			return as_boolean_get((as_boolean *) a) == as_boolean_get((as_boolean *) b);
+		case AS_INTEGER:
+			return as_integer_get((as_integer *) a) == as_integer_get((as_integer *) b);
+		case AS_STRING: {
+			const char * sa = as_string_get((as_string *) a);
+			const char * sb = as_string_get((as_string *) b);
+			if ( sa == NULL || sb == NULL ) return sa == sb;
+			size_t len = as_string_len((as_string *) a);
+			if ( len != as_string_len((as_string *) b) ) return false;
+			return memcmp(sa, sb, len) == 0;
+		}
+		case AS_BYTES: {
+			uint32_t sz = as_bytes_size((as_bytes *) a);
+			if ( sz != as_bytes_size((as_bytes *) b) ) return false;
+			return memcmp(as_bytes_get((as_bytes *) a), as_bytes_get((as_bytes *) b), sz) == 0;
+		}
+		default:
+			return false;
+	}
+}
+
+/**
+ *	Find the slot holding the key. Returns the capacity if not found.
+ */
+static uint32_t as_hashmap_find(const as_hashmap * map, const as_val * k, uint32_t hash)
+{
+	if ( map->capacity == 0 ) return 0;
+
+	uint32_t mask = map->capacity - 1;
+	uint32_t pos = as_hashmap_h1(hash) & mask;
+	uint8_t h2 = as_hashmap_h2(hash);
+
+	for ( uint32_t step = GROUP_WIDTH; ; step += GROUP_WIDTH ) {
+		uint64_t g = as_hashmap_group_load(map->ctrl + pos);
+
+		for ( uint64_t m = as_hashmap_group_match(g, h2); m; m &= m - 1 ) {
+			uint32_t i = (pos + as_hashmap_mask_first(m)) & mask;
+			as_hashmap_entry * e = &map->entries[i];
+			if ( e->hash == hash && as_hashmap_key_equals(e->pair._1, k) ) {
+				return i;
+			}
+		}
+
+		// an empty slot ends the probe sequence
+		if ( as_hashmap_group_match_empty(g) ) {
+			return map->capacity;
+		}
+
+		pos = (pos + step) & mask;
+	}
+}
+
+/**
+ *	Find the first slot which can take a new entry with the hash.
+ *	The table must have at least one empty slot.
+ */
+static uint32_t as_hashmap_find_free(const as_hashmap * map, uint32_t hash)
+{
+	uint32_t mask = map->capacity - 1;
+	uint32_t pos = as_hashmap_h1(hash) & mask;
+
+	for ( uint32_t step = GROUP_WIDTH; ; step += GROUP_WIDTH ) {
+		uint64_t m = as_hashmap_group_match_empty_or_deleted(as_hashmap_group_load(map->ctrl + pos));
+		if ( m ) {
+			return (pos + as_hashmap_mask_first(m)) & mask;
+		}
+		pos = (pos + step) & mask;
+	}
+}
+
+/**
+ *	Rebuild the table with the given capacity, dropping tombstones.
+ */
+static int as_hashmap_rehash(as_hashmap * map, uint32_t capacity)
+{
+	uint8_t * ctrl = NULL;
+	as_hashmap_entry * entries = NULL;
+
+	if ( map->arena ) {
+		// the old table is left behind, to be released with the arena
+		entries = (as_hashmap_entry *) as_arena_alloc(map->arena, sizeof(as_hashmap_entry) * capacity + capacity + GROUP_WIDTH);
+		if ( !entries ) {
+			return -1;
+		}
+		ctrl = (uint8_t *) (entries + capacity);
+	}
+	else {
+		ctrl = (uint8_t *) malloc(capacity + GROUP_WIDTH);
+		entries = (as_hashmap_entry *) malloc(sizeof(as_hashmap_entry) * capacity);
+
+		if ( !ctrl || !entries ) {
+			free(ctrl);
+			free(entries);
+			return -1;
+		}
+	}
+
+	memset(ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+
+	uint8_t * old_ctrl = map->ctrl;
+	as_hashmap_entry * old_entries = map->entries;
+	uint32_t old_capacity = map->capacity;
+
+	map->ctrl = ctrl;
+	map->entries = entries;
+	map->capacity = capacity;
+	map->growth_left = as_hashmap_max_load(capacity) - map->count;
+
+	for ( uint32_t i = 0; i < old_capacity; i++ ) {
+		if ( old_ctrl[i] & 0x80 ) continue;
+
+		uint32_t hash = old_entries[i].hash;
+		uint32_t j = as_hashmap_find_free(map, hash);
+		as_hashmap_set_ctrl(map, j, as_hashmap_h2(hash));
+		map->entries[j] = old_entries[i];
+	}
+
+	if ( !map->arena ) {
+		free(old_ctrl);
+		free(old_entries);
+	}
 	return 0;
 }
 
-static int as_hashmap_shash_foreach(void * key, void * data, void * udata) {
-	as_hashmap_shash_foreach_context * ctx = (as_hashmap_shash_foreach_context *) udata;
-	as_pair * pair = *((as_pair **) data);
-	return ctx->callback(as_pair_1(pair), as_pair_2(pair), ctx->udata) ? 0 : 1;
+/**
+ *	Make room for one more entry.
+ */
+static int as_hashmap_reserve(as_hashmap * map)
+{
+	if ( map->growth_left > 0 ) return 0;
+
+	uint32_t capacity = map->capacity ? map->capacity : GROUP_WIDTH;
+
+	// if most of the used slots are tombstones, rehashing in place is enough
+	if ( map->count >= as_hashmap_max_load(capacity) / 2 ) {
+		capacity = map->capacity ? map->capacity * 2 : GROUP_WIDTH;
+	}
+
+	return as_hashmap_rehash(map, capacity);
+}
+
+static void as_hashmap_erase(as_hashmap * map, uint32_t i)
+{
+	uint32_t mask = map->capacity - 1;
+	uint64_t empty_before = as_hashmap_group_match_empty(as_hashmap_group_load(map->ctrl + ((i - GROUP_WIDTH) & mask)));
+	uint64_t empty_after = as_hashmap_group_match_empty(as_hashmap_group_load(map->ctrl + i));
+
+	// If no group containing the slot was ever full, then no probe went 
+	// past it, and the slot can be made empty rather than a tombstone.
+	bool was_never_full = empty_before && empty_after &&
+		(uint32_t) ((__builtin_clzll(empty_before) >> 3) + (__builtin_ctzll(empty_after) >> 3)) < GROUP_WIDTH;
+
+	if ( was_never_full ) {
+		as_hashmap_set_ctrl(map, i, CTRL_EMPTY);
+		map->growth_left++;
+	}
+	else {
+		as_hashmap_set_ctrl(map, i, CTRL_DELETED);
+	}
+	map->count--;
+}
+
+static void as_hashmap_entry_destroy(as_hashmap_entry * e)
+{
+	as_val_destroy(e->pair._1);
+	as_val_destroy(e->pair._2);
+	e->pair._1 = NULL;
+	e->pair._2 = NULL;
+}
+
+static inline void as_hashmap_lock(as_hashmap * map)
+{
+	if ( map->concurrent ) pthread_mutex_lock(&map->lock);
+}
+
+static inline void as_hashmap_unlock(as_hashmap * map)
+{
+	if ( map->concurrent ) pthread_mutex_unlock(&map->lock);
+}
+
+static as_hashmap * as_hashmap_cons(as_hashmap * map, bool free, uint32_t capacity, bool concurrent, as_arena * arena)
+{
+	if ( !map ) return map;
+
+	as_map_cons((as_map *) map, free, NULL, &as_hashmap_map_hooks);
+	if ( arena ) {
+		((as_val *) map)->arena = true;
+		((as_val *) map)->local = true;
+	}
+	else if ( concurrent ) {
+		// a concurrent map is made to be shared
+		((as_val *) map)->local = false;
+	}
+	map->arena = arena;
+	map->capacity = 0;
+	map->count = 0;
+	map->growth_left = 0;
+	map->ctrl = NULL;
+	map->entries = NULL;
+
+	if ( capacity > 0 ) {
+		// smallest power of 2 able to hold capacity entries
+		uint32_t n = GROUP_WIDTH;
+		while ( as_hashmap_max_load(n) < capacity && n < (1U << 31) ) n <<= 1;
+		as_hashmap_rehash(map, n);
+	}
+
+	map->concurrent = concurrent;
+	if ( concurrent ) {
+		pthread_mutex_init(&map->lock, NULL);
+	}
+	return map;
 }
 
 /******************************************************************************
@@ -81,27 +379,51 @@ static int as_hashmap_shash_foreach(void * key, void * data, void * udata) {
 
 as_hashmap * as_hashmap_init(as_hashmap * map, uint32_t capacity)
 {
-	if ( !map ) return map;
-
-	as_map_cons((as_map *) map, false, NULL, &as_hashmap_map_hooks);
-	shash_create((shash **) &(map->htable), as_hashmap_shash_hash, sizeof(uint32_t), sizeof(as_pair *), capacity, SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE);
-	return map;
+	return as_hashmap_cons(map, false, capacity, false, NULL);
 }
 
 as_hashmap * as_hashmap_new(uint32_t capacity)
 {
 	as_hashmap * map = (as_hashmap *) malloc(sizeof(as_hashmap));
-	if ( !map ) return map;
+	return as_hashmap_cons(map, true, capacity, false, NULL);
+}
 
-	as_map_cons((as_map *) map, true, NULL, &as_hashmap_map_hooks);
-	shash_create((shash **) &(map->htable), as_hashmap_shash_hash, sizeof(uint32_t), sizeof(as_pair *), capacity, SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE);
-	return map;
+as_hashmap * as_hashmap_new_arena(as_arena * arena, uint32_t capacity)
+{
+	as_hashmap * map = (as_hashmap *) as_arena_alloc(arena, sizeof(as_hashmap));
+	return as_hashmap_cons(map, false, capacity, false, arena);
+}
+
+as_hashmap * as_hashmap_init_concurrent(as_hashmap * map, uint32_t capacity)
+{
+	return as_hashmap_cons(map, false, capacity, true, NULL);
+}
+
+as_hashmap * as_hashmap_new_concurrent(uint32_t capacity)
+{
+	as_hashmap * map = (as_hashmap *) malloc(sizeof(as_hashmap));
+	return as_hashmap_cons(map, true, capacity, true, NULL);
 }
 
 bool as_hashmap_release(as_hashmap * map)
 {
-	shash_reduce((shash *) map->htable, as_hashmap_shash_destroy, NULL);
-	shash_destroy((shash *) map->htable);
+	for ( uint32_t i = 0; i < map->capacity; i++ ) {
+		if ( map->ctrl[i] & 0x80 ) continue;
+		as_hashmap_entry_destroy(&map->entries[i]);
+	}
+	if ( !map->arena ) {
+		free(map->ctrl);
+		free(map->entries);
+	}
+	map->ctrl = NULL;
+	map->entries = NULL;
+	map->capacity = 0;
+	map->count = 0;
+	map->growth_left = 0;
+	if ( map->concurrent ) {
+		pthread_mutex_destroy(&map->lock);
+		map->concurrent = false;
+	}
 	return true;
 }
 
@@ -123,7 +445,11 @@ uint32_t as_hashmap_hashcode(const as_hashmap * map)
 
 uint32_t as_hashmap_size(const as_hashmap * map)
 {
-	return shash_get_size((shash *) map->htable);
+	as_hashmap * m = (as_hashmap *) map;
+	as_hashmap_lock(m);
+	uint32_t count = m->count;
+	as_hashmap_unlock(m);
+	return count;
 }
 
 /*******************************************************************************
@@ -132,39 +458,87 @@ uint32_t as_hashmap_size(const as_hashmap * map)
 
 int as_hashmap_set(as_hashmap * map, const as_val * k, const as_val * v)
 {
-	uint32_t h = as_val_hashcode(k);
-	as_pair * p = NULL;
+	uint32_t hash = as_hashmap_hash(k);
+
+	as_hashmap_lock(map);
 
-	if ( shash_get((shash *) map->htable, &h, &p) == SHASH_OK ) {
-		as_val_destroy((as_val *) p);
-		p = NULL;
+	uint32_t i = as_hashmap_find(map, k, hash);
+
+	if ( i < map->capacity ) {
+		// replace the existing entry
+		as_hashmap_entry * e = &map->entries[i];
+		as_hashmap_entry_destroy(e);
+		as_pair_init(&e->pair, (as_val *) k, (as_val *) v);
+		as_hashmap_unlock(map);
+		return 0;
 	}
-	p = pair_new(k,v);
-	return shash_put((shash *) map->htable, &h, &p);
+
+	if ( as_hashmap_reserve(map) != 0 ) {
+		as_hashmap_unlock(map);
+		return -1;
+	}
+
+	i = as_hashmap_find_free(map, hash);
+
+	// reusing a tombstone doesn't use up one of the empty slots
+	if ( map->ctrl[i] == CTRL_EMPTY ) {
+		map->growth_left--;
+	}
+
+	as_hashmap_set_ctrl(map, i, as_hashmap_h2(hash));
+
+	as_hashmap_entry * e = &map->entries[i];
+	as_pair_init(&e->pair, (as_val *) k, (as_val *) v);
+	e->hash = hash;
+	map->count++;
+
+	as_hashmap_unlock(map);
+	return 0;
 }
 
 as_val * as_hashmap_get(const as_hashmap * map, const as_val * k)
 {
-	uint32_t h = as_val_hashcode(k);
-	as_pair * p = NULL;
-
-	if ( shash_get((shash *) map->htable, &h, &p) != SHASH_OK ) {
-		return NULL;
+	as_hashmap * m = (as_hashmap *) map;
+	uint32_t hash = as_hashmap_hash(k);
+	as_val * v = NULL;
+
+	as_hashmap_lock(m);
+	uint32_t i = as_hashmap_find(m, k, hash);
+	if ( i < m->capacity ) {
+		v = m->entries[i].pair._2;
 	}
-	as_val * v = as_pair_2(p);
+	as_hashmap_unlock(m);
+
 	return v;
 }
 
 int as_hashmap_clear(as_hashmap * map)
 {
-	shash_reduce_delete((shash *) map->htable, as_hashmap_shash_clear, NULL);
+	as_hashmap_lock(map);
+	for ( uint32_t i = 0; i < map->capacity; i++ ) {
+		if ( map->ctrl[i] & 0x80 ) continue;
+		as_hashmap_entry_destroy(&map->entries[i]);
+	}
+	if ( map->capacity > 0 ) {
+		memset(map->ctrl, CTRL_EMPTY, map->capacity + GROUP_WIDTH);
+	}
+	map->count = 0;
+	map->growth_left = as_hashmap_max_load(map->capacity);
+	as_hashmap_unlock(map);
 	return 0;
 }
 
 int as_hashmap_remove(as_hashmap * map, const as_val * k)
 {
-	uint32_t h = as_val_hashcode(k);
-	shash_delete_lockfree((shash *) map->htable, &h);
+	uint32_t hash = as_hashmap_hash(k);
+
+	as_hashmap_lock(map);
+	uint32_t i = as_hashmap_find(map, k, hash);
+	if ( i < map->capacity ) {
+		as_hashmap_entry_destroy(&map->entries[i]);
+		as_hashmap_erase(map, i);
+	}
+	as_hashmap_unlock(map);
 	return 0;
 }
 
@@ -174,9 +548,19 @@ int as_hashmap_remove(as_hashmap * map, const as_val * k)
 
 bool as_hashmap_foreach(const as_hashmap * map, as_map_foreach_callback callback, void * udata)
 {
-	as_hashmap_shash_foreach_context ctx = {
-		.udata = udata,
-		.callback = callback
-	};
-	return shash_reduce((shash *) map->htable, as_hashmap_shash_foreach, &ctx) == 0;
+	as_hashmap * m = (as_hashmap *) map;
+	bool rv = true;
+
+	as_hashmap_lock(m);
+	for ( uint32_t i = 0; i < m->capacity; i++ ) {
+		if ( m->ctrl[i] & 0x80 ) continue;
+		as_pair * p = &m->entries[i].pair;
+		if ( callback(as_pair_1(p), as_pair_2(p), udata) == false ) {
+			rv = false;
+			break;
+		}
+	}
+	as_hashmap_unlock(m);
+
+	return rv;
 }
@@ -25,10 +25,9 @@
 #include <aerospike/as_iterator.h>
 #include <aerospike/as_pair.h>
 
-#include <citrusleaf/cf_shash.h>
-
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 /*******************************************************************************
  *	EXTERNS
@@ -42,93 +41,54 @@ extern const as_iterator_hooks as_hashmap_iterator_hooks;
 
 static bool as_hashmap_iterator_seek(as_hashmap_iterator * it)
 {
-	// We no longer have slots in the table
-	if ( it->pos > it->size ) return false;
-
 	// If curr is set, that means we have a value ready to be read.
 	if ( it->curr != NULL ) return true;
 
-	// If next is set, that means we have something to iterate to.
-	if ( it->next != NULL ) {
-		if ( ((shash_elem *) it->next)->in_use ) {
-			it->curr = it->next;
-			it->next = ((shash_elem *) it->curr)->next;
-			if ( !it->next ) {
-				it->pos++;
-			}
-			return true;
-		}
-		else {
-			it->pos++;
-			it->next = NULL;
-		}
-	}
-
 	// Iterate over the slots in the table
-	for( ; it->pos < it->size; it->pos++ ) {
-
-		// Get the bucket in the current slot
-		it->curr = (shash_elem *) (((byte *) ((shash *) it->htable)->table) + (SHASH_ELEM_SZ(((shash *) it->htable)) * it->pos));
-
-		// If the bucket has a value, then return true
-		if ( it->curr && ((shash_elem *) it->curr)->in_use ) {
-			
-			// we set next, so we have the next item in the bucket
-			it->next = ((shash_elem *) it->curr)->next;
-
-			// if next is empty, then we will move to the next bucket
-			if ( !it->next ) it->pos++;
+	for ( ; it->pos < it->size; it->pos++ ) {
 
+		// A control byte with the high bit clear is a slot in use
+		if ( (it->map->ctrl[it->pos] & 0x80) == 0 ) {
+			it->curr = &it->map->entries[it->pos];
+			it->pos++;
 			return true;
 		}
-		else {
-			it->curr = NULL;
-			it->next = NULL;
-		}
 	}
-	
-	it->curr = NULL;
-	it->next = NULL;
-	it->pos = it->size;
+
 	return false;
 }
 
-/******************************************************************************
- *	FUNCTIONS
- *****************************************************************************/
-
-as_hashmap_iterator * as_hashmap_iterator_init(as_hashmap_iterator * iterator, const as_hashmap * map)
+static as_hashmap_iterator * as_hashmap_iterator_cons(as_hashmap_iterator * iterator, bool free, const as_hashmap * map)
 {
 	if ( !iterator ) return iterator;
 
-	as_iterator_init((as_iterator *) iterator, false, NULL, &as_hashmap_iterator_hooks);
-	iterator->htable = map->htable;
+	as_iterator_init((as_iterator *) iterator, free, NULL, &as_hashmap_iterator_hooks);
+	iterator->map = map;
 	iterator->curr = NULL;
-	iterator->next = NULL;
-	iterator->size = (uint32_t) ((shash *) map->htable)->table_len;
+	iterator->size = map->capacity;
 	iterator->pos = 0;
 	return iterator;
 }
 
+/******************************************************************************
+ *	FUNCTIONS
+ *****************************************************************************/
+
+as_hashmap_iterator * as_hashmap_iterator_init(as_hashmap_iterator * iterator, const as_hashmap * map)
+{
+	return as_hashmap_iterator_cons(iterator, false, map);
+}
+
 as_hashmap_iterator * as_hashmap_iterator_new(const as_hashmap * map)
 {
 	as_hashmap_iterator * iterator = (as_hashmap_iterator *) malloc(sizeof(as_hashmap_iterator));
-	if ( !iterator ) return iterator;
-
-	as_iterator_init((as_iterator *) iterator, true, NULL, &as_hashmap_iterator_hooks);
-	iterator->htable = map->htable;
-	iterator->curr = NULL;
-	iterator->next = NULL;
-	iterator->size = (uint32_t) ((shash *) map->htable)->table_len;
-	iterator->pos = 0;
-	return iterator;
+	return as_hashmap_iterator_cons(iterator, true, map);
 }
 
 bool as_hashmap_iterator_release(as_hashmap_iterator * iterator)
 {
-	iterator->htable = NULL;
+	iterator->map = NULL;
 	iterator->curr = NULL;
-	iterator->next = NULL;
 	iterator->size = 0;
 	iterator->pos = 0;
 	return true;
@@ -148,11 +108,9 @@ const as_val * as_hashmap_iterator_next(as_hashmap_iterator * iterator)
 {
 	if ( !as_hashmap_iterator_seek(iterator) ) return NULL;
 
-	shash *         h   = iterator->htable;
-	shash_elem *    e   = iterator->curr;
-	as_pair **      p   = (as_pair **) SHASH_ELEM_VALUE_PTR(h, e);
+	as_hashmap_entry * e = (as_hashmap_entry *) iterator->curr;
 	
 	iterator->curr = NULL; // consume the value, so we can get the next one.
 	
-	return (as_val *) *p;
+	return (as_val *) &e->pair;
 }
@@ -26,12 +26,14 @@
 
 #include <citrusleaf/cf_alloc.h>
 #include <aerospike/as_integer.h>
+#include <aerospike/as_slab.h>
 
 /******************************************************************************
  *	INLINE FUNCTIONS
  ******************************************************************************/
 
 extern inline void			as_integer_destroy(as_integer * integer);
+extern inline as_val *		as_integer_new_imm(int64_t value);
 
 extern inline int64_t		as_integer_getorelse(const as_integer * integer, int64_t fallback);
 extern inline int64_t		as_integer_get(const as_integer * integer);
@@ -60,8 +62,23 @@ as_integer * as_integer_init(as_integer * integer, int64_t value)
 
 as_integer * as_integer_new(int64_t value)
 {
-	as_integer * integer = (as_integer *) malloc(sizeof(as_integer));
-	return as_integer_cons(integer, true, value);
+	as_integer * integer = (as_integer *) as_slab_alloc(sizeof(as_integer));
+	if ( !integer ) return integer;
+
+	as_integer_cons(integer, true, value);
+	integer->_.slab = true;
+	return integer;
+}
+
+as_integer * as_integer_new_arena(as_arena * arena, int64_t value)
+{
+	as_integer * integer = (as_integer *) as_arena_alloc(arena, sizeof(as_integer));
+	if ( !integer ) return integer;
+
+	as_integer_cons(integer, false, value);
+	integer->_.arena = true;
+	integer->_.local = true;
+	return integer;
 }
 
 /******************************************************************************
@@ -79,7 +96,7 @@ void as_integer_val_destroy(as_val * v)
 uint32_t as_integer_val_hashcode(const as_val * v)
 {
 	as_integer * i = as_integer_fromval(v);
-	return i != NULL ? i->value : 0;
+	return i != NULL ? as_integer_get(i) : 0;
 }
 
 char * as_integer_val_tostring(const as_val * v)
@@ -87,6 +104,6 @@ char * as_integer_val_tostring(const as_val * v)
 	as_integer * i = (as_integer *) v;
 	char * str = (char *) malloc(sizeof(char) * 32);
 	bzero(str, 32);
-	sprintf(str,"%ld",i->value);
+	sprintf(str,"%ld",as_integer_get(i));
 	return str;
 }
@@ -43,11 +43,11 @@ static int as_msgpack_pack_rec(msgpack_packer *, as_rec *);
 static int as_msgpack_pack_pair(msgpack_packer *, as_pair *);
 
 static int as_msgpack_nil_to_val(as_val ** v);
-static int as_msgpack_boolean_to_val(bool, as_val **);
-static int as_msgpack_integer_to_val(int64_t, as_val **);
-static int as_msgpack_raw_to_val(msgpack_object_raw *, as_val **);
-static int as_msgpack_array_to_val(msgpack_object_array *, as_val **);
-static int as_msgpack_map_to_val(msgpack_object_map *, as_val **);
+static int as_msgpack_boolean_to_val(bool, as_arena *, as_val **);
+static int as_msgpack_integer_to_val(int64_t, as_arena *, as_val **);
+static int as_msgpack_raw_to_val(msgpack_object_raw *, as_arena *, as_val **);
+static int as_msgpack_array_to_val(msgpack_object_array *, as_arena *, as_val **);
+static int as_msgpack_map_to_val(msgpack_object_map *, as_arena *, as_val **);
 
 /******************************************************************************
  * FUNCTIONS
@@ -115,16 +115,21 @@ int as_msgpack_pack_val(msgpack_packer * pk, as_val * val)
 }
 
 int as_msgpack_object_to_val(msgpack_object * object, as_val ** val) 
+{
+	return as_msgpack_object_to_val_arena(object, NULL, val);
+}
+
+int as_msgpack_object_to_val_arena(msgpack_object * object, as_arena * arena, as_val ** val) 
 {
 	if ( object == NULL ) return 1;
 	switch( object->type ) {
 		case MSGPACK_OBJECT_NIL             	: return as_msgpack_nil_to_val(val);
-		case MSGPACK_OBJECT_BOOLEAN             : return as_msgpack_boolean_to_val(object->via.boolean, val);
-		case MSGPACK_OBJECT_POSITIVE_INTEGER    : return as_msgpack_integer_to_val((int64_t) object->via.u64, val);
-		case MSGPACK_OBJECT_NEGATIVE_INTEGER    : return as_msgpack_integer_to_val((int64_t) object->via.i64, val);
-		case MSGPACK_OBJECT_RAW                 : return as_msgpack_raw_to_val(&object->via.raw, val);
-		case MSGPACK_OBJECT_ARRAY               : return as_msgpack_array_to_val(&object->via.array, val);
-		case MSGPACK_OBJECT_MAP                 : return as_msgpack_map_to_val(&object->via.map, val);
+		case MSGPACK_OBJECT_BOOLEAN             : return as_msgpack_boolean_to_val(object->via.boolean, arena, val);
+		case MSGPACK_OBJECT_POSITIVE_INTEGER    : return as_msgpack_integer_to_val((int64_t) object->via.u64, arena, val);
+		case MSGPACK_OBJECT_NEGATIVE_INTEGER    : return as_msgpack_integer_to_val((int64_t) object->via.i64, arena, val);
+		case MSGPACK_OBJECT_RAW                 : return as_msgpack_raw_to_val(&object->via.raw, arena, val);
+		case MSGPACK_OBJECT_ARRAY               : return as_msgpack_array_to_val(&object->via.array, arena, val);
+		case MSGPACK_OBJECT_MAP                 : return as_msgpack_map_to_val(&object->via.map, arena, val);
 		default                                 : return 2;
 	}
 }
@@ -323,33 +328,52 @@ static int as_msgpack_nil_to_val(as_val ** v)
 	return 0;
 }
 
-static int as_msgpack_boolean_to_val(bool b, as_val ** v)
+static int as_msgpack_boolean_to_val(bool b, as_arena * arena, as_val ** v)
 {
 	// Aerospike does not support Boolean, so we convert it to Integer
-	*v = (as_val *) as_integer_new(b == true ? 1 : 0);
-	return 0;
+	return as_msgpack_integer_to_val(b == true ? 1 : 0, arena, v);
 }
 
-static int as_msgpack_integer_to_val(int64_t i, as_val ** v)
+static int as_msgpack_integer_to_val(int64_t i, as_arena * arena, as_val ** v)
 {
-	*v = (as_val *) as_integer_new(i);
+	// small integers are immediate values, which need no allocation
+	if ( arena && (i < AS_VAL_IMM_INT_MIN || i > AS_VAL_IMM_INT_MAX) ) {
+		*v = (as_val *) as_integer_new_arena(arena, i);
+	}
+	else {
+		*v = as_integer_new_imm(i);
+	}
 	return 0;
 }
 
-static int as_msgpack_raw_to_val(msgpack_object_raw * r, as_val ** v)
+static int as_msgpack_raw_to_val(msgpack_object_raw * r, as_arena * arena, as_val ** v)
 {
 	const char * raw = r->ptr;
 	*v = 0;
 	// strings are special
 	if (*raw == AS_BYTES_STRING) {
-		*v = (as_val *) as_string_new(strndup(raw+1,r->size - 1),true);
+		if ( arena ) {
+			*v = (as_val *) as_string_new_arena(arena, raw+1, r->size - 1);
+		}
+		else {
+			*v = (as_val *) as_string_new_strndup(raw+1, r->size - 1);
+		}
 	}
 	// everything else encoded as a bytes with the type set
 	else {
 		int len = r->size - 1;
-		uint8_t *buf = malloc(len);
-		memcpy(buf, raw+1, len);
-		as_bytes *b = as_bytes_new_wrap(buf, len, true);
+		as_bytes *b = NULL;
+		if ( arena ) {
+			b = as_bytes_new_arena(arena, len);
+			if ( b ) {
+				as_bytes_append(b, (const uint8_t *) raw+1, len);
+			}
+		}
+		else {
+			uint8_t *buf = malloc(len);
+			memcpy(buf, raw+1, len);
+			b = as_bytes_new_wrap(buf, len, true);
+		}
 		if ( b ) {
 			b->type = (as_bytes_type) *raw;
 		}
@@ -358,13 +382,13 @@ static int as_msgpack_raw_to_val(msgpack_object_raw * r, as_val ** v)
 	return 0;
 }
 
-static int as_msgpack_array_to_val(msgpack_object_array * a, as_val ** v)
+static int as_msgpack_array_to_val(msgpack_object_array * a, as_arena * arena, as_val ** v)
 {
-	as_arraylist * l = as_arraylist_new(a->size, 8);
+	as_arraylist * l = arena ? as_arraylist_new_arena(arena, a->size, 8) : as_arraylist_new(a->size, 8);
 	for ( int i = 0; i < a->size; i++) {
 		msgpack_object * o = a->ptr + i;
 		as_val * val = NULL;
-		as_msgpack_object_to_val(o, &val);
+		as_msgpack_object_to_val_arena(o, arena, &val);
 		if ( val != NULL ) {
 			as_arraylist_set(l, i, val);
 		}
@@ -373,15 +397,15 @@ static int as_msgpack_array_to_val(msgpack_object_array * a, as_val ** v)
 	return 0;
 }
 
-static int as_msgpack_map_to_val(msgpack_object_map * o, as_val ** v)
+static int as_msgpack_map_to_val(msgpack_object_map * o, as_arena * arena, as_val ** v)
 {
-	as_hashmap * m = as_hashmap_new(32);
+	as_hashmap * m = arena ? as_hashmap_new_arena(arena, 32) : as_hashmap_new(32);
 	for ( int i = 0; i < o->size; i++) {
 		msgpack_object_kv * kv = o->ptr + i;
 		as_val * key = NULL;
 		as_val * val = NULL;
-		as_msgpack_object_to_val(&kv->key, &key);
-		as_msgpack_object_to_val(&kv->val, &val);
+		as_msgpack_object_to_val_arena(&kv->key, arena, &key);
+		as_msgpack_object_to_val_arena(&kv->val, arena, &val);
 		if ( key != NULL && val != NULL ) {
 			as_hashmap_set(m, key, val);
 		}
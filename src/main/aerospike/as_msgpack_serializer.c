@@ -59,6 +59,16 @@ as_serializer * as_msgpack_init(as_serializer * s)
     return s;
 }
 
+as_serializer * as_msgpack_new_arena(as_arena * arena) {
+    return as_serializer_new(arena, &as_msgpack_serializer_hooks);
+}
+
+as_serializer * as_msgpack_init_arena(as_serializer * s, as_arena * arena)
+{
+    as_serializer_init(s, arena, &as_msgpack_serializer_hooks);
+    return s;
+}
+
 /******************************************************************************
  * STATIC FUNCTIONS
  *****************************************************************************/
@@ -90,7 +100,7 @@ static int as_msgpack_serializer_deserialize(as_serializer * s, as_buffer * buff
     size_t offset = 0;
 
     if ( msgpack_unpack_next(&msg, (char *) buff->data, buff->size, &offset) ) {
-        as_msgpack_object_to_val(&msg.data, v);
+        as_msgpack_object_to_val_arena(&msg.data, (as_arena *) s->data, v);
     }
 
     msgpack_unpacked_destroy(&msg);
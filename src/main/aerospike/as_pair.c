@@ -26,6 +26,7 @@
 #include <citrusleaf/cf_alloc.h>
 #include <aerospike/as_util.h>
 #include <aerospike/as_pair.h>
+#include <aerospike/as_slab.h>
 
 /******************************************************************************
  *	INLINE FUNCTIONS
@@ -55,10 +56,24 @@ as_pair * as_pair_init(as_pair * pair, as_val * _1, as_val * _2)
 
 as_pair * as_pair_new(as_val * _1, as_val * _2)
 {
-	as_pair * pair = (as_pair *) malloc(sizeof(as_pair));
+	as_pair * pair = (as_pair *) as_slab_alloc(sizeof(as_pair));
 	if ( !pair ) return pair;
 
 	as_val_init((as_val *) pair, AS_PAIR, true);
+	pair->_.slab = true;
+	pair->_1 = _1;
+	pair->_2 = _2;
+	return pair;
+}
+
+as_pair * as_pair_new_arena(as_arena * arena, as_val * _1, as_val * _2)
+{
+	as_pair * pair = (as_pair *) as_arena_alloc(arena, sizeof(as_pair));
+	if ( !pair ) return pair;
+
+	as_val_init((as_val *) pair, AS_PAIR, false);
+	pair->_.arena = true;
+	pair->_.local = true;
 	pair->_1 = _1;
 	pair->_2 = _2;
 	return pair;
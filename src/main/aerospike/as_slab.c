@@ -0,0 +1,288 @@
+/******************************************************************************
+ *	Copyright 2008-2013 by Aerospike.
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy 
+ *	of this software and associated documentation files (the "Software"), to 
+ *	deal in the Software without restriction, including without limitation the 
+ *	rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ *	sell copies of the Software, and to permit persons to whom the Software is 
+ *	furnished to do so, subject to the following conditions:
+ * 
+ *	The above copyright notice and this permission notice shall be included in 
+ *	all copies or substantial portions of the Software.
+ * 
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ *	FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *	IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <aerospike/as_slab.h>
+
+/******************************************************************************
+ *	CONSTANTS
+ *****************************************************************************/
+
+/**
+ *	Slabs are aligned to their size, so the slab header of any object is 
+ *	found by masking its address.
+ */
+#define AS_SLAB_SIZE		(64 * 1024)
+
+/**
+ *	Size classes are 16, 24, ... AS_SLAB_MAX_SIZE bytes. Each object must
+ *	have room for two links while it is free.
+ */
+#define AS_SLAB_MIN_SIZE	16
+#define AS_SLAB_CLASSES		((AS_SLAB_MAX_SIZE - AS_SLAB_MIN_SIZE) / 8 + 1)
+
+/**
+ *	Objects move between a thread and the shared depot this many at a time.
+ *	A thread keeps at most twice this many free objects of each class.
+ */
+#define AS_SLAB_BATCH		32
+
+/******************************************************************************
+ *	TYPES
+ *****************************************************************************/
+
+/**
+ *	A free object. In the depot, the first object of each batch links to
+ *	the next batch.
+ */
+typedef struct as_slab_object_s {
+	struct as_slab_object_s * next;
+	struct as_slab_object_s * next_batch;
+} as_slab_object;
+
+/**
+ *	Header at the start of each slab.
+ */
+typedef struct as_slab_s {
+	struct as_slab_s * next;
+	size_t size;
+} as_slab;
+
+/**
+ *	The free objects of a size class, shared by all threads.
+ */
+typedef struct as_slab_depot_s {
+	pthread_mutex_t lock;
+
+	/**
+	 *	Batches of free objects.
+	 */
+	as_slab_object * batches;
+
+	/**
+	 *	The part of the newest slab not yet handed out.
+	 */
+	uint8_t * carve;
+	uint8_t * carve_end;
+
+	/**
+	 *	All slabs of the class. Slabs are never released.
+	 */
+	as_slab * slabs;
+} as_slab_depot;
+
+/**
+ *	A thread's free objects of a size class.
+ */
+typedef struct as_slab_cache_s {
+	as_slab_object * head;
+	uint32_t count;
+} as_slab_cache;
+
+/******************************************************************************
+ *	VARIABLES
+ *****************************************************************************/
+
+static as_slab_depot g_depots[AS_SLAB_CLASSES];
+
+static __thread as_slab_cache g_caches[AS_SLAB_CLASSES];
+static __thread bool g_registered = false;
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+
+/******************************************************************************
+ *	STATIC FUNCTIONS
+ *****************************************************************************/
+
+static inline uint32_t as_slab_class(size_t size)
+{
+	return size <= AS_SLAB_MIN_SIZE ? 0 : (uint32_t) ((size - AS_SLAB_MIN_SIZE + 7) / 8);
+}
+
+static inline size_t as_slab_class_size(uint32_t c)
+{
+	return AS_SLAB_MIN_SIZE + c * 8;
+}
+
+static void as_slab_thread_exit(void * udata)
+{
+	as_slab_flush();
+}
+
+static void as_slab_init()
+{
+	for ( uint32_t c = 0; c < AS_SLAB_CLASSES; c++ ) {
+		pthread_mutex_init(&g_depots[c].lock, NULL);
+	}
+	pthread_key_create(&g_key, as_slab_thread_exit);
+}
+
+/**
+ *	Arrange for the calling thread's caches to be flushed when it exits.
+ */
+static inline void as_slab_register()
+{
+	if ( !g_registered ) {
+		pthread_once(&g_once, as_slab_init);
+		pthread_setspecific(g_key, g_caches);
+		g_registered = true;
+	}
+}
+
+/**
+ *	Give a list of free objects to the depot, as one batch.
+ */
+static void as_slab_release(uint32_t c, as_slab_object * head)
+{
+	as_slab_depot * depot = &g_depots[c];
+
+	pthread_mutex_lock(&depot->lock);
+	head->next_batch = depot->batches;
+	depot->batches = head;
+	pthread_mutex_unlock(&depot->lock);
+}
+
+/**
+ *	Fill an empty cache with a batch from the depot, or carved from a slab.
+ */
+static void as_slab_refill(uint32_t c, as_slab_cache * cache)
+{
+	as_slab_register();
+
+	as_slab_depot * depot = &g_depots[c];
+	size_t size = as_slab_class_size(c);
+
+	pthread_mutex_lock(&depot->lock);
+
+	as_slab_object * batch = depot->batches;
+	if ( batch ) {
+		depot->batches = batch->next_batch;
+		pthread_mutex_unlock(&depot->lock);
+
+		uint32_t count = 0;
+		for ( as_slab_object * o = batch; o; o = o->next ) {
+			count++;
+		}
+		cache->head = batch;
+		cache->count = count;
+		return;
+	}
+
+	if ( depot->carve == depot->carve_end ) {
+		void * mem = NULL;
+		if ( posix_memalign(&mem, AS_SLAB_SIZE, AS_SLAB_SIZE) != 0 ) {
+			pthread_mutex_unlock(&depot->lock);
+			return;
+		}
+
+		as_slab * slab = (as_slab *) mem;
+		slab->size = size;
+		slab->next = depot->slabs;
+		depot->slabs = slab;
+
+		// whole objects after the header, which is rounded up to 16 bytes
+		uint8_t * start = (uint8_t *) mem + ((sizeof(as_slab) + 15) & ~((size_t) 15));
+		uint8_t * end = (uint8_t *) mem + AS_SLAB_SIZE;
+		depot->carve = start;
+		depot->carve_end = start + ((size_t) (end - start) / size) * size;
+	}
+
+	as_slab_object * head = NULL;
+	uint32_t count = 0;
+	while ( count < AS_SLAB_BATCH && depot->carve < depot->carve_end ) {
+		as_slab_object * o = (as_slab_object *) depot->carve;
+		depot->carve += size;
+		o->next = head;
+		head = o;
+		count++;
+	}
+
+	pthread_mutex_unlock(&depot->lock);
+
+	cache->head = head;
+	cache->count = count;
+}
+
+/******************************************************************************
+ *	FUNCTIONS
+ *****************************************************************************/
+
+void * as_slab_alloc(size_t size)
+{
+	if ( size > AS_SLAB_MAX_SIZE ) return NULL;
+
+	uint32_t c = as_slab_class(size);
+	as_slab_cache * cache = &g_caches[c];
+
+	if ( !cache->head ) {
+		as_slab_refill(c, cache);
+		if ( !cache->head ) return NULL;
+	}
+
+	as_slab_object * o = cache->head;
+	cache->head = o->next;
+	cache->count--;
+	return o;
+}
+
+void as_slab_free(void * p)
+{
+	as_slab * slab = (as_slab *) ((uintptr_t) p & ~((uintptr_t) AS_SLAB_SIZE - 1));
+	uint32_t c = as_slab_class(slab->size);
+	as_slab_cache * cache = &g_caches[c];
+
+	as_slab_register();
+
+	as_slab_object * o = (as_slab_object *) p;
+	o->next = cache->head;
+	cache->head = o;
+	cache->count++;
+
+	// keep the most recently freed objects, and hand back the rest
+	if ( cache->count >= 2 * AS_SLAB_BATCH ) {
+		as_slab_object * last = cache->head;
+		for ( uint32_t i = 1; i < AS_SLAB_BATCH; i++ ) {
+			last = last->next;
+		}
+		as_slab_object * batch = last->next;
+		last->next = NULL;
+		cache->count = AS_SLAB_BATCH;
+		as_slab_release(c, batch);
+	}
+}
+
+void as_slab_flush()
+{
+	for ( uint32_t c = 0; c < AS_SLAB_CLASSES; c++ ) {
+		as_slab_cache * cache = &g_caches[c];
+		if ( cache->head ) {
+			as_slab_release(c, cache->head);
+			cache->head = NULL;
+			cache->count = 0;
+		}
+	}
+}
@@ -24,6 +24,7 @@
 #include <string.h>
 
 #include <citrusleaf/cf_alloc.h>
+#include <aerospike/as_slab.h>
 #include <aerospike/as_string.h>
 
 /******************************************************************************
@@ -43,26 +44,97 @@ extern inline as_string *	as_string_fromval(const as_val * v);
  *	INSTANCE FUNCTIONS
  *****************************************************************************/
 
-static inline as_string * as_string_cons(as_string * string, bool free, char * value, bool value_free)
+static inline as_string * as_string_cons(as_string * string, bool free, char * value, size_t len, bool value_free)
 {
 	if ( !string ) return string;
 
 	as_val_cons((as_val *) string, AS_STRING, free);
 	string->free = value_free;
 	string->value = value;
-	string->len = SIZE_MAX;
+	string->len = value ? len : 0;
 	return string;
 }
 
+/**
+ *	Copy len characters, and a NULL terminator, into copy.
+ */
+static inline char * as_string_copy(char * copy, const char * value, size_t len)
+{
+	memcpy(copy, value, len);
+	copy[len] = '\0';
+	return copy;
+}
+
 as_string * as_string_init(as_string * string, char * value, bool free)
 {
-	return as_string_cons(string, false, value, free);
+	return as_string_cons(string, false, value, value ? strlen(value) : 0, free);
+}
+
+as_string * as_string_init_wlen(as_string * string, char * value, size_t len, bool free)
+{
+	return as_string_cons(string, false, value, len, free);
 }
 
 as_string * as_string_new(char * value, bool free)
 {
-	as_string * string = (as_string *) malloc(sizeof(as_string));
-	return as_string_cons(string, true, value, free);
+	return as_string_new_wlen(value, value ? strlen(value) : 0, free);
+}
+
+as_string * as_string_new_wlen(char * value, size_t len, bool free)
+{
+	as_string * string = (as_string *) as_slab_alloc(sizeof(as_string));
+	if ( !string ) return string;
+
+	as_string_cons(string, true, value, len, free);
+	string->_.slab = true;
+	return string;
+}
+
+as_string * as_string_new_strdup(const char * value)
+{
+	return as_string_new_strndup(value, strlen(value));
+}
+
+as_string * as_string_new_strndup(const char * value, size_t len)
+{
+	char * copy = NULL;
+	if ( len >= AS_STRING_INLINE_SIZE ) {
+		copy = (char *) malloc(len + 1);
+		if ( !copy ) return NULL;
+		as_string_copy(copy, value, len);
+	}
+
+	as_string * string = (as_string *) as_slab_alloc(sizeof(as_string));
+	if ( !string ) {
+		free(copy);
+		return string;
+	}
+
+	if ( copy ) {
+		as_string_cons(string, true, copy, len, true);
+	}
+	else {
+		as_string_cons(string, true, as_string_copy(string->inline_value, value, len), len, false);
+	}
+	string->_.slab = true;
+	return string;
+}
+
+as_string * as_string_new_arena(as_arena * arena, const char * value, size_t len)
+{
+	size_t size = sizeof(as_string);
+	if ( len >= AS_STRING_INLINE_SIZE ) {
+		size += len + 1;
+	}
+
+	as_string * string = (as_string *) as_arena_alloc(arena, size);
+	if ( !string ) return string;
+
+	char * copy = len >= AS_STRING_INLINE_SIZE ? (char *) (string + 1) : string->inline_value;
+	as_string_cons(string, false, as_string_copy(copy, value, len), len, false);
+	string->_.arena = true;
+	string->_.local = true;
+	return string;
 }
 
 /******************************************************************************
@@ -74,9 +146,6 @@ size_t as_string_len(as_string * string)
 	if (string->value == NULL) {
 		return 0;
 	}
-	if (string->len == SIZE_MAX) {
-		string->len = strlen(string->value);
-	}
 	return string->len;
 }
 
@@ -104,7 +173,8 @@ uint32_t as_string_val_hashcode(const as_val * v)
 	uint32_t hash = 0;
 	int c;
 	char * str = string->value;
-	while ( (c = *str++) ) {
+	for ( size_t i = 0; i < string->len; i++ ) {
+		c = str[i];
 		hash = c + (hash << 6) + (hash << 16) - hash;
 	}
 	return hash;
@@ -119,7 +189,7 @@ char * as_string_val_tostring(const as_val * v)
 	char * str = (char *) malloc(sizeof(char) * st);
 	if (!str) return str;
 	*(str + 0) = '\"';
-	strcpy(str + 1, s->value);
+	memcpy(str + 1, s->value, sl);
 	*(str + 1 + sl) = '\"';
 	*(str + 1 + sl + 1) = '\0';
 	return str;
@@ -32,6 +32,7 @@
 #include <aerospike/as_nil.h>
 #include <aerospike/as_pair.h>
 #include <aerospike/as_rec.h>
+#include <aerospike/as_slab.h>
 #include <aerospike/as_string.h>
 #include <aerospike/as_val.h>
 
@@ -43,10 +44,17 @@ typedef void		(* as_val_destroy_callback)(as_val * v);
 typedef uint32_t	(* as_val_hashcode_callback)(const as_val * v);
 typedef char *	(* as_val_tostring_callback)(const as_val * v);
 
+/******************************************************************************
+ *	VARIABLES
+ *****************************************************************************/
+
+__thread bool as_val_local_default = false;
+
 /******************************************************************************
  *	INLINE FUNCTIONS
  *****************************************************************************/
 
+extern inline as_val_t as_val_val_type(const as_val * v);
 extern inline void as_val_init(as_val *v, as_val_t type, bool free);
 extern inline as_val * as_val_cons(as_val * val, as_val_t type, bool free);
 
@@ -57,6 +65,8 @@ extern inline as_val * as_val_cons(as_val * val, as_val_t type, bool free);
 static void     as_val_destroy_noop(as_val *);
 static uint32_t as_val_hashcode_noop(const as_val *);
 static char *   as_val_tostring_noop(const as_val *);
+static bool     as_val_share_list_foreach(as_val *, void *);
+static bool     as_val_share_map_foreach(const as_val *, const as_val *, void *);
 
 /******************************************************************************
  *	VARIABLES
@@ -120,37 +130,97 @@ static char * as_val_tostring_noop(const as_val * v)
 	return 0;
 }
 
+static bool as_val_share_list_foreach(as_val * v, void * udata)
+{
+	as_val_val_share(v);
+	return true;
+}
+
+static bool as_val_share_map_foreach(const as_val * k, const as_val * v, void * udata)
+{
+	as_val_val_share((as_val *) k);
+	as_val_val_share((as_val *) v);
+	return true;
+}
+
 as_val * as_val_val_reserve(as_val * v) 
 {
-	if ( !v ) return v;
+	if ( !v || as_val_isimm(v) ) return v;
 
-	cf_atomic32_add(&(v->count),1);
+	if ( v->local ) {
+		v->count++;
+	}
+	else {
+		cf_atomic32_add(&(v->count),1);
+	}
 	return v;
 }
 
 as_val * as_val_val_destroy(as_val * v)
 {
-	if ( v == NULL || !v->count ) return v;
+	if ( v == NULL || as_val_isimm(v) || !v->count ) return v;
+
+	uint32_t count = v->local ? --v->count : (uint32_t) cf_atomic32_decr(&(v->count));
+
 	// if we reach the last reference, call the destructor, and free
-	if ( 0 == cf_atomic32_decr(&(v->count)) ) {
-		as_val_destroy_callbacks[ v->type ](v);     
-		if ( v->free ) {
-			free(v);
+	if ( 0 == count ) {
+		// an arena releases its values, and what they refer to, all at once
+		if ( !v->arena ) {
+			as_val_destroy_callbacks[ v->type ](v);     
+			if ( v->slab ) {
+				as_slab_free(v);
+			}
+			else if ( v->free ) {
+				free(v);
+			}
 		}
 		v = NULL;
 	}
 	return v;
 }
 
+as_val * as_val_val_share(as_val * v)
+{
+	if ( !v || as_val_isimm(v) ) return v;
+
+	// constants such as as_nil are never local, and may be read-only
+	if ( v->local ) {
+		v->local = false;
+	}
+
+	switch ( v->type ) {
+		case AS_LIST:
+			as_list_foreach((as_list *) v, as_val_share_list_foreach, NULL);
+			break;
+		case AS_MAP:
+			as_map_foreach((as_map *) v, as_val_share_map_foreach, NULL);
+			break;
+		case AS_PAIR:
+			as_val_val_share(((as_pair *) v)->_1);
+			as_val_val_share(((as_pair *) v)->_2);
+			break;
+		default:
+			break;
+	}
+	return v;
+}
+
+bool as_val_set_local(bool local)
+{
+	bool prev = as_val_local_default;
+	as_val_local_default = local;
+	return prev;
+}
+
 uint32_t as_val_val_hashcode(const as_val * v)
 {
 	if (v == 0) return 0;
-	return as_val_hashcode_callbacks[ v->type ](v);
+	return as_val_hashcode_callbacks[ as_val_type(v) ](v);
 }
 
 char * as_val_val_tostring(const as_val * v)
 {
 	if (v == 0) return 0;
-	return as_val_tostring_callbacks[ v->type ](v);
+	return as_val_tostring_callbacks[ as_val_type(v) ](v);
 }
 
@@ -45,6 +45,12 @@ cf_clock cf_getus() {
 	return ( CF_TIMESPEC_TO_US (ts) );
 }	
 
+cf_clock cf_getns() {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return ( CF_TIMESPEC_TO_NS (ts) );
+}
+
 cf_clock cf_clock_getabsolute() {
 	struct timespec ts;
 	clock_gettime(CLOCK_REALTIME, &ts);
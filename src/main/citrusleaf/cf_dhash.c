@@ -0,0 +1,483 @@
+/******************************************************************************
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to 
+ * deal in the Software without restriction, including without limitation the 
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ * sell copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <citrusleaf/cf_dhash.h>
+#include <citrusleaf/cf_alloc.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+/**
+ * Most elements a region of _n buckets should hold - in 64 bits, as the
+ * number of slots may not fit in 32
+ */
+#define CF_DHASH_MAX_LOAD(_n) ( (((uint64_t) (_n) * CF_DHASH_BUCKET_SLOTS) * 3) / 4 )
+
+/**
+ * A bucket's overflow count sticks here rather than wrapping - lookups then
+ * always probe past it, which is slower, but still right
+ */
+#define CF_DHASH_OVERFLOW_MAX UINT16_MAX
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * A bucket - its keys are in slots 0 to n_keys - 1. The overflow count is
+ * the number of digests that belong in this bucket or an earlier one, but
+ * were placed past it because it was full. A lookup that misses in a
+ * bucket with no overflow is done.
+ */
+typedef struct cf_dhash_bucket_s {
+	cf_digest				keys[CF_DHASH_BUCKET_SLOTS];
+	uint8_t					n_keys;
+	uint8_t					unused;
+	uint16_t				overflow;
+} __attribute__ ((aligned(64))) cf_dhash_bucket;
+
+/**
+ * A region - the values are kept apart from the buckets, so the buckets
+ * are all digests. The value of slot s of bucket i is value number
+ * (i * CF_DHASH_BUCKET_SLOTS) + s.
+ */
+typedef struct cf_dhash_region_s {
+	pthread_mutex_t			lock;
+	cf_dhash_bucket *		buckets;
+	uint8_t *				values;
+	uint32_t				n_buckets;		// a power of 2
+	uint32_t				n_elements;
+} __attribute__ ((aligned(64))) cf_dhash_region;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * The bits a digest is placed by. The low bits of the first word are the
+ * partition id, which all the digests of a partition's table share, so the
+ * bits are taken from the words after it.
+ */
+static inline uint64_t cf_dhash_bits(const cf_digest *d) {
+	uint64_t bits;
+	memcpy(&bits, d->digest + sizeof(uint32_t), sizeof(uint64_t));
+	return bits;
+}
+
+/**
+ * Compare two digests with a 16 byte and a 4 byte load each, rather than a
+ * memcmp.
+ */
+static inline bool cf_dhash_digest_eq(const cf_digest *a, const cf_digest *b) {
+	uint64_t a0, a1, b0, b1;
+	uint32_t a2, b2;
+
+	memcpy(&a0, a->digest, sizeof(uint64_t));
+	memcpy(&a1, a->digest + 8, sizeof(uint64_t));
+	memcpy(&a2, a->digest + 16, sizeof(uint32_t));
+	memcpy(&b0, b->digest, sizeof(uint64_t));
+	memcpy(&b1, b->digest + 8, sizeof(uint64_t));
+	memcpy(&b2, b->digest + 16, sizeof(uint32_t));
+
+	return ((a0 ^ b0) | (a1 ^ b1) | (a2 ^ b2)) == 0;
+}
+
+static inline cf_dhash_region * cf_dhash_region_get(cf_dhash *h, uint64_t bits) {
+	return &h->regions[bits & (h->n_regions - 1)];
+}
+
+static inline uint32_t cf_dhash_home(cf_dhash *h, cf_dhash_region *r, uint64_t bits) {
+	return (uint32_t) (bits >> h->region_shift) & (r->n_buckets - 1);
+}
+
+static inline void * cf_dhash_value(cf_dhash *h, cf_dhash_region *r, uint32_t i, uint s) {
+	return r->values + (((size_t) i * CF_DHASH_BUCKET_SLOTS + s) * h->value_len);
+}
+
+static inline void cf_dhash_lock(cf_dhash *h, cf_dhash_region *r) {
+	if (h->flags & (CF_DHASH_CR_MT_BIGLOCK | CF_DHASH_CR_MT_MANYLOCK)) {
+		pthread_mutex_lock(&r->lock);
+	}
+}
+
+static inline void cf_dhash_unlock(cf_dhash *h, cf_dhash_region *r) {
+	if (h->flags & (CF_DHASH_CR_MT_BIGLOCK | CF_DHASH_CR_MT_MANYLOCK)) {
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+static int cf_dhash_region_alloc(cf_dhash *h, cf_dhash_region *r, uint32_t n_buckets) {
+	cf_dhash_bucket *buckets = (cf_dhash_bucket *) cf_valloc(n_buckets * sizeof(cf_dhash_bucket));
+	uint8_t *values = 0;
+
+	if (h->value_len) {
+		values = (uint8_t *) cf_malloc((size_t) n_buckets * CF_DHASH_BUCKET_SLOTS * h->value_len);
+	}
+
+	if (! buckets || (h->value_len && ! values)) {
+		if (buckets)	cf_free(buckets);
+		if (values)		cf_free(values);
+		return(CF_DHASH_ERR);
+	}
+
+	memset(buckets, 0, n_buckets * sizeof(cf_dhash_bucket));
+	r->buckets = buckets;
+	r->values = values;
+	r->n_buckets = n_buckets;
+	return(CF_DHASH_OK);
+}
+
+/**
+ * Find a digest in a region - on success, fills in its bucket and slot.
+ */
+static bool cf_dhash_find(cf_dhash *h, cf_dhash_region *r, uint64_t bits, const cf_digest *d, uint32_t *i_r, uint *s_r) {
+	uint32_t mask = r->n_buckets - 1;
+	uint32_t i = cf_dhash_home(h, r, bits);
+
+	for (uint32_t n = 0; n < r->n_buckets; n++) {
+		cf_dhash_bucket *b = &r->buckets[i];
+
+		for (uint s = 0; s < b->n_keys; s++) {
+			if (cf_dhash_digest_eq(&b->keys[s], d)) {
+				*i_r = i;
+				*s_r = s;
+				return true;
+			}
+		}
+
+		if (b->overflow == 0) {
+			return false;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	return false;
+}
+
+/**
+ * Add a digest that isn't in the region yet, counting it as overflow in
+ * every full bucket it passes. The region must have room for it. Returns
+ * the value slot, for the caller to fill in.
+ */
+static void * cf_dhash_insert(cf_dhash *h, cf_dhash_region *r, uint64_t bits, const cf_digest *d) {
+	uint32_t mask = r->n_buckets - 1;
+	uint32_t i = cf_dhash_home(h, r, bits);
+
+	while (r->buckets[i].n_keys == CF_DHASH_BUCKET_SLOTS) {
+		if (r->buckets[i].overflow != CF_DHASH_OVERFLOW_MAX) {
+			r->buckets[i].overflow++;
+		}
+		i = (i + 1) & mask;
+	}
+
+	cf_dhash_bucket *b = &r->buckets[i];
+	uint s = b->n_keys++;
+	b->keys[s] = *d;
+	r->n_elements++;
+
+	return cf_dhash_value(h, r, i, s);
+}
+
+/**
+ * Remove the digest in slot s of bucket i - the bucket's last digest takes
+ * its slot, and the buckets between its home and i give back the overflow
+ * it took.
+ */
+static void cf_dhash_remove(cf_dhash *h, cf_dhash_region *r, uint32_t i, uint s) {
+	cf_dhash_bucket *b = &r->buckets[i];
+	uint32_t mask = r->n_buckets - 1;
+
+	for (uint32_t j = cf_dhash_home(h, r, cf_dhash_bits(&b->keys[s])); j != i; j = (j + 1) & mask) {
+		if (r->buckets[j].overflow != CF_DHASH_OVERFLOW_MAX) {
+			r->buckets[j].overflow--;
+		}
+	}
+
+	uint last = --b->n_keys;
+	if (s != last) {
+		b->keys[s] = b->keys[last];
+		if (h->value_len) {
+			memcpy(cf_dhash_value(h, r, i, s), cf_dhash_value(h, r, i, last), h->value_len);
+		}
+	}
+
+	r->n_elements--;
+}
+
+/**
+ * Double a region, putting every element back in from scratch. Caller holds
+ * the region's lock.
+ */
+static int cf_dhash_region_grow(cf_dhash *h, cf_dhash_region *r) {
+	cf_dhash_region old = *r;
+
+	if (old.n_buckets > UINT32_MAX / 2 / CF_DHASH_BUCKET_SLOTS) {
+		return(CF_DHASH_ERR);
+	}
+
+	if (cf_dhash_region_alloc(h, r, old.n_buckets * 2) != CF_DHASH_OK) {
+		return(CF_DHASH_ERR);
+	}
+
+	r->n_elements = 0;
+
+	for (uint32_t i = 0; i < old.n_buckets; i++) {
+		cf_dhash_bucket *b = &old.buckets[i];
+
+		for (uint s = 0; s < b->n_keys; s++) {
+			void *value = cf_dhash_insert(h, r, cf_dhash_bits(&b->keys[s]), &b->keys[s]);
+			if (h->value_len) {
+				memcpy(value, cf_dhash_value(h, &old, i, s), h->value_len);
+			}
+		}
+	}
+
+	cf_free(old.buckets);
+	if (old.values) {
+		cf_free(old.values);
+	}
+
+	return(CF_DHASH_OK);
+}
+
+static int cf_dhash_put_internal(cf_dhash *h, const cf_digest *d, const void *value, bool unique) {
+	uint64_t bits = cf_dhash_bits(d);
+	cf_dhash_region *r = cf_dhash_region_get(h, bits);
+	uint32_t i;
+	uint s;
+	int rv = CF_DHASH_OK;
+
+	cf_dhash_lock(h, r);
+
+	if (cf_dhash_find(h, r, bits, d, &i, &s)) {
+		if (unique) {
+			rv = CF_DHASH_ERR_FOUND;
+		}
+		else if (h->value_len) {
+			memcpy(cf_dhash_value(h, r, i, s), value, h->value_len);
+		}
+		cf_dhash_unlock(h, r);
+		return(rv);
+	}
+
+	if ((uint64_t) r->n_elements + 1 > CF_DHASH_MAX_LOAD(r->n_buckets) &&
+			cf_dhash_region_grow(h, r) != CF_DHASH_OK &&
+			(uint64_t) r->n_elements == (uint64_t) r->n_buckets * CF_DHASH_BUCKET_SLOTS) {
+		// couldn't grow, and there's no room at all
+		cf_dhash_unlock(h, r);
+		return(CF_DHASH_ERR);
+	}
+
+	void *v = cf_dhash_insert(h, r, bits, d);
+	if (h->value_len) {
+		memcpy(v, value, h->value_len);
+	}
+
+	cf_dhash_unlock(h, r);
+	return(rv);
+}
+
+static int cf_dhash_reduce_internal(cf_dhash *h, cf_dhash_reduce_fn reduce_fn, void *udata, bool del) {
+	for (uint n = 0; n < h->n_regions; n++) {
+		cf_dhash_region *r = &h->regions[n];
+
+		cf_dhash_lock(h, r);
+
+		for (uint32_t i = 0; i < r->n_buckets; i++) {
+			cf_dhash_bucket *b = &r->buckets[i];
+			uint s = 0;
+
+			while (s < b->n_keys) {
+				int rv = reduce_fn(&b->keys[s], h->value_len ? cf_dhash_value(h, r, i, s) : 0, udata);
+
+				if (del && rv == CF_DHASH_REDUCE_DELETE) {
+					// the bucket's last digest moves into slot s - visit it next
+					cf_dhash_remove(h, r, i, s);
+				}
+				else if (! del && rv != 0) {
+					cf_dhash_unlock(h, r);
+					return(CF_DHASH_OK);
+				}
+				else {
+					s++;
+				}
+			}
+		}
+
+		cf_dhash_unlock(h, r);
+	}
+
+	return(CF_DHASH_OK);
+}
+
+/**
+ * Free the first n_regions regions, whose locks have been initialized, and
+ * the table.
+ */
+static void cf_dhash_regions_destroy(cf_dhash *h, uint n_regions) {
+	for (uint n = 0; n < n_regions; n++) {
+		cf_dhash_region *r = &h->regions[n];
+
+		if (r->buckets) {
+			cf_free(r->buckets);
+		}
+		if (r->values) {
+			cf_free(r->values);
+		}
+		pthread_mutex_destroy(&r->lock);
+	}
+
+	cf_free(h->regions);
+	cf_free(h);
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+int cf_dhash_create(cf_dhash **h_r, uint32_t value_len, uint32_t sz, uint flags) {
+	*h_r = 0;
+
+	if ((flags & CF_DHASH_CR_MT_BIGLOCK) && (flags & CF_DHASH_CR_MT_MANYLOCK)) {
+		return(CF_DHASH_ERR);
+	}
+
+	cf_dhash *h = (cf_dhash *) cf_malloc(sizeof(cf_dhash));
+	if (! h) {
+		return(CF_DHASH_ERR);
+	}
+
+	h->value_len = value_len;
+	h->flags = flags;
+	h->n_regions = (flags & CF_DHASH_CR_MT_MANYLOCK) ? CF_DHASH_N_REGIONS : 1;
+	h->region_shift = 0;
+	while ((1u << h->region_shift) < h->n_regions) {
+		h->region_shift++;
+	}
+
+	h->regions = (cf_dhash_region *) cf_valloc(h->n_regions * sizeof(cf_dhash_region));
+	if (! h->regions) {
+		cf_free(h);
+		return(CF_DHASH_ERR);
+	}
+	memset(h->regions, 0, h->n_regions * sizeof(cf_dhash_region));
+
+	// enough buckets for sz elements at the maximum load
+	uint64_t per_region = ((uint64_t) sz + h->n_regions - 1) / h->n_regions;
+	uint32_t n_buckets = 1;
+	while (CF_DHASH_MAX_LOAD(n_buckets) < per_region && n_buckets < (1u << 30)) {
+		n_buckets *= 2;
+	}
+
+	for (uint n = 0; n < h->n_regions; n++) {
+		cf_dhash_region *r = &h->regions[n];
+
+		if (0 != pthread_mutex_init(&r->lock, 0)) {
+			cf_dhash_regions_destroy(h, n);
+			return(CF_DHASH_ERR);
+		}
+
+		if (cf_dhash_region_alloc(h, r, n_buckets) != CF_DHASH_OK) {
+			cf_dhash_regions_destroy(h, n + 1);
+			return(CF_DHASH_ERR);
+		}
+	}
+
+	*h_r = h;
+	return(CF_DHASH_OK);
+}
+
+int cf_dhash_put(cf_dhash *h, const cf_digest *d, const void *value) {
+	return cf_dhash_put_internal(h, d, value, false);
+}
+
+int cf_dhash_put_unique(cf_dhash *h, const cf_digest *d, const void *value) {
+	return cf_dhash_put_internal(h, d, value, true);
+}
+
+int cf_dhash_get(cf_dhash *h, const cf_digest *d, void *value) {
+	uint64_t bits = cf_dhash_bits(d);
+	cf_dhash_region *r = cf_dhash_region_get(h, bits);
+	uint32_t i;
+	uint s;
+	int rv = CF_DHASH_ERR_NOTFOUND;
+
+	cf_dhash_lock(h, r);
+
+	if (cf_dhash_find(h, r, bits, d, &i, &s)) {
+		if (value && h->value_len) {
+			memcpy(value, cf_dhash_value(h, r, i, s), h->value_len);
+		}
+		rv = CF_DHASH_OK;
+	}
+
+	cf_dhash_unlock(h, r);
+	return(rv);
+}
+
+int cf_dhash_delete(cf_dhash *h, const cf_digest *d) {
+	uint64_t bits = cf_dhash_bits(d);
+	cf_dhash_region *r = cf_dhash_region_get(h, bits);
+	uint32_t i;
+	uint s;
+	int rv = CF_DHASH_ERR_NOTFOUND;
+
+	cf_dhash_lock(h, r);
+
+	if (cf_dhash_find(h, r, bits, d, &i, &s)) {
+		cf_dhash_remove(h, r, i, s);
+		rv = CF_DHASH_OK;
+	}
+
+	cf_dhash_unlock(h, r);
+	return(rv);
+}
+
+uint32_t cf_dhash_get_size(cf_dhash *h) {
+	uint32_t sz = 0;
+
+	for (uint n = 0; n < h->n_regions; n++) {
+		sz += *(volatile uint32_t *) &h->regions[n].n_elements;
+	}
+
+	return(sz);
+}
+
+int cf_dhash_reduce(cf_dhash *h, cf_dhash_reduce_fn reduce_fn, void *udata) {
+	return cf_dhash_reduce_internal(h, reduce_fn, udata, false);
+}
+
+int cf_dhash_reduce_delete(cf_dhash *h, cf_dhash_reduce_fn reduce_fn, void *udata) {
+	return cf_dhash_reduce_internal(h, reduce_fn, udata, true);
+}
+
+void cf_dhash_destroy(cf_dhash *h) {
+	cf_dhash_regions_destroy(h, h->n_regions);
+}
@@ -0,0 +1,1011 @@
+/*
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_clock.h>
+#include <citrusleaf/cf_queue.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// times a waiting ring or spsc pop yields before it parks
+#define CF_QUEUE_WAIT_YIELDS 4
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * A ring slot - the sequence number says whose turn it is. A slot at ring
+ * position pos is free for the producer of pos when seq == pos, and holds
+ * the element for the consumer of pos when seq == pos + 1. The consumer
+ * hands it to the next lap by setting seq = pos + capacity.
+ */
+typedef struct cf_queue_ring_slot_s {
+	cf_atomic_int	seq;
+	uint8_t			data[];
+} cf_queue_ring_slot;
+
+/**
+ * The ring - producer and consumer positions are on their own cache lines,
+ * as is the parking state, which is only touched when the ring runs empty.
+ */
+struct cf_queue_ring_s {
+	cf_atomic_int_t	mask;			// capacity - 1
+	size_t			slotsz;			// bytes per slot, including seq
+	uint8_t *		slots;
+
+	cf_atomic_int	enqueue_pos __attribute__ ((aligned(64)));
+	cf_atomic_int	dequeue_pos __attribute__ ((aligned(64)));
+
+	// The futex word - bit 0 says a consumer is parked (or about to park),
+	// the rest counts wakes. Producers only make the wake syscall when the
+	// bit is set, and clear it as they do, so a burst of pushes into an
+	// empty ring costs one syscall, not one each.
+	cf_atomic32		wake_seq __attribute__ ((aligned(64)));
+};
+
+/**
+ * The single-producer/single-consumer ring - each side owns its position,
+ * and keeps a cached copy of the other side's, which it only refreshes when
+ * the cached value says the ring is full (or empty). So in the steady state
+ * neither side touches the other's cache line.
+ */
+struct cf_queue_spsc_s {
+	cf_atomic_int_t	mask;			// capacity - 1
+	uint8_t *		slots;
+
+	cf_atomic_int	write_pos __attribute__ ((aligned(64)));
+	cf_atomic_int_t	read_cache;		// producer's last look at read_pos
+
+	cf_atomic_int	read_pos __attribute__ ((aligned(64)));
+	cf_atomic_int_t	write_cache;	// consumer's last look at write_pos
+
+	cf_atomic32		wake_seq __attribute__ ((aligned(64)));	// as for the ring
+};
+
+typedef uint (*cf_queue_trypop_fn) (cf_queue *q, void *buf, uint n);
+
+/******************************************************************************
+ * MACROS
+ ******************************************************************************/
+
+#ifdef EXTERNAL_LOCKS
+#include <citrusleaf/cf_hooks.h>
+#define QUEUE_LOCK(_q) 		cf_hooked_mutex_lock(_q->LOCK)
+#define QUEUE_UNLOCK(_q) 	cf_hooked_mutex_unlock(_q->LOCK)
+#define QUEUE_SIGNAL(_q)
+#else
+#define QUEUE_LOCK(_q) 		pthread_mutex_lock(&_q->LOCK)
+#define QUEUE_UNLOCK(_q) 	pthread_mutex_unlock(&_q->LOCK)
+#define QUEUE_SIGNAL(_q) 	pthread_cond_signal(&_q->CV)
+#endif
+
+// A locked add to the top of the stack is a full barrier, and on x86 it's
+// much cheaper than mfence - a producer pays for one on every push.
+#if defined(MARCH_x86_64) && ! defined(CF_WINDOWS)
+#define QUEUE_FENCE() 		__asm__ __volatile__ ("lock; addl $0,-4(%%rsp)" : : : "memory", "cc")
+#else
+#define QUEUE_FENCE() 		smb_mb()
+#endif
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * Park until the wake word moves off val, or ms passes (ms < 0 is forever).
+ * Unpark wakes every parked consumer - those that find nothing park again.
+ * Without a futex, just nap - a push will be seen on the next look.
+ */
+#ifdef __linux__
+static inline void cf_queue_park(cf_atomic32 *word, uint32_t val, int ms) {
+	struct timespec ts;
+	struct timespec *tsp = NULL;
+	if (ms >= 0) {
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = (ms % 1000) * 1000000;
+		tsp = &ts;
+	}
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, tsp, NULL, 0);
+}
+
+static inline void cf_queue_unpark(cf_atomic32 *word) {
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#else
+static inline void cf_queue_park(cf_atomic32 *word, uint32_t val, int ms) {
+	usleep(ms < 0 || ms > 1 ? 1000 : 1000 * ms);
+}
+
+static inline void cf_queue_unpark(cf_atomic32 *word) {
+}
+#endif
+
+/**
+ * Called by a producer after it publishes. Publish before looking for parked
+ * consumers - a consumer sets the parked bit before its last look at the
+ * queue, so one of us is sure to see the other. If the clear fails, another
+ * producer is doing the wake.
+ */
+static inline void cf_queue_wake(cf_atomic32 *word) {
+	QUEUE_FENCE();
+	uint32_t w = cf_atomic32_get(*word);
+	if ((w & 1) && (uint32_t) cf_atomic32_cas(word, w, (w + 2) & ~1) == w) {
+		cf_queue_unpark(word);
+	}
+}
+
+/**
+ * Called after trypop found nothing - pop up to n, waiting as long as mswait
+ * for the first, parking on word. Returns the number popped, or
+ * CF_QUEUE_EMPTY.
+ */
+static int cf_queue_wait_pop_n(cf_queue *q, void *buf, uint n, int mswait, cf_atomic32 *word, cf_queue_trypop_fn trypop) {
+	uint got;
+
+	if (mswait == CF_QUEUE_NOWAIT) {
+		return CF_QUEUE_EMPTY;
+	}
+
+	// A consumer that keeps up with its producers finds the queue empty on
+	// nearly every pop - yield a few times before paying for a park and a
+	// wake, or we'd pay for one per element.
+	for (int i = 0; i < CF_QUEUE_WAIT_YIELDS; i++) {
+		sched_yield();
+		got = trypop(q, buf, n);
+		if (got) {
+			return (int) got;
+		}
+	}
+
+	cf_clock deadline = mswait > 0 ? cf_getms() + mswait : 0;
+
+	for (;;) {
+		// Set the parked bit, then look once more - a push after this point
+		// moves the word off w, and the park falls straight through.
+		uint32_t w = cf_atomic32_get(*word);
+		if (! (w & 1)) {
+			if ((uint32_t) cf_atomic32_cas(word, w, w | 1) != w) {
+				continue;
+			}
+			w |= 1;
+		}
+		else {
+			smb_mb();
+		}
+
+		got = trypop(q, buf, n);
+		if (got) {
+			return (int) got;
+		}
+
+		int ms = -1;
+		if (mswait > 0) {
+			cf_clock now = cf_getms();
+			if (now >= deadline) {
+				return CF_QUEUE_EMPTY;
+			}
+			ms = (int) (deadline - now);
+		}
+		cf_queue_park(word, w, ms);
+
+		got = trypop(q, buf, n);
+		if (got) {
+			return (int) got;
+		}
+	}
+}
+
+static inline cf_queue_ring_slot * cf_queue_ring_slot_get(struct cf_queue_ring_s *r, cf_atomic_int_t pos) {
+	return (cf_queue_ring_slot *) (r->slots + ((pos & r->mask) * r->slotsz));
+}
+
+/**
+ * Reserve up to n free slots at the producer position with one CAS, fill
+ * them, and publish. Returns the number pushed - 0 if the ring is full.
+ */
+static uint cf_queue_ring_push_n(cf_queue *q, void *ptr, uint n) {
+	struct cf_queue_ring_s *r = q->ring;
+	cf_atomic_int_t pos = cf_atomic_int_get(r->enqueue_pos);
+	uint k;
+
+	for (;;) {
+		// count the free slots in a row from pos
+		intptr_t dif = 0;
+		for (k = 0; k < n; k++) {
+			dif = (intptr_t) cf_atomic_int_get(cf_queue_ring_slot_get(r, pos + k)->seq) - (intptr_t) (pos + k);
+			if (dif != 0) {
+				break;
+			}
+		}
+
+		if (k != 0) {
+			cf_atomic_int_t prior = cf_atomic_int_cas(&r->enqueue_pos, pos, pos + k);
+			if (prior == pos) {
+				break;
+			}
+			pos = prior;
+		}
+		else if (dif < 0) {
+			// the consumer of the previous lap hasn't freed this slot
+			return 0;
+		}
+		else {
+			// another producer got here first
+			pos = cf_atomic_int_get(r->enqueue_pos);
+		}
+	}
+
+	uint8_t *src = (uint8_t *) ptr;
+	for (uint i = 0; i < k; i++) {
+		cf_queue_ring_slot *s = cf_queue_ring_slot_get(r, pos + i);
+		memcpy(s->data, src, q->elementsz);
+		src += q->elementsz;
+
+		// x86 doesn't reorder stores - just keep the compiler from doing it
+		CF_MEMORY_BARRIER_WRITE();
+		cf_atomic_int_set(&s->seq, pos + i + 1);
+	}
+
+	cf_queue_wake(&r->wake_seq);
+	return k;
+}
+
+/**
+ * Claim up to n published elements at the consumer position with one CAS,
+ * copy them out, and free the slots. Returns the number popped.
+ */
+static uint cf_queue_ring_trypop_n(cf_queue *q, void *buf, uint n) {
+	struct cf_queue_ring_s *r = q->ring;
+	cf_atomic_int_t pos = cf_atomic_int_get(r->dequeue_pos);
+	uint k;
+
+	for (;;) {
+		intptr_t dif = 0;
+		for (k = 0; k < n; k++) {
+			dif = (intptr_t) cf_atomic_int_get(cf_queue_ring_slot_get(r, pos + k)->seq) - (intptr_t) (pos + k + 1);
+			if (dif != 0) {
+				break;
+			}
+		}
+
+		if (k != 0) {
+			cf_atomic_int_t prior = cf_atomic_int_cas(&r->dequeue_pos, pos, pos + k);
+			if (prior == pos) {
+				break;
+			}
+			pos = prior;
+		}
+		else if (dif < 0) {
+			// empty - or the producer of pos hasn't finished its copy
+			return 0;
+		}
+		else {
+			pos = cf_atomic_int_get(r->dequeue_pos);
+		}
+	}
+
+	// x86 doesn't reorder loads - keep the copies after the seq loads, and
+	// each release after its copy
+	CF_MEMORY_BARRIER_WRITE();
+
+	uint8_t *dst = (uint8_t *) buf;
+	for (uint i = 0; i < k; i++) {
+		cf_queue_ring_slot *s = cf_queue_ring_slot_get(r, pos + i);
+		memcpy(dst, s->data, q->elementsz);
+		dst += q->elementsz;
+
+		CF_MEMORY_BARRIER_WRITE();
+		cf_atomic_int_set(&s->seq, pos + i + r->mask + 1);
+	}
+
+	return k;
+}
+
+static int cf_queue_ring_sz(cf_queue *q) {
+	struct cf_queue_ring_s *r = q->ring;
+	cf_atomic_int_t deq = cf_atomic_int_get(r->dequeue_pos);
+	intptr_t sz = (intptr_t) (cf_atomic_int_get(r->enqueue_pos) - deq);
+	if (sz < 0) {
+		return 0;
+	}
+	return sz > (intptr_t) (r->mask + 1) ? (int) (r->mask + 1) : (int) sz;
+}
+
+/**
+ * Push up to n into the spsc ring - wait-free, at most two copies. Producer
+ * thread only. Returns the number pushed - 0 if the ring is full.
+ */
+static uint cf_queue_spsc_push_n(cf_queue *q, void *ptr, uint n) {
+	struct cf_queue_spsc_s *s = q->spsc;
+	cf_atomic_int_t cap = s->mask + 1;
+	cf_atomic_int_t w = s->write_pos;
+	cf_atomic_int_t room = cap - (w - s->read_cache);
+
+	if (room < n) {
+		s->read_cache = cf_atomic_int_get(s->read_pos);
+		room = cap - (w - s->read_cache);
+		if (room == 0) {
+			return 0;
+		}
+	}
+	if (n > room) {
+		n = (uint) room;
+	}
+
+	uint i = (uint) (w & s->mask);
+	uint run = (uint) cap - i;
+	if (run > n) {
+		run = n;
+	}
+	memcpy(&s->slots[i * q->elementsz], ptr, run * q->elementsz);
+	memcpy(s->slots, (uint8_t *) ptr + (run * q->elementsz), (n - run) * q->elementsz);
+
+	// x86 doesn't reorder stores - just keep the compiler from doing it
+	CF_MEMORY_BARRIER_WRITE();
+	cf_atomic_int_set(&s->write_pos, w + n);
+
+	cf_queue_wake(&s->wake_seq);
+	return n;
+}
+
+/**
+ * Pop up to n from the spsc ring - wait-free, at most two copies. Consumer
+ * thread only. Returns the number popped.
+ */
+static uint cf_queue_spsc_trypop_n(cf_queue *q, void *buf, uint n) {
+	struct cf_queue_spsc_s *s = q->spsc;
+	cf_atomic_int_t r = s->read_pos;
+	cf_atomic_int_t avail = s->write_cache - r;
+
+	if (avail < n) {
+		s->write_cache = cf_atomic_int_get(s->write_pos);
+		avail = s->write_cache - r;
+		if (avail == 0) {
+			return 0;
+		}
+	}
+	if (n > avail) {
+		n = (uint) avail;
+	}
+
+	uint i = (uint) (r & s->mask);
+	uint run = (uint) (s->mask + 1) - i;
+	if (run > n) {
+		run = n;
+	}
+
+	// x86 doesn't reorder loads - keep the copies after the write_pos load,
+	// and the release after the copies
+	CF_MEMORY_BARRIER_WRITE();
+	memcpy(buf, &s->slots[i * q->elementsz], run * q->elementsz);
+	memcpy((uint8_t *) buf + (run * q->elementsz), s->slots, (n - run) * q->elementsz);
+	CF_MEMORY_BARRIER_WRITE();
+	cf_atomic_int_set(&s->read_pos, r + n);
+
+	return n;
+}
+
+static int cf_queue_spsc_sz(cf_queue *q) {
+	struct cf_queue_spsc_s *s = q->spsc;
+	cf_atomic_int_t r = cf_atomic_int_get(s->read_pos);
+	return (int) (cf_atomic_int_get(s->write_pos) - r);
+}
+
+/**
+ * Grow the queue. If the elements don't wrap, realloc is enough, otherwise
+ * copy them to the front of a new buffer.
+ */
+static int cf_queue_resize(cf_queue *q, uint new_sz) {
+	uint sz = CF_Q_SZ(q);
+	uint r = q->read_offset % q->allocsz;
+
+	if (r + sz <= q->allocsz) {
+		byte *t = realloc(q->queue, new_sz * q->elementsz);
+		if (! t) {
+			return CF_QUEUE_ERR;
+		}
+		q->queue = t;
+		q->read_offset = r;
+	}
+	else {
+		byte *t = malloc(new_sz * q->elementsz);
+		if (! t) {
+			return CF_QUEUE_ERR;
+		}
+		// endsz is the used bytes from the read offset to the end of the buffer
+		size_t endsz = (q->allocsz - r) * q->elementsz;
+		memcpy(t, &q->queue[r * q->elementsz], endsz);
+		memcpy(t + endsz, q->queue, (sz * q->elementsz) - endsz);
+		free(q->queue);
+		q->queue = t;
+		q->read_offset = 0;
+	}
+
+	q->write_offset = q->read_offset + sz;
+	q->allocsz = new_sz;
+	return CF_QUEUE_OK;
+}
+
+/**
+ * The offsets only ever grow - pull them back before they overflow.
+ */
+static inline void cf_queue_unwrap(cf_queue *q) {
+	uint sz = CF_Q_SZ(q);
+	q->read_offset %= q->allocsz;
+	q->write_offset = q->read_offset + sz;
+}
+
+/**
+ * Push n elements with the lock held - at most one resize, and at most two
+ * copies, up to the end of the buffer and then from the front.
+ */
+static int cf_queue_push_internal(cf_queue *q, void *ptr, uint n) {
+	if (n > 0x40000000) {
+		return CF_QUEUE_ERR;
+	}
+
+	uint need = CF_Q_SZ(q) + n;
+	if (need > q->allocsz) {
+		uint new_sz = q->allocsz * 2;
+		while (new_sz < need) {
+			new_sz *= 2;
+		}
+		if (CF_QUEUE_OK != cf_queue_resize(q, new_sz)) {
+			return CF_QUEUE_ERR;
+		}
+	}
+
+	uint w = q->write_offset % q->allocsz;
+	uint run = q->allocsz - w;
+	if (run > n) {
+		run = n;
+	}
+	memcpy(&q->queue[w * q->elementsz], ptr, run * q->elementsz);
+	memcpy(q->queue, (byte *) ptr + (run * q->elementsz), (n - run) * q->elementsz);
+	q->write_offset += n;
+
+	if (q->write_offset & 0xC0000000) {
+		cf_queue_unwrap(q);
+	}
+	return CF_QUEUE_OK;
+}
+
+/**
+ * Pop up to n elements with the lock held, waiting as long as mswait for the
+ * first. Returns the number popped, or CF_QUEUE_EMPTY.
+ */
+static int cf_queue_pop_internal(cf_queue *q, void *buf, uint n, int mswait) {
+	bool waited = false;
+
+#ifndef EXTERNAL_LOCKS
+	if (q->threadsafe && mswait != CF_QUEUE_NOWAIT && CF_Q_EMPTY(q)) {
+		waited = true;
+
+		// The condvar can wake more than one waiter, and a wake doesn't
+		// promise an element - always re-check under the lock.
+		if (mswait < 0) {
+			while (CF_Q_EMPTY(q)) {
+				pthread_cond_wait(&q->CV, &q->LOCK);
+			}
+		}
+		else {
+			struct timespec tp;
+			clock_gettime(CLOCK_REALTIME, &tp);
+			CF_TIMESPEC_ADD_MS(&tp, (uint) mswait);
+
+			while (CF_Q_EMPTY(q)) {
+				if (ETIMEDOUT == pthread_cond_timedwait(&q->CV, &q->LOCK, &tp)) {
+					break;
+				}
+			}
+		}
+	}
+#endif // EXTERNAL_LOCKS
+
+	uint sz = CF_Q_SZ(q);
+	if (sz == 0) {
+		return CF_QUEUE_EMPTY;
+	}
+	if (n > sz) {
+		n = sz;
+	}
+
+	uint r = q->read_offset % q->allocsz;
+	uint run = q->allocsz - r;
+	if (run > n) {
+		run = n;
+	}
+	memcpy(buf, &q->queue[r * q->elementsz], run * q->elementsz);
+	memcpy((byte *) buf + (run * q->elementsz), q->queue, (n - run) * q->elementsz);
+	q->read_offset += n;
+
+	// when the queue drains, start over at the front - keeps the cache warm
+	if (q->read_offset == q->write_offset) {
+		q->read_offset = q->write_offset = 0;
+	}
+	else if (waited) {
+		// a push signals once, however many it pushed - pass the wake along
+		QUEUE_SIGNAL(q);
+	}
+
+	return (int) n;
+}
+
+/**
+ * Move the elements from 'from' onward down to 'to', after a compaction pass
+ * has dropped (from - to) of them.
+ */
+static void cf_queue_close_gap(cf_queue *q, uint to, uint from) {
+	if (to == from) {
+		return;
+	}
+	while (from < q->write_offset) {
+		memcpy(CF_Q_ELEM_PTR(q, to), CF_Q_ELEM_PTR(q, from), q->elementsz);
+		to++;
+		from++;
+	}
+	q->write_offset = to;
+
+	if (CF_Q_EMPTY(q)) {
+		q->read_offset = q->write_offset = 0;
+	}
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_queue * cf_queue_create(size_t elementsz, bool threadsafe) {
+	cf_queue *q = malloc(sizeof(cf_queue));
+	if (! q) {
+		return NULL;
+	}
+
+	q->allocsz = CF_QUEUE_ALLOCSZ;
+	q->write_offset = q->read_offset = 0;
+	q->elementsz = elementsz;
+	q->threadsafe = threadsafe;
+	q->ring = NULL;
+	q->spsc = NULL;
+
+	q->queue = malloc(CF_QUEUE_ALLOCSZ * elementsz);
+	if (! q->queue) {
+		free(q);
+		return NULL;
+	}
+
+	if (! threadsafe) {
+		return q;
+	}
+
+#ifdef EXTERNAL_LOCKS
+	q->LOCK = cf_hooked_mutex_alloc();
+#else
+	if (0 != pthread_mutex_init(&q->LOCK, NULL)) {
+		free(q->queue);
+		free(q);
+		return NULL;
+	}
+	if (0 != pthread_cond_init(&q->CV, NULL)) {
+		pthread_mutex_destroy(&q->LOCK);
+		free(q->queue);
+		free(q);
+		return NULL;
+	}
+#endif // EXTERNAL_LOCKS
+
+	return q;
+}
+
+cf_queue * cf_queue_create_ring(size_t elementsz, uint capacity) {
+	if (elementsz == 0 || capacity == 0 || capacity > 0x40000000) {
+		return NULL;
+	}
+
+	uint n = 1;
+	while (n < capacity) {
+		n <<= 1;
+	}
+
+	cf_queue *q = malloc(sizeof(cf_queue));
+	if (! q) {
+		return NULL;
+	}
+
+	struct cf_queue_ring_s *r = valloc(sizeof(struct cf_queue_ring_s));
+	if (! r) {
+		free(q);
+		return NULL;
+	}
+	memset(r, 0, sizeof(struct cf_queue_ring_s));
+
+	r->mask = n - 1;
+	r->slotsz = (sizeof(cf_queue_ring_slot) + elementsz + sizeof(cf_atomic_int) - 1) & ~(sizeof(cf_atomic_int) - 1);
+	r->slots = valloc(n * r->slotsz);
+	if (! r->slots) {
+		free(r);
+		free(q);
+		return NULL;
+	}
+	for (uint i = 0; i < n; i++) {
+		cf_atomic_int_set(&cf_queue_ring_slot_get(r, i)->seq, i);
+	}
+
+	q->threadsafe = true;
+	q->allocsz = n;
+	q->write_offset = q->read_offset = 0;
+	q->elementsz = elementsz;
+	q->queue = NULL;
+	q->ring = r;
+	q->spsc = NULL;
+	return q;
+}
+
+cf_queue * cf_queue_create_spsc(size_t elementsz, uint capacity) {
+	if (elementsz == 0 || capacity == 0 || capacity > 0x40000000) {
+		return NULL;
+	}
+
+	uint n = 1;
+	while (n < capacity) {
+		n <<= 1;
+	}
+
+	cf_queue *q = malloc(sizeof(cf_queue));
+	if (! q) {
+		return NULL;
+	}
+
+	struct cf_queue_spsc_s *s = valloc(sizeof(struct cf_queue_spsc_s));
+	if (! s) {
+		free(q);
+		return NULL;
+	}
+	memset(s, 0, sizeof(struct cf_queue_spsc_s));
+
+	s->mask = n - 1;
+	s->slots = valloc(n * elementsz);
+	if (! s->slots) {
+		free(s);
+		free(q);
+		return NULL;
+	}
+
+	q->threadsafe = true;
+	q->allocsz = n;
+	q->write_offset = q->read_offset = 0;
+	q->elementsz = elementsz;
+	q->queue = NULL;
+	q->ring = NULL;
+	q->spsc = s;
+	return q;
+}
+
+void cf_queue_destroy(cf_queue *q) {
+	if (q->ring) {
+		free(q->ring->slots);
+		free(q->ring);
+	}
+	else if (q->spsc) {
+		free(q->spsc->slots);
+		free(q->spsc);
+	}
+	else if (q->threadsafe) {
+#ifdef EXTERNAL_LOCKS
+		cf_hooked_mutex_free(q->LOCK);
+#else
+		pthread_cond_destroy(&q->CV);
+		pthread_mutex_destroy(&q->LOCK);
+#endif // EXTERNAL_LOCKS
+	}
+	free(q->queue);
+	free(q);
+}
+
+int cf_queue_sz(cf_queue *q) {
+	if (q->ring) {
+		return cf_queue_ring_sz(q);
+	}
+	if (q->spsc) {
+		return cf_queue_spsc_sz(q);
+	}
+
+	if (q->threadsafe) {
+		QUEUE_LOCK(q);
+	}
+	int rv = CF_Q_SZ(q);
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+int cf_queue_push(cf_queue *q, void *ptr) {
+	int rv = cf_queue_push_n(q, ptr, 1);
+	return rv == 1 ? CF_QUEUE_OK : rv;
+}
+
+int cf_queue_push_n(cf_queue *q, void *ptr, uint n) {
+	if (n == 0) {
+		return 0;
+	}
+
+	if (q->spsc || q->ring) {
+		uint pushed = q->spsc ? cf_queue_spsc_push_n(q, ptr, n) : cf_queue_ring_push_n(q, ptr, n);
+		return pushed ? (int) pushed : CF_QUEUE_FULL;
+	}
+
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	int rv = cf_queue_push_internal(q, ptr, n);
+
+	if (q->threadsafe) {
+		if (rv == CF_QUEUE_OK) {
+			QUEUE_SIGNAL(q);
+		}
+		QUEUE_UNLOCK(q);
+	}
+	return rv == CF_QUEUE_OK ? (int) n : rv;
+}
+
+bool cf_queue_push_limit(cf_queue *q, void *ptr, uint limit) {
+	if (q->ring || q->spsc) {
+		if ((uint) cf_queue_sz(q) >= limit) {
+			return false;
+		}
+		return cf_queue_push_n(q, ptr, 1) == 1;
+	}
+
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return false;
+	}
+
+	bool pushed = false;
+	if (CF_Q_SZ(q) < limit) {
+		pushed = cf_queue_push_internal(q, ptr, 1) == CF_QUEUE_OK;
+	}
+
+	if (q->threadsafe) {
+		if (pushed) {
+			QUEUE_SIGNAL(q);
+		}
+		QUEUE_UNLOCK(q);
+	}
+	return pushed;
+}
+
+int cf_queue_pop(cf_queue *q, void *buf, int mswait) {
+	int rv = cf_queue_pop_n(q, buf, 1, mswait);
+	return rv > 0 ? CF_QUEUE_OK : rv;
+}
+
+int cf_queue_pop_n(cf_queue *q, void *buf, uint n, int mswait) {
+	if (n == 0) {
+		return 0;
+	}
+
+	if (q->spsc) {
+		uint got = cf_queue_spsc_trypop_n(q, buf, n);
+		if (got) {
+			return (int) got;
+		}
+		return cf_queue_wait_pop_n(q, buf, n, mswait, &q->spsc->wake_seq, cf_queue_spsc_trypop_n);
+	}
+	if (q->ring) {
+		uint got = cf_queue_ring_trypop_n(q, buf, n);
+		if (got) {
+			return (int) got;
+		}
+		return cf_queue_wait_pop_n(q, buf, n, mswait, &q->ring->wake_seq, cf_queue_ring_trypop_n);
+	}
+
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	int rv = cf_queue_pop_internal(q, buf, n, mswait);
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+void cf_queue_delete_offset(cf_queue *q, uint index) {
+	if (index == q->read_offset) {
+		q->read_offset++;
+		if (q->read_offset == q->write_offset) {
+			q->read_offset = q->write_offset = 0;
+		}
+		return;
+	}
+	cf_queue_close_gap(q, index, index + 1);
+}
+
+int cf_queue_reduce(cf_queue *q, cf_queue_reduce_fn cb, void *udata) {
+	if (q->ring || q->spsc) {
+		return CF_QUEUE_ERR;
+	}
+
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	// One compaction pass - survivors are moved down over the deleted.
+	uint keep = q->read_offset;
+	uint i = q->read_offset;
+
+	while (i < q->write_offset) {
+		int rv = cb(CF_Q_ELEM_PTR(q, i), udata);
+		if (rv == -2) {
+			i++;
+			continue;
+		}
+		if (keep != i) {
+			memcpy(CF_Q_ELEM_PTR(q, keep), CF_Q_ELEM_PTR(q, i), q->elementsz);
+		}
+		keep++;
+		i++;
+		if (rv == -1) {
+			break;
+		}
+	}
+	cf_queue_close_gap(q, keep, i);
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return CF_QUEUE_OK;
+}
+
+int cf_queue_delete(cf_queue *q, void *buf, bool only_one) {
+	if (q->ring || q->spsc) {
+		return CF_QUEUE_ERR;
+	}
+
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	bool found = false;
+	uint keep = q->read_offset;
+	uint i = q->read_offset;
+
+	while (i < q->write_offset) {
+		if ((! found || ! only_one) && 0 == memcmp(CF_Q_ELEM_PTR(q, i), buf, q->elementsz)) {
+			found = true;
+			i++;
+			continue;
+		}
+		if (found && only_one) {
+			break;
+		}
+		if (keep != i) {
+			memcpy(CF_Q_ELEM_PTR(q, keep), CF_Q_ELEM_PTR(q, i), q->elementsz);
+		}
+		keep++;
+		i++;
+	}
+	cf_queue_close_gap(q, keep, i);
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return found ? CF_QUEUE_OK : CF_QUEUE_EMPTY;
+}
+
+/******************************************************************************
+ * TEST
+ ******************************************************************************/
+
+static int cf_queue_test_delete_odd(void *buf, void *udata) {
+	return (*(int *) buf & 1) ? -2 : 0;
+}
+
+static int cf_queue_test_one(cf_queue *q, bool can_reduce) {
+	int v;
+
+	for (int i = 0; i < 500; i++) {
+		if (CF_QUEUE_OK != cf_queue_push(q, &i)) {
+			return -1;
+		}
+	}
+	if (cf_queue_sz(q) != 500) {
+		return -1;
+	}
+
+	if (can_reduce) {
+		cf_queue_reduce(q, cf_queue_test_delete_odd, NULL);
+		v = 100;
+		if (CF_QUEUE_OK != cf_queue_delete(q, &v, true)) {
+			return -1;
+		}
+		if (cf_queue_sz(q) != 249) {
+			return -1;
+		}
+	}
+
+	int expect = 0;
+	while (CF_QUEUE_OK == cf_queue_pop(q, &v, CF_QUEUE_NOWAIT)) {
+		if (can_reduce && expect == 100) {
+			expect += 2;
+		}
+		if (v != expect) {
+			fprintf(stderr, "cf_queue test: popped %d expected %d\n", v, expect);
+			return -1;
+		}
+		expect += can_reduce ? 2 : 1;
+	}
+	if (expect != 500 || cf_queue_sz(q) != 0) {
+		return -1;
+	}
+	return cf_queue_pop(q, &v, 1) == CF_QUEUE_EMPTY ? 0 : -1;
+}
+
+int cf_queue_test() {
+	cf_queue *q = cf_queue_create(sizeof(int), true);
+	if (! q) {
+		return -1;
+	}
+	int rv = cf_queue_test_one(q, true);
+	cf_queue_destroy(q);
+	if (rv != 0) {
+		return rv;
+	}
+
+	q = cf_queue_create_ring(sizeof(int), 500);
+	if (! q) {
+		return -1;
+	}
+	rv = cf_queue_test_one(q, false);
+	cf_queue_destroy(q);
+	if (rv != 0) {
+		return rv;
+	}
+
+	q = cf_queue_create_spsc(sizeof(int), 500);
+	if (! q) {
+		return -1;
+	}
+	rv = cf_queue_test_one(q, false);
+	cf_queue_destroy(q);
+	return rv;
+}
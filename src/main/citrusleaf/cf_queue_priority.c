@@ -0,0 +1,315 @@
+/*
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <citrusleaf/cf_clock.h>
+#include <citrusleaf/cf_queue_priority.h>
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef struct cf_queue_priority_reduce_udata_s {
+	cf_queue_reduce_fn	cb;
+	void *				udata;
+	bool				stop;
+} cf_queue_priority_reduce_udata;
+
+/******************************************************************************
+ * MACROS
+ ******************************************************************************/
+
+#ifdef EXTERNAL_LOCKS
+#include <citrusleaf/cf_hooks.h>
+#define QUEUE_LOCK(_q) 		cf_hooked_mutex_lock(_q->LOCK)
+#define QUEUE_UNLOCK(_q) 	cf_hooked_mutex_unlock(_q->LOCK)
+#define QUEUE_SIGNAL(_q)
+#else
+#define QUEUE_LOCK(_q) 		pthread_mutex_lock(&_q->LOCK)
+#define QUEUE_UNLOCK(_q) 	pthread_mutex_unlock(&_q->LOCK)
+#define QUEUE_SIGNAL(_q) 	pthread_cond_signal(&_q->CV)
+#endif
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * Pick the level to pop from - there must be something queued. Strict
+ * priority takes the highest non-empty level. Weighted, the level whose
+ * turn it is is served while it has credit and elements, then the turn (and
+ * that level's weight in credit) moves on - so an empty level gives up the
+ * rest of its turn.
+ */
+static uint cf_queue_priority_next(cf_queue_priority *q) {
+	if (! q->weights) {
+		for (uint i = 0; i < q->n_levels; i++) {
+			if (! CF_Q_EMPTY(q->queues[i])) {
+				return i;
+			}
+		}
+		return 0;
+	}
+
+	for (;;) {
+		if (q->credit != 0 && ! CF_Q_EMPTY(q->queues[q->cursor])) {
+			q->credit--;
+			return q->cursor;
+		}
+		q->cursor = (q->cursor + 1) % q->n_levels;
+		q->credit = q->weights[q->cursor];
+	}
+}
+
+static void cf_queue_priority_recount(cf_queue_priority *q) {
+	q->n_elements = 0;
+	for (uint i = 0; i < q->n_levels; i++) {
+		q->n_elements += CF_Q_SZ(q->queues[i]);
+	}
+}
+
+static int cf_queue_priority_reduce_cb(void *buf, void *udata) {
+	cf_queue_priority_reduce_udata *u = (cf_queue_priority_reduce_udata *) udata;
+	int rv = u->cb(buf, u->udata);
+	if (rv == -1) {
+		u->stop = true;
+	}
+	return rv;
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_queue_priority *cf_queue_priority_create(size_t elementsz, bool threadsafe) {
+	return cf_queue_priority_create_n(elementsz, threadsafe, CF_QUEUE_PRIORITY_LOW, NULL);
+}
+
+cf_queue_priority *cf_queue_priority_create_n(size_t elementsz, bool threadsafe, uint n_levels, const uint *weights) {
+	if (n_levels == 0 || n_levels > CF_QUEUE_PRIORITY_MAX_LEVELS) {
+		return NULL;
+	}
+	if (weights) {
+		for (uint i = 0; i < n_levels; i++) {
+			if (weights[i] == 0) {
+				return NULL;
+			}
+		}
+	}
+
+	cf_queue_priority *q = malloc(sizeof(cf_queue_priority));
+	if (! q) {
+		return NULL;
+	}
+	memset(q, 0, sizeof(cf_queue_priority));
+
+	q->threadsafe = threadsafe;
+	q->n_levels = n_levels;
+
+	q->queues = malloc(n_levels * sizeof(cf_queue *));
+	if (! q->queues) {
+		goto Fail;
+	}
+	memset(q->queues, 0, n_levels * sizeof(cf_queue *));
+
+	// the levels are all guarded by our lock
+	for (uint i = 0; i < n_levels; i++) {
+		if (! (q->queues[i] = cf_queue_create(elementsz, false))) {
+			goto Fail;
+		}
+	}
+
+	if (weights) {
+		if (! (q->weights = malloc(n_levels * sizeof(uint)))) {
+			goto Fail;
+		}
+		memcpy(q->weights, weights, n_levels * sizeof(uint));
+		q->cursor = 0;
+		q->credit = q->weights[0];
+	}
+
+	if (! threadsafe) {
+		return q;
+	}
+
+#ifdef EXTERNAL_LOCKS
+	q->LOCK = cf_hooked_mutex_alloc();
+#else
+	if (0 != pthread_mutex_init(&q->LOCK, NULL)) {
+		goto Fail;
+	}
+	if (0 != pthread_cond_init(&q->CV, NULL)) {
+		pthread_mutex_destroy(&q->LOCK);
+		goto Fail;
+	}
+#endif // EXTERNAL_LOCKS
+
+	return q;
+
+Fail:
+	if (q->queues) {
+		for (uint i = 0; i < n_levels; i++) {
+			if (q->queues[i]) {
+				cf_queue_destroy(q->queues[i]);
+			}
+		}
+		free(q->queues);
+	}
+	free(q->weights);
+	free(q);
+	return NULL;
+}
+
+void cf_queue_priority_destroy(cf_queue_priority *q) {
+	for (uint i = 0; i < q->n_levels; i++) {
+		cf_queue_destroy(q->queues[i]);
+	}
+	free(q->queues);
+	free(q->weights);
+
+	if (q->threadsafe) {
+#ifdef EXTERNAL_LOCKS
+		cf_hooked_mutex_free(q->LOCK);
+#else
+		pthread_cond_destroy(&q->CV);
+		pthread_mutex_destroy(&q->LOCK);
+#endif // EXTERNAL_LOCKS
+	}
+	free(q);
+}
+
+int cf_queue_priority_push(cf_queue_priority *q, void *ptr, int pri) {
+	if (pri < 1 || pri > (int) q->n_levels) {
+		return CF_QUEUE_ERR;
+	}
+
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	int rv = cf_queue_push(q->queues[pri - 1], ptr);
+	if (rv == CF_QUEUE_OK) {
+		q->n_elements++;
+	}
+
+	if (q->threadsafe) {
+		if (rv == CF_QUEUE_OK) {
+			QUEUE_SIGNAL(q);
+		}
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+int cf_queue_priority_pop(cf_queue_priority *q, void *buf, int mswait) {
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+#ifndef EXTERNAL_LOCKS
+	if (q->threadsafe && mswait != CF_QUEUE_NOWAIT) {
+		if (mswait < 0) {
+			while (CF_Q_PRI_EMPTY(q)) {
+				pthread_cond_wait(&q->CV, &q->LOCK);
+			}
+		}
+		else {
+			struct timespec tp;
+			clock_gettime(CLOCK_REALTIME, &tp);
+			CF_TIMESPEC_ADD_MS(&tp, (uint) mswait);
+
+			while (CF_Q_PRI_EMPTY(q)) {
+				if (ETIMEDOUT == pthread_cond_timedwait(&q->CV, &q->LOCK, &tp)) {
+					break;
+				}
+			}
+		}
+	}
+#endif // EXTERNAL_LOCKS
+
+	int rv = CF_QUEUE_EMPTY;
+	if (! CF_Q_PRI_EMPTY(q)) {
+		rv = cf_queue_pop(q->queues[cf_queue_priority_next(q)], buf, CF_QUEUE_NOWAIT);
+		if (rv == CF_QUEUE_OK) {
+			q->n_elements--;
+		}
+	}
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+int cf_queue_priority_sz(cf_queue_priority *q) {
+	if (q->threadsafe) {
+		QUEUE_LOCK(q);
+	}
+	int rv = (int) q->n_elements;
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+int cf_queue_priority_reduce(cf_queue_priority *q, cf_queue_reduce_fn cb, void *udata) {
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	cf_queue_priority_reduce_udata u = { cb, udata, false };
+	for (uint i = 0; i < q->n_levels && ! u.stop; i++) {
+		cf_queue_reduce(q->queues[i], cf_queue_priority_reduce_cb, &u);
+	}
+	cf_queue_priority_recount(q);
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return CF_QUEUE_OK;
+}
+
+int cf_queue_priority_delete(cf_queue_priority *q, void *buf, bool only_one) {
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	bool found = false;
+	for (uint i = 0; i < q->n_levels; i++) {
+		if (CF_QUEUE_OK == cf_queue_delete(q->queues[i], buf, only_one)) {
+			found = true;
+			if (only_one) {
+				break;
+			}
+		}
+	}
+	cf_queue_priority_recount(q);
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return found ? CF_QUEUE_OK : CF_QUEUE_EMPTY;
+}
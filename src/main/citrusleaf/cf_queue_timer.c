@@ -0,0 +1,424 @@
+/*
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <citrusleaf/cf_queue_timer.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+#define CF_QUEUE_TIMER_ARITY 4
+
+// end of the free slot list
+#define CF_QUEUE_TIMER_NO_SLOT 0xFFFFFFFF
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * A heap entry carries its deadline, so sifting never leaves the heap array.
+ */
+struct cf_queue_timer_entry_s {
+	cf_clock	deadline;
+	uint32_t	slot;
+};
+
+/**
+ * Where an element lives, for the life of its handle. The generation is odd
+ * while the slot holds a pending element, even while it is free - it moves
+ * on at both push and removal, so a handle only matches the push it came
+ * from.
+ */
+struct cf_queue_timer_slot_s {
+	uint32_t	gen;
+	uint32_t	pos;			// heap position if pending, else next free slot
+};
+
+typedef struct cf_queue_timer_entry_s cf_queue_timer_entry;
+typedef struct cf_queue_timer_slot_s cf_queue_timer_slot;
+
+/******************************************************************************
+ * MACROS
+ ******************************************************************************/
+
+#ifdef EXTERNAL_LOCKS
+#include <citrusleaf/cf_hooks.h>
+#define QUEUE_LOCK(_q) 		cf_hooked_mutex_lock(_q->LOCK)
+#define QUEUE_UNLOCK(_q) 	cf_hooked_mutex_unlock(_q->LOCK)
+#define QUEUE_SIGNAL(_q)
+#else
+#define QUEUE_LOCK(_q) 		pthread_mutex_lock(&_q->LOCK)
+#define QUEUE_UNLOCK(_q) 	pthread_mutex_unlock(&_q->LOCK)
+#define QUEUE_SIGNAL(_q) 	pthread_cond_signal(&_q->CV)
+#endif
+
+#define TIMER_ELEM_PTR(_q, _slot) (&(_q)->elements[(size_t) (_slot) * (_q)->elementsz])
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static inline void cf_queue_timer_place(cf_queue_timer *q, uint32_t pos, cf_queue_timer_entry e) {
+	q->heap[pos] = e;
+	q->slots[e.slot].pos = pos;
+}
+
+static void cf_queue_timer_sift_up(cf_queue_timer *q, uint32_t pos) {
+	cf_queue_timer_entry e = q->heap[pos];
+
+	while (pos > 0) {
+		uint32_t parent = (pos - 1) / CF_QUEUE_TIMER_ARITY;
+		if (q->heap[parent].deadline <= e.deadline) {
+			break;
+		}
+		cf_queue_timer_place(q, pos, q->heap[parent]);
+		pos = parent;
+	}
+	cf_queue_timer_place(q, pos, e);
+}
+
+static void cf_queue_timer_sift_down(cf_queue_timer *q, uint32_t pos) {
+	cf_queue_timer_entry e = q->heap[pos];
+
+	for (;;) {
+		uint32_t first = (pos * CF_QUEUE_TIMER_ARITY) + 1;
+		if (first >= q->n_elements) {
+			break;
+		}
+
+		uint32_t end = first + CF_QUEUE_TIMER_ARITY;
+		if (end > q->n_elements) {
+			end = q->n_elements;
+		}
+		uint32_t min = first;
+		for (uint32_t c = first + 1; c < end; c++) {
+			if (q->heap[c].deadline < q->heap[min].deadline) {
+				min = c;
+			}
+		}
+
+		if (e.deadline <= q->heap[min].deadline) {
+			break;
+		}
+		cf_queue_timer_place(q, pos, q->heap[min]);
+		pos = min;
+	}
+	cf_queue_timer_place(q, pos, e);
+}
+
+/**
+ * Take the element at heap position pos out - copy it to buf (if not null),
+ * and free its slot.
+ */
+static void cf_queue_timer_remove(cf_queue_timer *q, uint32_t pos, void *buf) {
+	uint32_t slot = q->heap[pos].slot;
+
+	if (buf) {
+		memcpy(buf, TIMER_ELEM_PTR(q, slot), q->elementsz);
+	}
+
+	q->n_elements--;
+	if (pos < q->n_elements) {
+		cf_queue_timer_entry last = q->heap[q->n_elements];
+		cf_queue_timer_place(q, pos, last);
+
+		if (pos > 0 && last.deadline < q->heap[(pos - 1) / CF_QUEUE_TIMER_ARITY].deadline) {
+			cf_queue_timer_sift_up(q, pos);
+		}
+		else {
+			cf_queue_timer_sift_down(q, pos);
+		}
+	}
+
+	q->slots[slot].gen++;
+	q->slots[slot].pos = q->free_slot;
+	q->free_slot = slot;
+}
+
+/**
+ * Double everything, and chain the new slots onto the free list.
+ */
+static int cf_queue_timer_resize(cf_queue_timer *q) {
+	uint new_sz = q->allocsz * 2;
+	if (new_sz > 0x40000000) {
+		return CF_QUEUE_ERR;
+	}
+
+	cf_queue_timer_entry *heap = realloc(q->heap, new_sz * sizeof(cf_queue_timer_entry));
+	if (! heap) {
+		return CF_QUEUE_ERR;
+	}
+	q->heap = heap;
+
+	cf_queue_timer_slot *slots = realloc(q->slots, new_sz * sizeof(cf_queue_timer_slot));
+	if (! slots) {
+		return CF_QUEUE_ERR;
+	}
+	q->slots = slots;
+
+	byte *elements = realloc(q->elements, new_sz * q->elementsz);
+	if (! elements) {
+		return CF_QUEUE_ERR;
+	}
+	q->elements = elements;
+
+	for (uint i = q->allocsz; i < new_sz; i++) {
+		q->slots[i].gen = 0;
+		q->slots[i].pos = i + 1 < new_sz ? i + 1 : q->free_slot;
+	}
+	q->free_slot = q->allocsz;
+	q->allocsz = new_sz;
+	return CF_QUEUE_OK;
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_queue_timer * cf_queue_timer_create(size_t elementsz, bool threadsafe) {
+	cf_queue_timer *q = malloc(sizeof(cf_queue_timer));
+	if (! q) {
+		return NULL;
+	}
+
+	q->threadsafe = threadsafe;
+	q->elementsz = elementsz;
+	q->n_elements = 0;
+	q->allocsz = CF_QUEUE_ALLOCSZ;
+	q->heap = malloc(CF_QUEUE_ALLOCSZ * sizeof(cf_queue_timer_entry));
+	q->slots = malloc(CF_QUEUE_ALLOCSZ * sizeof(cf_queue_timer_slot));
+	q->elements = malloc(CF_QUEUE_ALLOCSZ * elementsz);
+
+	if (! q->heap || ! q->slots || ! q->elements) {
+		goto Fail;
+	}
+
+	for (uint i = 0; i < CF_QUEUE_ALLOCSZ; i++) {
+		q->slots[i].gen = 0;
+		q->slots[i].pos = i + 1 < CF_QUEUE_ALLOCSZ ? i + 1 : CF_QUEUE_TIMER_NO_SLOT;
+	}
+	q->free_slot = 0;
+
+	if (! threadsafe) {
+		return q;
+	}
+
+#ifdef EXTERNAL_LOCKS
+	q->LOCK = cf_hooked_mutex_alloc();
+#else
+	if (0 != pthread_mutex_init(&q->LOCK, NULL)) {
+		goto Fail;
+	}
+
+	// deadlines are cf_getms() time - wait on the same clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	int rv = pthread_cond_init(&q->CV, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (0 != rv) {
+		pthread_mutex_destroy(&q->LOCK);
+		goto Fail;
+	}
+#endif // EXTERNAL_LOCKS
+
+	return q;
+
+Fail:
+	free(q->heap);
+	free(q->slots);
+	free(q->elements);
+	free(q);
+	return NULL;
+}
+
+void cf_queue_timer_destroy(cf_queue_timer *q) {
+	if (q->threadsafe) {
+#ifdef EXTERNAL_LOCKS
+		cf_hooked_mutex_free(q->LOCK);
+#else
+		pthread_cond_destroy(&q->CV);
+		pthread_mutex_destroy(&q->LOCK);
+#endif // EXTERNAL_LOCKS
+	}
+	free(q->heap);
+	free(q->slots);
+	free(q->elements);
+	free(q);
+}
+
+int cf_queue_timer_push(cf_queue_timer *q, void *ptr, cf_clock deadline, cf_queue_timer_handle *handle_r) {
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	if (q->free_slot == CF_QUEUE_TIMER_NO_SLOT && CF_QUEUE_OK != cf_queue_timer_resize(q)) {
+		if (q->threadsafe) {
+			QUEUE_UNLOCK(q);
+		}
+		return CF_QUEUE_ERR;
+	}
+
+	uint32_t slot = q->free_slot;
+	q->free_slot = q->slots[slot].pos;
+	q->slots[slot].gen++;
+
+	memcpy(TIMER_ELEM_PTR(q, slot), ptr, q->elementsz);
+
+	cf_queue_timer_entry e = { deadline, slot };
+	uint32_t pos = q->n_elements++;
+	q->heap[pos] = e;
+	cf_queue_timer_sift_up(q, pos);
+
+	if (handle_r) {
+		*handle_r = ((uint64_t) q->slots[slot].gen << 32) | slot;
+	}
+
+	if (q->threadsafe) {
+		// a new earliest deadline - waiters must re-time their sleep
+		if (q->heap[0].slot == slot) {
+			QUEUE_SIGNAL(q);
+		}
+		QUEUE_UNLOCK(q);
+	}
+	return CF_QUEUE_OK;
+}
+
+int cf_queue_timer_cancel(cf_queue_timer *q, cf_queue_timer_handle handle, void *buf) {
+	uint32_t slot = (uint32_t) handle;
+	uint32_t gen = (uint32_t) (handle >> 32);
+
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	int rv = CF_QUEUE_NOMATCH;
+	if (slot < q->allocsz && q->slots[slot].gen == gen && (gen & 1)) {
+		cf_queue_timer_remove(q, q->slots[slot].pos, buf);
+		rv = CF_QUEUE_OK;
+	}
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+int cf_queue_timer_pop(cf_queue_timer *q, void *buf, int mswait) {
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	cf_clock now = cf_getms();
+	cf_clock give_up = mswait > 0 ? now + mswait : 0;
+	int rv = CF_QUEUE_EMPTY;
+
+	for (;;) {
+		if (q->n_elements != 0 && q->heap[0].deadline <= now) {
+			cf_queue_timer_remove(q, 0, buf);
+			rv = CF_QUEUE_OK;
+
+			// others may be waiting on the same deadline, or an earlier one
+			// than they know of
+			if (q->threadsafe && q->n_elements != 0) {
+				QUEUE_SIGNAL(q);
+			}
+			break;
+		}
+
+		if (! q->threadsafe || mswait == CF_QUEUE_NOWAIT || (mswait > 0 && now >= give_up)) {
+			break;
+		}
+
+#ifdef EXTERNAL_LOCKS
+		break;
+#else
+		// sleep until the earliest deadline, or until we give up
+		cf_clock until = give_up;
+		if (q->n_elements != 0 && (until == 0 || q->heap[0].deadline < until)) {
+			until = q->heap[0].deadline;
+		}
+
+		if (until == 0) {
+			pthread_cond_wait(&q->CV, &q->LOCK);
+		}
+		else {
+			struct timespec tp;
+			tp.tv_sec = until / 1000;
+			tp.tv_nsec = (until % 1000) * 1000000;
+			pthread_cond_timedwait(&q->CV, &q->LOCK, &tp);
+		}
+		now = cf_getms();
+#endif // EXTERNAL_LOCKS
+	}
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+int cf_queue_timer_pop_expired(cf_queue_timer *q, void *buf, uint n, cf_clock now) {
+	if (q->threadsafe && 0 != QUEUE_LOCK(q)) {
+		return CF_QUEUE_ERR;
+	}
+
+	uint i = 0;
+	while (i < n && q->n_elements != 0 && q->heap[0].deadline <= now) {
+		cf_queue_timer_remove(q, 0, (byte *) buf + (i * q->elementsz));
+		i++;
+	}
+
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return (int) i;
+}
+
+cf_clock cf_queue_timer_next_deadline(cf_queue_timer *q) {
+	if (q->threadsafe) {
+		QUEUE_LOCK(q);
+	}
+	cf_clock rv = q->n_elements != 0 ? q->heap[0].deadline : 0;
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
+
+int cf_queue_timer_sz(cf_queue_timer *q) {
+	if (q->threadsafe) {
+		QUEUE_LOCK(q);
+	}
+	int rv = (int) q->n_elements;
+	if (q->threadsafe) {
+		QUEUE_UNLOCK(q);
+	}
+	return rv;
+}
@@ -42,14 +42,147 @@
 #include <citrusleaf/cf_rchash.h>
 #include <citrusleaf/cf_alloc.h>
 #include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_clock.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+/**
+ * Number of buckets a thread of a parallel reduce claims at a time
+ */
+#define CF_RCHASH_REDUCE_CHUNK 1024
+
+/**
+ * Number of reader slots of a CF_RCHASH_CR_EPOCH table - threads beyond this
+ * share slots, which only makes grace periods a little longer
+ */
+#define CF_RCHASH_EPOCH_SLOTS 64
+
+/**
+ * A writer tries to reclaim retired elements every this many retires
+ */
+#define CF_RCHASH_EPOCH_BATCH 64
+
+/**
+ * Number of old buckets a writer moves, when a table is resizing, before
+ * doing its own work
+ */
+#define CF_RCHASH_RESIZE_STEP 4
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * State shared by the threads of a parallel reduce - the threads claim
+ * CF_RCHASH_REDUCE_CHUNK buckets at a time.
+ */
+typedef struct cf_rchash_reduce_job_s {
+	cf_rchash *				h;
+	cf_rchash_reduce_fn		reduce_fn;
+	bool					del;
+	cf_atomic32				next_bucket;
+	cf_atomic32				stop;
+} cf_rchash_reduce_job;
+
+/**
+ * The statistics counters - atomic, as threads holding different bucket
+ * locks share them.
+ */
+struct cf_rchash_stats_data_s {
+	cf_atomic64				collisions;
+	cf_atomic64				resizes;
+	cf_atomic64				lock_samples;
+	cf_atomic64				lock_wait_ns;
+	cf_atomic64				lock_wait_max_ns;
+};
+
+/**
+ * Resize state of a CF_RCHASH_CR_RESIZE table. A resize doubles the table,
+ * and the elements of each old bucket i are moved to new buckets i and
+ * i + old_len - either by the first operation on them, or by a writer
+ * stepping through the old table. The lock of a bucket is picked by hash %
+ * lock_table_len, which divides every table size, so old bucket i and both
+ * its new buckets are under the same lock.
+ */
+struct cf_rchash_resize_s {
+	pthread_mutex_t			lock;		// held to start or end a resize, and through traversals
+	void *					old_table;	// 0 if not resizing
+	uint					old_len;
+	uint8_t *				moved;		// per old bucket, set once it's been moved
+	cf_atomic32				next;		// next old bucket for a writer to move
+	cf_atomic32				n_moved;
+};
+
+/**
+ * The element of a CF_RCHASH_CR_EPOCH table, for fixed and variable size
+ * keys alike. The buckets are just pointers, so every element is allocated,
+ * and once linked only next changes - a lock-free reader never sees a key
+ * or object being rewritten under it.
+ */
+typedef struct cf_rchash_elem_e_s {
+	struct cf_rchash_elem_e_s *	next;
+	void *					object; // this is a reference counted object
+	struct cf_rchash_elem_e_s *	retired_next;
+	uint32_t				retired_epoch;
+	uint32_t				key_len;
+	uint8_t					key[];
+} cf_rchash_elem_e;
+
+/**
+ * Counts of the readers in even and odd epochs - a cache line each, so
+ * readers in different slots don't contend.
+ */
+typedef struct cf_rchash_reader_slot_s {
+	cf_atomic32				count[2];
+} __attribute__ ((aligned(64))) cf_rchash_reader_slot;
+
+/**
+ * Epoch state of a CF_RCHASH_CR_EPOCH table. A reader registers in its slot
+ * under the current epoch. An element unlinked in epoch c is retired, tagged
+ * c, and is freed once the epoch has moved past c and no reader registered
+ * before that is left.
+ */
+struct cf_rchash_epoch_s {
+	cf_atomic32				epoch;
+	cf_atomic32				n_retired;
+	cf_atomic_p				retired;		// stack of retired elements
+	pthread_mutex_t			reclaim_lock;
+	cf_rchash_reader_slot	slots[CF_RCHASH_EPOCH_SLOTS];
+};
+
+typedef struct cf_rchash_reduce_worker_s {
+	cf_rchash_reduce_job *	job;
+	void *					udata;
+	uint32_t				deleted;
+	pthread_t				thread;
+	bool					started;
+} cf_rchash_reduce_worker;
+
+/******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+
+/**
+ * Lock acquisitions by this thread on tables keeping statistics - used to
+ * pick which to time.
+ */
+static __thread uint32_t cf_rchash_lock_count;
+
+/**
+ * Reader ids, handed out to threads on their first lock-free get - a thread
+ * uses reader slot (id % CF_RCHASH_EPOCH_SLOTS) of every table.
+ */
+static cf_atomic32 cf_rchash_n_reader_ids;
+static __thread uint32_t cf_rchash_reader_id;
 
 /******************************************************************************
  * FUNCTION DECLS
  ******************************************************************************/
 
 void cf_rchash_destroy_v(cf_rchash *h);
-void cf_rchash_reduce_delete_v(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata);
-void cf_rchash_reduce_v(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata);
+static int cf_rchash_reduce_bucket_v(cf_rchash *h, uint i, cf_rchash_reduce_fn reduce_fn, void *udata, bool del, uint32_t *deleted);
 int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len);
 int cf_rchash_get_v(cf_rchash *h, void *key, uint32_t key_len, void **object);
 int cf_rchash_put_unique_v(cf_rchash *h, void *key, uint32_t key_len, void *object);
@@ -57,6 +190,11 @@ int cf_rchash_put_v(cf_rchash *h, void *key, uint32_t key_len, void *object);
 uint32_t cf_rchash_get_size_v(cf_rchash *h);
 void cf_rchash_destroy_elements_v(cf_rchash *h);
 void cf_rchash_dump_v(cf_rchash *h);
+static int cf_rchash_put_e(cf_rchash *h, void *key, uint32_t key_len, void *object, bool unique);
+static int cf_rchash_get_e(cf_rchash *h, void *key, uint32_t key_len, void **object);
+static int cf_rchash_delete_e(cf_rchash *h, void *key, uint32_t key_len);
+static int cf_rchash_reduce_bucket_e(cf_rchash *h, uint i, cf_rchash_reduce_fn reduce_fn, void *udata, bool del, uint32_t *deleted);
+static void cf_rchash_destroy_elements_e(cf_rchash *h);
 
 /******************************************************************************
  * FUNCTIONS
@@ -80,8 +218,24 @@ int cf_rchash_create(cf_rchash **h_r, cf_rchash_hash_fn h_fn, cf_rchash_destruct
 		return(CF_RCHASH_ERR);
 	}
 
-	if (key_len == 0)
-        h->table = cf_calloc(sz, sizeof(cf_rchash_elem_v));
+	// lock-free gets only make sense if the writers lock, and can't follow
+	// elements being moved by a resize
+	if ((flags & CF_RCHASH_CR_EPOCH) && (! (flags & (CF_RCHASH_CR_MT_BIGLOCK | CF_RCHASH_CR_MT_MANYLOCK)) || (flags & CF_RCHASH_CR_RESIZE))) {
+		cf_free(h);
+		*h_r = 0;
+		return(CF_RCHASH_ERR);
+	}
+
+	if (sz == 0) {
+		cf_free(h);
+		*h_r = 0;
+		return(CF_RCHASH_ERR);
+	}
+
+	if (flags & CF_RCHASH_CR_EPOCH)
+		h->table = cf_calloc(sz, sizeof(cf_rchash_elem_e *));
+	else if (key_len == 0)
+        h->table = cf_calloc(sz, sizeof(cf_rchash_elem_v *));
     else
         h->table = cf_calloc(sz, sizeof(cf_rchash_elem_f) + key_len);
     
@@ -109,9 +263,49 @@ int cf_rchash_create(cf_rchash **h_r, cf_rchash_hash_fn h_fn, cf_rchash_destruct
 		for (uint i=0;i<sz;i++) {
 			pthread_mutex_init( &(h->lock_table[i]), 0 );
 		}
+		h->lock_table_len = sz;
+		h->buckets_per_lock = 1;
 	}
-	else
+	else {
 		h->lock_table = 0;
+		h->lock_table_len = 0;
+		h->buckets_per_lock = 0;
+	}
+
+	h->stats = 0;
+	h->epoch = 0;
+	h->resize = 0;
+
+	if (flags & CF_RCHASH_CR_STATS) {
+		h->stats = cf_calloc(1, sizeof(struct cf_rchash_stats_data_s));
+		if (! h->stats) {
+			cf_rchash_destroy(h);
+			*h_r = 0;
+			return(CF_RCHASH_ERR);
+		}
+	}
+
+	if (flags & CF_RCHASH_CR_EPOCH) {
+		struct cf_rchash_epoch_s *ep = cf_valloc(sizeof(struct cf_rchash_epoch_s));
+		if (! ep) {
+			cf_rchash_destroy(h);
+			*h_r = 0;
+			return(CF_RCHASH_ERR);
+		}
+		memset(ep, 0, sizeof(struct cf_rchash_epoch_s));
+		pthread_mutex_init(&ep->reclaim_lock, 0);
+		h->epoch = ep;
+	}
+
+	if (flags & CF_RCHASH_CR_RESIZE) {
+		h->resize = cf_calloc(1, sizeof(struct cf_rchash_resize_s));
+		if (! h->resize) {
+			cf_rchash_destroy(h);
+			*h_r = 0;
+			return(CF_RCHASH_ERR);
+		}
+		pthread_mutex_init(&h->resize->lock, 0);
+	}
 
 	*h_r = h;
 
@@ -125,6 +319,46 @@ void cf_rchash_free(cf_rchash *h, void *object) {
 	}
 }
 
+/**
+ * Take a lock, timing one acquisition in CF_RCHASH_STATS_LOCK_SAMPLE if the
+ * table keeps statistics. If the lock is free, there's no wait to time, so
+ * we only read the clock when we'd otherwise block.
+ */
+static inline void cf_rchash_lock(cf_rchash *h, pthread_mutex_t *l) {
+	if (! (h->flags & CF_RCHASH_CR_STATS) || ++cf_rchash_lock_count % CF_RCHASH_STATS_LOCK_SAMPLE != 0) {
+		pthread_mutex_lock(l);
+		return;
+	}
+
+	uint64_t wait = 0;
+
+	if (0 != pthread_mutex_trylock(l)) {
+		cf_clock start = cf_getns();
+		pthread_mutex_lock(l);
+		wait = cf_getns() - start;
+	}
+
+	struct cf_rchash_stats_data_s *st = h->stats;
+	cf_atomic64_incr(&st->lock_samples);
+	if (wait) {
+		cf_atomic64_add(&st->lock_wait_ns, wait);
+
+		uint64_t max;
+		while (wait > (max = cf_atomic64_get(st->lock_wait_max_ns)) &&
+				(uint64_t) cf_atomic64_cas(&st->lock_wait_max_ns, max, wait) != max)
+			;
+	}
+}
+
+/**
+ * Count a put of a new key that found its bucket taken.
+ */
+static inline void cf_rchash_stats_collision(cf_rchash *h) {
+	if (h->flags & CF_RCHASH_CR_STATS) {
+		cf_atomic64_incr(&h->stats->collisions);
+	}
+}
+
 static inline cf_rchash_elem_f *get_bucket(cf_rchash *h, uint i) {
     return( (cf_rchash_elem_f * ) (
                 ((uint8_t *) h->table) +
@@ -133,6 +367,262 @@ static inline cf_rchash_elem_f *get_bucket(cf_rchash *h, uint i) {
            );
 }
 
+/**
+ * Move the elements of old bucket j to the new table. The new buckets are
+ * empty until this is done (anything hashing to them is in old bucket j),
+ * so the old head is copied into its new bucket, and every other element
+ * either becomes a head or is linked in as is - nothing is allocated.
+ */
+static void cf_rchash_move_bucket_f(cf_rchash *h, uint j) {
+	size_t elem_sz = sizeof(cf_rchash_elem_f) + h->key_len;
+	cf_rchash_elem_f *head = (cf_rchash_elem_f *) (((uint8_t *) h->resize->old_table) + (elem_sz * j));
+
+	if (head->object == 0)
+		return;
+
+	cf_rchash_elem_f *e = head->next;
+	cf_rchash_elem_f *to = get_bucket(h, h->h_fn(head->key, h->key_len) % h->table_len);
+	memcpy(to, head, elem_sz);
+	to->next = 0;
+
+	while (e) {
+		cf_rchash_elem_f *t = e->next;
+		to = get_bucket(h, h->h_fn(e->key, h->key_len) % h->table_len);
+		if (to->object == 0) {
+			memcpy(to, e, elem_sz);
+			to->next = 0;
+			cf_free(e);
+		}
+		else {
+			e->next = to->next;
+			to->next = e;
+		}
+		e = t;
+	}
+}
+
+/**
+ * cf_rchash_move_bucket_f() for variable size keys - the elements keep
+ * their full hash, so they're just relinked.
+ */
+static void cf_rchash_move_bucket_v(cf_rchash *h, uint j) {
+	cf_rchash_elem_v **old = ((cf_rchash_elem_v **) h->resize->old_table) + j;
+	cf_rchash_elem_v *e = *old;
+
+	while (e) {
+		cf_rchash_elem_v *t = e->next;
+		cf_rchash_elem_v **to = ((cf_rchash_elem_v **) h->table) + (e->hash % h->table_len);
+		e->next = *to;
+		*to = e;
+		e = t;
+	}
+
+	*old = 0;
+}
+
+/**
+ * Move old bucket j, unless it's been moved already. Caller holds the
+ * bucket's lock, and the table is resizing.
+ */
+static void cf_rchash_move_bucket(cf_rchash *h, uint j) {
+	struct cf_rchash_resize_s *rs = h->resize;
+
+	if (rs->moved[j])
+		return;
+
+	if (h->key_len == 0)
+		cf_rchash_move_bucket_v(h, j);
+	else
+		cf_rchash_move_bucket_f(h, j);
+
+	rs->moved[j] = 1;
+	cf_atomic32_incr(&rs->n_moved);
+}
+
+/**
+ * Map a hash to its bucket, moving the elements that belong there first if
+ * a resize hasn't yet. Caller holds the bucket's lock - the table can't
+ * change under any bucket lock.
+ */
+static inline uint cf_rchash_bucket_index(cf_rchash *h, uint hash) {
+	if (h->resize && h->resize->old_table) {
+		cf_rchash_move_bucket(h, hash % h->resize->old_len);
+	}
+	return hash % h->table_len;
+}
+
+static inline pthread_mutex_t * cf_rchash_bucket_lock(cf_rchash *h, uint hash) {
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
+		return &h->biglock;
+	if (h->flags & CF_RCHASH_CR_MT_MANYLOCK)
+		return &h->lock_table[hash % h->lock_table_len];
+	return 0;
+}
+
+static void cf_rchash_lock_all(cf_rchash *h) {
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock(&h->biglock);
+	}
+	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
+		for (int i = 0; i < h->lock_table_len; i++)
+			pthread_mutex_lock(&h->lock_table[i]);
+	}
+}
+
+static void cf_rchash_unlock_all(cf_rchash *h) {
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_unlock(&h->biglock);
+	}
+	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
+		for (int i = h->lock_table_len - 1; i >= 0; i--)
+			pthread_mutex_unlock(&h->lock_table[i]);
+	}
+}
+
+/**
+ * Lock old bucket j and move it.
+ */
+static void cf_rchash_move_bucket_locked(cf_rchash *h, uint j) {
+	pthread_mutex_t *l = cf_rchash_bucket_lock(h, j);
+	if (l)	pthread_mutex_lock(l);
+
+	if (h->resize->old_table && j < h->resize->old_len)
+		cf_rchash_move_bucket(h, j);
+
+	if (l)	pthread_mutex_unlock(l);
+}
+
+/**
+ * Double the table. The elements stay where they are, to be moved a bucket
+ * at a time, so all the locks are only held to swap in the new table.
+ */
+static void cf_rchash_resize_start(cf_rchash *h) {
+	struct cf_rchash_resize_s *rs = h->resize;
+
+	if (0 != pthread_mutex_trylock(&rs->lock))
+		return;
+
+	uint len = h->table_len;
+
+	if (rs->old_table || cf_atomic32_get(h->elements) <= len || len > UINT32_MAX / 2) {
+		pthread_mutex_unlock(&rs->lock);
+		return;
+	}
+
+	void *table = cf_calloc(len * 2, h->key_len ? sizeof(cf_rchash_elem_f) + h->key_len : sizeof(cf_rchash_elem_v *));
+	uint8_t *moved = cf_calloc(len, sizeof(uint8_t));
+
+	if (! table || ! moved) {
+		if (table)	cf_free(table);
+		if (moved)	cf_free(moved);
+		pthread_mutex_unlock(&rs->lock);
+		return;
+	}
+
+	cf_rchash_lock_all(h);
+
+	rs->old_table = h->table;
+	rs->old_len = len;
+	rs->moved = moved;
+	rs->next = 0;
+	rs->n_moved = 0;
+
+	h->table = table;
+	h->table_len = len * 2;
+	if (h->lock_table_len)
+		h->buckets_per_lock = h->table_len / h->lock_table_len;
+
+	cf_rchash_unlock_all(h);
+
+	if (h->flags & CF_RCHASH_CR_STATS)
+		cf_atomic64_incr(&h->stats->resizes);
+
+	pthread_mutex_unlock(&rs->lock);
+}
+
+/**
+ * Free the old table once every bucket has been moved. Caller holds the
+ * resize lock. Operations only look at the old table under a bucket lock,
+ * so taking them all makes sure nobody still is.
+ */
+static void cf_rchash_resize_end(cf_rchash *h) {
+	struct cf_rchash_resize_s *rs = h->resize;
+
+	if (! rs->old_table || cf_atomic32_get(rs->n_moved) != rs->old_len)
+		return;
+
+	cf_rchash_lock_all(h);
+
+	void *old_table = rs->old_table;
+	uint8_t *moved = rs->moved;
+	rs->old_table = 0;
+	rs->moved = 0;
+	rs->old_len = 0;
+
+	cf_rchash_unlock_all(h);
+
+	cf_free(old_table);
+	cf_free(moved);
+}
+
+/**
+ * A writer's share of the resizing, done before it takes its own lock -
+ * start a resize if the table has more elements than buckets, or move a
+ * few old buckets (and end the resize when they're all moved).
+ */
+static void cf_rchash_resize_step(cf_rchash *h) {
+	struct cf_rchash_resize_s *rs = h->resize;
+
+	if (! rs->old_table) {
+		if (cf_atomic32_get(h->elements) > h->table_len)
+			cf_rchash_resize_start(h);
+		return;
+	}
+
+	for (uint n = 0; n < CF_RCHASH_RESIZE_STEP; n++) {
+		if (cf_atomic32_get(rs->next) >= rs->old_len)
+			break;
+
+		uint j = cf_atomic32_incr(&rs->next) - 1;
+		if (j >= rs->old_len)
+			break;
+
+		cf_rchash_move_bucket_locked(h, j);
+	}
+
+	if (rs->old_table && cf_atomic32_get(rs->n_moved) == rs->old_len) {
+		if (0 == pthread_mutex_trylock(&rs->lock)) {
+			cf_rchash_resize_end(h);
+			pthread_mutex_unlock(&rs->lock);
+		}
+	}
+}
+
+/**
+ * Hold off resizes while traversing the table, finishing any in progress,
+ * so the traversal sees a table that stays put.
+ */
+static void cf_rchash_resize_pause(cf_rchash *h) {
+	struct cf_rchash_resize_s *rs = h->resize;
+
+	if (! rs)
+		return;
+
+	pthread_mutex_lock(&rs->lock);
+
+	if (rs->old_table) {
+		for (uint j = 0; j < rs->old_len; j++)
+			cf_rchash_move_bucket_locked(h, j);
+
+		cf_rchash_resize_end(h);
+	}
+}
+
+static void cf_rchash_resize_resume(cf_rchash *h) {
+	if (h->resize)
+		pthread_mutex_unlock(&h->resize->lock);
+}
+
 uint32_t cf_rchash_get_size(cf_rchash *h) {
     if (h->key_len == 0)    return(cf_rchash_get_size_v(h));
     
@@ -180,22 +670,24 @@ uint32_t cf_rchash_get_size(cf_rchash *h) {
 }
 
 int cf_rchash_put(cf_rchash *h, void *key, uint32_t key_len, void *object) {
+    if (h->flags & CF_RCHASH_CR_EPOCH)    return(cf_rchash_put_e(h, key, key_len, object, false));
     if (h->key_len == 0)    return(cf_rchash_put_v(h, key, key_len, object));
+    if (h->resize)    cf_rchash_resize_step(h);
 
 	if (h->key_len != key_len) return(CF_RCHASH_ERR);
 
 	// Calculate hash
 	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
 
 	pthread_mutex_t		*l = 0;
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		l = &h->biglock;
 	}
 	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+		l = & (h->lock_table[hash % h->lock_table_len]);
 	}
-	if (l)     pthread_mutex_lock( l );
+	if (l)     cf_rchash_lock(h, l);
+	hash = cf_rchash_bucket_index(h, hash);
 		
 	cf_rchash_elem_f *e = get_bucket(h, hash);
 
@@ -229,6 +721,7 @@ int cf_rchash_put(cf_rchash *h, void *key, uint32_t key_len, void *object) {
 
 	e = (cf_rchash_elem_f *) cf_malloc(sizeof(cf_rchash_elem_f) + key_len);
 	if (!e) return (CF_RCHASH_ERR);
+	cf_rchash_stats_collision(h);
 	e->next = e_head->next;
 	e_head->next = e;
 	
@@ -252,7 +745,9 @@ Copy:
 //
 
 int cf_rchash_put_unique(cf_rchash *h, void *key, uint32_t key_len, void *object) {
+    if (h->flags & CF_RCHASH_CR_EPOCH)    return(cf_rchash_put_e(h, key, key_len, object, true));
     if (h->key_len == 0)    return(cf_rchash_put_unique_v(h,key,key_len,object));
+    if (h->resize)    cf_rchash_resize_step(h);
 
 	if (h->key_len != key_len) return(CF_RCHASH_ERR);
 
@@ -266,16 +761,16 @@ int cf_rchash_put_unique(cf_rchash *h, void *key, uint32_t key_len, void *object
 	
 	// Calculate hash
 	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
 
 	pthread_mutex_t		*l = 0;
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		l = &h->biglock;
 	}
 	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+		l = & (h->lock_table[hash % h->lock_table_len]);
 	}
-	if (l)     pthread_mutex_lock( l );
+	if (l)     cf_rchash_lock(h, l);
+	hash = cf_rchash_bucket_index(h, hash);
 		
 	cf_rchash_elem_f *e = get_bucket(h, hash);
 
@@ -303,6 +798,7 @@ int cf_rchash_put_unique(cf_rchash *h, void *key, uint32_t key_len, void *object
 
 	e = (cf_rchash_elem_f *) cf_malloc(sizeof(cf_rchash_elem_f) + key_len);
 	if (!e) return (CF_RCHASH_ERR);
+	cf_rchash_stats_collision(h);
 	e->next = e_head->next;
 	e_head->next = e;
 	
@@ -322,22 +818,23 @@ Copy:
 
 int cf_rchash_get(cf_rchash *h, void *key, uint32_t key_len, void **object) {
 	if (!h || !key || !object) return(CF_RCHASH_ERR);
+    if (h->flags & CF_RCHASH_CR_EPOCH)    return(cf_rchash_get_e(h, key, key_len, object));
     if (h->key_len == 0)    return(cf_rchash_get_v(h,key,key_len,object));
 	if (h->key_len != key_len) return(CF_RCHASH_ERR);
 
 	int rv = CF_RCHASH_ERR;
 	
 	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
 
 	pthread_mutex_t		*l = 0;
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		l = &h->biglock;
 	}
 	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+		l = & (h->lock_table[hash % h->lock_table_len]);
 	}
-	if (l)     pthread_mutex_lock( l );
+	if (l)     cf_rchash_lock(h, l);
+	hash = cf_rchash_bucket_index(h, hash);
 	
 	cf_rchash_elem_f *e = get_bucket(h, hash);
 
@@ -376,12 +873,13 @@ Out:
 }
 
 int cf_rchash_delete(cf_rchash *h, void *key, uint32_t key_len) {
+    if (h->flags & CF_RCHASH_CR_EPOCH)    return(cf_rchash_delete_e(h, key, key_len));
     if (h->key_len == 0)    return(cf_rchash_delete_v(h,key,key_len));
+    if (h->resize)    cf_rchash_resize_step(h);
 	if (h->key_len != key_len) return(CF_RCHASH_ERR);
 
 	// Calculate hash
 	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
 	int rv = CF_RCHASH_ERR;
 
     // take lock
@@ -390,9 +888,10 @@ int cf_rchash_delete(cf_rchash *h, void *key, uint32_t key_len) {
 		l = &h->biglock;
 	}
 	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+		l = & (h->lock_table[hash % h->lock_table_len]);
 	}
-	if (l)     pthread_mutex_lock( l );
+	if (l)     cf_rchash_lock(h, l);
+	hash = cf_rchash_bucket_index(h, hash);
 		
 	cf_rchash_elem_f *e = get_bucket(h, hash);
 
@@ -457,153 +956,261 @@ Out:
 	return(rv);
 }
 
-// Call the function over every node in the tree
-// Can be lock-expensive at the moment, until we improve the lockfree code
+/**
+ * Call the function over every element of bucket i, deleting the elements
+ * for which it returns CF_RCHASH_REDUCE_DELETE if del is set, and adding the
+ * number deleted to *deleted - the caller fixes up the element count.
+ * Without del, returns non-zero if the function asked to stop the reduce.
+ * Caller holds the bucket's lock.
+ */
+static int cf_rchash_reduce_bucket(cf_rchash *h, uint i, cf_rchash_reduce_fn reduce_fn, void *udata, bool del, uint32_t *deleted) {
+	if (h->flags & CF_RCHASH_CR_EPOCH) {
+		return cf_rchash_reduce_bucket_e(h, i, reduce_fn, udata, del, deleted);
+	}
+	if (h->key_len == 0) {
+		return cf_rchash_reduce_bucket_v(h, i, reduce_fn, udata, del, deleted);
+	}
 
-void cf_rchash_reduce(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
-    if (h->key_len == 0)    {
-        cf_rchash_reduce_v(h,reduce_fn, udata);
-        return;
-    }
-	
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
-		pthread_mutex_lock(&h->biglock);
-	
-	for (uint i=0; i<h->table_len ; i++) {
-		pthread_mutex_t *l = 0;
-		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock( l );
-		}
+	cf_rchash_elem_f *list_he = get_bucket(h, i);
+	cf_rchash_elem_f *prev_he = 0;
+	int rv;
 
-		cf_rchash_elem_f *list_he = get_bucket(h, i);
+	while (list_he) {
+		// This kind of structure might have the head as an empty element,
+		// that's a signal to move along
+		if (list_he->object == 0)
+			break;
 
-		while (list_he) {
-			
-			// 0 length means an unused head pointer - break
-			if (list_he->object == 0)
-				break;
-			
 #ifdef VALIDATE
-			cf_atomic_int_t rc;
-			if ((rc = cf_rc_count(list_he->object)) < 1) {
-				cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, list_he->object);
-			}
-#endif		
-
-			if (0 != reduce_fn(list_he->key, h->key_len, list_he->object, udata)) {
-				if (l)		pthread_mutex_unlock(l);
-				goto Out;
-			}
-			
-			list_he = list_he->next;
+		cf_atomic_int_t rc;
+		if ((rc = cf_rc_count(list_he->object)) < 1) {
+			cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, list_he->object);
+			if (del)	return(CF_RCHASH_ERR);
 		}
-		
-		if (l)	pthread_mutex_unlock(l);
-		
-	}
+#endif
 
-Out:	
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
-		pthread_mutex_unlock(&h->biglock);
+		rv = reduce_fn(list_he->key, h->key_len, list_he->object, udata);
 
-	return;
-}
+		// Delete is requested
+		// Leave the pointers in a "next" state
+		if (del && rv == CF_RCHASH_REDUCE_DELETE) {
+
+			cf_rchash_free(h, list_he->object);
+			(*deleted)++;
+
+			// patchup pointers & free element if not head
+			if (prev_he) {
+				prev_he->next = list_he->next;
+				cf_free(list_he);
+				list_he = prev_he->next;
+			}
+			// am at head - more complicated
+			else {
+				// at head with no next - easy peasy!
+				if (0 == list_he->next) {
+					memset(list_he, 0, sizeof(cf_rchash_elem_f));
+					list_he = 0;
+				}
+				// at head with a next - more complicated -
+				// copy next into current and free next
+				// (the old trick of how to delete from a singly
+				// linked list without a prev pointer)
+				// Somewhat confusingly, prev_he stays 0
+				// and list_he stays where it is
+				else {
+					cf_rchash_elem_f *_t = list_he->next;
+					memcpy(list_he, list_he->next, sizeof(cf_rchash_elem_f)+h->key_len);
+					cf_free(_t);
+				}
+			}
+
+		}
+		else if (! del && rv != 0) {
+			return(rv);
+		}
+		else { // don't delete, just forward everything
+			prev_he = list_he;
+			list_he = list_he->next;
+		}
+	}
+
+	return(0);
+}
+
+static inline void cf_rchash_elements_incr(cf_rchash *h) {
+	if (h->flags & CF_RCHASH_CR_MT_MANYLOCK)
+		cf_atomic32_incr(&h->elements);
+	else
+		h->elements++;
+}
+
+static inline void cf_rchash_elements_sub(cf_rchash *h, uint32_t n) {
+	if (n == 0)
+		return;
+	if (h->flags & CF_RCHASH_CR_MT_MANYLOCK)
+		cf_atomic32_sub(&h->elements, n);
+	else
+		h->elements -= n;
+}
+
+static void cf_rchash_reduce_internal(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, bool del) {
+	uint32_t deleted = 0;
+
+	cf_rchash_resize_pause(h);
 
-// A special version of 'reduce' that supports deletion
-// In this case, if you return '-1' from the reduce fn, that node will be
-// deleted
-void cf_rchash_reduce_delete(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
-	if (h->key_len == 0) {
-        cf_rchash_reduce_delete_v(h,reduce_fn, udata);
-        return;
-    }
-    
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
 		pthread_mutex_lock(&h->biglock);
 
 	for (uint i=0; i<h->table_len ; i++) {
-
 		pthread_mutex_t *l = 0;
 		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
+			l = &(h->lock_table[i % h->lock_table_len]);
 			pthread_mutex_lock( l );
 		}
-		
-		cf_rchash_elem_f *list_he = get_bucket(h, i);
-		cf_rchash_elem_f *prev_he = 0;
-		int rv;
 
-		while (list_he) {
-			// This kind of structure might have the head as an empty element,
-			// that's a signal to move along
-			if (list_he->object == 0)
-				break;
-			
-#ifdef VALIDATE
-			cf_atomic_int_t rc;
-			if ((rc = cf_rc_count(list_he->object)) < 1) {
-				cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, list_he->object);
-				if (l)	pthread_mutex_unlock(l);
-				return;
+		int rv = cf_rchash_reduce_bucket(h, i, reduce_fn, udata, del, &deleted);
+
+		if (l)	pthread_mutex_unlock(l);
+
+		if (rv != 0)
+			break;
+	}
+
+	cf_rchash_elements_sub(h, deleted);
+
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
+		pthread_mutex_unlock(&h->biglock);
+
+	cf_rchash_resize_resume(h);
+}
+
+// Call the function over every node in the tree
+// Can be lock-expensive at the moment, until we improve the lockfree code
+
+void cf_rchash_reduce(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
+	cf_rchash_reduce_internal(h, reduce_fn, udata, false);
+}
+
+// A special version of 'reduce' that supports deletion
+// In this case, if you return '1' (CF_RCHASH_REDUCE_DELETE) from the reduce
+// fn, that node will be deleted
+void cf_rchash_reduce_delete(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
+	cf_rchash_reduce_internal(h, reduce_fn, udata, true);
+}
+
+static void * cf_rchash_reduce_worker_fn(void *arg) {
+	cf_rchash_reduce_worker *w = (cf_rchash_reduce_worker *) arg;
+	cf_rchash_reduce_job *job = w->job;
+	cf_rchash *h = job->h;
+
+	while (0 == cf_atomic32_get(job->stop)) {
+		uint start = (uint) cf_atomic32_add(&job->next_bucket, CF_RCHASH_REDUCE_CHUNK) - CF_RCHASH_REDUCE_CHUNK;
+		if (start >= h->table_len)
+			break;
+		uint end = start + CF_RCHASH_REDUCE_CHUNK < h->table_len ? start + CF_RCHASH_REDUCE_CHUNK : h->table_len;
+
+		for (uint i=start; i<end; i++) {
+			pthread_mutex_t *l = 0;
+			if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
+				l = &(h->lock_table[i % h->lock_table_len]);
+				pthread_mutex_lock( l );
 			}
-#endif		
-			
-			rv = reduce_fn(list_he->key, h->key_len, list_he->object, udata);
-			
-			// Delete is requested
-			// Leave the pointers in a "next" state
-			if (rv == CF_RCHASH_REDUCE_DELETE) {
-                
-				cf_rchash_free(h, list_he->object);
-				
-				if (h->flags & CF_RCHASH_CR_MT_MANYLOCK)
-					cf_atomic32_decr(&h->elements);
-				else
-					h->elements--;
-                
-				// patchup pointers & free element if not head
-				if (prev_he) {
-					prev_he->next = list_he->next;
-					cf_free(list_he);
-					list_he = prev_he->next;
-				}
-				// am at head - more complicated
-				else {
-					// at head with no next - easy peasy!
-					if (0 == list_he->next) {
-						memset(list_he, 0, sizeof(cf_rchash_elem_f));
-						list_he = 0;
-					}
-					// at head with a next - more complicated -
-					// copy next into current and free next
-					// (the old trick of how to delete from a singly
-					// linked list without a prev pointer)
-					// Somewhat confusingly, prev_he stays 0
-					// and list_he stays where it is
-					else {
-						cf_rchash_elem_f *_t = list_he->next;
-						memcpy(list_he, list_he->next, sizeof(cf_rchash_elem_f)+h->key_len);
-						cf_free(_t);
-					}
-				}
 
+			int rv = cf_rchash_reduce_bucket(h, i, job->reduce_fn, w->udata, job->del, &w->deleted);
+
+			if (l)	pthread_mutex_unlock(l);
+
+			if (rv != 0) {
+				cf_atomic32_cas(&job->stop, 0, 1);
+				break;
 			}
-			else { // don't delete, just forward everything
-				prev_he = list_he;
-				list_he = list_he->next;
-			}	
-				
 		}
-		
-		if (l) pthread_mutex_unlock(l);
-		
 	}
 
+	return 0;
+}
+
+static int cf_rchash_reduce_parallel_internal(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, size_t udata_sz, cf_rchash_combine_fn combine_fn, uint n_threads, bool del) {
+	if (n_threads == 0 || (udata_sz && ! combine_fn))
+		return(CF_RCHASH_ERR);
+
+	cf_rchash_resize_pause(h);
+
+	uint n_chunks = (h->table_len + CF_RCHASH_REDUCE_CHUNK - 1) / CF_RCHASH_REDUCE_CHUNK;
+	if (n_threads > n_chunks)
+		n_threads = n_chunks ? n_chunks : 1;
+
+	cf_rchash_reduce_worker *workers = (cf_rchash_reduce_worker *) malloc(n_threads * (sizeof(cf_rchash_reduce_worker) + udata_sz));
+	if (! workers) {
+		cf_rchash_resize_resume(h);
+		return(CF_RCHASH_ERR);
+	}
+
+	uint8_t *udatas = (uint8_t *) (workers + n_threads);
+
+	cf_rchash_reduce_job job;
+	job.h = h;
+	job.reduce_fn = reduce_fn;
+	job.del = del;
+	job.next_bucket = 0;
+	job.stop = 0;
+
+	for (uint i=0; i<n_threads; i++) {
+		cf_rchash_reduce_worker *w = &workers[i];
+		w->job = &job;
+		w->deleted = 0;
+		w->started = false;
+		if (udata_sz) {
+			w->udata = udatas + (i * udata_sz);
+			memcpy(w->udata, udata, udata_sz);
+		}
+		else {
+			w->udata = udata;
+		}
+	}
+
+	// as in cf_rchash_reduce(), the big lock is held for the whole traversal
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
+		pthread_mutex_lock(&h->biglock);
+
+	// the calling thread is worker 0 - if a thread can't be started, the
+	// others just end up with more of the work
+	for (uint i=1; i<n_threads; i++) {
+		workers[i].started = 0 == pthread_create(&workers[i].thread, 0, cf_rchash_reduce_worker_fn, &workers[i]);
+	}
+	cf_rchash_reduce_worker_fn(&workers[0]);
+
+	uint32_t deleted = 0;
+	for (uint i=0; i<n_threads; i++) {
+		if (workers[i].started) {
+			pthread_join(workers[i].thread, 0);
+		}
+		deleted += workers[i].deleted;
+	}
+
+	cf_rchash_elements_sub(h, deleted);
+
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
 		pthread_mutex_unlock(&h->biglock);
 
-	return;
+	cf_rchash_resize_resume(h);
+
+	if (udata_sz) {
+		for (uint i=0; i<n_threads; i++) {
+			combine_fn(udata, workers[i].udata);
+		}
+	}
+
+	free(workers);
+	return(CF_RCHASH_OK);
+}
+
+int cf_rchash_reduce_parallel(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, size_t udata_sz, cf_rchash_combine_fn combine_fn, uint n_threads) {
+	return cf_rchash_reduce_parallel_internal(h, reduce_fn, udata, udata_sz, combine_fn, n_threads, false);
+}
+
+int cf_rchash_reduce_delete_parallel(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, size_t udata_sz, cf_rchash_combine_fn combine_fn, uint n_threads) {
+	return cf_rchash_reduce_parallel_internal(h, reduce_fn, udata, udata_sz, combine_fn, n_threads, true);
 }
 
 void cf_rchash_destroy_elements(cf_rchash *h) {
@@ -624,29 +1231,48 @@ void cf_rchash_destroy_elements(cf_rchash *h) {
 }
 
 void cf_rchash_destroy(cf_rchash *h) {
-    if (h->key_len == 0) cf_rchash_destroy_elements_v(h);
-    else                 cf_rchash_destroy_elements(h);
+    // put everything back in the one table
+    cf_rchash_resize_pause(h);
+    cf_rchash_resize_resume(h);
+
+    if (h->epoch)             cf_rchash_destroy_elements_e(h);
+    else if (h->key_len == 0) cf_rchash_destroy_elements_v(h);
+    else                      cf_rchash_destroy_elements(h);
 
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_destroy(&h->biglock);
 	}
 	if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		for (uint i=0;i<h->table_len;i++) {
+		for (int i=0;i<h->lock_table_len;i++) {
 			pthread_mutex_destroy(&(h->lock_table[i]));
 		}
 		cf_free(h->lock_table);
 	}
 
+	if (h->stats) {
+		cf_free(h->stats);
+	}
+
+	if (h->epoch) {
+		pthread_mutex_destroy(&h->epoch->reclaim_lock);
+		cf_free(h->epoch);
+	}
+
+	if (h->resize) {
+		pthread_mutex_destroy(&h->resize->lock);
+		cf_free(h->resize);
+	}
+
 	cf_free(h->table);
 	cf_free(h);
 }
 
-inline static cf_rchash_elem_v * get_bucket_v(cf_rchash *h, uint i) {
-    return ( (cf_rchash_elem_v *) 
-               ( 
-                 ((uint8_t *)h->table) + (sizeof(cf_rchash_elem_v) * i)
-               ) 
-           );
+inline static cf_rchash_elem_v ** get_bucket_v(cf_rchash *h, uint i) {
+    return ( ((cf_rchash_elem_v **) h->table) + i );
+}
+
+static inline bool cf_rchash_elem_v_match(cf_rchash_elem_v *e, uint32_t hash, void *key, uint32_t key_len) {
+	return e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0;
 }
 
 
@@ -667,30 +1293,29 @@ uint32_t cf_rchash_get_size_v(cf_rchash *h) {
     return(sz);
 }
 
-
-int cf_rchash_put_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
+/**
+ * Common part of cf_rchash_put_v() and cf_rchash_put_unique_v(). The key is
+ * copied in after the element, so an element is a single allocation, and
+ * new elements go at the head of the chain.
+ */
+static int cf_rchash_put_v_internal(cf_rchash *h, void *key, uint32_t key_len, void *object, bool unique) {
 	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
+	if (h->resize)	cf_rchash_resize_step(h);
 
 	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
+	uint32_t hash = h->h_fn(key, key_len);
 
 	pthread_mutex_t		*l = 0;
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		l = &h->biglock;
 	}
 	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+		l = & (h->lock_table[hash % h->lock_table_len]);
 	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
+	if (l)     cf_rchash_lock(h, l);
 
-	// most common case should be insert into empty bucket, special case
-	if ( e->object == 0 )
-		goto Copy;
-
-	cf_rchash_elem_v *e_head = e;
+	cf_rchash_elem_v **bucket = get_bucket_v(h, cf_rchash_bucket_index(h, hash));
+	cf_rchash_elem_v *e = *bucket;
 
 	// This loop might be skippable if you know the key is not already in the hash
 	// (like, you just searched and it's single-threaded)
@@ -698,14 +1323,17 @@ int cf_rchash_put_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
 #ifdef VALIDATE
 		cf_atomic_int_t rc;
 		if ((rc = cf_rc_count(e->object)) < 1) {
-			cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count on %p", h, rc, e->object);
+			cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
 			if (l)		pthread_mutex_unlock(l);
 			return(CF_RCHASH_ERR);
 		}
 #endif		
-        // in this case we're replacing the previous object with the new object
-		if ( ( key_len == e->key_len ) &&
-			 ( memcmp(e->key, key, key_len) == 0) ) {
+		if (cf_rchash_elem_v_match(e, hash, key, key_len)) {
+			if (unique) {
+				if (l)	pthread_mutex_unlock(l);
+				return(CF_RCHASH_ERR_FOUND);
+			}
+			// in this case we're replacing the previous object with the new object
 			cf_rchash_free(h,e->object);
 			e->object = object;
 			if (l)	pthread_mutex_unlock(l);
@@ -714,32 +1342,38 @@ int cf_rchash_put_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
 		e = e->next;
 	}
 
-	e = (cf_rchash_elem_v *) cf_malloc(sizeof(cf_rchash_elem_v));
-	if (!e)	return (CF_RCHASH_ERR);
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	e->key = cf_malloc(key_len);
-	if (!e->key) return (CF_RCHASH_ERR);
-	memcpy(e->key, key, key_len);
-	e->key_len = key_len;
+	e = (cf_rchash_elem_v *) cf_malloc(sizeof(cf_rchash_elem_v) + key_len);
+	if (!e) {
+		if (l)	pthread_mutex_unlock(l);
+		return (CF_RCHASH_ERR);
+	}
+
+	if (*bucket)
+		cf_rchash_stats_collision(h);
 
 	e->object = object;
+	e->hash = hash;
+	e->key_len = key_len;
+	memcpy(e->key, key, key_len);
+	e->next = *bucket;
+	*bucket = e;
+
+	cf_rchash_elements_incr(h);
 
-	h->elements++;
 	if (l)		pthread_mutex_unlock(l);
 	return(CF_RCHASH_OK);
 }
 
+int cf_rchash_put_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
+	return cf_rchash_put_v_internal(h, key, key_len, object, false);
+}
+
 //
 // Put of any sort gobbles the reference count.
 // make sure the incoming reference count is > 0
 //
 
 int cf_rchash_put_unique_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
-	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
-
 #ifdef VALIDATE
 	cf_atomic_int_t rc;
 	if ((rc = cf_rc_count(object)) < 1) {
@@ -747,87 +1381,26 @@ int cf_rchash_put_unique_v(cf_rchash *h, void *key, uint32_t key_len, void *obje
 		return(CF_RCHASH_ERR);
 	}
 #endif    
-	
-	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
-
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
-
-	// most common case should be insert into empty bucket, special case
-	if ( e->object == 0 )
-		goto Copy;
 
-	cf_rchash_elem_v *e_head = e;
-
-	// check for uniqueness of key - if not unique, fail!
-	while (e) {
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-		if ( ( key_len == e->key_len ) &&
-			 ( memcmp(e->key, key, key_len) == 0) ) {
-			if (l) pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR_FOUND);
-		}
-		e = e->next;
-	}
-
-	e = (cf_rchash_elem_v *) cf_malloc(sizeof(cf_rchash_elem_v));
-	if (!e)	return (CF_RCHASH_ERR);
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	e->key = cf_malloc(key_len);
-	if (!e->key) return (CF_RCHASH_ERR);
-	memcpy(e->key, key, key_len);
-	e->key_len = key_len;
-
-	e->object = object;
-
-	h->elements++;
-	if (l)		pthread_mutex_unlock(l);
-	return(CF_RCHASH_OK);
+	return cf_rchash_put_v_internal(h, key, key_len, object, true);
 }
 
 int cf_rchash_get_v(cf_rchash *h, void *key, uint32_t key_len, void **object) {
-	int rv = CF_RCHASH_ERR;
+	int rv = CF_RCHASH_ERR_NOTFOUND;
 	
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
+	uint32_t hash = h->h_fn(key, key_len);
 
 	pthread_mutex_t		*l = 0;
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		l = &h->biglock;
 	}
 	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+		l = & (h->lock_table[hash % h->lock_table_len]);
 	}
-	if (l)     pthread_mutex_lock( l );
-	
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
+	if (l)     cf_rchash_lock(h, l);
+
+	cf_rchash_elem_v *e = *get_bucket_v(h, cf_rchash_bucket_index(h, hash));
 
-  	// finding an empty bucket means key is not here
-	if ( e->object == 0 ) {
-        rv = CF_RCHASH_ERR_NOTFOUND;
-        goto Out;
-	}
-    
 	while (e) {
 #ifdef VALIDATE
 		cf_atomic_int_t rc;
@@ -838,19 +1411,15 @@ int cf_rchash_get_v(cf_rchash *h, void *key, uint32_t key_len, void **object) {
 		}
 #endif		
 
-		if ( ( key_len == e->key_len ) &&
-			 ( memcmp(key, e->key, key_len) == 0) ) {
+		if (cf_rchash_elem_v_match(e, hash, key, key_len)) {
 			cf_rc_reserve( e->object );
 			*object = e->object;
 			rv = CF_RCHASH_OK; 
-			goto Out;
+			break;
 		}
 		e = e->next;
 	}
-    
-	rv = CF_RCHASH_ERR_NOTFOUND;
-	
-Out:
+
 	if (l)
 		pthread_mutex_unlock(l);
 
@@ -859,34 +1428,27 @@ Out:
 
 int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len) {
 	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
+	if (h->resize)	cf_rchash_resize_step(h);
 
 	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
-	int rv = CF_RCHASH_ERR;
+	uint32_t hash = h->h_fn(key, key_len);
+	int rv = CF_RCHASH_ERR_NOTFOUND;
 
 	pthread_mutex_t		*l = 0;
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		l = &h->biglock;
 	}
 	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+		l = & (h->lock_table[hash % h->lock_table_len]);
 	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
+	if (l)     cf_rchash_lock(h, l);
 
-	// If bucket empty, def can't delete
-	if ( ( e->next == 0 ) && (e->key_len == 0) ) {
-		rv = CF_RCHASH_ERR_NOTFOUND;
-		goto Out;
-	}
-
-	cf_rchash_elem_v *e_prev = 0;
+	cf_rchash_elem_v **pe = get_bucket_v(h, cf_rchash_bucket_index(h, hash));
 
 	// Look for the element and destroy if found
-	while (e) {
-		
+	while (*pe) {
+		cf_rchash_elem_v *e = *pe;
+
 #ifdef VALIDATE
 		cf_atomic_int_t rc;
 		if ((rc = cf_rc_count(e->object)) < 1) {
@@ -896,204 +1458,450 @@ int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len) {
 		}
 #endif		
 
-		if ( ( key_len == e->key_len ) &&
-			 ( memcmp(e->key, key, key_len) == 0) ) {
+		if (cf_rchash_elem_v_match(e, hash, key, key_len)) {
 			// Found it, kill it
-			cf_free(e->key);
+			*pe = e->next;
 			cf_rchash_free(h, e->object);
-			// patchup pointers & free element if not head
-			if (e_prev) {
-				e_prev->next = e->next;
-				cf_free(e);
-			}
-			// am at head - more complicated
-			else {
-				// at head with no next - easy peasy!
-				if (0 == e->next) {
-					memset(e, 0, sizeof(cf_rchash_elem_v));
-				}
-				// at head with a next - more complicated
-				else {
-					cf_rchash_elem_v *_t = e->next;
-					memcpy(e, e->next, sizeof(cf_rchash_elem_v));
-					cf_free(_t);
-				}
-			}
-			h->elements--;
+			cf_free(e);
+			cf_rchash_elements_sub(h, 1);
 			rv = CF_RCHASH_OK;
-			goto Out;
-
+			break;
 		}
-		e_prev = e;
-		e = e->next;
+		pe = &e->next;
 	}
-	rv = CF_RCHASH_ERR_NOTFOUND;
 
-Out:
 	if (l)	pthread_mutex_unlock(l);
 	return(rv);
 }
 
 /**
- * Call the function over every node in the tree
- * Can be lock-expensive at the moment, until we improve the lockfree code
+ * Variable key version of cf_rchash_reduce_bucket()
  */
-void cf_rchash_reduce_v(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
-	
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
-		pthread_mutex_lock(&h->biglock);
-	
-	for (uint i=0; i<h->table_len ; i++) {
+static int cf_rchash_reduce_bucket_v(cf_rchash *h, uint i, cf_rchash_reduce_fn reduce_fn, void *udata, bool del, uint32_t *deleted) {
+	cf_rchash_elem_v **pe = get_bucket_v(h, i);
+	int rv;
 
-		pthread_mutex_t *l = 0;
-		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock( l );
+	while (*pe) {
+		cf_rchash_elem_v *e = *pe;
+
+#ifdef VALIDATE
+		cf_atomic_int_t rc;
+		if ((rc = cf_rc_count(e->object)) < 1) {
+			cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
+			if (del)	return(CF_RCHASH_ERR);
 		}
+#endif
 
-		cf_rchash_elem_v *list_he = get_bucket_v(h, i);
+		rv = reduce_fn(e->key, e->key_len, e->object, udata);
 
-		while (list_he) {
-			
-			// 0 length means an unused head pointer - break
-			if (list_he->object == 0)
-				break;
-			
-#ifdef VALIDATE
-			cf_atomic_int_t rc;
-			if ((rc = cf_rc_count(list_he->object)) < 1) {
-				cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, list_he->object);
-			}
-#endif		
+		// Delete is requested
+		// Leave the pointers in a "next" state
+		if (del && rv == CF_RCHASH_REDUCE_DELETE) {
+			*pe = e->next;
+			cf_rchash_free(h, e->object);
+			cf_free(e);
+			(*deleted)++;
+		}
+		else if (! del && rv != 0) {
+			return(rv);
+		}
+		else { // don't delete, just forward everything
+			pe = &e->next;
+		}
+	}
 
-			if (0 != reduce_fn(list_he->key, list_he->key_len, list_he->object, udata)) {
-				if (l)		pthread_mutex_unlock(l);
-				goto Out;
-			}
-			
-			list_he = list_he->next;
+	return(0);
+}
+
+void cf_rchash_destroy_elements_v(cf_rchash *h) {
+	for (uint i=0;i<h->table_len;i++) {
+        cf_rchash_elem_v **bucket = get_bucket_v(h, i);
+        cf_rchash_elem_v *e = *bucket;
+
+        while (e) {
+            cf_rchash_elem_v *t = e->next;
+            cf_rchash_free(h, e->object);
+            cf_free(e);
+            e = t;
 		}
-		
+		*bucket = 0;
+	}
+	h->elements = 0;
+}
+
+/******************************************************************************
+ * EPOCH (LOCK-FREE GET) FUNCTIONS
+ ******************************************************************************/
+
+#define CF_RCHASH_READ_ONCE(_x) ( *(volatile __typeof__(_x) *) &(_x) )
+
+static inline cf_rchash_reader_slot * cf_rchash_reader_slot_get(cf_rchash *h) {
+	if (cf_rchash_reader_id == 0) {
+		cf_rchash_reader_id = cf_atomic32_incr(&cf_rchash_n_reader_ids);
+	}
+	return &h->epoch->slots[cf_rchash_reader_id % CF_RCHASH_EPOCH_SLOTS];
+}
+
+/**
+ * Register as a reader in the current epoch, returns the epoch registered
+ * in. The count is taken before the epoch is checked again, so a reclaim
+ * that has moved the epoch on either sees us, or we see its new epoch.
+ */
+static inline uint32_t cf_rchash_read_begin(cf_rchash *h, cf_rchash_reader_slot *slot) {
+	struct cf_rchash_epoch_s *ep = h->epoch;
+
+	while (true) {
+		uint32_t e = cf_atomic32_get(ep->epoch);
+		cf_atomic32_incr(&slot->count[e & 1]);
+		if (cf_atomic32_get(ep->epoch) == e)
+			return e;
+		cf_atomic32_decr(&slot->count[e & 1]);
+	}
+}
+
+static inline void cf_rchash_read_end(cf_rchash_reader_slot *slot, uint32_t e) {
+	cf_atomic32_decr(&slot->count[e & 1]);
+}
+
+/**
+ * Free the retired elements no reader can still see, and release the
+ * table's references to their objects. Elements retired in the current
+ * epoch c may still be seen by readers of c - but once there are no readers
+ * of c - 1 left, every reader started after the epoch became c, so nothing
+ * retired before that can be reached. Whoever holds reclaim_lock is the only
+ * one to move the epoch, so no reader ever registers in an older epoch than
+ * c - 1. A writer that finds the lock taken, or readers of c - 1, leaves the
+ * work for a later one.
+ */
+static void cf_rchash_reclaim(cf_rchash *h) {
+	struct cf_rchash_epoch_s *ep = h->epoch;
+
+	if (0 != pthread_mutex_trylock(&ep->reclaim_lock))
+		return;
+
+	uint32_t c = cf_atomic32_get(ep->epoch);
+
+	for (uint i = 0; i < CF_RCHASH_EPOCH_SLOTS; i++) {
+		if (cf_atomic32_get(ep->slots[i].count[(c - 1) & 1]) != 0) {
+			pthread_mutex_unlock(&ep->reclaim_lock);
+			return;
+		}
+	}
+
+	cf_rchash_elem_e *e;
+	do {
+		e = (cf_rchash_elem_e *) cf_atomic_p_get(ep->retired);
+	} while (e && cf_atomic_p_cas(&ep->retired, (cf_atomic_p) e, 0) != (cf_atomic_p) e);
+
+	uint32_t freed = 0;
+	bool keep = false;
+
+	while (e) {
+		cf_rchash_elem_e *t = e->retired_next;
+
+		if (e->retired_epoch != c) {
+			cf_rchash_free(h, e->object);
+			cf_free(e);
+			freed++;
+		}
+		else {
+			cf_rchash_elem_e *head;
+			do {
+				head = (cf_rchash_elem_e *) cf_atomic_p_get(ep->retired);
+				e->retired_next = head;
+			} while (cf_atomic_p_cas(&ep->retired, (cf_atomic_p) head, (cf_atomic_p) e) != (cf_atomic_p) head);
+			keep = true;
+		}
+
+		e = t;
+	}
+
+	// what's left can go once the readers of this epoch are done
+	if (keep)
+		cf_atomic32_incr(&ep->epoch);
+
+	if (freed)
+		cf_atomic32_sub(&ep->n_retired, freed);
+
+	pthread_mutex_unlock(&ep->reclaim_lock);
+}
+
+/**
+ * Retire an element the caller has just unlinked, under its bucket's lock.
+ * The fence makes the unlink visible before the epoch is read, so a reader
+ * that registers in a later epoch can't find the element.
+ */
+static void cf_rchash_retire(cf_rchash *h, cf_rchash_elem_e *e) {
+	struct cf_rchash_epoch_s *ep = h->epoch;
+
+	smb_mb();
+	e->retired_epoch = cf_atomic32_get(ep->epoch);
+
+	cf_rchash_elem_e *head;
+	do {
+		head = (cf_rchash_elem_e *) cf_atomic_p_get(ep->retired);
+		e->retired_next = head;
+	} while (cf_atomic_p_cas(&ep->retired, (cf_atomic_p) head, (cf_atomic_p) e) != (cf_atomic_p) head);
+
+	if (cf_atomic32_incr(&ep->n_retired) % CF_RCHASH_EPOCH_BATCH == 0)
+		cf_rchash_reclaim(h);
+}
+
+static inline bool cf_rchash_elem_e_match(cf_rchash_elem_e *e, void *key, uint32_t key_len) {
+	return e->key_len == key_len && memcmp(e->key, key, key_len) == 0;
+}
+
+/**
+ * Put for CF_RCHASH_CR_EPOCH tables. The new element is filled in before
+ * it's linked, and a replaced element is swapped out in one store, so
+ * lock-free readers always see a whole chain.
+ */
+static int cf_rchash_put_e(cf_rchash *h, void *key, uint32_t key_len, void *object, bool unique) {
+	if (h->key_len && h->key_len != key_len) return(CF_RCHASH_ERR);
+
+	uint hash = h->h_fn(key, key_len);
+	hash %= h->table_len;
+
+	pthread_mutex_t *l = cf_rchash_bucket_lock(h, hash);
+	if (l)	cf_rchash_lock(h, l);
+
+	cf_rchash_elem_e **pe = &((cf_rchash_elem_e **) h->table)[hash];
+	bool empty = *pe == 0;
+
+	while (*pe && ! cf_rchash_elem_e_match(*pe, key, key_len))
+		pe = &(*pe)->next;
+
+	cf_rchash_elem_e *e = *pe;
+
+	if (e && unique) {
 		if (l)	pthread_mutex_unlock(l);
-		
+		return(CF_RCHASH_ERR_FOUND);
 	}
 
-Out:	
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
-		pthread_mutex_unlock(&h->biglock);
+	cf_rchash_elem_e *n = (cf_rchash_elem_e *) cf_malloc(sizeof(cf_rchash_elem_e) + key_len);
+	if (! n) {
+		if (l)	pthread_mutex_unlock(l);
+		return(CF_RCHASH_ERR);
+	}
+
+	n->object = object;
+	n->key_len = key_len;
+	memcpy(n->key, key, key_len);
+	n->next = e ? e->next : 0;
+
+	CF_MEMORY_BARRIER_WRITE();
+	*pe = n;
+
+	if (e) {
+		cf_rchash_retire(h, e);
+	}
+	else {
+		if (! empty)
+			cf_rchash_stats_collision(h);
+		cf_rchash_elements_incr(h);
+	}
+
+	if (l)	pthread_mutex_unlock(l);
 
-	return;
+	return(CF_RCHASH_OK);
 }
 
 /**
- * A special version of 'reduce' that supports deletion
- * In this case, if you return '-1' from the reduce fn, that node will be
- * deleted
+ * Lock-free get for CF_RCHASH_CR_EPOCH tables. Being registered as a reader
+ * keeps every element we can reach - and the table's reference to its
+ * object - alive, so the object's count can't reach zero under us, and a
+ * plain reserve is safe.
  */
-void cf_rchash_reduce_delete_v(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
-	
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
-		pthread_mutex_lock(&h->biglock);
+static int cf_rchash_get_e(cf_rchash *h, void *key, uint32_t key_len, void **object) {
+	if (h->key_len && h->key_len != key_len) return(CF_RCHASH_ERR);
 
-	for (uint i=0; i<h->table_len ; i++) {
+	uint hash = h->h_fn(key, key_len);
+	hash %= h->table_len;
 
-		pthread_mutex_t *l = 0;
-		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock( l );
+	int rv = CF_RCHASH_ERR_NOTFOUND;
+
+	cf_rchash_reader_slot *slot = cf_rchash_reader_slot_get(h);
+	uint32_t epoch = cf_rchash_read_begin(h, slot);
+
+	cf_rchash_elem_e *e = CF_RCHASH_READ_ONCE(((cf_rchash_elem_e **) h->table)[hash]);
+
+	while (e) {
+		if (cf_rchash_elem_e_match(e, key, key_len)) {
+			cf_rc_reserve(e->object);
+			*object = e->object;
+			rv = CF_RCHASH_OK;
+			break;
 		}
-		
-		cf_rchash_elem_v *list_he = get_bucket_v(h, i);
-		cf_rchash_elem_v *prev_he = 0;
-		int rv;
+		e = CF_RCHASH_READ_ONCE(e->next);
+	}
 
-		while (list_he) {
-			// This kind of structure might have the head as an empty element,
-			// that's a signal to move along
-			if (list_he->key_len == 0)
-				break;
-			
-#ifdef VALIDATE
-			cf_atomic_int_t rc;
-			if ((rc = cf_rc_count(list_he->object)) < 1) {
-				cf_info(CF_RCHASH,"cf_rchash %p: internal bad reference count (%d) on %p", h, rc, list_he->object);
-				if (l)	pthread_mutex_unlock(l);
-				return;
-			}
-#endif		
-			
-			rv = reduce_fn(list_he->key, list_he->key_len, list_he->object, udata);
-			
-			// Delete is requested
-			// Leave the pointers in a "next" state
-			if (rv == CF_RCHASH_REDUCE_DELETE) {
-                
-				cf_free(list_he->key);
-				cf_rchash_free(h, list_he->object);
-                h->elements--;
-                
-				// patchup pointers & free element if not head
-				if (prev_he) {
-					prev_he->next = list_he->next;
-					cf_free(list_he);
-					list_he = prev_he->next;
-				}
-				// am at head - more complicated
-				else {
-					// at head with no next - easy peasy!
-					if (0 == list_he->next) {
-						memset(list_he, 0, sizeof(cf_rchash_elem_v));
-						list_he = 0;
-					}
-					// at head with a next - more complicated -
-					// copy next into current and free next
-					// (the old trick of how to delete from a singly
-					// linked list without a prev pointer)
-					// Somewhat confusingly, prev_he stays 0
-					// and list_he stays where it is
-					else {
-						cf_rchash_elem_v *_t = list_he->next;
-						memcpy(list_he, list_he->next, sizeof(cf_rchash_elem_v));
-						cf_free(_t);
-					}
-				}
+	cf_rchash_read_end(slot, epoch);
 
-			}
-			else { // don't delete, just forward everything
-				prev_he = list_he;
-				list_he = list_he->next;
-			}	
-				
+	return(rv);
+}
+
+static int cf_rchash_delete_e(cf_rchash *h, void *key, uint32_t key_len) {
+	if (h->key_len && h->key_len != key_len) return(CF_RCHASH_ERR);
+
+	uint hash = h->h_fn(key, key_len);
+	hash %= h->table_len;
+
+	pthread_mutex_t *l = cf_rchash_bucket_lock(h, hash);
+	if (l)	cf_rchash_lock(h, l);
+
+	cf_rchash_elem_e **pe = &((cf_rchash_elem_e **) h->table)[hash];
+
+	while (*pe && ! cf_rchash_elem_e_match(*pe, key, key_len))
+		pe = &(*pe)->next;
+
+	cf_rchash_elem_e *e = *pe;
+	int rv = CF_RCHASH_ERR_NOTFOUND;
+
+	if (e) {
+		*pe = e->next;
+		cf_rchash_elements_sub(h, 1);
+		cf_rchash_retire(h, e);
+		rv = CF_RCHASH_OK;
+	}
+
+	if (l)	pthread_mutex_unlock(l);
+
+	return(rv);
+}
+
+/**
+ * cf_rchash_reduce_bucket() for CF_RCHASH_CR_EPOCH tables.
+ */
+static int cf_rchash_reduce_bucket_e(cf_rchash *h, uint i, cf_rchash_reduce_fn reduce_fn, void *udata, bool del, uint32_t *deleted) {
+	cf_rchash_elem_e **pe = &((cf_rchash_elem_e **) h->table)[i];
+
+	while (*pe) {
+		cf_rchash_elem_e *e = *pe;
+
+		int rv = reduce_fn(e->key, e->key_len, e->object, udata);
+
+		if (del && rv == CF_RCHASH_REDUCE_DELETE) {
+			*pe = e->next;
+			(*deleted)++;
+			cf_rchash_retire(h, e);
+		}
+		else if (! del && rv != 0) {
+			return(rv);
+		}
+		else {
+			pe = &e->next;
 		}
-		
-		if (l) pthread_mutex_unlock(l);
-		
 	}
 
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK)
-		pthread_mutex_unlock(&h->biglock);
+	return(0);
+}
+
+/**
+ * Free everything, retired elements included - there can be no readers
+ * left when the table is being destroyed.
+ */
+static void cf_rchash_destroy_elements_e(cf_rchash *h) {
+	cf_rchash_elem_e **table = (cf_rchash_elem_e **) h->table;
+
+	for (uint i = 0; i < h->table_len; i++) {
+		cf_rchash_elem_e *e = table[i];
+		while (e) {
+			cf_rchash_elem_e *t = e->next;
+			cf_rchash_free(h, e->object);
+			cf_free(e);
+			e = t;
+		}
+		table[i] = 0;
+	}
+
+	if (h->epoch) {
+		cf_rchash_elem_e *e = (cf_rchash_elem_e *) h->epoch->retired;
+		while (e) {
+			cf_rchash_elem_e *t = e->retired_next;
+			cf_rchash_free(h, e->object);
+			cf_free(e);
+			e = t;
+		}
+		h->epoch->retired = 0;
+		h->epoch->n_retired = 0;
+	}
 
-	return;
+	h->elements = 0;
 }
 
-void cf_rchash_destroy_elements_v(cf_rchash *h) {
-	for (uint i=0;i<h->table_len;i++) {
-        
-        cf_rchash_elem_v *e = get_bucket_v(h, i);
-        if (e->object == 0) continue;
-        
-        cf_rchash_free(h, e->object);
-        cf_free(e->key);
-        e = e->next; // skip the first, it's in place
+/**
+ * Add bucket i's chain to the histogram. Caller holds the bucket's lock.
+ */
+static void cf_rchash_stats_walk_bucket(cf_rchash *h, uint i, cf_rchash_stats *stats) {
+	uint len = 0;
 
-        while (e) {
-            cf_rchash_elem_v *t = e->next;
-            cf_rchash_free(h, e->object);
-            cf_free(e->key);
-            cf_free(e);
-            e = t;
+	if (h->flags & CF_RCHASH_CR_EPOCH) {
+		for (cf_rchash_elem_e *e = ((cf_rchash_elem_e **) h->table)[i]; e; e = e->next)
+			len++;
+	}
+	else if (h->key_len == 0) {
+		for (cf_rchash_elem_v *e = *get_bucket_v(h, i); e; e = e->next)
+			len++;
+	}
+	else {
+		for (cf_rchash_elem_f *e = get_bucket(h, i); e && e->object; e = e->next)
+			len++;
+	}
+
+	stats->chains[len < CF_RCHASH_STATS_CHAIN_BINS ? len : CF_RCHASH_STATS_CHAIN_BINS - 1]++;
+	if (len > stats->max_chain)
+		stats->max_chain = len;
+}
+
+/*
+ *  Snapshot the statistics of the table, see cf_rchash_get_stats() in the
+ *  header. The walk takes the locks directly, so it isn't timed.
+ */
+int cf_rchash_get_stats(cf_rchash *h, cf_rchash_stats *stats, bool walk)
+{
+	if (!(h->flags & CF_RCHASH_CR_STATS)) {
+		return(CF_RCHASH_ERR);
+	}
+
+	memset(stats, 0, sizeof(cf_rchash_stats));
+	stats->elements = cf_rchash_get_size(h);
+	stats->table_len = h->table_len;
+	stats->collisions = cf_atomic64_get(h->stats->collisions);
+	stats->resizes = cf_atomic64_get(h->stats->resizes);
+	stats->lock_samples = cf_atomic64_get(h->stats->lock_samples);
+	stats->lock_wait_ns = cf_atomic64_get(h->stats->lock_wait_ns);
+	stats->lock_wait_max_ns = cf_atomic64_get(h->stats->lock_wait_max_ns);
+
+	if (!walk) {
+		return(CF_RCHASH_OK);
+	}
+
+	cf_rchash_resize_pause(h);
+	stats->table_len = h->table_len;
+
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock(&h->biglock);
+	}
+
+	for (uint i = 0; i < h->table_len; i++) {
+		pthread_mutex_t *l = 0;
+		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
+			l = &(h->lock_table[i % h->lock_table_len]);
+			pthread_mutex_lock(l);
 		}
+
+		cf_rchash_stats_walk_bucket(h, i, stats);
+
+		if (l)	pthread_mutex_unlock(l);
+	}
+
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_unlock(&h->biglock);
 	}
+
+	cf_rchash_resize_resume(h);
+
+	return(CF_RCHASH_OK);
 }
 
 #ifdef DEBUG
@@ -1103,11 +1911,18 @@ void cf_rchash_destroy_elements_v(cf_rchash *h) {
  */
 void cf_rchash_dump(cf_rchash *h)
 {
+	if (h->flags & CF_RCHASH_CR_EPOCH) {
+		cf_info(CF_RCHASH, "rchash: %p ; flags 0x%08x ; key_len %d ; table_len %d (epoch mode, not dumped)", h, h->flags, h->key_len, h->table_len);
+		return;
+	}
+
 	if (!(h->key_len)) {
 		cf_rchash_dump_v(h);
 		return;
 	}
 
+	cf_rchash_resize_pause(h);
+
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_lock(&h->biglock);
 	}
@@ -1123,7 +1938,7 @@ void cf_rchash_dump(cf_rchash *h)
 	for (uint i = 0; i < h->table_len; i++) {
 		pthread_mutex_t *l = 0;
 		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
+			l = &(h->lock_table[i % h->lock_table_len]);
 			pthread_mutex_lock(l);
 		}
 
@@ -1152,6 +1967,8 @@ void cf_rchash_dump(cf_rchash *h)
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_unlock(&h->biglock);
 	}
+
+	cf_rchash_resize_resume(h);
 }
 
 /*
@@ -1159,6 +1976,8 @@ void cf_rchash_dump(cf_rchash *h)
  */
 void cf_rchash_dump_v(cf_rchash *h)
 {
+	cf_rchash_resize_pause(h);
+
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_lock(&h->biglock);
 	}
@@ -1174,11 +1993,11 @@ void cf_rchash_dump_v(cf_rchash *h)
 	for (uint i = 0; i < h->table_len; i++) {
 		pthread_mutex_t *l = 0;
 		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
+			l = &(h->lock_table[i % h->lock_table_len]);
 			pthread_mutex_lock(l);
 		}
 
-		cf_rchash_elem_v *list_he = get_bucket_v(h, i);
+		cf_rchash_elem_v *list_he = *get_bucket_v(h, i);
 
 		uint j = 0;
 		while (list_he) {
@@ -1207,6 +2026,8 @@ void cf_rchash_dump_v(cf_rchash *h)
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_unlock(&h->biglock);
 	}
+
+	cf_rchash_resize_resume(h);
 }
 
 #endif // defined(DEBUG)
@@ -20,20 +20,1623 @@
  * SOFTWARE.
  */
 
+
+/**
+ * A general purpose hashtable implementation
+ * Good at multithreading
+ * Just, hopefully, the last reasonable hash table you'll ever need
+ */
+
+#include <alloca.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <citrusleaf/cf_shash.h>
+#include <citrusleaf/cf_alloc.h>
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_clock.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+/**
+ * Number of old buckets migrated by each call while a resize is in progress
+ */
+#define SHASH_MIGRATE_STEP 2
+
+/**
+ * Number of keys hashed and prefetched ahead by the batch calls
+ */
+#define SHASH_BATCH_SZ 64
+
+/**
+ * Number of buckets a thread of a parallel reduce claims at a time, when the
+ * table isn't striped
+ */
+#define SHASH_REDUCE_CHUNK 1024
+
+/**
+ * Number of times an optimistic read is retried before falling back to
+ * taking the lock
+ */
+#define SHASH_READ_RETRIES 4
+
+/**
+ * Internal return value of an optimistic read that a writer got in the way of
+ */
+#define SHASH_READ_RETRY 1
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * State shared by the threads of a parallel reduce. The work is cut into
+ * units - stripes in the manylock case, else ranges of SHASH_REDUCE_CHUNK
+ * buckets - which the threads claim one at a time.
+ */
+typedef struct shash_reduce_job_s {
+	shash *				h;
+	shash_reduce_fn		reduce_fn;
+	bool				del;
+	uint				n_units;
+	uint				n_buckets;
+	cf_atomic32			next_unit;
+	cf_atomic32			rv;				// non-zero once any thread stops the reduce
+} shash_reduce_job;
+
+/**
+ * An old table of a read-mostly hash, kept until the hash is destroyed.
+ */
+typedef struct shash_retired_s {
+	struct shash_retired_s *	next;
+	void *						table;
+} shash_retired;
+
+/**
+ * The statistics counters of a stripe - updated under the stripe's lock.
+ */
+typedef struct shash_stripe_stats_s {
+	uint64_t			collisions;
+	uint64_t			lock_samples;
+	uint64_t			lock_wait_ns;
+	uint64_t			lock_wait_max_ns;
+} __attribute__ ((aligned(64))) shash_stripe_stats;
+
+struct shash_stats_data_s {
+	uint64_t			resizes;		// updated under all the locks
+	uint64_t			purges;
+	shash_stripe_stats	stripes[];
+};
+
+typedef struct shash_reduce_worker_s {
+	shash_reduce_job *	job;
+	void *				udata;
+	uint32_t			deleted;		// only used when not manylock
+	pthread_t			thread;
+	bool				started;
+} shash_reduce_worker;
+
+/******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+
+/**
+ * Lock acquisitions by this thread on tables keeping statistics - used to
+ * pick which to time.
+ */
+static __thread uint32_t shash_lock_count;
+
+/******************************************************************************
+ * MACROS
+ ******************************************************************************/
+
+#define SHASH_ELEM_AT(_h, _table, _i) ( (shash_elem *) ( ((uint8_t *)(_table)) + (SHASH_ELEM_SZ(_h) * (_i)) ) )
+
+/**
+ * Most elements an open addressing region of _m slots should hold
+ */
+#define SHASH_OPEN_MAX_LOAD(_m) ( ((_m) * 3) / 4 )
+
+/**
+ * Loads on x86 aren't reordered with other loads, so an optimistic reader
+ * only has to stop the compiler from moving its loads across the checks of
+ * the sequence counter.
+ */
+#define SHASH_READ_BARRIER() __asm__ __volatile__ ("" : : : "memory")
+
+/**
+ * Read a field that a writer may change under an optimistic reader.
+ */
+#define SHASH_READ_ONCE(_x) ( *(volatile __typeof__(_x) *) &(_x) )
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static inline void * shash_malloc(shash *h, size_t sz) {
+	return (h->flags & SHASH_CR_UNTRACKED) ? malloc(sz) : cf_malloc(sz);
+}
+
+static inline void shash_free(shash *h, void *p) {
+	if (h->flags & SHASH_CR_UNTRACKED)
+		free(p);
+	else
+		cf_free(p);
+}
+
+/**
+ * Round the number of buckets up to a multiple of the number of locks.
+ */
+static inline uint shash_round_len(uint table_len, uint n_locks) {
+	return n_locks ? ((table_len + n_locks - 1) / n_locks) * n_locks : table_len;
+}
+
+/**
+ * Allocate a table of empty, unchained head elements.
+ */
+static void * shash_table_create(shash *h, uint table_len) {
+	void *table = shash_malloc(h, table_len * SHASH_ELEM_SZ(h));
+	if (table) {
+		shash_elem *e = table;
+		for (uint i=0;i<table_len;i++) {
+			e->in_use = false;
+			e->deleted = false;
+			e->next = 0;
+			// next element in head table
+			e = (shash_elem *) (((uint8_t *)e) + SHASH_ELEM_SZ(h));
+		}
+	}
+	return table;
+}
+
+/**
+ * Allocate the stripes - page aligned, so that each stripe starts its own
+ * cache line.
+ */
+static shash_stripe * shash_stripes_create(shash *h, uint n_stripes) {
+	size_t sz = sizeof(shash_stripe) * n_stripes;
+	shash_stripe *stripes = (shash_stripe *) ((h->flags & SHASH_CR_UNTRACKED) ? valloc(sz) : cf_valloc(sz));
+	if (! stripes) {
+		return 0;
+	}
+	for (uint i=0;i<n_stripes;i++) {
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_init( &(stripes[i].lock), 0 );
+		}
+		stripes[i].migrate_pos = 0;
+		stripes[i].elements = 0;
+		stripes[i].tombstones = 0;
+		stripes[i].seq = 0;
+		stripes[i].free_elems = 0;
+	}
+	return stripes;
+}
+
+/**
+ * Free the elements kept for reuse by a read-mostly stripe.
+ */
+static void shash_stripe_drain(shash *h, shash_stripe *st) {
+	while (st->free_elems) {
+		shash_elem *e = st->free_elems;
+		st->free_elems = e->next;
+		shash_free(h, e);
+	}
+}
+
+static void shash_stripes_destroy(shash *h, shash_stripe *stripes, uint n_stripes) {
+	for (uint i=0;i<n_stripes;i++) {
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_destroy(&(stripes[i].lock));
+		}
+		shash_stripe_drain(h, &stripes[i]);
+	}
+	shash_free(h, stripes);
+}
+
+/**
+ * Allocate zeroed statistics counters for the stripes - page aligned, like
+ * the stripes.
+ */
+static struct shash_stats_data_s * shash_stats_create(shash *h, uint n_stripes) {
+	size_t sz = sizeof(struct shash_stats_data_s) + (sizeof(shash_stripe_stats) * n_stripes);
+	struct shash_stats_data_s *stats = (struct shash_stats_data_s *) ((h->flags & SHASH_CR_UNTRACKED) ? valloc(sz) : cf_valloc(sz));
+	if (stats) {
+		memset(stats, 0, sz);
+	}
+	return stats;
+}
+
+/**
+ * Number of lock stripes - every bucket belongs to stripe (index % stripes).
+ * Without manylock, the whole table is one stripe.
+ */
+static inline uint shash_stripes(shash *h) {
+	return (h->flags & SHASH_CR_MT_MANYLOCK) ? h->n_locks : 1;
+}
+
+static inline pthread_mutex_t * shash_stripe_lock(shash *h, uint stripe) {
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		return &h->biglock;
+	}
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		return &h->stripes[stripe].lock;
+	}
+	return 0;
+}
+
+static inline uint shash_stripe_of(shash *h, uint hash) {
+	return (h->flags & SHASH_CR_MT_MANYLOCK) ? hash % h->n_locks : 0;
+}
+
+/**
+ * Read-mostly - bracket a change to a stripe, so that optimistic readers of
+ * the stripe see an odd sequence number while it's going on, and a new one
+ * after. Caller holds the stripe's lock. The atomic increments are full
+ * barriers, so the changes can't leak out of the bracket.
+ */
+static inline void shash_write_begin(shash *h, uint stripe) {
+	if (h->flags & SHASH_CR_READ_MOSTLY) {
+		cf_atomic32_incr((cf_atomic32 *) &h->stripes[stripe].seq);
+	}
+}
+
+static inline void shash_write_end(shash *h, uint stripe) {
+	if (h->flags & SHASH_CR_READ_MOSTLY) {
+		cf_atomic32_incr((cf_atomic32 *) &h->stripes[stripe].seq);
+	}
+}
+
+/**
+ * Take a stripe's lock, timing one acquisition in SHASH_STATS_LOCK_SAMPLE.
+ * If the lock is free, there's no wait to time, so we only read the clock
+ * when we'd otherwise block.
+ */
+static void shash_lock_timed(shash *h, uint stripe, pthread_mutex_t *l) {
+	if (++shash_lock_count % SHASH_STATS_LOCK_SAMPLE != 0) {
+		pthread_mutex_lock(l);
+		return;
+	}
+
+	uint64_t wait = 0;
+
+	if (0 != pthread_mutex_trylock(l)) {
+		cf_clock start = cf_getns();
+		pthread_mutex_lock(l);
+		wait = cf_getns() - start;
+	}
+
+	shash_stripe_stats *ss = &h->stats->stripes[stripe];
+	ss->lock_samples++;
+	ss->lock_wait_ns += wait;
+	if (wait > ss->lock_wait_max_ns)
+		ss->lock_wait_max_ns = wait;
+}
+
+static inline pthread_mutex_t * shash_lock(shash *h, uint stripe) {
+	pthread_mutex_t *l = shash_stripe_lock(h, stripe);
+	if (l) {
+		if (h->flags & SHASH_CR_STATS)
+			shash_lock_timed(h, stripe, l);
+		else
+			pthread_mutex_lock( l );
+	}
+	shash_write_begin(h, stripe);
+	return l;
+}
+
+/**
+ * Count a put of a new key that found its bucket (or first slot) taken.
+ * Caller holds the stripe's lock.
+ */
+static inline void shash_stats_collision(shash *h, uint stripe) {
+	if (h->flags & SHASH_CR_STATS) {
+		h->stats->stripes[stripe].collisions++;
+	}
+}
+
+static void shash_lock_all(shash *h) {
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock(&h->biglock);
+	}
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		for (uint i=0; i<h->n_locks; i++) {
+			pthread_mutex_lock(&h->stripes[i].lock);
+		}
+	}
+	for (uint i=0; i<shash_stripes(h); i++) {
+		shash_write_begin(h, i);
+	}
+}
+
+static void shash_unlock_all(shash *h) {
+	for (uint i=0; i<shash_stripes(h); i++) {
+		shash_write_end(h, i);
+	}
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_unlock(&h->biglock);
+	}
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		for (uint i=0; i<h->n_locks; i++) {
+			pthread_mutex_unlock(&h->stripes[i].lock);
+		}
+	}
+}
+
+/**
+ * Get a chained element - in a read-mostly hash, one deleted earlier from
+ * the stripe if there is one. Caller holds the stripe's lock.
+ */
+static inline shash_elem * shash_elem_alloc(shash *h, uint stripe) {
+	if (h->flags & SHASH_CR_READ_MOSTLY) {
+		shash_elem *e = h->stripes[stripe].free_elems;
+		if (e) {
+			h->stripes[stripe].free_elems = e->next;
+			return e;
+		}
+	}
+	return (shash_elem *) shash_malloc(h, SHASH_ELEM_SZ(h));
+}
+
+/**
+ * Free a chained element. In a read-mostly hash, optimistic readers may
+ * still be walking it, so it's kept on the stripe's free list instead -
+ * with a CAS, as the threads of a parallel reduce share stripe 0.
+ */
+static inline void shash_elem_free(shash *h, uint stripe, shash_elem *e) {
+	if (! (h->flags & SHASH_CR_READ_MOSTLY)) {
+		shash_free(h, e);
+		return;
+	}
+
+	shash_stripe *st = &h->stripes[stripe];
+	shash_elem *head;
+	do {
+		head = st->free_elems;
+		e->next = head;
+	} while (cf_atomic_p_cas((cf_atomic_p *) &st->free_elems, (cf_atomic_p) head, (cf_atomic_p) e) != (cf_atomic_p) head);
+}
+
+/**
+ * In the manylock case, each stripe counts its own elements, under its lock.
+ */
+static inline void shash_elements_add(shash *h, uint stripe, int32_t n) {
+	if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		h->stripes[stripe].elements += n;
+	}
+	else {
+		h->elements += n;
+	}
+}
+
+/**
+ * Sum of the stripe counts - only exact if all the locks are held.
+ */
+static uint32_t shash_elements(shash *h) {
+	if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		uint32_t elements = 0;
+		for (uint i=0; i<h->n_locks; i++) {
+			elements += h->stripes[i].elements;
+		}
+		return elements;
+	}
+	return h->elements;
+}
+
+static inline uint32_t shash_stripe_elements(shash *h, uint stripe) {
+	return (h->flags & SHASH_CR_MT_MANYLOCK) ? h->stripes[stripe].elements : h->elements;
+}
+
+/**
+ * Open addressing - is a stripe's region too full to keep probes short?
+ */
+static inline bool shash_open_full(shash *h, uint stripe, uint table_len) {
+	return shash_stripe_elements(h, stripe) > SHASH_OPEN_MAX_LOAD(table_len / shash_stripes(h));
+}
+
+/**
+ * Open addressing - are there enough tombstones in a stripe's region to be
+ * worth rehashing it in place?
+ */
+static inline bool shash_open_dirty(shash *h, uint stripe) {
+	uint m = h->table_len / shash_stripes(h);
+	uint32_t tombstones = h->stripes[stripe].tombstones;
+	return tombstones > m / 8 && shash_stripe_elements(h, stripe) + tombstones > SHASH_OPEN_MAX_LOAD(m);
+}
+
+/**
+ * Is the table too full? In the manylock case, a stripe only knows its own
+ * count, and about half the stripes have more than their share while the
+ * table as a whole is fine. So a stripe has to be a quarter over its share
+ * before we add up the (unlocked, so rough) total - and only if that's over
+ * too do we go on to take every lock. With open addressing, the stripe may
+ * also just need its tombstones cleared out, which doesn't need
+ * SHASH_CR_RESIZE.
+ */
+static inline bool shash_needs_grow(shash *h, uint stripe) {
+	if (h->flags & SHASH_CR_OPEN) {
+		return ((h->flags & SHASH_CR_RESIZE) && shash_open_full(h, stripe, h->table_len)) ||
+				(! h->old_table && shash_open_dirty(h, stripe));
+	}
+
+	if (! (h->flags & SHASH_CR_RESIZE))
+		return false;
+
+	if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		uint32_t share = h->table_len / h->n_locks;
+		return h->stripes[stripe].elements > share + (share / 4) && shash_elements(h) > h->table_len;
+	}
+
+	return h->elements > h->table_len;
+}
+
+/**
+ * The whole table's version of shash_needs_grow() - caller holds all locks.
+ */
+static bool shash_too_full(shash *h) {
+	if (h->flags & SHASH_CR_OPEN) {
+		for (uint i=0; i<shash_stripes(h); i++) {
+			if (shash_open_full(h, i, h->table_len))
+				return true;
+		}
+		return false;
+	}
+
+	return shash_elements(h) > h->table_len;
+}
+
+/**
+ * Has bucket i of the old table been migrated to the new table?
+ * Caller holds the bucket's stripe lock.
+ */
+static inline bool shash_migrated(shash *h, uint i) {
+	uint n = shash_stripes(h);
+	return i / n < h->stripes[i % n].migrate_pos;
+}
+
+/**
+ * Find the bucket (head element) for a hash.
+ * Caller holds the hash's stripe lock.
+ */
+static inline shash_elem * shash_bucket(shash *h, uint hash) {
+	if (h->old_table) {
+		uint i = hash % h->old_table_len;
+		if (! shash_migrated(h, i)) {
+			return SHASH_ELEM_AT(h, h->old_table, i);
+		}
+	}
+	return SHASH_ELEM_AT(h, h->table, hash % h->table_len);
+}
+
+/**
+ * Move the elements of bucket i of the old table to the new table.
+ * The new table is twice the size, so the elements can only go to new
+ * buckets i and i + old_table_len - both of which are still empty, as
+ * keys hashing to them have lived in old bucket i until now. Thus the old
+ * head element always lands in an empty head, and the chained elements
+ * are relinked rather than copied - no allocation is needed.
+ */
+static void shash_migrate_bucket(shash *h, uint i) {
+	shash_elem *e = SHASH_ELEM_AT(h, h->old_table, i);
+
+	if (e->in_use == false)
+		return;
+
+	shash_elem *head = e;
+
+	while (e) {
+		shash_elem *next = e->next;
+
+		uint hash = h->h_fn(SHASH_ELEM_KEY_PTR(h, e));
+		shash_elem *dst = SHASH_ELEM_AT(h, h->table, hash % h->table_len);
+
+		if (dst->in_use == false) {
+			memcpy(dst->data, e->data, h->key_len + h->value_len);
+			dst->in_use = true;
+			dst->next = 0;
+			if (e != head)
+				shash_elem_free(h, i % shash_stripes(h), e);
+		}
+		else {
+			// only chained elements get here, see above
+			e->next = dst->next;
+			dst->next = e;
+		}
+		e = next;
+	}
+
+	head->in_use = false;
+	head->next = 0;
+}
+
+/**
+ * Open addressing - the first slot of a stripe's region of a table.
+ */
+static inline shash_elem * shash_open_region(shash *h, void *table, uint table_len, uint stripe) {
+	return stripe ? SHASH_ELEM_AT(h, table, stripe * (table_len / shash_stripes(h))) : (shash_elem *) table;
+}
+
+/**
+ * Open addressing - find the region of a table a hash probes, its number of
+ * slots, and the index in the region the probe starts at. Without manylock,
+ * that's a single division, like finding a chained bucket.
+ */
+static inline uint shash_open_locate(shash *h, void *table, uint table_len, uint hash, shash_elem **region, uint *m) {
+	uint n = shash_stripes(h);
+
+	if (n == 1) {
+		*region = (shash_elem *) table;
+		*m = table_len;
+		return hash % table_len;
+	}
+
+	*m = table_len / n;
+	*region = SHASH_ELEM_AT(h, table, (hash % n) * *m);
+	return (hash / n) % *m;
+}
+
+/**
+ * Open addressing - the slot a hash's probe starts at.
+ */
+static inline shash_elem * shash_open_home(shash *h, void *table, uint table_len, uint hash) {
+	shash_elem *region;
+	uint m;
+	uint j = shash_open_locate(h, table, table_len, hash, &region, &m);
+	return SHASH_ELEM_AT(h, region, j);
+}
+
+/**
+ * Open addressing - probe a region of m slots for a key, from slot j,
+ * stopping at the first slot never used. If free_e is not NULL, it's set to
+ * the first unused slot found (tombstone or not), or NULL if there is none.
+ * With a NULL key, we only look for that unused slot.
+ */
+static shash_elem * shash_open_probe_region(shash *h, shash_elem *region, uint m, uint j, void *key, shash_elem **free_e) {
+	if (free_e)	*free_e = 0;
+
+	size_t sz = SHASH_ELEM_SZ(h);
+	uint8_t *p = (uint8_t *) SHASH_ELEM_AT(h, region, j);
+	uint8_t *end = (uint8_t *) SHASH_ELEM_AT(h, region, m);
+
+	for (uint k=0; k<m; k++) {
+		shash_elem *e = (shash_elem *) p;
+
+		if (e->in_use) {
+			if (key && memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0)
+				return e;
+		}
+		else {
+			if (free_e && ! *free_e)	*free_e = e;
+			if (! key || ! e->deleted)	break;
+		}
+
+		p += sz;
+		if (p == end)	p = (uint8_t *) region;
+	}
+
+	return 0;
+}
+
+/**
+ * Open addressing - probe a table for a key, see shash_open_probe_region().
+ */
+static inline shash_elem * shash_open_probe(shash *h, void *table, uint table_len, uint hash, void *key, shash_elem **free_e) {
+	shash_elem *region;
+	uint m;
+	uint j = shash_open_locate(h, table, table_len, hash, &region, &m);
+	return shash_open_probe_region(h, region, m, j, key, free_e);
+}
+
+/**
+ * Open addressing - find a key's slot, in the old table if its stripe's
+ * region there isn't migrated yet, else in the current table.
+ * Caller holds the hash's stripe lock.
+ */
+static shash_elem * shash_open_find(shash *h, uint hash, void *key) {
+	if (h->old_table) {
+		uint n = shash_stripes(h);
+		if (h->stripes[hash % n].migrate_pos < h->old_table_len / n) {
+			shash_elem *e = shash_open_probe(h, h->old_table, h->old_table_len, hash, key, 0);
+			if (e)	return e;
+		}
+	}
+	return shash_open_probe(h, h->table, h->table_len, hash, key, 0);
+}
+
+/**
+ * Open addressing - take a free slot of the current table into use.
+ */
+static inline void shash_open_use(shash *h, uint stripe, shash_elem *e) {
+	if (e->deleted) {
+		e->deleted = false;
+		if (h->stripes[stripe].tombstones)	h->stripes[stripe].tombstones--;
+	}
+	e->in_use = true;
+}
+
+/**
+ * Open addressing - claim a free slot in the current table for a hash.
+ * Returns NULL if the stripe's region is full.
+ */
+static shash_elem * shash_open_claim(shash *h, uint stripe, uint hash) {
+	shash_elem *e;
+	shash_open_probe(h, h->table, h->table_len, hash, 0, &e);
+
+	if (e)	shash_open_use(h, stripe, e);
+	return e;
+}
+
+/**
+ * Open addressing - count a new key's slot as a collision if it isn't the
+ * slot its probe starts at.
+ */
+static inline void shash_open_stats_collision(shash *h, uint stripe, uint hash, shash_elem *e) {
+	if ((h->flags & SHASH_CR_STATS) && e != shash_open_home(h, h->table, h->table_len, hash)) {
+		shash_stats_collision(h, stripe);
+	}
+}
+
+/**
+ * Open addressing - insert a key known not to be in the table.
+ */
+static int shash_open_insert(shash *h, uint stripe, uint hash, void *key, void *value) {
+	shash_elem *e = shash_open_claim(h, stripe, hash);
+	if (! e)
+		return(SHASH_ERR);
+
+	shash_open_stats_collision(h, stripe, hash, e);
+
+	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
+	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
+	shash_elements_add(h, stripe, 1);
+	return(SHASH_OK);
+}
+
+/**
+ * Open addressing - put a key, or with unique set, fail if it's there. The
+ * current table is probed just once, for both the key and a free slot.
+ */
+static int shash_open_put(shash *h, uint stripe, uint hash, void *key, void *value, bool unique) {
+	shash_elem *e = 0;
+	shash_elem *free_e = 0;
+
+	if (h->old_table && h->stripes[stripe].migrate_pos < h->old_table_len / shash_stripes(h)) {
+		e = shash_open_probe(h, h->old_table, h->old_table_len, hash, key, 0);
+	}
+	if (! e) {
+		e = shash_open_probe(h, h->table, h->table_len, hash, key, &free_e);
+	}
+
+	if (e) {
+		if (unique)
+			return(SHASH_ERR_FOUND);
+		memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
+		return(SHASH_OK);
+	}
+
+	if (! free_e)
+		return(SHASH_ERR);
+
+	shash_open_stats_collision(h, stripe, hash, free_e);
+	shash_open_use(h, stripe, free_e);
+	memcpy(SHASH_ELEM_KEY_PTR(h, free_e), key, h->key_len);
+	memcpy(SHASH_ELEM_VALUE_PTR(h, free_e), value, h->value_len);
+	shash_elements_add(h, stripe, 1);
+	return(SHASH_OK);
+}
+
+/**
+ * Open addressing - move an old slot's element to the current table. The
+ * old slot becomes a tombstone, so probes for other keys still get past it.
+ * Every put checks whether the stripe needs to grow, and a resize finishes
+ * migrating before it starts another, so the stripe's new region should have
+ * room. If it doesn't, the element is left where it is (and still found
+ * there), and we return SHASH_ERR.
+ */
+static int shash_open_migrate_slot(shash *h, uint stripe, shash_elem *e) {
+	if (! e->in_use)
+		return(SHASH_OK);
+
+	shash_elem *dst = shash_open_claim(h, stripe, h->h_fn(SHASH_ELEM_KEY_PTR(h, e)));
+	if (! dst)
+		return(SHASH_ERR);
+
+	memcpy(dst->data, e->data, h->key_len + h->value_len);
+
+	e->in_use = false;
+	e->deleted = true;
+	return(SHASH_OK);
+}
+
+/**
+ * Open addressing - rehash a stripe's region in place, to clear out its
+ * tombstones. Caller holds all locks, and there's no resize in progress.
+ */
+static void shash_open_purge(shash *h, uint stripe) {
+	uint m = h->table_len / shash_stripes(h);
+	shash_elem *region = shash_open_region(h, h->table, h->table_len, stripe);
+	uint8_t *buf = (uint8_t *) shash_malloc(h, (size_t) m * (h->key_len + h->value_len));
+	uint n_live = 0;
+
+	if (! buf)
+		return;
+
+	for (uint j=0; j<m; j++) {
+		shash_elem *e = SHASH_ELEM_AT(h, region, j);
+		if (e->in_use) {
+			memcpy(buf + ((size_t) n_live++ * (h->key_len + h->value_len)), e->data, h->key_len + h->value_len);
+		}
+		e->in_use = false;
+		e->deleted = false;
+	}
+	h->stripes[stripe].tombstones = 0;
+
+	// the region was just emptied, and n_live <= m, so there's a slot for each
+	for (uint i=0; i<n_live; i++) {
+		uint8_t *data = buf + ((size_t) i * (h->key_len + h->value_len));
+		shash_elem *e = shash_open_claim(h, stripe, h->h_fn(data));
+		if (! e)
+			break;
+		memcpy(e->data, data, h->key_len + h->value_len);
+	}
+
+	shash_free(h, buf);
+}
+
+/**
+ * Migrate the old bucket (or slot) at position pos of a stripe.
+ * Returns SHASH_ERR if an open slot's element found no room.
+ */
+static inline int shash_migrate_pos(shash *h, uint stripe, uint pos) {
+	uint n = shash_stripes(h);
+
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_elem *region = shash_open_region(h, h->old_table, h->old_table_len, stripe);
+		return(shash_open_migrate_slot(h, stripe, SHASH_ELEM_AT(h, region, pos)));
+	}
+
+	shash_migrate_bucket(h, stripe + (pos * n));
+	return(SHASH_OK);
+}
+
+/**
+ * Migrate a few of the old buckets in a stripe.
+ * Caller holds the stripe's lock.
+ * Returns true if this call migrated the last old bucket of the table, in
+ * which case the old table should be freed, via shash_resize().
+ */
+static bool shash_migrate(shash *h, uint stripe) {
+	if (! h->old_table)
+		return false;
+
+	uint n = shash_stripes(h);
+	uint end = h->old_table_len / n;
+	uint32_t pos = h->stripes[stripe].migrate_pos;
+
+	if (pos == end)
+		return false;
+
+	for (int i=0; i<SHASH_MIGRATE_STEP && pos < end; i++, pos++) {
+		if (shash_migrate_pos(h, stripe, pos) != SHASH_OK)
+			break;
+	}
+	h->stripes[stripe].migrate_pos = pos;
+
+	return pos == end && cf_atomic32_decr((cf_atomic32 *) &h->migrate_left) == 0;
+}
+
+/**
+ * Finish a resize that is done migrating, and start a new one if the table
+ * has become too full. Caller holds all locks.
+ */
+static void shash_resize(shash *h) {
+	if (h->old_table) {
+		// don't start a new resize, unless this one has fallen behind
+		if (h->migrate_left != 0 && ! shash_too_full(h))
+			return;
+
+		if (h->migrate_left != 0) {
+			uint n = shash_stripes(h);
+			uint end = h->old_table_len / n;
+			for (uint i=0; i<n; i++) {
+				uint pos = h->stripes[i].migrate_pos;
+				if (pos == end)
+					continue;
+
+				while (pos < end && shash_migrate_pos(h, i, pos) == SHASH_OK) {
+					pos++;
+				}
+				h->stripes[i].migrate_pos = pos;
+
+				// no room - keep the old table, and what's left in it
+				if (pos < end)
+					return;
+
+				h->migrate_left--;
+			}
+		}
+
+		// a read-mostly hash's old table is already on the retired list
+		if (! (h->flags & SHASH_CR_READ_MOSTLY))
+			shash_free(h, h->old_table);
+		h->old_table = 0;
+		h->old_table_len = 0;
+	}
+
+	if (! (h->flags & SHASH_CR_RESIZE) || ! shash_too_full(h)) {
+		if (h->flags & SHASH_CR_OPEN) {
+			for (uint i=0; i<shash_stripes(h); i++) {
+				if (shash_open_dirty(h, i)) {
+					shash_open_purge(h, i);
+					if (h->flags & SHASH_CR_STATS)	h->stats->purges++;
+				}
+			}
+		}
+		return;
+	}
+
+	uint table_len = h->table_len * 2;
+	if (table_len < h->table_len)
+		return;
+
+	void *table = shash_malloc(h, table_len * SHASH_ELEM_SZ(h));
+	if (! table)
+		return;
+
+	// zeroes are empty, unchained head elements
+	memset(table, 0, table_len * SHASH_ELEM_SZ(h));
+
+	// optimistic readers may be in the current table at any time until the
+	// hash is destroyed, so it will have to be kept when it's done with
+	if (h->flags & SHASH_CR_READ_MOSTLY) {
+		shash_retired *r = (shash_retired *) shash_malloc(h, sizeof(shash_retired));
+		if (! r) {
+			shash_free(h, table);
+			return;
+		}
+		r->table = h->table;
+		r->next = (shash_retired *) h->retired;
+		h->retired = r;
+	}
+
+	h->old_table = h->table;
+	h->old_table_len = h->table_len;
+	h->table = table;
+	h->table_len = table_len;
+
+	if (h->flags & SHASH_CR_STATS)	h->stats->resizes++;
+
+	for (uint i=0; i<shash_stripes(h); i++) {
+		h->stripes[i].migrate_pos = 0;
+		h->stripes[i].tombstones = 0;
+	}
+	h->migrate_left = shash_stripes(h);
+}
+
+/**
+ * Release the lock taken by shash_lock() on a stripe. If resize is set, then
+ * first finish or start a resize - in the manylock case, this must be done
+ * holding all the locks, so we drop the one we have first.
+ */
+static void shash_unlock(shash *h, uint stripe, pthread_mutex_t *l, bool resize) {
+	if (resize && (h->flags & SHASH_CR_MT_MANYLOCK)) {
+		shash_write_end(h, stripe);
+		pthread_mutex_unlock(l);
+		shash_lock_all(h);
+		shash_resize(h);
+		shash_unlock_all(h);
+		return;
+	}
+
+	if (resize)
+		shash_resize(h);
+
+	shash_write_end(h, stripe);
+	if (l)     pthread_mutex_unlock(l);
+}
+
+/**
+ * Find a key's element. If e_prev is not NULL, it's set to the element before
+ * it in the bucket's chain (NULL if it's the head, or with open addressing).
+ * Caller holds the hash's stripe lock.
+ */
+static shash_elem * shash_find(shash *h, uint hash, void *key, shash_elem **e_prev) {
+	shash_elem *prev = 0;
+	shash_elem *e;
+
+	if (h->flags & SHASH_CR_OPEN) {
+		e = shash_open_find(h, hash, key);
+		goto Out;
+	}
+
+	e = shash_bucket(h, hash);
+
+	if (e->in_use == false) {
+		e = 0;
+		goto Out;
+	}
+
+	while (e) {
+		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0)
+			break;
+		prev = e;
+		e = e->next;
+	}
+
+Out:
+	if (e_prev)	*e_prev = prev;
+	return e;
+}
+
+/**
+ * The body of shash_put() - caller holds the stripe's lock.
+ */
+static int shash_put_locked(shash *h, uint stripe, uint hash, void *key, void *value) {
+	if (h->flags & SHASH_CR_OPEN) {
+		return shash_open_put(h, stripe, hash, key, value, false);
+	}
+
+	shash_elem *e = shash_bucket(h, hash);
+
+	// most common case should be insert into empty bucket, special case
+	if ( e->in_use == false )
+		goto Copy;
+
+	shash_elem *e_head = e;
+
+	// This loop might be skippable if you know the key is not already in the hash
+	// (like, you just searched and it's single-threaded)	
+	while (e) {
+		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
+			memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
+			return(SHASH_OK);
+		}
+		e = e->next;
+	}
+
+	e = shash_elem_alloc(h, stripe);
+	if (!e) {
+		return (SHASH_ERR);
+	}
+
+	shash_stats_collision(h, stripe);
+	e->next = e_head->next;
+	e_head->next = e;
+	
+Copy:
+	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
+	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
+	e->in_use = true;
+	shash_elements_add(h, stripe, 1);
+	return(SHASH_OK);	
+}
+
+/**
+ * The body of shash_get() - caller holds the hash's stripe lock.
+ */
+static int shash_get_locked(shash *h, uint hash, void *key, void *value) {
+	shash_elem *e = shash_find(h, hash, key, 0);
+
+	if (! e) {
+		return(SHASH_ERR_NOTFOUND);
+	}
+
+	if (NULL != value)
+	    memcpy(value, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
+	return(SHASH_OK);
+}
+
+/**
+ * Read-mostly - has the stripe changed since an optimistic read began?
+ */
+static inline bool shash_read_stale(shash_stripe *st, uint32_t seq) {
+	SHASH_READ_BARRIER();
+	return SHASH_READ_ONCE(st->seq) != seq;
+}
+
+/**
+ * Read-mostly - the body of an optimistic shash_get(), which may see the
+ * stripe in any state a writer leaves it in along the way. So the tables
+ * are only followed after checking that the fields locating them haven't
+ * changed, every step along a chain is checked in case the chain changed
+ * (or even looped), and any value found is only good if the stripe hasn't
+ * changed by the end. Readers can't hit freed memory, as a read-mostly hash
+ * keeps its old tables and deleted elements.
+ * Returns SHASH_READ_RETRY if a writer got in the way.
+ */
+static int shash_read(shash *h, shash_stripe *st, uint32_t seq, uint hash, void *key, void *value) {
+	void *table = SHASH_READ_ONCE(h->table);
+	uint table_len = SHASH_READ_ONCE(h->table_len);
+	void *old_table = SHASH_READ_ONCE(h->old_table);
+	uint old_table_len = SHASH_READ_ONCE(h->old_table_len);
+	bool migrated = SHASH_READ_ONCE(st->migrate_pos) == old_table_len / shash_stripes(h);
+
+	if (shash_read_stale(st, seq) || table_len == 0 || (old_table && old_table_len == 0))
+		return(SHASH_READ_RETRY);
+
+	shash_elem *e = 0;
+
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_elem *region;
+		uint m;
+		uint j;
+
+		if (old_table && ! migrated) {
+			j = shash_open_locate(h, old_table, old_table_len, hash, &region, &m);
+			e = shash_open_probe_region(h, region, m, j, key, 0);
+		}
+		if (! e) {
+			j = shash_open_locate(h, table, table_len, hash, &region, &m);
+			e = shash_open_probe_region(h, region, m, j, key, 0);
+		}
+	}
+	else {
+		e = SHASH_ELEM_AT(h, table, hash % table_len);
+		if (old_table) {
+			uint i = hash % old_table_len;
+			if (i / shash_stripes(h) >= SHASH_READ_ONCE(st->migrate_pos))
+				e = SHASH_ELEM_AT(h, old_table, i);
+		}
+
+		if (! SHASH_READ_ONCE(e->in_use))
+			e = 0;
+
+		while (e) {
+			if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0)
+				break;
+			e = SHASH_READ_ONCE(e->next);
+			if (shash_read_stale(st, seq))
+				return(SHASH_READ_RETRY);
+		}
+	}
+
+	if (e && NULL != value)
+		memcpy(value, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
+
+	if (shash_read_stale(st, seq))
+		return(SHASH_READ_RETRY);
+
+	return(e ? SHASH_OK : SHASH_ERR_NOTFOUND);
+}
+
+/**
+ * Read-mostly - try shash_get() without the lock. Gives up, returning
+ * SHASH_READ_RETRY, if writers keep getting in the way. A read that turns
+ * out stale may have copied another element's value, so values are read
+ * into a local buffer, and only copied out once found.
+ */
+static int shash_get_optimistic(shash *h, uint stripe, uint hash, void *key, void *value) {
+	shash_stripe *st = &h->stripes[stripe];
+	void *buf = value ? alloca(h->value_len) : 0;
+
+	for (int i=0; i<SHASH_READ_RETRIES; i++) {
+		uint32_t seq = SHASH_READ_ONCE(st->seq);
+		// a writer is in the stripe
+		if (seq & 1)
+			continue;
+		SHASH_READ_BARRIER();
+
+		int rv = shash_read(h, st, seq, hash, key, buf);
+		if (rv == SHASH_OK && value)
+			memcpy(value, buf, h->value_len);
+		if (rv != SHASH_READ_RETRY)
+			return(rv);
+	}
+
+	return(SHASH_READ_RETRY);
+}
+
+/**
+ * Get or put a batch of keys, SHASH_BATCH_SZ at a time. For each chunk, we
+ * hash all the keys and prefetch their buckets before taking any lock, then
+ * handle the keys grouped by stripe, so that each stripe's lock is taken
+ * once per chunk.
+ */
+static int shash_many(shash *h, uint8_t *keys, uint8_t *values, uint n_keys, int *results, bool put) {
+	uint hashes[SHASH_BATCH_SZ];
+	uint stripes[SHASH_BATCH_SZ];
+	uint order[SHASH_BATCH_SZ];
+	uint counts[SHASH_BATCH_SZ + 1];
+	uint n_stripes = shash_stripes(h);
+	int rv = SHASH_OK;
+
+	for (uint base = 0; base < n_keys; base += SHASH_BATCH_SZ) {
+		uint n = n_keys - base < SHASH_BATCH_SZ ? n_keys - base : SHASH_BATCH_SZ;
+
+		for (uint i = 0; i < n; i++) {
+			uint hash = h->h_fn(keys + ((size_t) (base + i) * h->key_len));
+			hashes[i] = hash;
+			stripes[i] = shash_stripe_of(h, hash);
+			order[i] = i;
+
+			// we don't hold the lock, so the table may be changing under us -
+			// but this is only a hint, and prefetching a stale address is harmless
+			__builtin_prefetch((h->flags & SHASH_CR_OPEN) ?
+					shash_open_home(h, h->table, h->table_len, hash) :
+					SHASH_ELEM_AT(h, h->table, hash % h->table_len));
+		}
+
+		// With no more stripes than keys in the chunk, sort the keys by stripe
+		// (a counting sort, which keeps keys in order within a stripe). With
+		// more, a chunk mostly has one key per stripe, so sorting doesn't pay,
+		// and we only share the lock between neighboring keys.
+		if (n_stripes > 1 && n_stripes <= SHASH_BATCH_SZ) {
+			memset(counts, 0, sizeof(uint) * (n_stripes + 1));
+			for (uint i = 0; i < n; i++) {
+				counts[stripes[i] + 1]++;
+			}
+			for (uint i = 1; i <= n_stripes; i++) {
+				counts[i] += counts[i - 1];
+			}
+			for (uint i = 0; i < n; i++) {
+				order[counts[stripes[i]]++] = i;
+			}
+		}
+
+		for (uint g = 0; g < n; ) {
+			uint stripe = stripes[order[g]];
+
+			pthread_mutex_t *l = shash_lock(h, stripe);
+			bool resize = shash_migrate(h, stripe);
+
+			for ( ; g < n && stripes[order[g]] == stripe; g++) {
+				uint k = base + order[g];
+				void *key = keys + ((size_t) k * h->key_len);
+				void *value = values ? values + ((size_t) k * h->value_len) : NULL;
+				int r;
+
+				// an open stripe's region has only so many slots, so grow it
+				// before each put, as a run of shash_put() calls would
+				if (put && (h->flags & SHASH_CR_OPEN) && shash_needs_grow(h, stripe)) {
+					shash_unlock(h, stripe, l, true);
+					l = shash_lock(h, stripe);
+					resize = shash_migrate(h, stripe);
+				}
+
+				if (put) {
+					r = shash_put_locked(h, stripe, hashes[order[g]], key, value);
+					if (r != SHASH_OK)
+						rv = SHASH_ERR;
+				}
+				else {
+					r = shash_get_locked(h, hashes[order[g]], key, value);
+				}
+
+				if (results)
+					results[k] = r;
+			}
+
+			shash_unlock(h, stripe, l, resize || (put && shash_needs_grow(h, stripe)));
+		}
+	}
+
+	return(rv);
+}
+
+/**
+ * Open addressing - free a slot. It must become a tombstone, unless no probe
+ * carries on past it - i.e. the next slot of the region was never used - in
+ * which case it, and any tombstones just before it, can be left empty.
+ */
+static void shash_open_unuse(shash *h, uint stripe, shash_elem *e) {
+	uint m = h->table_len / shash_stripes(h);
+	uint8_t *region = (uint8_t *) shash_open_region(h, h->table, h->table_len, stripe);
+	size_t sz = SHASH_ELEM_SZ(h);
+
+	e->in_use = false;
+
+	// slots of the old table are just left as tombstones
+	if ((uint8_t *) e < region || (uint8_t *) e >= region + (m * sz)) {
+		e->deleted = true;
+		return;
+	}
+
+	uint j = ((uint8_t *) e - region) / sz;
+	shash_elem *next = SHASH_ELEM_AT(h, region, j + 1 == m ? 0 : j + 1);
+
+	if (next->in_use || next->deleted) {
+		e->deleted = true;
+		h->stripes[stripe].tombstones++;
+		return;
+	}
+
+	e->deleted = false;
+
+	for (uint k=1; k<m; k++) {
+		j = j ? j - 1 : m - 1;
+		shash_elem *prev = SHASH_ELEM_AT(h, region, j);
+		if (! prev->deleted)
+			break;
+		prev->deleted = false;
+		if (h->stripes[stripe].tombstones)	h->stripes[stripe].tombstones--;
+	}
+}
+
+/**
+ * Mark a head element (or open addressing slot) unused.
+ */
+static inline void shash_elem_unuse(shash *h, uint stripe, shash_elem *e) {
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_open_unuse(h, stripe, e);
+	}
+	else {
+		e->in_use = false;
+	}
+}
+
 /**
- * A general purpose hashtable implementation
- * Good at multithreading
- * Just, hopefully, the last reasonable hash table you'll ever need
+ * Unlink and free an element found in a bucket's chain. Element e_prev is
+ * the element before it, or NULL if e is the head.
  */
+static void shash_delete_elem(shash *h, uint stripe, shash_elem *e, shash_elem *e_prev) {
+	// patchup pointers & free element if not head
+	if (e_prev) {
+		e_prev->next = e->next;
+		shash_elem_free(h, stripe, e);
+	}
+	// am at head - more complicated
+	else {
+		// at head with no next - easy peasy!
+		// (with open addressing, always here - the slot becomes a tombstone)
+		if (0 == e->next) {
+			shash_elem_unuse(h, stripe, e);
+		}
+		// at head with a next - more complicated
+		else {
+			shash_elem *_t = e->next;
+			memcpy(e, e->next, SHASH_ELEM_SZ(h) );
+			shash_elem_free(h, stripe, _t);
+		}
+	}
+	shash_elements_add(h, stripe, -1);
+}
 
-#include <pthread.h>
-#include <stddef.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <string.h>
+/**
+ * Call the function over every element of a bucket, deleting the elements
+ * for which it returns SHASH_REDUCE_DELETE if del is set, and adding the
+ * number deleted to *deleted - the caller fixes up the element count.
+ * Returns the first other non-zero return value of the function.
+ */
+static int shash_reduce_bucket(shash *h, uint stripe, shash_elem *list_he, shash_reduce_fn reduce_fn, void *udata, bool del, uint32_t *deleted) {
+	shash_elem *prev_he = 0;
 
-#include <citrusleaf/cf_shash.h>
-#include <citrusleaf/cf_alloc.h>
+	while (list_he) {
+		// This kind of structure might have the head as an empty element,
+		// that's a signal to move along
+		if (list_he->in_use == false)
+			break;
+
+		int rv = reduce_fn( SHASH_ELEM_KEY_PTR(h, list_he), SHASH_ELEM_VALUE_PTR(h, list_he), udata);
+
+		// Delete is requested
+		// Leave the pointers in a "next" state
+		if (del && rv == SHASH_REDUCE_DELETE) {
+
+			(*deleted)++;
+
+			// patchup pointers & free element if not head
+			if (prev_he) {
+				prev_he->next = list_he->next;
+				shash_elem_free(h, stripe, list_he);
+				list_he = prev_he->next;
+			}
+			// am at head - more complicated
+			else {
+				// at head with no next - easy peasy!
+				// (with open addressing, always here - the slot becomes a
+				// tombstone, counted by the caller)
+				if (0 == list_he->next) {
+					list_he->in_use = false;
+					list_he->deleted = (h->flags & SHASH_CR_OPEN) != 0;
+					list_he = 0;
+				}
+				// at head with a next - more complicated -
+				// copy next into current and free next
+				// (the old trick of how to delete from a singly
+				// linked list without a prev pointer)
+				// Somewhat confusingly, prev_he stays 0
+				// and list_he stays where it is
+				else {
+					shash_elem *_t = list_he->next;
+					memcpy(list_he, list_he->next, SHASH_ELEM_SZ(h) );
+					shash_elem_free(h, stripe, _t);
+				}
+			}
+		}
+		else if (0 != rv) {
+			return(rv);
+		}
+		else { // don't delete, just forward everything
+			prev_he = list_he;
+			list_he = list_he->next;
+		}
+	}
+
+	return(0);
+}
+
+/**
+ * Account for elements deleted by a reduce - with open addressing, each
+ * left a tombstone.
+ */
+static inline void shash_reduce_deleted(shash *h, uint stripe, uint32_t deleted) {
+	shash_elements_add(h, stripe, -(int32_t)deleted);
+	if (h->flags & SHASH_CR_OPEN) {
+		h->stripes[stripe].tombstones += deleted;
+	}
+}
+
+/**
+ * Call the function over every element covered by a stripe - the old
+ * buckets not yet migrated, and the buckets of the current table.
+ * Caller holds the stripe's lock.
+ */
+static int shash_reduce_stripe(shash *h, uint stripe, shash_reduce_fn reduce_fn, void *udata, bool del) {
+	uint n = shash_stripes(h);
+	uint32_t deleted = 0;
+	int rv = 0;
+
+	// chained buckets are interleaved across the stripes, while open
+	// addressing slots are in a contiguous region per stripe
+	bool open = (h->flags & SHASH_CR_OPEN) != 0;
+	uint step = open ? 1 : n;
+
+	if (del)
+		shash_write_begin(h, stripe);
+
+	if (h->old_table) {
+		uint m = h->old_table_len / n;
+		uint start = open ? stripe * m : stripe;
+		uint end = open ? start + m : h->old_table_len;
+		for (uint i = start + (h->stripes[stripe].migrate_pos * step); i < end; i += step) {
+			rv = shash_reduce_bucket(h, stripe, SHASH_ELEM_AT(h, h->old_table, i), reduce_fn, udata, del, &deleted);
+			if (0 != rv)
+				goto Out;
+		}
+	}
+
+	uint m = h->table_len / n;
+	uint start = open ? stripe * m : stripe;
+	uint end = open ? start + m : h->table_len;
+	for (uint i = start; i < end; i += step) {
+		rv = shash_reduce_bucket(h, stripe, SHASH_ELEM_AT(h, h->table, i), reduce_fn, udata, del, &deleted);
+		if (0 != rv)
+			goto Out;
+	}
+
+Out:
+	shash_reduce_deleted(h, stripe, deleted);
+	if (del)
+		shash_write_end(h, stripe);
+	return(rv);
+}
+
+/**
+ * Call the function over every element of a range of buckets, numbered
+ * across the old table (if any) then the current table. Migrated old
+ * buckets are empty, so they need no special treatment.
+ * Caller holds the big lock - used to split a single stripe among threads.
+ */
+static int shash_reduce_range(shash *h, uint start, uint end, shash_reduce_fn reduce_fn, void *udata, bool del, uint32_t *deleted) {
+	uint old_len = h->old_table ? h->old_table_len : 0;
+
+	for (uint i = start; i < end; i++) {
+		shash_elem *he = i < old_len ? SHASH_ELEM_AT(h, h->old_table, i) : SHASH_ELEM_AT(h, h->table, i - old_len);
+		int rv = shash_reduce_bucket(h, 0, he, reduce_fn, udata, del, deleted);
+		if (0 != rv)
+			return(rv);
+	}
+
+	return(0);
+}
+
+static void * shash_reduce_worker_fn(void *arg) {
+	shash_reduce_worker *w = (shash_reduce_worker *) arg;
+	shash_reduce_job *job = w->job;
+	shash *h = job->h;
+
+	while (0 == cf_atomic32_get(job->rv)) {
+		uint unit = (uint) cf_atomic32_incr(&job->next_unit) - 1;
+		if (unit >= job->n_units)
+			break;
+
+		int rv;
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_lock(&h->stripes[unit].lock);
+			rv = shash_reduce_stripe(h, unit, job->reduce_fn, w->udata, job->del);
+			pthread_mutex_unlock(&h->stripes[unit].lock);
+		}
+		else {
+			uint start = unit * SHASH_REDUCE_CHUNK;
+			uint end = start + SHASH_REDUCE_CHUNK < job->n_buckets ? start + SHASH_REDUCE_CHUNK : job->n_buckets;
+			rv = shash_reduce_range(h, start, end, job->reduce_fn, w->udata, job->del, &w->deleted);
+		}
+
+		// the first thread to stop the reduce sets the return value
+		if (0 != rv)
+			cf_atomic32_cas(&job->rv, 0, rv);
+	}
+
+	return 0;
+}
+
+static int shash_reduce_parallel_internal(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_sz, shash_combine_fn combine_fn, uint n_threads, bool del) {
+	if (n_threads == 0 || (udata_sz && ! combine_fn))
+		return(SHASH_ERR);
+
+	shash_reduce_worker *workers = (shash_reduce_worker *) shash_malloc(h, n_threads * (sizeof(shash_reduce_worker) + udata_sz));
+	if (! workers)
+		return(SHASH_ERR);
+
+	uint8_t *udatas = (uint8_t *) (workers + n_threads);
+
+	shash_reduce_job job;
+	job.h = h;
+	job.reduce_fn = reduce_fn;
+	job.del = del;
+	job.next_unit = 0;
+	job.rv = 0;
+
+	// a single stripe is held under the big lock for the whole reduce, as
+	// in shash_reduce(), and its buckets are split among the threads
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock(&h->biglock);
+	}
+
+	if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		job.n_buckets = 0;
+		job.n_units = h->n_locks;
+	}
+	else {
+		job.n_buckets = (h->old_table ? h->old_table_len : 0) + h->table_len;
+		job.n_units = (job.n_buckets + SHASH_REDUCE_CHUNK - 1) / SHASH_REDUCE_CHUNK;
+		if (del)
+			shash_write_begin(h, 0);
+	}
+
+	if (n_threads > job.n_units)
+		n_threads = job.n_units ? job.n_units : 1;
+
+	for (uint i=0; i<n_threads; i++) {
+		shash_reduce_worker *w = &workers[i];
+		w->job = &job;
+		w->deleted = 0;
+		w->started = false;
+		if (udata_sz) {
+			w->udata = udatas + (i * udata_sz);
+			memcpy(w->udata, udata, udata_sz);
+		}
+		else {
+			w->udata = udata;
+		}
+	}
+
+	// the calling thread is worker 0 - if a thread can't be started, the
+	// others just end up with more of the work
+	for (uint i=1; i<n_threads; i++) {
+		workers[i].started = 0 == pthread_create(&workers[i].thread, 0, shash_reduce_worker_fn, &workers[i]);
+	}
+	shash_reduce_worker_fn(&workers[0]);
+
+	uint32_t deleted = 0;
+	for (uint i=0; i<n_threads; i++) {
+		if (workers[i].started) {
+			pthread_join(workers[i].thread, 0);
+		}
+		deleted += workers[i].deleted;
+	}
+
+	if (! (h->flags & SHASH_CR_MT_MANYLOCK)) {
+		shash_reduce_deleted(h, 0, deleted);
+		if (del)
+			shash_write_end(h, 0);
+	}
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_unlock(&h->biglock);
+	}
+
+	if (udata_sz) {
+		for (uint i=0; i<n_threads; i++) {
+			combine_fn(udata, workers[i].udata);
+		}
+	}
+
+	shash_free(h, workers);
+	return((int) job.rv);
+}
+
+/**
+ * Add a chain length (or probe distance) to a histogram.
+ */
+static inline void shash_stats_chain(shash_stats *stats, uint len) {
+	stats->chains[len < SHASH_STATS_CHAIN_BINS ? len : SHASH_STATS_CHAIN_BINS - 1]++;
+	if (len > stats->max_chain)
+		stats->max_chain = len;
+}
+
+/**
+ * Open addressing - add the probe distances of the elements in a stripe's
+ * region of a table to a histogram.
+ */
+static void shash_stats_walk_region(shash *h, void *table, uint table_len, uint stripe, shash_stats *stats) {
+	uint m = table_len / shash_stripes(h);
+	shash_elem *region = shash_open_region(h, table, table_len, stripe);
+
+	for (uint j=0; j<m; j++) {
+		shash_elem *e = SHASH_ELEM_AT(h, region, j);
+		if (e->in_use) {
+			shash_elem *home_region;
+			uint home_m;
+			uint home = shash_open_locate(h, table, table_len, h->h_fn(SHASH_ELEM_KEY_PTR(h, e)), &home_region, &home_m);
+			shash_stats_chain(stats, (j + m - home) % m);
+		}
+	}
+}
+
+/**
+ * Add the chains of a stripe's buckets to a histogram - the old buckets not
+ * yet migrated, and the buckets of the current table.
+ * Caller holds the stripe's lock.
+ */
+static void shash_stats_walk_stripe(shash *h, uint stripe, shash_stats *stats) {
+	uint n = shash_stripes(h);
+
+	if (h->flags & SHASH_CR_OPEN) {
+		if (h->old_table && h->stripes[stripe].migrate_pos < h->old_table_len / n) {
+			shash_stats_walk_region(h, h->old_table, h->old_table_len, stripe, stats);
+		}
+		shash_stats_walk_region(h, h->table, h->table_len, stripe, stats);
+		return;
+	}
+
+	if (h->old_table) {
+		for (uint i = stripe + (h->stripes[stripe].migrate_pos * n); i < h->old_table_len; i += n) {
+			uint len = 0;
+			for (shash_elem *e = SHASH_ELEM_AT(h, h->old_table, i); e && e->in_use; e = e->next)
+				len++;
+			shash_stats_chain(stats, len);
+		}
+	}
+
+	for (uint i = stripe; i < h->table_len; i += n) {
+		uint len = 0;
+		for (shash_elem *e = SHASH_ELEM_AT(h, h->table, i); e && e->in_use; e = e->next)
+			len++;
+		shash_stats_chain(stats, len);
+	}
+}
+
+/**
+ * Free the chained elements of every bucket of a table, and mark the head
+ * elements unused.
+ */
+static void shash_clear_table(shash *h, void *table, uint table_len) {
+	shash_elem *e_table = table;
+	for (uint i=0;i<table_len;i++) {
+		if (e_table->next) {
+			shash_elem *e = e_table->next;
+			shash_elem *t;
+			while (e) {
+				t = e->next;
+				shash_free(h, e);
+				e = t;
+			}
+			// The head element of each hash bucket overflow chain also
+			// contains data. But we should not free it as it is 
+			// allocated as part of the overall hash table. So, just mark
+			// it so that it is re-used.
+			e_table->next = NULL;
+		}
+		e_table->in_use = false;
+		e_table->deleted = false;
+		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
+	}
+}
 
 /******************************************************************************
  * FUNCTIONS
@@ -52,71 +1655,87 @@ int shash_create(shash **h_r, shash_hash_fn h_fn, uint32_t key_len, uint32_t val
 	shash *h;
 	bool mem_tracked = !(flags & SHASH_CR_UNTRACKED);
 
+	if ((flags & SHASH_CR_MT_BIGLOCK) && (flags & SHASH_CR_MT_MANYLOCK)) {
+		*h_r = 0;
+		return(SHASH_ERR);
+	}
+
+	// optimistic readers need the writers to hold off each other
+	if ((flags & SHASH_CR_READ_MOSTLY) && ! (flags & (SHASH_CR_MT_BIGLOCK | SHASH_CR_MT_MANYLOCK))) {
+		*h_r = 0;
+		return(SHASH_ERR);
+	}
+
+	// a manylock open table is split into a region per lock, and a region
+	// can fill up long before the table does, unless the table grows
+	if ((flags & SHASH_CR_OPEN) && (flags & SHASH_CR_MT_MANYLOCK) && ! (flags & SHASH_CR_RESIZE)) {
+		*h_r = 0;
+		return(SHASH_ERR);
+	}
+
 	h = (shash *) (mem_tracked ? cf_malloc(sizeof(shash)) : malloc(sizeof(shash)));
 	if (!h)	return(SHASH_ERR);
 
 	h->elements = 0;
-	h->table_len = sz;
 	h->key_len = key_len;
 	h->value_len = value_len;
 	h->flags = flags;
 	h->h_fn = h_fn;
+	h->old_table = 0;
+	h->old_table_len = 0;
+	h->migrate_left = 0;
+	h->stripes = 0;
+	h->n_locks = 0;
+	h->retired = 0;
+	h->stats = 0;
 
-	if ((flags & SHASH_CR_MT_BIGLOCK) && (flags & SHASH_CR_MT_MANYLOCK)) {
-		*h_r = 0;
-		return(SHASH_ERR);
+	if (flags & SHASH_CR_MT_MANYLOCK) {
+		h->n_locks = sz < SHASH_N_LOCKS ? sz : SHASH_N_LOCKS;
+		sz = shash_round_len(sz, h->n_locks);
 	}
-	
-	h->table = (shash_elem *) (mem_tracked ? cf_malloc(sz * SHASH_ELEM_SZ(h)) : malloc(sz * SHASH_ELEM_SZ(h)));
+
+	h->table_len = sz;
+	h->table = shash_table_create(h, sz);
 
 	if (!h->table) {
-		if (mem_tracked) 
-		  cf_free(h);
-		else
-		  free(h);
+		shash_free(h, h);
 		*h_r = 0;
 		return(SHASH_ERR);
 	}
-	
-	shash_elem *table = h->table;
-	for (uint i=0;i<sz;i++) {
-		table->in_use = false;
-		table->next = 0;
-		// next element in head table
-		table = (shash_elem *) (((uint8_t *)table) + SHASH_ELEM_SZ(h));
-	}
-	
-	if (flags & SHASH_CR_MT_BIGLOCK) {
-		if (0 != pthread_mutex_init ( &h->biglock, 0) ) {
-			if (mem_tracked) {
-				cf_free(h->table);
-				cf_free(h);
-			} else {
-				free(h->table);
-				free(h);
-			}
+
+	if (flags & (SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE | SHASH_CR_OPEN | SHASH_CR_READ_MOSTLY)) {
+		h->stripes = shash_stripes_create(h, shash_stripes(h));
+		if (! h->stripes) {
+			shash_free(h, h->table);
+			shash_free(h, h);
+			*h_r = 0;
 			return(SHASH_ERR);
 		}
 	}
-	else
-		memset( (void *) &h->biglock, 0, sizeof( h->biglock ) );
 	
-	if (flags & SHASH_CR_MT_MANYLOCK) {
-		h->lock_table = (pthread_mutex_t *) (mem_tracked ? cf_malloc( sizeof(pthread_mutex_t) * sz) : malloc( sizeof(pthread_mutex_t) * sz));
-		if (! h->lock_table) {
-			if (mem_tracked)
-			  cf_free(h);
-			else
-			  free(h);
+	if (flags & SHASH_CR_STATS) {
+		h->stats = shash_stats_create(h, shash_stripes(h));
+		if (! h->stats) {
+			if (h->stripes) shash_stripes_destroy(h, h->stripes, shash_stripes(h));
+			shash_free(h, h->table);
+			shash_free(h, h);
 			*h_r = 0;
 			return(SHASH_ERR);
 		}
-		for (uint i=0;i<sz;i++) {
-			pthread_mutex_init( &(h->lock_table[i]), 0 );
+	}
+
+	if (flags & SHASH_CR_MT_BIGLOCK) {
+		if (0 != pthread_mutex_init ( &h->biglock, 0) ) {
+			if (h->stats) shash_free(h, h->stats);
+			if (h->stripes) shash_stripes_destroy(h, h->stripes, shash_stripes(h));
+			shash_free(h, h->table);
+			shash_free(h, h);
+			*h_r = 0;
+			return(SHASH_ERR);
 		}
 	}
 	else
-		h->lock_table = 0;
+		memset( (void *) &h->biglock, 0, sizeof( h->biglock ) );
 
 	*h_r = h;
 
@@ -124,124 +1743,125 @@ int shash_create(shash **h_r, shash_hash_fn h_fn, uint32_t key_len, uint32_t val
 }
 
 /**
- * If MANYLOCK, then the elements counter will be wrong because there's no single
- * lock to use to protect. We've got a choice to use an atomic to make sure
- * the get_size call is fast in that case (thus slowing down every access), or
- * running the list and make get_size slow.
- * Choose making get_size slow in the case, but retaining parallelism
+ * Only valid before the table is used. With resize, the table can't have
+ * grown yet, so if it is empty, there's no migration state to keep.
  */
-uint32_t shash_get_size(shash *h) {
-    uint32_t elements = 0;
-	
-	if (h->flags & SHASH_CR_MT_MANYLOCK) {
-        
-        for (uint i=0; i<h->table_len ; i++) {
-            
-            pthread_mutex_t *l = &(h->lock_table[i]);
-            pthread_mutex_lock( l );
-            
-            shash_elem *list_he = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * i));
-            while (list_he) {
-                
-                // not in use is common at head pointer - unused bucket
-                if (list_he->in_use == false) 
-                    break;
-                
-                elements++;
-                
-                list_he = list_he->next;
-            }
-    
-            pthread_mutex_unlock(l);
-    
-        }
-
-    }
-    
-    else if (h->flags & SHASH_CR_MT_BIGLOCK) {
-    	pthread_mutex_lock(&h->biglock);
-    	elements = h->elements;
-    	pthread_mutex_unlock(&h->biglock);
-    }
-    else {
-    	elements = h->elements;
-    }
-    
-	return(elements);
-}
+int shash_set_nlocks(shash *h, uint n_locks) {
+	if (! (h->flags & SHASH_CR_MT_MANYLOCK) || n_locks == 0 || h->old_table) {
+		return(SHASH_ERR);
+	}
 
-int shash_put(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+	shash_elem *e_table = h->table;
+	for (uint i=0;i<h->table_len;i++) {
+		if (e_table->in_use) {
+			return(SHASH_ERR);
+		}
+		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
+	}
 
-	// Calculate hash
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint table_len = shash_round_len(h->table_len, n_locks);
+	if (table_len < h->table_len) {
+		return(SHASH_ERR);
+	}
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
+	shash_stripe *stripes = shash_stripes_create(h, n_locks);
+	if (! stripes) {
+		return(SHASH_ERR);
 	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+
+	struct shash_stats_data_s *stats = 0;
+	if (h->flags & SHASH_CR_STATS) {
+		stats = shash_stats_create(h, n_locks);
+		if (! stats) {
+			shash_stripes_destroy(h, stripes, n_locks);
+			return(SHASH_ERR);
+		}
 	}
-	if (l)     pthread_mutex_lock( l );
-		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
 
-	// most common case should be insert into empty bucket, special case
-	if ( e->in_use == false )
-		goto Copy;
+	if (table_len != h->table_len) {
+		void *table = shash_table_create(h, table_len);
+		if (! table) {
+			if (stats) shash_free(h, stats);
+			shash_stripes_destroy(h, stripes, n_locks);
+			return(SHASH_ERR);
+		}
+		shash_free(h, h->table);
+		h->table = table;
+		h->table_len = table_len;
+	}
 
-	shash_elem *e_head = e;
+	shash_stripes_destroy(h, h->stripes, h->n_locks);
+	h->stripes = stripes;
+	h->n_locks = n_locks;
 
-	// This loop might be skippable if you know the key is not already in the hash
-	// (like, you just searched and it's single-threaded)	
-	while (e) {
-		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
-			if (l)     pthread_mutex_unlock(l);
-			return(SHASH_OK);
-		}
-		e = e->next;
+	if (stats) {
+		shash_free(h, h->stats);
+		h->stats = stats;
 	}
 
-	e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
-	if (!e) {
-		if (l)     pthread_mutex_unlock( l );
-		return (SHASH_ERR);
+	return(SHASH_OK);
+}
+
+/**
+ * If MANYLOCK, then there's no single lock to protect an elements counter.
+ * Instead, each stripe counts its own elements under its lock, and here we
+ * add up the counts without taking any of the locks. That's an estimate,
+ * but with many locks there's no real size at any given instant anyway.
+ */
+uint32_t shash_get_size(shash *h) {
+	uint32_t elements = 0;
+	
+	if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		elements = shash_elements(h);
+	}
+	else if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock(&h->biglock);
+		elements = h->elements;
+		pthread_mutex_unlock(&h->biglock);
+	}
+	else {
+		elements = h->elements;
 	}
+	
+	return(elements);
+}
+
+int shash_put(shash *h, void *key, void *value) {
+	// Calculate hash
+	uint hash = h->h_fn(key);
+	uint stripe = shash_stripe_of(h, hash);
 
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
-	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
-	e->in_use = true;
-	h->elements++;
-	if (l)	pthread_mutex_unlock( l );
-	return(SHASH_OK);	
+	pthread_mutex_t *l = shash_lock(h, stripe);
+	bool resize = shash_migrate(h, stripe);
+	int rv = shash_put_locked(h, stripe, hash, key, value);
+	shash_unlock(h, stripe, l, resize || shash_needs_grow(h, stripe));
+	return(rv);
+}
+
+/**
+ * Put the keys a chunk at a time - see shash_many().
+ */
+int shash_put_many(shash *h, void *keys, void *values, uint n_keys, int *results) {
+	return shash_many(h, keys, values, n_keys, results, true);
 }
 
 // Fail if there's already a value there
 
 int shash_put_unique(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
 	// Calculate hash
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint stripe = shash_stripe_of(h, hash);
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+	pthread_mutex_t *l = shash_lock(h, stripe);
+	bool resize = shash_migrate(h, stripe);
+
+	if (h->flags & SHASH_CR_OPEN) {
+		int rv = shash_open_put(h, stripe, hash, key, value, true);
+		shash_unlock(h, stripe, l, resize || shash_needs_grow(h, stripe));
+		return(rv);
 	}
-	if (l)     pthread_mutex_lock( l );
 		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_bucket(h, hash);
 
 	// most common case should be insert into empty bucket, special case
 	if ( e->in_use == false ) {
@@ -252,18 +1872,19 @@ int shash_put_unique(shash *h, void *key, void *value) {
 
 	while (e) {
 		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			if (l)     pthread_mutex_unlock(l);
+			shash_unlock(h, stripe, l, resize);
 			return(SHASH_ERR_FOUND);
 		}
 		e = e->next;
 	}
 
-	e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
+	e = shash_elem_alloc(h, stripe);
 	if (!e) {
-		if (l)     pthread_mutex_unlock( l );
+		shash_unlock(h, stripe, l, resize);
 		return (SHASH_ERR);
 	}
 
+	shash_stats_collision(h, stripe);
 	e->next = e_head->next;
 	e_head->next = e;
 	
@@ -271,8 +1892,8 @@ Copy:
 	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
 	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
 	e->in_use = true;
-	h->elements++;
-	if (l)	pthread_mutex_unlock( l );
+	shash_elements_add(h, stripe, 1);
+	shash_unlock(h, stripe, l, resize || shash_needs_grow(h, stripe));
 	return(SHASH_OK);	
 
 }
@@ -283,33 +1904,32 @@ Copy:
  * presence of the key is not searched for.
  */
 int shash_put_duplicate(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
 	// Calculate hash
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint stripe = shash_stripe_of(h, hash);
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+	pthread_mutex_t *l = shash_lock(h, stripe);
+	bool resize = shash_migrate(h, stripe);
+
+	if (h->flags & SHASH_CR_OPEN) {
+		int rv = shash_open_insert(h, stripe, hash, key, value);
+		shash_unlock(h, stripe, l, resize || shash_needs_grow(h, stripe));
+		return(rv);
 	}
-	if (l)     pthread_mutex_lock( l );
 		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_bucket(h, hash);
 	shash_elem *e_head = e;
 	// most common case should be insert into empty bucket, special case
 	if ( e->in_use == false )
 		goto Copy;
 
-	e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
+	e = shash_elem_alloc(h, stripe);
 	if (!e) {
-		if (l)     pthread_mutex_unlock( l );
+		shash_unlock(h, stripe, l, resize);
 		return (SHASH_ERR);
 	}
 
+	shash_stats_collision(h, stripe);
 	e->next = e_head->next;
 	e_head->next = e;
 	
@@ -317,48 +1937,44 @@ Copy:
 	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
 	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
 	e->in_use = true;
-	h->elements++;
-	if (l)	pthread_mutex_unlock( l );
+	shash_elements_add(h, stripe, 1);
+	shash_unlock(h, stripe, l, resize || shash_needs_grow(h, stripe));
 	return(SHASH_OK);	
 }
 
 int shash_get(shash *h, void *key, void *value) {
-	int rv = SHASH_ERR;
-
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint stripe = shash_stripe_of(h, hash);
 
-	pthread_mutex_t *l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+	if (h->flags & SHASH_CR_READ_MOSTLY) {
+		int rv = shash_get_optimistic(h, stripe, hash, key, value);
+		if (rv != SHASH_READ_RETRY)
+			return(rv);
 	}
-	if (l)     pthread_mutex_lock( l );
 
-	shash_elem *e = (shash_elem *) (((byte *)h->table) + (SHASH_ELEM_SZ(h) * hash));
-
-	if (e->in_use == false) {
-		rv = SHASH_ERR_NOTFOUND;
-		goto Out;
-	}
+	pthread_mutex_t *l = shash_lock(h, stripe);
+	bool resize = shash_migrate(h, stripe);
+	int rv = shash_get_locked(h, hash, key, value);
+	shash_unlock(h, stripe, l, resize);
+	return(rv);
+}
 
-	do {
-		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			if (NULL != value)
-			    memcpy(value, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
-			rv = SHASH_OK; 
-			goto Out;
+/**
+ * Get the keys a chunk at a time - see shash_many(). In a read-mostly hash,
+ * there are no locks to share, so just get the keys one by one.
+ */
+int shash_get_many(shash *h, void *keys, void *values, uint n_keys, int *results) {
+	if (h->flags & SHASH_CR_READ_MOSTLY) {
+		for (uint i = 0; i < n_keys; i++) {
+			int r = shash_get(h, (uint8_t *) keys + ((size_t) i * h->key_len),
+					values ? (uint8_t *) values + ((size_t) i * h->value_len) : NULL);
+			if (results)
+				results[i] = r;
 		}
-		e = e->next;
-	} while (e);
-	rv = SHASH_ERR_NOTFOUND;
-
-Out:
-	if (l) pthread_mutex_unlock(l);
+		return(SHASH_OK);
+	}
 
-	return(rv);
+	return shash_many(h, keys, values, n_keys, results, false);
 }
 
 /**
@@ -370,36 +1986,23 @@ int shash_get_vlock(shash *h, void *key, void **value, pthread_mutex_t **vlock)
 	int rv = SHASH_ERR;
 	
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
+	// no migrating here - the old table can't be freed while the caller
+	// holds the lock, so leave that to other calls - and as nothing changes
+	// here, no need to hold off optimistic readers, as shash_lock() would
+	pthread_mutex_t *l = shash_stripe_lock(h, shash_stripe_of(h, hash));
+	if (l)	pthread_mutex_lock(l);
 	
-	shash_elem *e = (shash_elem *) ( ((byte *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_find(h, hash, key, 0);
 
-	if (e->in_use == false) {
+	if (e) {
+		*value = SHASH_ELEM_VALUE_PTR(h, e);
+		rv = SHASH_OK;
+	}
+	else {
 		rv = SHASH_ERR_NOTFOUND;
-		goto Out;
 	}
 	
-	do {
-		if ( memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			*value = SHASH_ELEM_VALUE_PTR(h, e);
-			rv = SHASH_OK; 
-			goto Out;
-		}
-		e = e->next;
-	} while (e);
-	
-	rv = SHASH_ERR_NOTFOUND;
-	
-Out:
 	if (l) {
 		if (rv == SHASH_OK) {
 			*vlock = l;
@@ -424,22 +2027,36 @@ Out:
  * The user data can be anything.
  */
 int shash_update(shash *h, void *key, void *value_old, void *value_new, shash_update_fn update_fn, void *udata) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
 	int rv = SHASH_OK;
 
-	pthread_mutex_t *l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+	uint stripe = shash_stripe_of(h, hash);
+
+	pthread_mutex_t *l = shash_lock(h, stripe);
+	bool resize = shash_migrate(h, stripe);
+
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_elem *e = shash_open_find(h, hash, key);
+
+		if (e && NULL != value_old)
+			memcpy(value_old, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
+
+		// Invoke the caller's update function.
+		(update_fn)(key, e ? value_old : NULL, value_new, udata);
+
+		if (e) {
+			memcpy(SHASH_ELEM_VALUE_PTR(h, e), value_new, h->value_len);
+		}
+		else {
+			rv = shash_open_insert(h, stripe, hash, key, value_new);
+			resize = resize || shash_needs_grow(h, stripe);
+		}
+
+		shash_unlock(h, stripe, l, resize);
+		return(rv);
 	}
-	if (l)     pthread_mutex_lock( l );
 
-	shash_elem *e = (shash_elem *) (((byte *)h->table) + (SHASH_ELEM_SZ(h) * hash));
+	shash_elem *e = shash_bucket(h, hash);
 	shash_elem *e_head = e;
 
 	if (e->in_use == false) {
@@ -464,12 +2081,13 @@ Update:
 	// Write the new value into the hash table.
 
 	if (!value_old && !e) {
-		e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
+		e = shash_elem_alloc(h, stripe);
 		if (!e) {
-			if (l)     pthread_mutex_unlock( l );
+			shash_unlock(h, stripe, l, resize);
 			return (SHASH_ERR);
 		}
 
+		shash_stats_collision(h, stripe);
 		e->next = e_head->next;
 		e_head->next = e;
 	}
@@ -479,222 +2097,90 @@ Update:
 	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value_new, h->value_len);
 	e->in_use = true;
 
-	if (!value_old)
-	  h->elements++;
+	if (!value_old) {
+		shash_elements_add(h, stripe, 1);
+		resize = resize || shash_needs_grow(h, stripe);
+	}
 
-	if (l) pthread_mutex_unlock(l);
+	shash_unlock(h, stripe, l, resize);
 
 	return(rv);
 }
 
 int shash_delete(shash *h, void *key) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
 	// Calculate hash
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
 	int rv = SHASH_ERR;
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	uint stripe = shash_stripe_of(h, hash);
 
-	// If bucket empty, def can't delete
-	if ( e->in_use == false ) {
-		rv = SHASH_ERR_NOTFOUND;
-		goto Out;
-	}
+	pthread_mutex_t *l = shash_lock(h, stripe);
+	bool resize = shash_migrate(h, stripe);
 
-	shash_elem *e_prev = 0;
+	shash_elem *e_prev;
+	shash_elem *e = shash_find(h, hash, key, &e_prev);
 
 	// Look for the element and destroy if found
-	while (e) {
-		if ( memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			// Found it
-			// patchup pointers & free element if not head
-			if (e_prev) {
-				e_prev->next = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);				
-			}
-			// am at head - more complicated
-			else {
-				// at head with no next - easy peasy!
-				if (0 == e->next) {
-					e->in_use = false;
-				}
-				// at head with a next - more complicated
-				else {
-					shash_elem *_t = e->next;
-					memcpy(e, e->next, SHASH_ELEM_SZ(h) );
-					if (mem_tracked)
-					  cf_free(_t);
-					else
-					  free(_t);
-				}
-			}
-			h->elements--;
-			rv = SHASH_OK;
-			goto Out;
-
-		}
-		e_prev = e;
-		e = e->next;
+	if (e) {
+		shash_delete_elem(h, stripe, e, e_prev);
+		rv = SHASH_OK;
+	}
+	else {
+		rv = SHASH_ERR_NOTFOUND;
 	}
-	rv = SHASH_ERR_NOTFOUND;
 
-Out:
-	if (l) 
-		pthread_mutex_unlock(l);
+	shash_unlock(h, stripe, l, resize);
 	return(rv);	
-	
-
 }
 
-// I kind of feel bad about this cut n paste, but
-// it's nice in the lock state to slim down the area under which the lock is taken
-// doing multiple helper functions may be better...
-
+/**
+ * Special function you can call when you already have the lock - such as
+ * a vlock get. It doesn't migrate anything, as the table can't be swapped
+ * without all of the locks.
+ */
 int shash_delete_lockfree(shash *h, void *key) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
 	// Calculate hash
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint stripe = shash_stripe_of(h, hash);
 
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e_prev;
+	shash_elem *e = shash_find(h, hash, key, &e_prev);
 
-	// If bucket empty, def can't delete
-	if ( e->in_use == false )
+	if (! e)
 		return( SHASH_ERR_NOTFOUND );
 
-	shash_elem *e_prev = 0;
-
-	// Look for the element and destroy if found
-	while (e) {
-		if ( memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			// Found it
-			// patchup pointers & free element if not head
-			if (e_prev) {
-				e_prev->next = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
-			}
-			// am at head - more complicated
-			else {
-				// at head with no next - easy peasy!
-				if (0 == e->next) {
-					e->in_use = false;
-				}
-				// at head with a next - more complicated
-				else {
-					shash_elem *_t = e->next;
-					memcpy(e, e->next, SHASH_ELEM_SZ(h) );
-					if (mem_tracked)
-					  cf_free(_t);
-					else
-					  free(_t);
-				}
-			}
-			h->elements--;
-			return( SHASH_OK );
-		}
-		e_prev = e;
-		e = e->next;
-	}
-	
-	return ( SHASH_ERR_NOTFOUND );
-
-	
+	shash_write_begin(h, stripe);
+	shash_delete_elem(h, stripe, e, e_prev);
+	shash_write_end(h, stripe);
+	return( SHASH_OK );
 }
 
 int shash_get_and_delete(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
 	// Calculate hash
 	uint hash = h->h_fn(key);
-	hash %= h->table_len;
 	int rv = SHASH_ERR;
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
-
-	// If bucket empty, def can't delete
-	if ( e->in_use == false ) {
-		rv = SHASH_ERR_NOTFOUND;
-		goto Out;
-	}
+	uint stripe = shash_stripe_of(h, hash);
 
-	shash_elem *e_prev = 0;
+	pthread_mutex_t *l = shash_lock(h, stripe);
+	bool resize = shash_migrate(h, stripe);
 
-	// Look for the element and destroy if found
-	while (e) {
-		if ( memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-		
-			// Found it - check length of buffer and copy to destination
-			memcpy(value, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
+	shash_elem *e_prev;
+	shash_elem *e = shash_find(h, hash, key, &e_prev);
 
-			
-			// patchup pointers & free element if not head
-			if (e_prev) {
-				e_prev->next = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
-			}
-			// am at head - more complicated
-			else {
-				// at head with no next - easy peasy!
-				if (0 == e->next) {
-					e->in_use = false;
-				}
-				// at head with a next - more complicated
-				else {
-					shash_elem *_t = e->next;
-					memcpy(e, e->next, SHASH_ELEM_SZ(h) );
-					if (mem_tracked)
-					  cf_free(_t);
-					else
-					  free(_t);
-				}
-			}
-			h->elements--;
-			rv = SHASH_OK;
-			goto Out;
+	if (e) {
+		// Found it - copy to destination
+		memcpy(value, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
 
-		}
-		e_prev = e;
-		e = e->next;
+		shash_delete_elem(h, stripe, e, e_prev);
+		rv = SHASH_OK;
+	}
+	else {
+		rv = SHASH_ERR_NOTFOUND;
 	}
-	rv = SHASH_ERR_NOTFOUND;
 
-Out:
-	if (l)
-		pthread_mutex_unlock( l );
-		
+	shash_unlock(h, stripe, l, resize);
 	return(rv);	
-	
-
 }
 
 /**
@@ -705,41 +2191,15 @@ Out:
  */
 int shash_reduce(shash *h, shash_reduce_fn reduce_fn, void *udata) {
 	int rv = 0;
-	
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		pthread_mutex_lock( &h->biglock);
-	}
-
-	for (uint i=0; i<h->table_len ; i++) {
-		
-		pthread_mutex_t *l = 0;
-		if (h->flags & SHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock( l );
-		}
-		
-		shash_elem *list_he = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * i));
-		while (list_he) {
-			
-			// not in use is common at head pointer - unused bucket
-			if (list_he->in_use == false)
-				break;
-			
-			rv = reduce_fn(	SHASH_ELEM_KEY_PTR(h, list_he), SHASH_ELEM_VALUE_PTR(h, list_he), udata);
-			if (0 != rv) {
-                if (l) pthread_mutex_unlock(l);
-				goto Out;
-			}
-			
-			list_he = list_he->next;
-		}
 
+	for (uint i=0; i<shash_stripes(h) ; i++) {
+		pthread_mutex_t *l = shash_stripe_lock(h, i);
+		if (l)	pthread_mutex_lock(l);
+		rv = shash_reduce_stripe(h, i, reduce_fn, udata, false);
 		if (l)	pthread_mutex_unlock(l);
-
+		if (0 != rv)
+			break;
 	}
-Out:
-	if (h->flags & SHASH_CR_MT_BIGLOCK)
-		pthread_mutex_unlock(&h->biglock);
 
 	return(rv);
 }
@@ -752,90 +2212,74 @@ Out:
  * negative numbers are errors
  */
 int shash_reduce_delete(shash *h, shash_reduce_fn reduce_fn, void *udata) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
 	int rv = 0;
-	
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		pthread_mutex_lock( &h->biglock);
+
+	for (uint i=0; i<shash_stripes(h) ; i++) {
+		pthread_mutex_t *l = shash_stripe_lock(h, i);
+		if (l)	pthread_mutex_lock(l);
+		rv = shash_reduce_stripe(h, i, reduce_fn, udata, true);
+		if (l)	pthread_mutex_unlock(l);
+		if (0 != rv)
+			break;
 	}
-	
-	for (uint i=0; i<h->table_len ; i++) {
 
-		pthread_mutex_t *l = 0;
-		if (h->flags & SHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock( l );
+	return(rv);
+}
+
+/**
+ * Parallel versions of the reduce calls - the units of work are claimed by
+ * n_threads threads, the calling thread included. Without udata_sz, all the
+ * threads share udata; with it, each thread reduces into its own copy of
+ * udata, and the copies are folded back into udata by combine_fn at the end.
+ */
+int shash_reduce_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_sz, shash_combine_fn combine_fn, uint n_threads) {
+	return shash_reduce_parallel_internal(h, reduce_fn, udata, udata_sz, combine_fn, n_threads, false);
+}
+
+int shash_reduce_delete_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_sz, shash_combine_fn combine_fn, uint n_threads) {
+	return shash_reduce_parallel_internal(h, reduce_fn, udata, udata_sz, combine_fn, n_threads, true);
+}
+
+/**
+ * Sum up the stripes' counters, and if asked, walk the table for the chain
+ * histogram. The walk takes each stripe's lock directly, so it isn't timed.
+ */
+int shash_get_stats(shash *h, shash_stats *stats, bool walk) {
+	if (! (h->flags & SHASH_CR_STATS)) {
+		return(SHASH_ERR);
+	}
+
+	memset(stats, 0, sizeof(shash_stats));
+	stats->elements = shash_get_size(h);
+	stats->table_len = h->table_len;
+	stats->n_stripes = shash_stripes(h);
+	stats->resizes = h->stats->resizes;
+	stats->purges = h->stats->purges;
+
+	for (uint i=0; i<stats->n_stripes; i++) {
+		shash_stripe_stats *ss = &h->stats->stripes[i];
+		stats->collisions += ss->collisions;
+		stats->lock_samples += ss->lock_samples;
+		stats->lock_wait_ns += ss->lock_wait_ns;
+		if (ss->lock_wait_max_ns > stats->lock_wait_max_ns) {
+			stats->lock_wait_max_ns = ss->lock_wait_max_ns;
 		}
-		
-		shash_elem *list_he = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * i));
-		shash_elem *prev_he = 0;
-		
-		while (list_he) {
-			// This kind of structure might have the head as an empty element,
-			// that's a signal to move along
-			if (list_he->in_use == false)
-				break;
-			
-			rv = reduce_fn( SHASH_ELEM_KEY_PTR(h, list_he), SHASH_ELEM_VALUE_PTR(h, list_he), udata);
-			
-			// Delete is requested
-			// Leave the pointers in a "next" state
-			if (rv == SHASH_REDUCE_DELETE) {
-
-                h->elements--;
-                
-				// patchup pointers & free element if not head
-				if (prev_he) {
-					prev_he->next = list_he->next;
-					if (mem_tracked)
-					  cf_free(list_he);
-					else
-					  free(list_he);					
-					list_he = prev_he->next;
-				}
-				// am at head - more complicated
-				else {
-					// at head with no next - easy peasy!
-					if (0 == list_he->next) {
-						list_he->in_use = false;
-						list_he = 0;
-					}
-					// at head with a next - more complicated -
-					// copy next into current and free next
-					// (the old trick of how to delete from a singly
-					// linked list without a prev pointer)
-					// Somewhat confusingly, prev_he stays 0
-					// and list_he stays where it is
-					else {
-						shash_elem *_t = list_he->next;
-						memcpy(list_he, list_he->next, SHASH_ELEM_SZ(h) );
-						if (mem_tracked)
-						  cf_free(_t);
-						else
-						  free(_t);
-					}
-				}
-				rv = 0;
-			}
-			else if (0 != rv) {
-				if (l)	pthread_mutex_unlock(l);
-				goto Out;
-			}
-			else { // don't delete, just forward everything
-				prev_he = list_he;
-				list_he = list_he->next;
-			}	
+		if (ss->lock_wait_ns > stats->hot_stripe_wait_ns) {
+			stats->hot_stripe = i;
+			stats->hot_stripe_wait_ns = ss->lock_wait_ns;
 		}
-		
-		if (l) pthread_mutex_unlock(l);
 	}
 
-Out:
+	if (walk) {
+		for (uint i=0; i<stats->n_stripes; i++) {
+			pthread_mutex_t *l = shash_stripe_lock(h, i);
+			if (l)	pthread_mutex_lock(l);
+			shash_stats_walk_stripe(h, i, stats);
+			if (l)	pthread_mutex_unlock(l);
+		}
+	}
 
-	if (h->flags & SHASH_CR_MT_BIGLOCK)
-		pthread_mutex_unlock( &h->biglock);
-	
-	return(rv);
+	return(SHASH_OK);
 }
 
 /**
@@ -843,29 +2287,29 @@ Out:
  * knows this is going to be single threaded
  */
 void shash_deleteall_lockfree(shash *h) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
-	shash_elem *e_table = h->table;
-	for (uint i=0;i<h->table_len;i++) {
-		if (e_table->next) {
-			shash_elem *e = e_table->next;
-			shash_elem *t;
-			while (e) {
-				t = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
-				e = t;
-			}
-			// The head element of each hash bucket overflow chain also
-			// contains data. But we should not free it as it is 
-			// allocated as part of the overall hash table. So, just mark
-			// it so that it is re-used.
-			e_table->next = NULL;
-			e_table->in_use = false;
+	if (h->old_table) {
+		shash_clear_table(h, h->old_table, h->old_table_len);
+		// a read-mostly hash's old table is on the retired list
+		if (! (h->flags & SHASH_CR_READ_MOSTLY))
+			shash_free(h, h->old_table);
+		h->old_table = 0;
+		h->old_table_len = 0;
+		h->migrate_left = 0;
+	}
+	while (h->retired) {
+		shash_retired *r = (shash_retired *) h->retired;
+		h->retired = r->next;
+		shash_free(h, r->table);
+		shash_free(h, r);
+	}
+	shash_clear_table(h, h->table, h->table_len);
+	h->elements = 0;
+	if (h->stripes) {
+		for (uint i=0; i<shash_stripes(h); i++) {
+			h->stripes[i].elements = 0;
+			h->stripes[i].tombstones = 0;
+			shash_stripe_drain(h, &h->stripes[i]);
 		}
-		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
 	}
 }	
 
@@ -874,43 +2318,18 @@ void shash_deleteall_lockfree(shash *h) {
  * Destroy a simple hash table. 
  */
 void shash_destroy(shash *h) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
-	shash_elem * e_table = (shash_elem *) h->table;
-	for (uint i=0;i<h->table_len;i++) {
-		if (e_table->next) {
-			shash_elem *e = e_table->next;
-			shash_elem *t;
-			while (e) {
-				t = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
-				e = t;
-			}
-		}
-		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
-	}
+	shash_deleteall_lockfree(h);
 
 	if (h->flags & SHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_destroy(&h->biglock);
 	}
-	if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		for (uint i=0;i<h->table_len;i++) {
-			pthread_mutex_destroy(&(h->lock_table[i]));
-		}
-		if (mem_tracked)
-		  cf_free(h->lock_table);
-		else
-		  free(h->lock_table);
+	if (h->stripes) {
+		shash_stripes_destroy(h, h->stripes, shash_stripes(h));
 	}
-
-	if (mem_tracked) {
-		cf_free(h->table);
-		cf_free(h);
-	} else {
-		free(h->table);
-		free(h);
+	if (h->stats) {
+		shash_free(h, h->stats);
 	}
-}	
+
+	shash_free(h, h->table);
+	shash_free(h, h);
+}
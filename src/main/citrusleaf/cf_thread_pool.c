@@ -0,0 +1,489 @@
+/*
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <citrusleaf/cf_thread_pool.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// tasks per worker deque - must be a power of 2, overflow goes to inject
+#define CF_THREAD_POOL_DEQUE_SZ 1024
+
+// times an idle worker yields before it parks
+#define CF_THREAD_POOL_YIELDS 4
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef struct cf_thread_pool_task_s {
+	cf_thread_pool_fn		fn;
+	void *					udata;
+	cf_thread_pool_group *	group;
+} cf_thread_pool_task;
+
+/**
+ * A parallel_for chunk - the task is first, so freeing the task frees it.
+ */
+typedef struct cf_thread_pool_range_s {
+	cf_thread_pool_task		task;
+	cf_thread_pool *		pool;
+	uint64_t				begin;
+	uint64_t				end;
+	uint64_t				grain;
+	cf_thread_pool_range_fn	fn;
+	void *					udata;
+} cf_thread_pool_range;
+
+/**
+ * A worker and its deque. The owner pushes and pops at bottom, thieves take
+ * from top - each on its own cache line.
+ */
+struct cf_thread_pool_worker_s {
+	cf_atomic_int		top __attribute__ ((aligned(64)));
+	cf_atomic_int		bottom __attribute__ ((aligned(64)));
+	cf_atomic_p			tasks[CF_THREAD_POOL_DEQUE_SZ];
+	cf_thread_pool *	pool;
+	pthread_t			thread;
+	uint32_t			rand;		// for picking victims
+} __attribute__ ((aligned(64)));
+
+typedef struct cf_thread_pool_worker_s cf_thread_pool_worker;
+
+/******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+
+// the worker this thread is, if it is one
+static __thread cf_thread_pool_worker *g_worker = NULL;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+#ifdef __linux__
+static inline void cf_thread_pool_park(cf_atomic32 *word, uint32_t val) {
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void cf_thread_pool_unpark(cf_atomic32 *word, int n) {
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+#else
+static inline void cf_thread_pool_park(cf_atomic32 *word, uint32_t val) {
+	usleep(1000);
+}
+
+static inline void cf_thread_pool_unpark(cf_atomic32 *word, int n) {
+}
+#endif
+
+/**
+ * Owner only. Returns false if the deque is full.
+ */
+static bool cf_thread_pool_deque_push(cf_thread_pool_worker *w, cf_thread_pool_task *t) {
+	cf_atomic_int_t b = w->bottom;
+	cf_atomic_int_t top = cf_atomic_int_get(w->top);
+
+	if ((intptr_t) (b - top) >= CF_THREAD_POOL_DEQUE_SZ) {
+		return false;
+	}
+
+	cf_atomic_p_set(&w->tasks[b & (CF_THREAD_POOL_DEQUE_SZ - 1)], (cf_atomic_p) t);
+
+	// x86 doesn't reorder stores - just keep the compiler from doing it
+	CF_MEMORY_BARRIER_WRITE();
+	cf_atomic_int_set(&w->bottom, b + 1);
+	return true;
+}
+
+/**
+ * Owner only - takes the newest task.
+ */
+static cf_thread_pool_task * cf_thread_pool_deque_pop(cf_thread_pool_worker *w) {
+	cf_atomic_int_t b = w->bottom - 1;
+
+	// claim the bottom slot before looking at top - thieves look the other
+	// way round
+	cf_atomic_int_set(&w->bottom, b);
+	smb_mb();
+	cf_atomic_int_t t = cf_atomic_int_get(w->top);
+
+	if ((intptr_t) (b - t) < 0) {
+		cf_atomic_int_set(&w->bottom, b + 1);
+		return NULL;
+	}
+
+	cf_thread_pool_task *task = (cf_thread_pool_task *) cf_atomic_p_get(w->tasks[b & (CF_THREAD_POOL_DEQUE_SZ - 1)]);
+
+	if (b == t) {
+		// the last one - race any thieves for it
+		if ((cf_atomic_int_t) cf_atomic_int_cas(&w->top, t, t + 1) != t) {
+			task = NULL;
+		}
+		cf_atomic_int_set(&w->bottom, b + 1);
+	}
+	return task;
+}
+
+/**
+ * Any thread - takes the oldest task.
+ */
+static cf_thread_pool_task * cf_thread_pool_deque_steal(cf_thread_pool_worker *w) {
+	cf_atomic_int_t t = cf_atomic_int_get(w->top);
+
+	// x86 doesn't reorder loads - just keep the compiler from doing it
+	CF_MEMORY_BARRIER_WRITE();
+	cf_atomic_int_t b = cf_atomic_int_get(w->bottom);
+
+	if ((intptr_t) (b - t) <= 0) {
+		return NULL;
+	}
+
+	cf_thread_pool_task *task = (cf_thread_pool_task *) cf_atomic_p_get(w->tasks[t & (CF_THREAD_POOL_DEQUE_SZ - 1)]);
+
+	if ((cf_atomic_int_t) cf_atomic_int_cas(&w->top, t, t + 1) != t) {
+		// lost to the owner or another thief
+		return NULL;
+	}
+	return task;
+}
+
+static inline bool cf_thread_pool_deque_empty(cf_thread_pool_worker *w) {
+	return (intptr_t) (cf_atomic_int_get(w->bottom) - cf_atomic_int_get(w->top)) <= 0;
+}
+
+static bool cf_thread_pool_has_work(cf_thread_pool *pool) {
+	if (cf_queue_sz(pool->inject) != 0) {
+		return true;
+	}
+	for (uint i = 0; i < pool->n_threads; i++) {
+		if (! cf_thread_pool_deque_empty(&pool->workers[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Wake an idle worker if there is one. Called after a push - the push is
+ * visible before we look, and an idler counts itself before its last look
+ * for work, so one of us is sure to see the other.
+ */
+static void cf_thread_pool_wake(cf_thread_pool *pool) {
+	smb_mb();
+	if (cf_atomic32_get(pool->n_idle) != 0) {
+		cf_atomic32_incr(&pool->wake_seq);
+		cf_thread_pool_unpark(&pool->wake_seq, 1);
+	}
+}
+
+static int cf_thread_pool_push(cf_thread_pool *pool, cf_thread_pool_task *t) {
+	if (t->group) {
+		cf_atomic32_incr(&t->group->pending);
+	}
+
+	cf_thread_pool_worker *w = g_worker;
+	if (! (w && w->pool == pool && cf_thread_pool_deque_push(w, t))) {
+		if (CF_QUEUE_OK != cf_queue_push(pool->inject, &t)) {
+			if (t->group) {
+				cf_atomic32_decr(&t->group->pending);
+			}
+			return CF_THREAD_POOL_ERR;
+		}
+	}
+
+	cf_thread_pool_wake(pool);
+	return CF_THREAD_POOL_OK;
+}
+
+/**
+ * Find a task - our own newest, then the injection queue, then the oldest
+ * of some other worker's.
+ */
+static cf_thread_pool_task * cf_thread_pool_find(cf_thread_pool *pool, cf_thread_pool_worker *self) {
+	cf_thread_pool_task *t = NULL;
+
+	if (self && (t = cf_thread_pool_deque_pop(self))) {
+		return t;
+	}
+	if (CF_QUEUE_OK == cf_queue_pop(pool->inject, &t, CF_QUEUE_NOWAIT)) {
+		return t;
+	}
+
+	uint32_t start = 0;
+	if (self) {
+		// xorshift
+		self->rand ^= self->rand << 13;
+		self->rand ^= self->rand >> 17;
+		self->rand ^= self->rand << 5;
+		start = self->rand;
+	}
+	for (uint i = 0; i < pool->n_threads; i++) {
+		cf_thread_pool_worker *victim = &pool->workers[(start + i) % pool->n_threads];
+		if (victim != self && (t = cf_thread_pool_deque_steal(victim))) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static bool cf_thread_pool_run_one(cf_thread_pool *pool, cf_thread_pool_worker *self) {
+	cf_thread_pool_task *t = cf_thread_pool_find(pool, self);
+	if (! t) {
+		return false;
+	}
+
+	cf_thread_pool_group *group = t->group;
+	t->fn(t->udata);
+	free(t);
+
+	// The last task of a group wakes everyone parked - group waiters park
+	// with the idle workers. The group may be gone once pending hits 0.
+	if (group && cf_atomic32_decr(&group->pending) == 0) {
+		cf_atomic32_incr(&pool->wake_seq);
+		cf_thread_pool_unpark(&pool->wake_seq, INT_MAX);
+	}
+	return true;
+}
+
+static void * cf_thread_pool_worker_fn(void *udata) {
+	cf_thread_pool_worker *w = (cf_thread_pool_worker *) udata;
+	cf_thread_pool *pool = w->pool;
+
+	g_worker = w;
+
+	for (;;) {
+		if (cf_thread_pool_run_one(pool, w)) {
+			continue;
+		}
+
+		bool found = false;
+		for (int i = 0; i < CF_THREAD_POOL_YIELDS && ! found; i++) {
+			sched_yield();
+			found = cf_thread_pool_run_one(pool, w);
+		}
+		if (found) {
+			continue;
+		}
+
+		// Read the futex word, count ourselves idle, then look once more - a
+		// submit after this point sees us, and moves the word.
+		uint32_t seen = cf_atomic32_get(pool->wake_seq);
+		cf_atomic32_incr(&pool->n_idle);
+
+		if (! cf_thread_pool_has_work(pool)) {
+			if (cf_atomic32_get(pool->shutdown)) {
+				cf_atomic32_decr(&pool->n_idle);
+				break;
+			}
+			cf_thread_pool_park(&pool->wake_seq, seen);
+		}
+		cf_atomic32_decr(&pool->n_idle);
+	}
+
+	g_worker = NULL;
+	return NULL;
+}
+
+static void cf_thread_pool_range_run(cf_thread_pool_range *r);
+
+static void cf_thread_pool_range_task_fn(void *udata) {
+	cf_thread_pool_range_run((cf_thread_pool_range *) udata);
+}
+
+/**
+ * Keep halving - push the upper half, carry on with the lower.
+ */
+static void cf_thread_pool_range_run(cf_thread_pool_range *r) {
+	uint64_t begin = r->begin;
+	uint64_t end = r->end;
+
+	while (end - begin > r->grain) {
+		uint64_t mid = begin + ((end - begin) / 2);
+
+		cf_thread_pool_range *half = malloc(sizeof(cf_thread_pool_range));
+		if (! half) {
+			break;
+		}
+		*half = *r;
+		half->task.udata = half;
+		half->begin = mid;
+		half->end = end;
+
+		if (CF_THREAD_POOL_OK != cf_thread_pool_push(r->pool, &half->task)) {
+			free(half);
+			break;
+		}
+		end = mid;
+	}
+
+	// if we couldn't split, the rest is done here in grain size bites
+	while (begin < end) {
+		uint64_t stop = end - begin > r->grain ? begin + r->grain : end;
+		r->fn(begin, stop, r->udata);
+		begin = stop;
+	}
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_thread_pool * cf_thread_pool_create(uint n_threads) {
+	if (n_threads == 0) {
+		return NULL;
+	}
+
+	cf_thread_pool *pool = malloc(sizeof(cf_thread_pool));
+	if (! pool) {
+		return NULL;
+	}
+	memset(pool, 0, sizeof(cf_thread_pool));
+
+	pool->inject = cf_queue_create(sizeof(cf_thread_pool_task *), true);
+	if (! pool->inject) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->workers = valloc(n_threads * sizeof(cf_thread_pool_worker));
+	if (! pool->workers) {
+		cf_queue_destroy(pool->inject);
+		free(pool);
+		return NULL;
+	}
+	memset(pool->workers, 0, n_threads * sizeof(cf_thread_pool_worker));
+
+	for (uint i = 0; i < n_threads; i++) {
+		cf_thread_pool_worker *w = &pool->workers[i];
+		w->pool = pool;
+		w->rand = (i + 1) * 2654435761u;
+
+		if (0 != pthread_create(&w->thread, NULL, cf_thread_pool_worker_fn, w)) {
+			// stop the ones we have
+			pool->n_threads = i;
+			cf_thread_pool_destroy(pool);
+			return NULL;
+		}
+		pool->n_threads = i + 1;
+	}
+
+	return pool;
+}
+
+void cf_thread_pool_destroy(cf_thread_pool *pool) {
+	cf_atomic32_set(&pool->shutdown, 1);
+	cf_atomic32_incr(&pool->wake_seq);
+	cf_thread_pool_unpark(&pool->wake_seq, INT_MAX);
+
+	for (uint i = 0; i < pool->n_threads; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	// anything the workers left (only if there were none) is run here
+	while (cf_thread_pool_run_one(pool, NULL)) {
+		;
+	}
+
+	cf_queue_destroy(pool->inject);
+	free(pool->workers);
+	free(pool);
+}
+
+int cf_thread_pool_submit(cf_thread_pool *pool, cf_thread_pool_fn fn, void *udata, cf_thread_pool_group *group) {
+	cf_thread_pool_task *t = malloc(sizeof(cf_thread_pool_task));
+	if (! t) {
+		return CF_THREAD_POOL_ERR;
+	}
+	t->fn = fn;
+	t->udata = udata;
+	t->group = group;
+
+	if (CF_THREAD_POOL_OK != cf_thread_pool_push(pool, t)) {
+		free(t);
+		return CF_THREAD_POOL_ERR;
+	}
+	return CF_THREAD_POOL_OK;
+}
+
+void cf_thread_pool_group_init(cf_thread_pool_group *group) {
+	cf_atomic32_set(&group->pending, 0);
+}
+
+void cf_thread_pool_group_wait(cf_thread_pool *pool, cf_thread_pool_group *group) {
+	cf_thread_pool_worker *self = g_worker && g_worker->pool == pool ? g_worker : NULL;
+
+	while (cf_atomic32_get(group->pending) != 0) {
+		if (cf_thread_pool_run_one(pool, self)) {
+			continue;
+		}
+
+		// Nothing to help with - park with the idle workers. The group's last
+		// task moves the word after pending hits 0, as does any submit.
+		uint32_t seen = cf_atomic32_get(pool->wake_seq);
+		cf_atomic32_incr(&pool->n_idle);
+
+		if (cf_atomic32_get(group->pending) != 0 && ! cf_thread_pool_has_work(pool)) {
+			cf_thread_pool_park(&pool->wake_seq, seen);
+		}
+		cf_atomic32_decr(&pool->n_idle);
+	}
+}
+
+int cf_thread_pool_parallel_for(cf_thread_pool *pool, uint64_t begin, uint64_t end, uint64_t grain, cf_thread_pool_range_fn fn, void *udata) {
+	if (end <= begin) {
+		return CF_THREAD_POOL_OK;
+	}
+
+	cf_thread_pool_group group;
+	cf_thread_pool_group_init(&group);
+
+	cf_thread_pool_range r;
+	r.task.fn = cf_thread_pool_range_task_fn;
+	r.task.udata = &r;
+	r.task.group = &group;
+	r.pool = pool;
+	r.begin = begin;
+	r.end = end;
+	r.grain = grain ? grain : 1;
+	r.fn = fn;
+	r.udata = udata;
+
+	cf_thread_pool_range_run(&r);
+	cf_thread_pool_group_wait(pool, &group);
+	return CF_THREAD_POOL_OK;
+}
@@ -0,0 +1,336 @@
+/******************************************************************************
+ * Copyright 2008-2013 by Aerospike.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to 
+ * deal in the Software without restriction, including without limitation the 
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or 
+ * sell copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in 
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * Contention benchmark for shash in manylock mode.
+ *
+ * A number of threads do a mix of gets and puts on one table, which is run
+ * with pools of different numbers of locks - including one lock per bucket,
+ * the old manylock layout. Creation time is reported too, as that's what a
+ * lock per bucket costs the most.
+ *
+ * The same mix is then run on read-mostly tables, where gets don't lock.
+ *
+ * Then batches of random keys are read with a shash_get() per key, and with
+ * shash_get_many().
+ *
+ * Last, chaining and open addressing are compared on a single thread, with a
+ * sliding window of keys - each op puts a new key, deletes the oldest, and
+ * gets a random key of the window.
+ *
+ * Then gets of digest keys are compared between shash and cf_dhash, on a
+ * single thread.
+ *
+ *	usage: shash_bench [threads] [ops per thread]
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <citrusleaf/cf_dhash.h>
+#include <citrusleaf/cf_digest.h>
+#include <citrusleaf/cf_shash.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+#define N_BUCKETS (1024 * 1024)
+#define N_KEYS (N_BUCKETS / 2)
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef struct bench_thread_s {
+	pthread_t	thread;
+	shash *		h;
+	uint64_t	ops;
+	uint64_t	seed;
+	uint		batch;		// if non-zero, keys per batch read
+	bool		many;		// use shash_get_many() for batch reads
+} bench_thread;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t bench_hash(void *key) {
+	uint64_t k = *(uint64_t *) key;
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return (uint32_t) k;
+}
+
+static uint64_t bench_rand(uint64_t *seed) {
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static uint32_t bench_digest_hash(void *key) {
+	return cf_digest_gethash((cf_digest *) key, 0xffffffff);
+}
+
+
+/**
+ * 90% gets, 10% puts, over the prefilled keys
+ */
+static void * bench_run(void *udata) {
+	bench_thread *t = (bench_thread *) udata;
+	uint64_t value;
+
+	for (uint64_t i = 0; i < t->ops; i++) {
+		uint64_t r = bench_rand(&t->seed);
+		uint64_t key = (r >> 8) % N_KEYS;
+		if ((r & 0xff) < 26) {
+			shash_put(t->h, &key, &r);
+		}
+		else {
+			shash_get(t->h, &key, &value);
+		}
+	}
+	return NULL;
+}
+
+static void * bench_run_batch(void *udata) {
+	bench_thread *t = (bench_thread *) udata;
+	uint64_t keys[t->batch];
+	uint64_t values[t->batch];
+	int results[t->batch];
+
+	for (uint64_t i = 0; i < t->ops; i += t->batch) {
+		for (uint j = 0; j < t->batch; j++) {
+			keys[j] = (bench_rand(&t->seed) >> 8) % N_KEYS;
+		}
+		if (t->many) {
+			shash_get_many(t->h, keys, values, t->batch, results);
+		}
+		else {
+			for (uint j = 0; j < t->batch; j++) {
+				results[j] = shash_get(t->h, &keys[j], &values[j]);
+			}
+		}
+	}
+	return NULL;
+}
+
+static shash * bench_create(uint n_locks, uint flags) {
+	shash *h;
+
+	if (shash_create(&h, bench_hash, sizeof(uint64_t), sizeof(uint64_t), N_BUCKETS, SHASH_CR_MT_MANYLOCK | flags) != SHASH_OK ||
+			shash_set_nlocks(h, n_locks) != SHASH_OK) {
+		fprintf(stderr, "failed to create table with %u locks\n", n_locks);
+		exit(1);
+	}
+	return h;
+}
+
+static void bench_fill(shash *h) {
+	for (uint64_t key = 0; key < N_KEYS; key++) {
+		shash_put(h, &key, &key);
+	}
+}
+
+/**
+ * Run the threads, returning the elapsed time in ns.
+ */
+static uint64_t bench_threads(shash *h, int n_threads, uint64_t ops, uint batch, bool many) {
+	bench_thread threads[n_threads];
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < n_threads; i++) {
+		threads[i].h = h;
+		threads[i].ops = ops;
+		threads[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		threads[i].batch = batch;
+		threads[i].many = many;
+		pthread_create(&threads[i].thread, NULL, batch ? bench_run_batch : bench_run, &threads[i]);
+	}
+	for (int i = 0; i < n_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+	}
+	return now_ns() - start;
+}
+
+static void bench_batch(uint n_locks, uint batch, int n_threads, uint64_t ops) {
+	shash *h = bench_create(n_locks, 0);
+	bench_fill(h);
+
+	ops -= ops % batch;
+	uint64_t get_ns = bench_threads(h, n_threads, ops, batch, false);
+	uint64_t many_ns = bench_threads(h, n_threads, ops, batch, true);
+
+	printf("%10u %10u %12.2f %12.2f\n", n_locks, batch, (double) ops * n_threads * 1e3 / get_ns,
+			(double) ops * n_threads * 1e3 / many_ns);
+
+	shash_destroy(h);
+}
+
+static void bench(uint n_locks, uint flags, int n_threads, uint64_t ops) {
+	uint64_t start = now_ns();
+	shash *h = bench_create(n_locks, flags);
+	uint64_t create_ns = now_ns() - start;
+
+	bench_fill(h);
+
+	uint64_t run_ns = bench_threads(h, n_threads, ops, 0, false);
+
+	printf("%10u %12.2f %12.2f %14.1f\n", n_locks, create_ns / 1e6, (double) ops * n_threads * 1e3 / run_ns,
+			(double) run_ns / ops);
+
+	shash_destroy(h);
+}
+
+static void bench_churn(const char *name, uint flags, uint64_t ops) {
+	shash *h;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	uint64_t value;
+
+	if (shash_create(&h, bench_hash, sizeof(uint64_t), sizeof(uint64_t), N_BUCKETS, flags) != SHASH_OK) {
+		fprintf(stderr, "failed to create %s table\n", name);
+		exit(1);
+	}
+	bench_fill(h);
+
+	uint64_t start = now_ns();
+	for (uint64_t key = N_KEYS; key < N_KEYS + ops; key++) {
+		uint64_t old = key - N_KEYS;
+		shash_put(h, &key, &key);
+		shash_delete(h, &old);
+		old += 1 + ((bench_rand(&seed) >> 8) % N_KEYS);
+		shash_get(h, &old, &value);
+	}
+	uint64_t run_ns = now_ns() - start;
+
+	printf("%10s %12.2f\n", name, (double) ops * 1e3 / run_ns);
+
+	shash_destroy(h);
+}
+
+/**
+ * Random gets of N_KEYS digest keys, with 8 byte values.
+ */
+static void bench_digest(uint64_t ops) {
+	cf_digest *digests = (cf_digest *) malloc(N_KEYS * sizeof(cf_digest));
+	shash *sh;
+	cf_dhash *dh;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	uint64_t value;
+
+	if (! digests ||
+			shash_create(&sh, bench_digest_hash, sizeof(cf_digest), sizeof(uint64_t), N_BUCKETS, 0) != SHASH_OK ||
+			cf_dhash_create(&dh, sizeof(uint64_t), N_KEYS, 0) != CF_DHASH_OK) {
+		fprintf(stderr, "failed to create digest tables\n");
+		exit(1);
+	}
+
+	for (uint64_t key = 0; key < N_KEYS; key++) {
+		cf_digest_compute(&key, sizeof(key), &digests[key]);
+		shash_put(sh, &digests[key], &key);
+		cf_dhash_put(dh, &digests[key], &key);
+	}
+
+	uint64_t start = now_ns();
+	for (uint64_t i = 0; i < ops; i++) {
+		shash_get(sh, &digests[(bench_rand(&seed) >> 8) % N_KEYS], &value);
+	}
+	uint64_t shash_ns = now_ns() - start;
+
+	start = now_ns();
+	for (uint64_t i = 0; i < ops; i++) {
+		cf_dhash_get(dh, &digests[(bench_rand(&seed) >> 8) % N_KEYS], &value);
+	}
+	uint64_t dhash_ns = now_ns() - start;
+
+	printf("%10s %12.2f\n", "shash", (double) ops * 1e3 / shash_ns);
+	printf("%10s %12.2f\n", "cf_dhash", (double) ops * 1e3 / dhash_ns);
+
+	shash_destroy(sh);
+	cf_dhash_destroy(dh);
+	free(digests);
+}
+
+/******************************************************************************
+ * MAIN
+ ******************************************************************************/
+
+int main(int argc, char ** argv) {
+	int n_threads = argc > 1 ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t ops = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+	uint n_locks[] = { 1, 4, 16, 64, 256, 1024, 4096, N_BUCKETS };
+
+	printf("shash manylock: %d threads, %" PRIu64 " ops per thread, %u buckets, %u keys\n\n", n_threads, ops, N_BUCKETS, N_KEYS);
+	printf("%10s %12s %12s %14s\n", "locks", "create (ms)", "Mops/s", "ns/op/thread");
+
+	for (int i = 0; i < sizeof(n_locks) / sizeof(n_locks[0]); i++) {
+		bench(n_locks[i], 0, n_threads, ops);
+	}
+
+	uint read_mostly_locks[] = { 1, 16, SHASH_N_LOCKS };
+
+	printf("\nshash read-mostly\n\n");
+	printf("%10s %12s %12s %14s\n", "locks", "create (ms)", "Mops/s", "ns/op/thread");
+
+	for (int i = 0; i < sizeof(read_mostly_locks) / sizeof(read_mostly_locks[0]); i++) {
+		bench(read_mostly_locks[i], SHASH_CR_READ_MOSTLY, n_threads, ops);
+	}
+
+	uint batch_locks[] = { 16, SHASH_N_LOCKS };
+	uint batches[] = { 10, 100, 1000 };
+
+	printf("\nshash batch reads\n\n");
+	printf("%10s %10s %12s %12s\n", "locks", "batch", "get Mkeys/s", "many Mkeys/s");
+
+	for (int i = 0; i < sizeof(batch_locks) / sizeof(batch_locks[0]); i++) {
+		for (int j = 0; j < sizeof(batches) / sizeof(batches[0]); j++) {
+			bench_batch(batch_locks[i], batches[j], n_threads, ops);
+		}
+	}
+
+	printf("\nshash churn, 1 thread\n\n");
+	printf("%10s %12s\n", "table", "Mops/s");
+
+	bench_churn("chained", 0, ops);
+	bench_churn("open", SHASH_CR_OPEN, ops);
+
+	printf("\ndigest gets, 1 thread\n\n");
+	printf("%10s %12s\n", "table", "Mops/s");
+
+	bench_digest(ops);
+
+	return 0;
+}
@@ -11,6 +11,26 @@ PLAN( common ) {
     plan_add( types_bytes );
     plan_add( types_arraylist );
     plan_add( types_hashmap );
+    plan_add( types_arena );
+
+    /**
+     * hash - tests citrusleaf hash tables
+     */
+    plan_add( hash_shash );
+    plan_add( hash_rchash );
+    plan_add( hash_dhash );
+
+    /**
+     * queue - tests citrusleaf queues
+     */
+    plan_add( queue_queue );
+    plan_add( queue_priority );
+    plan_add( queue_timer );
+
+    /**
+     * thread - tests citrusleaf threading
+     */
+    plan_add( thread_pool );
 
     /**
      * msgpack - tests msgpack
@@ -0,0 +1,219 @@
+#include "../test.h"
+
+#include <string.h>
+
+#include <citrusleaf/cf_dhash.h>
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint64_t hash_dhash_mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * A random looking digest for k.
+ */
+static void hash_dhash_digest(uint32_t k, cf_digest * d) {
+    uint64_t words[3];
+    words[0] = hash_dhash_mix(k + 1);
+    words[1] = hash_dhash_mix(words[0]);
+    words[2] = hash_dhash_mix(words[1]);
+    memcpy(d->digest, words, sizeof(d->digest));
+}
+
+/**
+ * A digest for k which is placed in the same bucket as every other
+ * colliding digest - the bits the table places digests by (bytes 4 to 11)
+ * are all the same, and k is in the bytes after them.
+ */
+static void hash_dhash_digest_colliding(uint32_t k, cf_digest * d) {
+    memset(d->digest, 0x5a, sizeof(d->digest));
+    memcpy(d->digest + 12, &k, sizeof(k));
+}
+
+/**
+ * Put digests 0 .. n-1, each digest's value being k * 10.
+ */
+static int hash_dhash_fill(cf_dhash * h, uint32_t n) {
+    cf_digest d;
+    for ( uint32_t k = 0; k < n; k++ ) {
+        uint64_t v = (uint64_t) k * 10;
+        hash_dhash_digest(k, &d);
+        int rc = cf_dhash_put(h, &d, &v);
+        if ( rc != CF_DHASH_OK ) return rc;
+    }
+    return CF_DHASH_OK;
+}
+
+typedef struct {
+    uint64_t values;
+    uint32_t count;
+} hash_dhash_sums;
+
+static int hash_dhash_sum(const cf_digest * d, void * value, void * udata) {
+    hash_dhash_sums * sums = (hash_dhash_sums *) udata;
+    sums->values += *(uint64_t *) value;
+    sums->count++;
+    return 0;
+}
+
+static int hash_dhash_delete_odd(const cf_digest * d, void * value, void * udata) {
+    return (*(uint64_t *) value / 10) & 1 ? CF_DHASH_REDUCE_DELETE : 0;
+}
+
+static int hash_dhash_stop(const cf_digest * d, void * value, void * udata) {
+    hash_dhash_sums * sums = (hash_dhash_sums *) udata;
+    return ++sums->count == 100 ? -99 : 0;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( hash_dhash_flags, "cf_dhash put, get, delete and reduce under each flag combination" ) {
+    const uint32_t n = 5000;
+    uint flags[] = { 0, CF_DHASH_CR_MT_BIGLOCK, CF_DHASH_CR_MT_MANYLOCK };
+    cf_digest d;
+    uint64_t v;
+
+    for ( int i = 0; i < 3; i++ ) {
+        // start small, so the regions grow
+        cf_dhash * h = NULL;
+        assert_int_eq( cf_dhash_create(&h, sizeof(uint64_t), 16, flags[i]), CF_DHASH_OK );
+
+        // put
+        assert_int_eq( hash_dhash_fill(h, n), CF_DHASH_OK );
+        assert_int_eq( cf_dhash_get_size(h), n );
+
+        hash_dhash_digest(7, &d);
+        v = 1;
+        assert_int_eq( cf_dhash_put_unique(h, &d, &v), CF_DHASH_ERR_FOUND );
+        assert_int_eq( cf_dhash_put(h, &d, &v), CF_DHASH_OK );
+        assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_OK );
+        assert( v == 1 );
+        v = 70;
+        assert_int_eq( cf_dhash_put(h, &d, &v), CF_DHASH_OK );
+        assert_int_eq( cf_dhash_get_size(h), n );
+
+        // get
+        for ( uint32_t k = 0; k < n; k++ ) {
+            hash_dhash_digest(k, &d);
+            v = 0;
+            assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_OK );
+            assert( v == (uint64_t) k * 10 );
+        }
+        hash_dhash_digest(n, &d);
+        assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_ERR_NOTFOUND );
+        assert_int_eq( cf_dhash_get(h, &d, NULL), CF_DHASH_ERR_NOTFOUND );
+        hash_dhash_digest(0, &d);
+        assert_int_eq( cf_dhash_get(h, &d, NULL), CF_DHASH_OK );
+
+        // reduce
+        hash_dhash_sums sums = { 0, 0 };
+        assert_int_eq( cf_dhash_reduce(h, hash_dhash_sum, &sums), CF_DHASH_OK );
+        assert_int_eq( sums.count, n );
+        assert( sums.values == (uint64_t) n * (n - 1) * 5 );
+
+        memset(&sums, 0, sizeof(sums));
+        assert_int_eq( cf_dhash_reduce(h, hash_dhash_stop, &sums), CF_DHASH_OK );
+        assert_int_eq( sums.count, 100 );
+
+        // delete
+        for ( uint32_t k = 0; k < n; k += 2 ) {
+            hash_dhash_digest(k, &d);
+            assert_int_eq( cf_dhash_delete(h, &d), CF_DHASH_OK );
+            assert_int_eq( cf_dhash_delete(h, &d), CF_DHASH_ERR_NOTFOUND );
+            assert_int_eq( cf_dhash_get(h, &d, NULL), CF_DHASH_ERR_NOTFOUND );
+        }
+        assert_int_eq( cf_dhash_get_size(h), n / 2 );
+        for ( uint32_t k = 1; k < n; k += 2 ) {
+            hash_dhash_digest(k, &d);
+            assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_OK );
+            assert( v == (uint64_t) k * 10 );
+        }
+
+        // reduce delete, leaving nothing
+        assert_int_eq( cf_dhash_reduce_delete(h, hash_dhash_delete_odd, NULL), CF_DHASH_OK );
+        assert_int_eq( cf_dhash_get_size(h), 0 );
+        memset(&sums, 0, sizeof(sums));
+        assert_int_eq( cf_dhash_reduce(h, hash_dhash_sum, &sums), CF_DHASH_OK );
+        assert_int_eq( sums.count, 0 );
+
+        // deleted digests can be put back
+        assert_int_eq( hash_dhash_fill(h, n), CF_DHASH_OK );
+        assert_int_eq( cf_dhash_get_size(h), n );
+        hash_dhash_digest(n - 1, &d);
+        assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_OK );
+        assert( v == (uint64_t) (n - 1) * 10 );
+
+        cf_dhash_destroy(h);
+    }
+}
+
+TEST( hash_dhash_overflow, "cf_dhash digests spilling out of a full bucket" ) {
+    const uint32_t n = 40;
+    cf_digest d;
+    uint64_t v;
+
+    cf_dhash * h = NULL;
+    assert_int_eq( cf_dhash_create(&h, sizeof(uint64_t), 1024, 0), CF_DHASH_OK );
+
+    // every digest belongs in the same bucket, so all but the first few
+    // are placed past it
+    for ( uint32_t k = 0; k < n; k++ ) {
+        hash_dhash_digest_colliding(k, &d);
+        v = k;
+        assert_int_eq( cf_dhash_put_unique(h, &d, &v), CF_DHASH_OK );
+    }
+    assert_int_eq( cf_dhash_get_size(h), n );
+
+    // unrelated digests are still found past the spilled ones
+    assert_int_eq( hash_dhash_fill(h, 500), CF_DHASH_OK );
+
+    // deleting from the home bucket must not hide the spilled digests
+    for ( uint32_t k = 0; k < n; k += 3 ) {
+        hash_dhash_digest_colliding(k, &d);
+        assert_int_eq( cf_dhash_delete(h, &d), CF_DHASH_OK );
+    }
+    for ( uint32_t k = 0; k < n; k++ ) {
+        hash_dhash_digest_colliding(k, &d);
+        if ( k % 3 == 0 ) {
+            assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_ERR_NOTFOUND );
+        }
+        else {
+            assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_OK );
+            assert( v == k );
+        }
+    }
+    hash_dhash_digest_colliding(n, &d);
+    assert_int_eq( cf_dhash_get(h, &d, NULL), CF_DHASH_ERR_NOTFOUND );
+
+    for ( uint32_t k = 0; k < 500; k++ ) {
+        hash_dhash_digest(k, &d);
+        assert_int_eq( cf_dhash_get(h, &d, &v), CF_DHASH_OK );
+        assert( v == (uint64_t) k * 10 );
+    }
+
+    // the freed slots are reused
+    for ( uint32_t k = 0; k < n; k += 3 ) {
+        hash_dhash_digest_colliding(k, &d);
+        v = k;
+        assert_int_eq( cf_dhash_put_unique(h, &d, &v), CF_DHASH_OK );
+    }
+    assert_int_eq( cf_dhash_get_size(h), n + 500 );
+
+    cf_dhash_destroy(h);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( hash_dhash, "cf_dhash" ) {
+    suite_add( hash_dhash_flags );
+    suite_add( hash_dhash_overflow );
+}
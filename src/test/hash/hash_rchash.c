@@ -0,0 +1,288 @@
+#include "../test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <citrusleaf/cf_alloc.h>
+#include <citrusleaf/cf_rchash.h>
+
+/******************************************************************************
+ * VARIABLES
+ *****************************************************************************/
+
+/**
+ * Number of objects the table's destructor has been called on.
+ */
+static uint32_t hash_rchash_destroyed = 0;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t hash_rchash_fn(void * key, uint32_t key_len) {
+    uint32_t hash = 2166136261u;
+    for ( uint32_t i = 0; i < key_len; i++ ) {
+        hash = (hash ^ ((uint8_t *) key)[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void hash_rchash_destructor(void * object) {
+    __sync_fetch_and_add(&hash_rchash_destroyed, 1);
+}
+
+/**
+ * The key for k - k itself in a fixed key table (key_len 4), or a string
+ * in a variable key table (key_len 0). Returns the key's length.
+ */
+static uint32_t hash_rchash_key(uint32_t key_len, uint32_t k, void * buf) {
+    if ( key_len ) {
+        memcpy(buf, &k, sizeof(k));
+        return sizeof(k);
+    }
+    return (uint32_t) sprintf((char *) buf, "key-%u", k);
+}
+
+static uint32_t * hash_rchash_object(uint32_t value) {
+    uint32_t * object = (uint32_t *) cf_rc_alloc(sizeof(uint32_t));
+    *object = value;
+    return object;
+}
+
+/**
+ * Put keys 0 .. n-1, each key's object holding key * 10.
+ */
+static int hash_rchash_fill(cf_rchash * h, uint32_t key_len, uint32_t n) {
+    char key[32];
+    for ( uint32_t k = 0; k < n; k++ ) {
+        int rc = cf_rchash_put(h, key, hash_rchash_key(key_len, k, key), hash_rchash_object(k * 10));
+        if ( rc != CF_RCHASH_OK ) return rc;
+    }
+    return CF_RCHASH_OK;
+}
+
+/**
+ * Get the value of k's object, or -1 if k isn't found.
+ */
+static int64_t hash_rchash_value(cf_rchash * h, uint32_t key_len, uint32_t k) {
+    char key[32];
+    void * object = NULL;
+    if ( cf_rchash_get(h, key, hash_rchash_key(key_len, k, key), &object) != CF_RCHASH_OK ) {
+        return -1;
+    }
+    int64_t value = *(uint32_t *) object;
+    cf_rc_release(object);
+    return value;
+}
+
+typedef struct {
+    uint64_t values;
+    uint32_t count;
+} hash_rchash_sums;
+
+static int hash_rchash_sum(void * key, uint32_t key_len, void * object, void * udata) {
+    hash_rchash_sums * sums = (hash_rchash_sums *) udata;
+    sums->values += *(uint32_t *) object;
+    sums->count++;
+    return 0;
+}
+
+static void hash_rchash_sum_combine(void * udata, void * thread_udata) {
+    hash_rchash_sums * sums = (hash_rchash_sums *) udata;
+    hash_rchash_sums * thread_sums = (hash_rchash_sums *) thread_udata;
+    sums->values += thread_sums->values;
+    sums->count += thread_sums->count;
+}
+
+static int hash_rchash_delete_odd(void * key, uint32_t key_len, void * object, void * udata) {
+    return (*(uint32_t *) object / 10) & 1 ? CF_RCHASH_REDUCE_DELETE : 0;
+}
+
+/**
+ * The flag combinations exercised by hash_rchash_flags.
+ */
+static const uint hash_rchash_flag_sets[] = {
+    0,
+    CF_RCHASH_CR_RESIZE,
+    CF_RCHASH_CR_MT_BIGLOCK,
+    CF_RCHASH_CR_MT_BIGLOCK | CF_RCHASH_CR_RESIZE,
+    CF_RCHASH_CR_MT_MANYLOCK,
+    CF_RCHASH_CR_MT_MANYLOCK | CF_RCHASH_CR_RESIZE,
+    CF_RCHASH_CR_EPOCH | CF_RCHASH_CR_MT_BIGLOCK,
+    CF_RCHASH_CR_EPOCH | CF_RCHASH_CR_MT_MANYLOCK,
+};
+
+#define HASH_RCHASH_N_FLAG_SETS (sizeof(hash_rchash_flag_sets) / sizeof(hash_rchash_flag_sets[0]))
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( hash_rchash_flags, "cf_rchash put, get, delete and reduce under each flag combination" ) {
+    const uint32_t n = 2000;
+    uint32_t key_lens[] = { sizeof(uint32_t), 0 };
+    char key[32];
+
+    for ( uint i = 0; i < HASH_RCHASH_N_FLAG_SETS; i++ ) {
+        for ( int j = 0; j < 2; j++ ) {
+            uint flags = hash_rchash_flag_sets[i];
+            uint32_t key_len = key_lens[j];
+
+            cf_rchash * h = NULL;
+            assert_int_eq( cf_rchash_create(&h, hash_rchash_fn, hash_rchash_destructor, key_len, 64, flags | CF_RCHASH_CR_STATS), CF_RCHASH_OK );
+            hash_rchash_destroyed = 0;
+
+            // put
+            assert_int_eq( hash_rchash_fill(h, key_len, n), CF_RCHASH_OK );
+            assert_int_eq( cf_rchash_get_size(h), n );
+
+            // a failed put_unique leaves the caller with its reference
+            uint32_t * object = hash_rchash_object(1);
+            assert_int_eq( cf_rchash_put_unique(h, key, hash_rchash_key(key_len, 7, key), object), CF_RCHASH_ERR_FOUND );
+            assert_int_eq( cf_rc_count(object), 1 );
+
+            // replacing an object releases the old one
+            assert_int_eq( cf_rchash_put(h, key, hash_rchash_key(key_len, 7, key), object), CF_RCHASH_OK );
+            assert_int_eq( hash_rchash_value(h, key_len, 7), 1 );
+            assert_int_eq( cf_rchash_put(h, key, hash_rchash_key(key_len, 7, key), hash_rchash_object(70)), CF_RCHASH_OK );
+            assert_int_eq( cf_rchash_get_size(h), n );
+            if ( ! (flags & CF_RCHASH_CR_EPOCH) ) {
+                assert_int_eq( hash_rchash_destroyed, 2 );
+            }
+
+            // a get takes a reference
+            void * got = NULL;
+            assert_int_eq( cf_rchash_get(h, key, hash_rchash_key(key_len, 7, key), &got), CF_RCHASH_OK );
+            assert_int_eq( cf_rc_count(got), 2 );
+            cf_rc_release(got);
+
+            // get
+            for ( uint32_t k = 0; k < n; k++ ) {
+                assert_int_eq( hash_rchash_value(h, key_len, k), k * 10 );
+            }
+            assert_int_eq( hash_rchash_value(h, key_len, n), -1 );
+
+            // reduce
+            hash_rchash_sums sums = { 0, 0 };
+            cf_rchash_reduce(h, hash_rchash_sum, &sums);
+            assert_int_eq( sums.count, n );
+            assert( sums.values == (uint64_t) n * (n - 1) * 5 );
+
+            // delete
+            for ( uint32_t k = 0; k < n; k += 2 ) {
+                assert_int_eq( cf_rchash_delete(h, key, hash_rchash_key(key_len, k, key)), CF_RCHASH_OK );
+                assert_int_eq( cf_rchash_delete(h, key, hash_rchash_key(key_len, k, key)), CF_RCHASH_ERR_NOTFOUND );
+                assert_int_eq( hash_rchash_value(h, key_len, k), -1 );
+            }
+            assert_int_eq( cf_rchash_get_size(h), n / 2 );
+            if ( ! (flags & CF_RCHASH_CR_EPOCH) ) {
+                assert_int_eq( hash_rchash_destroyed, 2 + n / 2 );
+            }
+
+            // reduce delete, leaving nothing
+            cf_rchash_reduce_delete(h, hash_rchash_delete_odd, NULL);
+            assert_int_eq( cf_rchash_get_size(h), 0 );
+            memset(&sums, 0, sizeof(sums));
+            cf_rchash_reduce(h, hash_rchash_sum, &sums);
+            assert_int_eq( sums.count, 0 );
+
+            // deleted keys can be put back
+            assert_int_eq( hash_rchash_fill(h, key_len, n), CF_RCHASH_OK );
+            assert_int_eq( hash_rchash_value(h, key_len, n - 1), (n - 1) * 10 );
+
+            cf_rchash_stats stats;
+            assert_int_eq( cf_rchash_get_stats(h, &stats, true), CF_RCHASH_OK );
+            if ( flags & CF_RCHASH_CR_RESIZE ) {
+                assert_true( stats.resizes > 0 );
+                assert_true( stats.table_len > 64 );
+            }
+            else {
+                assert( stats.resizes == 0 );
+                assert_int_eq( stats.table_len, 64 );
+            }
+
+            // every object is released by the end
+            cf_rchash_destroy(h);
+            assert_int_eq( hash_rchash_destroyed, 2 * n + 2 );
+        }
+    }
+}
+
+TEST( hash_rchash_resize, "cf_rchash gets see every element while a resize is in progress" ) {
+    uint32_t key_lens[] = { sizeof(uint32_t), 0 };
+    char key[32];
+
+    for ( int j = 0; j < 2; j++ ) {
+        uint32_t key_len = key_lens[j];
+        cf_rchash * h = NULL;
+        assert_int_eq( cf_rchash_create(&h, hash_rchash_fn, hash_rchash_destructor, key_len, 16, CF_RCHASH_CR_MT_MANYLOCK | CF_RCHASH_CR_RESIZE | CF_RCHASH_CR_STATS), CF_RCHASH_OK );
+        hash_rchash_destroyed = 0;
+
+        // each put may start or advance a move - all the elements so far
+        // must stay visible throughout
+        for ( uint32_t k = 0; k < 5000; k++ ) {
+            assert_int_eq( cf_rchash_put(h, key, hash_rchash_key(key_len, k, key), hash_rchash_object(k * 10)), CF_RCHASH_OK );
+
+            for ( uint32_t i = k & 7; i <= k; i += 97 ) {
+                assert_int_eq( hash_rchash_value(h, key_len, i), i * 10 );
+            }
+        }
+
+        // deletes advance the move too
+        for ( uint32_t k = 0; k < 5000; k += 2 ) {
+            assert_int_eq( cf_rchash_delete(h, key, hash_rchash_key(key_len, k, key)), CF_RCHASH_OK );
+        }
+        assert_int_eq( cf_rchash_get_size(h), 2500 );
+        assert_int_eq( hash_rchash_destroyed, 2500 );
+
+        hash_rchash_sums sums = { 0, 0 };
+        cf_rchash_reduce(h, hash_rchash_sum, &sums);
+        assert_int_eq( sums.count, 2500 );
+        assert( sums.values == 2500ull * 2500 * 10 );
+
+        cf_rchash_stats stats;
+        assert_int_eq( cf_rchash_get_stats(h, &stats, false), CF_RCHASH_OK );
+        assert_true( stats.resizes >= 8 );
+        assert_true( stats.table_len >= 4096 );
+
+        cf_rchash_destroy(h);
+        assert_int_eq( hash_rchash_destroyed, 5000 );
+    }
+}
+
+TEST( hash_rchash_reduce_parallel, "cf_rchash parallel reduce" ) {
+    uint flags[] = { CF_RCHASH_CR_MT_BIGLOCK, CF_RCHASH_CR_MT_MANYLOCK, CF_RCHASH_CR_EPOCH | CF_RCHASH_CR_MT_MANYLOCK };
+
+    for ( int i = 0; i < 3; i++ ) {
+        cf_rchash * h = NULL;
+        assert_int_eq( cf_rchash_create(&h, hash_rchash_fn, hash_rchash_destructor, sizeof(uint32_t), 1024, flags[i]), CF_RCHASH_OK );
+        hash_rchash_destroyed = 0;
+        assert_int_eq( hash_rchash_fill(h, sizeof(uint32_t), 10000), CF_RCHASH_OK );
+
+        hash_rchash_sums sums = { 0, 0 };
+        assert_int_eq( cf_rchash_reduce_parallel(h, hash_rchash_sum, &sums, sizeof(sums), hash_rchash_sum_combine, 4), CF_RCHASH_OK );
+        assert_int_eq( sums.count, 10000 );
+        assert( sums.values == 10000ull * 9999 * 5 );
+
+        assert_int_eq( cf_rchash_reduce_delete_parallel(h, hash_rchash_delete_odd, NULL, 0, NULL, 4), CF_RCHASH_OK );
+        assert_int_eq( cf_rchash_get_size(h), 5000 );
+
+        memset(&sums, 0, sizeof(sums));
+        assert_int_eq( cf_rchash_reduce_parallel(h, hash_rchash_sum, &sums, sizeof(sums), hash_rchash_sum_combine, 4), CF_RCHASH_OK );
+        assert_int_eq( sums.count, 5000 );
+        assert( sums.values == 5000ull * 4999 * 10 );
+
+        cf_rchash_destroy(h);
+        assert_int_eq( hash_rchash_destroyed, 10000 );
+    }
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( hash_rchash, "cf_rchash" ) {
+    suite_add( hash_rchash_flags );
+    suite_add( hash_rchash_resize );
+    suite_add( hash_rchash_reduce_parallel );
+}
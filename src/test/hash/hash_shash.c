@@ -0,0 +1,384 @@
+#include "../test.h"
+
+#include <string.h>
+
+#include <citrusleaf/cf_shash.h>
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t hash_shash_fn(void * key) {
+    return *(uint32_t *) key * 2654435761u;
+}
+
+/**
+ * Fill a table with keys 0 .. n-1, each key's value being key * 10.
+ */
+static int hash_shash_fill(shash * h, uint32_t n) {
+    for ( uint32_t k = 0; k < n; k++ ) {
+        uint32_t v = k * 10;
+        int rc = shash_put(h, &k, &v);
+        if ( rc != SHASH_OK ) return rc;
+    }
+    return SHASH_OK;
+}
+
+/**
+ * Sum up the keys and values, and count the elements.
+ */
+typedef struct {
+    uint64_t keys;
+    uint64_t values;
+    uint32_t count;
+} hash_shash_sums;
+
+static int hash_shash_sum(void * key, void * value, void * udata) {
+    hash_shash_sums * sums = (hash_shash_sums *) udata;
+    sums->keys += *(uint32_t *) key;
+    sums->values += *(uint32_t *) value;
+    sums->count++;
+    return 0;
+}
+
+static void hash_shash_sum_combine(void * udata, void * thread_udata) {
+    hash_shash_sums * sums = (hash_shash_sums *) udata;
+    hash_shash_sums * thread_sums = (hash_shash_sums *) thread_udata;
+    sums->keys += thread_sums->keys;
+    sums->values += thread_sums->values;
+    sums->count += thread_sums->count;
+}
+
+static int hash_shash_delete_odd(void * key, void * value, void * udata) {
+    return (*(uint32_t *) key & 1) ? SHASH_REDUCE_DELETE : 0;
+}
+
+static int hash_shash_stop(void * key, void * value, void * udata) {
+    return *(uint32_t *) key == *(uint32_t *) udata ? -99 : 0;
+}
+
+/**
+ * The flag combinations exercised by hash_shash_flags and hash_shash_many.
+ */
+static const uint hash_shash_flag_sets[] = {
+    0,
+    SHASH_CR_RESIZE,
+    SHASH_CR_MT_BIGLOCK,
+    SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE,
+    SHASH_CR_MT_MANYLOCK,
+    SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE,
+    SHASH_CR_OPEN,
+    SHASH_CR_OPEN | SHASH_CR_RESIZE,
+    SHASH_CR_OPEN | SHASH_CR_MT_BIGLOCK,
+    SHASH_CR_OPEN | SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE,
+    SHASH_CR_OPEN | SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE,
+    SHASH_CR_READ_MOSTLY | SHASH_CR_MT_BIGLOCK,
+    SHASH_CR_READ_MOSTLY | SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE,
+    SHASH_CR_READ_MOSTLY | SHASH_CR_MT_MANYLOCK,
+    SHASH_CR_READ_MOSTLY | SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE,
+    SHASH_CR_READ_MOSTLY | SHASH_CR_OPEN | SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE,
+};
+
+#define HASH_SHASH_N_FLAG_SETS (sizeof(hash_shash_flag_sets) / sizeof(hash_shash_flag_sets[0]))
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( hash_shash_flags, "shash put, get, delete and reduce under each flag combination" ) {
+    const uint32_t n = 2000;
+
+    for ( uint i = 0; i < HASH_SHASH_N_FLAG_SETS; i++ ) {
+        uint flags = hash_shash_flag_sets[i];
+        // a fixed size open table must have room for every element
+        uint32_t sz = (flags & SHASH_CR_OPEN) && ! (flags & SHASH_CR_RESIZE) ? n : 64;
+
+        shash * h = NULL;
+        assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), sz, flags | SHASH_CR_STATS), SHASH_OK );
+
+        // put
+        assert_int_eq( hash_shash_fill(h, n), SHASH_OK );
+        assert_int_eq( shash_get_size(h), n );
+
+        uint32_t k = 7;
+        uint32_t v = 1;
+        assert_int_eq( shash_put_unique(h, &k, &v), SHASH_ERR_FOUND );
+        assert_int_eq( shash_put(h, &k, &v), SHASH_OK );
+        assert_int_eq( shash_get(h, &k, &v), SHASH_OK );
+        assert_int_eq( v, 1 );
+        v = 70;
+        assert_int_eq( shash_put(h, &k, &v), SHASH_OK );
+        assert_int_eq( shash_get_size(h), n );
+
+        // get
+        for ( k = 0; k < n; k++ ) {
+            v = 0;
+            assert_int_eq( shash_get(h, &k, &v), SHASH_OK );
+            assert_int_eq( v, k * 10 );
+        }
+        k = n;
+        assert_int_eq( shash_get(h, &k, &v), SHASH_ERR_NOTFOUND );
+        assert_int_eq( shash_get(h, &k, NULL), SHASH_ERR_NOTFOUND );
+        k = 0;
+        assert_int_eq( shash_get(h, &k, NULL), SHASH_OK );
+
+        // reduce
+        hash_shash_sums sums = { 0, 0, 0 };
+        assert_int_eq( shash_reduce(h, hash_shash_sum, &sums), SHASH_OK );
+        assert_int_eq( sums.count, n );
+        assert( sums.keys == (uint64_t) n * (n - 1) / 2 );
+        assert( sums.values == sums.keys * 10 );
+
+        k = n / 2;
+        assert_int_eq( shash_reduce(h, hash_shash_stop, &k), -99 );
+
+        // delete
+        for ( k = 0; k < n; k += 4 ) {
+            assert_int_eq( shash_delete(h, &k), SHASH_OK );
+            assert_int_eq( shash_delete(h, &k), SHASH_ERR_NOTFOUND );
+        }
+        for ( k = 2; k < n; k += 4 ) {
+            v = 0;
+            assert_int_eq( shash_get_and_delete(h, &k, &v), SHASH_OK );
+            assert_int_eq( v, k * 10 );
+            assert_int_eq( shash_get(h, &k, &v), SHASH_ERR_NOTFOUND );
+        }
+        assert_int_eq( shash_get_size(h), n / 2 );
+
+        // reduce delete, leaving nothing
+        assert_int_eq( shash_reduce_delete(h, hash_shash_delete_odd, NULL), SHASH_OK );
+        assert_int_eq( shash_get_size(h), 0 );
+        memset(&sums, 0, sizeof(sums));
+        assert_int_eq( shash_reduce(h, hash_shash_sum, &sums), SHASH_OK );
+        assert_int_eq( sums.count, 0 );
+
+        // deleted keys can be put back
+        assert_int_eq( hash_shash_fill(h, n), SHASH_OK );
+        assert_int_eq( shash_get_size(h), n );
+
+        shash_stats stats;
+        assert_int_eq( shash_get_stats(h, &stats, true), SHASH_OK );
+        assert_int_eq( stats.elements, n );
+        if ( flags & SHASH_CR_RESIZE ) {
+            assert_true( stats.resizes > 0 );
+            assert_true( stats.table_len > sz );
+        }
+        else {
+            assert( stats.resizes == 0 );
+        }
+
+        shash_destroy(h);
+    }
+}
+
+TEST( hash_shash_resize, "shash gets see every element while a resize is in progress" ) {
+    uint flags[] = { SHASH_CR_RESIZE, SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE, SHASH_CR_OPEN | SHASH_CR_RESIZE };
+
+    for ( int i = 0; i < 3; i++ ) {
+        shash * h = NULL;
+        assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), 16, flags[i] | SHASH_CR_STATS), SHASH_OK );
+
+        // each put may start or advance a migration - all the elements so
+        // far must stay visible throughout
+        for ( uint32_t k = 0; k < 5000; k++ ) {
+            uint32_t v = k * 10;
+            assert_int_eq( shash_put(h, &k, &v), SHASH_OK );
+
+            for ( uint32_t j = k & 7; j <= k; j += 97 ) {
+                assert_int_eq( shash_get(h, &j, &v), SHASH_OK );
+                assert_int_eq( v, j * 10 );
+            }
+        }
+        assert_int_eq( shash_get_size(h), 5000 );
+
+        // deletes advance the migration too
+        for ( uint32_t k = 0; k < 5000; k += 2 ) {
+            assert_int_eq( shash_delete(h, &k), SHASH_OK );
+        }
+        assert_int_eq( shash_get_size(h), 2500 );
+
+        hash_shash_sums sums = { 0, 0, 0 };
+        assert_int_eq( shash_reduce(h, hash_shash_sum, &sums), SHASH_OK );
+        assert_int_eq( sums.count, 2500 );
+        assert( sums.keys == 2500ull * 2500 );
+
+        shash_stats stats;
+        assert_int_eq( shash_get_stats(h, &stats, false), SHASH_OK );
+        assert_true( stats.resizes >= 8 );
+        assert_true( stats.table_len >= 4096 );
+
+        shash_destroy(h);
+    }
+}
+
+TEST( hash_shash_many, "shash put_many and get_many under each flag combination" ) {
+    const uint32_t n = 1000;
+    uint32_t keys[1000];
+    uint32_t values[1000];
+    int results[1000];
+
+    for ( uint i = 0; i < HASH_SHASH_N_FLAG_SETS; i++ ) {
+        uint flags = hash_shash_flag_sets[i];
+        // many more keys than the table starts with, unless it can't grow
+        uint32_t sz = (flags & SHASH_CR_OPEN) && ! (flags & SHASH_CR_RESIZE) ? n : 16;
+
+        shash * h = NULL;
+        assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), sz, flags), SHASH_OK );
+
+        for ( uint32_t k = 0; k < n; k++ ) {
+            keys[k] = k * 3;
+            values[k] = k;
+            results[k] = SHASH_ERR;
+        }
+        assert_int_eq( shash_put_many(h, keys, values, n, results), SHASH_OK );
+        for ( uint32_t k = 0; k < n; k++ ) {
+            assert_int_eq( results[k], SHASH_OK );
+        }
+        assert_int_eq( shash_get_size(h), n );
+
+        // the same keys again only update the values
+        for ( uint32_t k = 0; k < n; k++ ) {
+            values[k] = k + 1;
+        }
+        assert_int_eq( shash_put_many(h, keys, values, n, NULL), SHASH_OK );
+        assert_int_eq( shash_get_size(h), n );
+
+        // every other key is missing
+        for ( uint32_t k = 0; k < n; k++ ) {
+            keys[k] = k * 3 * (k & 1 ? 1000 : 1);
+            values[k] = 0;
+        }
+        shash_get_many(h, keys, values, n, results);
+        for ( uint32_t k = 0; k < n; k++ ) {
+            if ( k & 1 ) {
+                assert_int_eq( results[k], SHASH_ERR_NOTFOUND );
+            }
+            else {
+                assert_int_eq( results[k], SHASH_OK );
+                assert_int_eq( values[k], k + 1 );
+            }
+        }
+
+        // and single gets agree
+        for ( uint32_t k = 0; k < n; k++ ) {
+            uint32_t key = k * 3;
+            uint32_t v = 0;
+            assert_int_eq( shash_get(h, &key, &v), SHASH_OK );
+            assert_int_eq( v, k + 1 );
+        }
+
+        shash_destroy(h);
+    }
+}
+
+TEST( hash_shash_reduce_parallel, "shash parallel reduce" ) {
+    uint flags[] = { SHASH_CR_MT_BIGLOCK, SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE, SHASH_CR_OPEN | SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE };
+
+    for ( int i = 0; i < 3; i++ ) {
+        shash * h = NULL;
+        assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), 1024, flags[i]), SHASH_OK );
+        assert_int_eq( hash_shash_fill(h, 10000), SHASH_OK );
+
+        hash_shash_sums sums = { 0, 0, 0 };
+        assert_int_eq( shash_reduce_parallel(h, hash_shash_sum, &sums, sizeof(sums), hash_shash_sum_combine, 4), SHASH_OK );
+        assert_int_eq( sums.count, 10000 );
+        assert( sums.keys == 10000ull * 9999 / 2 );
+        assert( sums.values == sums.keys * 10 );
+
+        assert_int_eq( shash_reduce_delete_parallel(h, hash_shash_delete_odd, NULL, 0, NULL, 4), SHASH_OK );
+        assert_int_eq( shash_get_size(h), 5000 );
+
+        memset(&sums, 0, sizeof(sums));
+        assert_int_eq( shash_reduce_parallel(h, hash_shash_sum, &sums, sizeof(sums), hash_shash_sum_combine, 4), SHASH_OK );
+        assert_int_eq( sums.count, 5000 );
+        assert( sums.keys == 5000ull * 4999 );
+
+        shash_destroy(h);
+    }
+}
+
+TEST( hash_shash_open_fixed, "shash open addressing without resize holds sz elements" ) {
+    uint32_t sizes[] = { 64, 8000 };
+
+    for ( int i = 0; i < 2; i++ ) {
+        uint32_t sz = sizes[i];
+        shash * h = NULL;
+        assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), sz, SHASH_CR_OPEN | SHASH_CR_MT_BIGLOCK), SHASH_OK );
+
+        assert_int_eq( hash_shash_fill(h, sz), SHASH_OK );
+        assert_int_eq( shash_get_size(h), sz );
+
+        // full
+        uint32_t k = sz;
+        uint32_t v = 0;
+        assert_int_eq( shash_put(h, &k, &v), SHASH_ERR );
+
+        for ( k = 0; k < sz; k++ ) {
+            assert_int_eq( shash_get(h, &k, &v), SHASH_OK );
+            assert_int_eq( v, k * 10 );
+        }
+
+        // deleted slots are reused
+        for ( k = 0; k < sz; k += 2 ) {
+            assert_int_eq( shash_delete(h, &k), SHASH_OK );
+        }
+        for ( k = sz; k < sz + sz / 2; k++ ) {
+            assert_int_eq( shash_put(h, &k, &v), SHASH_OK );
+        }
+        assert_int_eq( shash_get_size(h), sz );
+
+        shash_destroy(h);
+    }
+}
+
+TEST( hash_shash_open_manylock, "shash open addressing with manylock requires resize" ) {
+    shash * h = NULL;
+    assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), 8000, SHASH_CR_OPEN | SHASH_CR_MT_MANYLOCK), SHASH_ERR );
+    assert_null( h );
+
+    assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), 64, SHASH_CR_OPEN | SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE), SHASH_OK );
+    assert_int_eq( hash_shash_fill(h, 8000), SHASH_OK );
+    assert_int_eq( shash_get_size(h), 8000 );
+
+    uint32_t v = 0;
+    for ( uint32_t k = 0; k < 8000; k++ ) {
+        assert_int_eq( shash_get(h, &k, &v), SHASH_OK );
+        assert_int_eq( v, k * 10 );
+    }
+
+    shash_destroy(h);
+}
+
+TEST( hash_shash_read_mostly, "shash read-mostly gets" ) {
+    shash * h = NULL;
+    assert_int_eq( shash_create(&h, hash_shash_fn, sizeof(uint32_t), sizeof(uint32_t), 64, SHASH_CR_READ_MOSTLY | SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE), SHASH_OK );
+    assert_int_eq( hash_shash_fill(h, 1000), SHASH_OK );
+
+    uint32_t v = 0;
+    for ( uint32_t k = 0; k < 1000; k++ ) {
+        assert_int_eq( shash_get(h, &k, &v), SHASH_OK );
+        assert_int_eq( v, k * 10 );
+    }
+
+    // a key that isn't found leaves the value alone
+    uint32_t k = 1000;
+    v = 12345;
+    assert_int_eq( shash_get(h, &k, &v), SHASH_ERR_NOTFOUND );
+    assert_int_eq( v, 12345 );
+
+    shash_destroy(h);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( hash_shash, "shash" ) {
+    suite_add( hash_shash_flags );
+    suite_add( hash_shash_resize );
+    suite_add( hash_shash_many );
+    suite_add( hash_shash_reduce_parallel );
+    suite_add( hash_shash_open_fixed );
+    suite_add( hash_shash_open_manylock );
+    suite_add( hash_shash_read_mostly );
+}
@@ -166,6 +166,41 @@ TEST( msgpack_roundtrip_map2, "roundtrip: {'abc': [1,2,3], 'def': [4,5,6], 'ghi'
 	as_hashmap_destroy(&m1);
 	as_val_destroy(v2);
 }
+TEST( msgpack_roundtrip_arena1, "roundtrip into an arena: {\"abc\":[1,2,3],\"def\":\"xyz\"}" )
+{
+	as_arraylist l1;
+	as_arraylist_init(&l1, 3, 0);
+	as_arraylist_append_int64(&l1, 1);
+	as_arraylist_append_int64(&l1, 2);
+	as_arraylist_append_int64(&l1, 3);
+
+	as_hashmap m1;
+	as_hashmap_init(&m1, 2);
+	as_stringmap_set_list((as_map *) &m1, "abc", (as_list *) &l1);
+	as_stringmap_set_str((as_map *) &m1, "def", "xyz");
+
+	as_arena arena;
+	as_arena_init(&arena, 0);
+
+	as_serializer ser;
+	as_msgpack_init_arena(&ser, &arena);
+
+	as_buffer b;
+	as_buffer_init(&b);
+
+	as_val * v2 = NULL;
+	as_serializer_serialize(&ser, (as_val *) &m1, &b);
+	as_serializer_deserialize(&ser, &b, &v2);
+
+	assert_true( v2->arena );
+	assert_val_eq(v2, &m1);
+
+	as_val_destroy(v2);
+	as_arena_destroy(&arena);
+	as_buffer_destroy(&b);
+	as_hashmap_destroy(&m1);
+}
+
 /******************************************************************************
  * TEST SUITE
  *****************************************************************************/
@@ -177,4 +212,5 @@ SUITE( msgpack_roundtrip, "as_msgpack roundtrip serialize/deserialize" ) {
 	suite_add( msgpack_roundtrip_list2 );
 	suite_add( msgpack_roundtrip_map1 );
 	suite_add( msgpack_roundtrip_map2 );
+	suite_add( msgpack_roundtrip_arena1 );
 }
@@ -0,0 +1,186 @@
+#include "../test.h"
+
+#include <citrusleaf/cf_queue_priority.h>
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * Push n elements onto level pri, each holding the level in the top half
+ * and a sequence number in the bottom half.
+ */
+static int queue_priority_fill(cf_queue_priority * q, int pri, uint32_t n) {
+    for ( uint32_t i = 0; i < n; i++ ) {
+        uint32_t v = ((uint32_t) pri << 16) | i;
+        int rc = cf_queue_priority_push(q, &v, pri);
+        if ( rc != CF_QUEUE_OK ) return rc;
+    }
+    return CF_QUEUE_OK;
+}
+
+/**
+ * Pop one element, returning its level, and checking that the level's
+ * elements come out in order - or 0 if the pop failed.
+ */
+static int queue_priority_pop_level(cf_queue_priority * q, uint32_t * next) {
+    uint32_t v = 0;
+    if ( cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT) != CF_QUEUE_OK ) {
+        return 0;
+    }
+    uint32_t pri = v >> 16;
+    if ( (v & 0xffff) != next[pri]++ ) {
+        return 0;
+    }
+    return (int) pri;
+}
+
+static int queue_priority_collect(void * buf, void * udata) {
+    uint32_t ** out = (uint32_t **) udata;
+    *(*out)++ = *(uint32_t *) buf;
+    // delete the odd elements
+    return (*(uint32_t *) buf & 1) ? -2 : 0;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( queue_priority_strict, "cf_queue_priority pops the highest level first" ) {
+    cf_queue_priority * q = cf_queue_priority_create(sizeof(uint32_t), true);
+    assert_not_null( q );
+
+    uint32_t v = 0;
+    assert_int_eq( cf_queue_priority_push(q, &v, 0), CF_QUEUE_ERR );
+    assert_int_eq( cf_queue_priority_push(q, &v, CF_QUEUE_PRIORITY_LOW + 1), CF_QUEUE_ERR );
+    assert_int_eq( cf_queue_priority_sz(q), 0 );
+
+    // pushed lowest first, so order of arrival doesn't help
+    assert_int_eq( queue_priority_fill(q, CF_QUEUE_PRIORITY_LOW, 10), CF_QUEUE_OK );
+    assert_int_eq( queue_priority_fill(q, CF_QUEUE_PRIORITY_MEDIUM, 10), CF_QUEUE_OK );
+    assert_int_eq( queue_priority_fill(q, CF_QUEUE_PRIORITY_HIGH, 10), CF_QUEUE_OK );
+    assert_int_eq( cf_queue_priority_sz(q), 30 );
+
+    uint32_t next[4] = { 0, 0, 0, 0 };
+    for ( int i = 0; i < 30; i++ ) {
+        assert_int_eq( queue_priority_pop_level(q, next), 1 + i / 10 );
+
+        // a higher level push jumps the queue
+        if ( i == 15 ) {
+            v = (CF_QUEUE_PRIORITY_HIGH << 16) | 10;
+            assert_int_eq( cf_queue_priority_push(q, &v, CF_QUEUE_PRIORITY_HIGH), CF_QUEUE_OK );
+            assert_int_eq( queue_priority_pop_level(q, next), CF_QUEUE_PRIORITY_HIGH );
+        }
+    }
+
+    assert_int_eq( cf_queue_priority_sz(q), 0 );
+    assert_int_eq( cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY );
+    assert_int_eq( cf_queue_priority_pop(q, &v, 10), CF_QUEUE_EMPTY );
+
+    cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_weighted, "cf_queue_priority weighted levels take turns" ) {
+    uint weights[] = { 4, 2, 1 };
+    assert_null( cf_queue_priority_create_n(sizeof(uint32_t), true, 0, NULL) );
+    assert_null( cf_queue_priority_create_n(sizeof(uint32_t), true, CF_QUEUE_PRIORITY_MAX_LEVELS + 1, NULL) );
+    uint bad_weights[] = { 4, 0, 1 };
+    assert_null( cf_queue_priority_create_n(sizeof(uint32_t), true, 3, bad_weights) );
+
+    cf_queue_priority * q = cf_queue_priority_create_n(sizeof(uint32_t), true, 3, weights);
+    assert_not_null( q );
+
+    for ( int pri = 1; pri <= 3; pri++ ) {
+        assert_int_eq( queue_priority_fill(q, pri, 100), CF_QUEUE_OK );
+    }
+
+    // each round is 4 pops of level 1, 2 of level 2 and 1 of level 3
+    uint32_t next[4] = { 0, 0, 0, 0 };
+    const int round[] = { 1, 1, 1, 1, 2, 2, 3 };
+    for ( int i = 0; i < 70; i++ ) {
+        assert_int_eq( queue_priority_pop_level(q, next), round[i % 7] );
+    }
+    assert_int_eq( next[1], 40 );
+    assert_int_eq( next[2], 20 );
+    assert_int_eq( next[3], 10 );
+
+    // level 1 runs out after 60 more of its pops, and the others share
+    // the turns from then on
+    uint32_t counts[4] = { 0, 0, 0, 0 };
+    for ( int i = 0; i < 105; i++ ) {
+        counts[queue_priority_pop_level(q, next)]++;
+    }
+    assert_int_eq( counts[0], 0 );
+    assert_int_eq( counts[1], 60 );
+    assert_int_eq( counts[2], 30 );
+    assert_int_eq( counts[3], 15 );
+
+    for ( int i = 0; i < 125; i++ ) {
+        int pri = queue_priority_pop_level(q, next);
+        assert_true( pri == 2 || pri == 3 );
+    }
+    assert_int_eq( cf_queue_priority_sz(q), 0 );
+
+    cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_weighted_skip, "cf_queue_priority empty levels give up their turn" ) {
+    uint weights[] = { 3, 5, 1 };
+    cf_queue_priority * q = cf_queue_priority_create_n(sizeof(uint32_t), true, 3, weights);
+
+    assert_int_eq( queue_priority_fill(q, 1, 30), CF_QUEUE_OK );
+    assert_int_eq( queue_priority_fill(q, 3, 10), CF_QUEUE_OK );
+
+    // level 2 is empty, so it doesn't hold up level 3
+    uint32_t next[4] = { 0, 0, 0, 0 };
+    const int round[] = { 1, 1, 1, 3 };
+    for ( int i = 0; i < 40; i++ ) {
+        assert_int_eq( queue_priority_pop_level(q, next), round[i % 4] );
+    }
+    assert_int_eq( cf_queue_priority_sz(q), 0 );
+
+    cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_reduce, "cf_queue_priority reduce and delete" ) {
+    cf_queue_priority * q = cf_queue_priority_create(sizeof(uint32_t), false);
+
+    assert_int_eq( queue_priority_fill(q, CF_QUEUE_PRIORITY_LOW, 4), CF_QUEUE_OK );
+    assert_int_eq( queue_priority_fill(q, CF_QUEUE_PRIORITY_HIGH, 4), CF_QUEUE_OK );
+
+    // from the highest level down, deleting the odd ones
+    uint32_t seen[8];
+    uint32_t * out = seen;
+    assert_int_eq( cf_queue_priority_reduce(q, queue_priority_collect, &out), CF_QUEUE_OK );
+    assert_int_eq( out - seen, 8 );
+    for ( uint32_t i = 0; i < 8; i++ ) {
+        uint32_t pri = i < 4 ? CF_QUEUE_PRIORITY_HIGH : CF_QUEUE_PRIORITY_LOW;
+        assert_int_eq( seen[i], (pri << 16) | (i % 4) );
+    }
+    assert_int_eq( cf_queue_priority_sz(q), 4 );
+
+    uint32_t v = (CF_QUEUE_PRIORITY_LOW << 16) | 2;
+    assert_int_eq( cf_queue_priority_delete(q, &v, true), CF_QUEUE_OK );
+    assert_int_eq( cf_queue_priority_delete(q, &v, true), CF_QUEUE_EMPTY );
+    assert_int_eq( cf_queue_priority_sz(q), 3 );
+
+    assert_int_eq( cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+    assert_int_eq( v, (CF_QUEUE_PRIORITY_HIGH << 16) | 0 );
+    assert_int_eq( cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+    assert_int_eq( v, (CF_QUEUE_PRIORITY_HIGH << 16) | 2 );
+    assert_int_eq( cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+    assert_int_eq( v, (CF_QUEUE_PRIORITY_LOW << 16) | 0 );
+
+    cf_queue_priority_destroy(q);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( queue_priority, "cf_queue_priority" ) {
+    suite_add( queue_priority_strict );
+    suite_add( queue_priority_weighted );
+    suite_add( queue_priority_weighted_skip );
+    suite_add( queue_priority_reduce );
+}
@@ -0,0 +1,363 @@
+#include "../test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <citrusleaf/cf_queue.h>
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define QUEUE_QUEUE_THREADS 4
+#define QUEUE_QUEUE_PER_THREAD 100000
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+    cf_queue *  q;
+    uint32_t    id;
+    uint64_t    sum;
+    bool        ordered;
+} queue_queue_thread;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * Push QUEUE_QUEUE_PER_THREAD elements, the thread's id in the top byte and
+ * a sequence number below it, retrying while the queue is full.
+ */
+static void * queue_queue_produce(void * udata) {
+    queue_queue_thread * t = (queue_queue_thread *) udata;
+    for ( uint32_t i = 0; i < QUEUE_QUEUE_PER_THREAD; i++ ) {
+        uint32_t v = (t->id << 24) | i;
+        while ( cf_queue_push(t->q, &v) == CF_QUEUE_FULL ) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Pop QUEUE_QUEUE_PER_THREAD elements, checking that each producer's
+ * elements arrive in the order they were pushed.
+ */
+static void * queue_queue_consume(void * udata) {
+    queue_queue_thread * t = (queue_queue_thread *) udata;
+    int32_t last[QUEUE_QUEUE_THREADS];
+    memset(last, 0xff, sizeof(last));
+    t->sum = 0;
+    t->ordered = true;
+
+    for ( uint32_t i = 0; i < QUEUE_QUEUE_PER_THREAD; i++ ) {
+        uint32_t v = 0;
+        if ( cf_queue_pop(t->q, &v, CF_QUEUE_FOREVER) != CF_QUEUE_OK ) {
+            t->ordered = false;
+            break;
+        }
+        uint32_t id = v >> 24;
+        int32_t seq = (int32_t) (v & 0xffffff);
+        if ( id >= QUEUE_QUEUE_THREADS || seq <= last[id] ) {
+            t->ordered = false;
+        }
+        else {
+            last[id] = seq;
+        }
+        t->sum += v & 0xffffff;
+    }
+    return NULL;
+}
+
+/**
+ * Run n producers against n consumers, which share the elements evenly.
+ * True if every element arrived once, in order.
+ */
+static bool queue_queue_run(cf_queue * q, uint n) {
+    queue_queue_thread producers[QUEUE_QUEUE_THREADS];
+    queue_queue_thread consumers[QUEUE_QUEUE_THREADS];
+    pthread_t producer_ids[QUEUE_QUEUE_THREADS];
+    pthread_t consumer_ids[QUEUE_QUEUE_THREADS];
+
+    for ( uint i = 0; i < n; i++ ) {
+        producers[i].q = q;
+        producers[i].id = i;
+        consumers[i].q = q;
+        pthread_create(&consumer_ids[i], NULL, queue_queue_consume, &consumers[i]);
+        pthread_create(&producer_ids[i], NULL, queue_queue_produce, &producers[i]);
+    }
+
+    bool ok = true;
+    uint64_t sum = 0;
+    for ( uint i = 0; i < n; i++ ) {
+        pthread_join(producer_ids[i], NULL);
+        pthread_join(consumer_ids[i], NULL);
+        ok = ok && consumers[i].ordered;
+        sum += consumers[i].sum;
+    }
+
+    uint64_t per_thread = QUEUE_QUEUE_PER_THREAD;
+    return ok && sum == n * (per_thread * (per_thread - 1) / 2) && cf_queue_sz(q) == 0;
+}
+
+/**
+ * Push 10 elements with one push_n, after a short sleep.
+ */
+static void * queue_queue_push_later(void * udata) {
+    uint32_t values[10];
+    for ( uint32_t i = 0; i < 10; i++ ) {
+        values[i] = i;
+    }
+    usleep(20 * 1000);
+    cf_queue_push_n((cf_queue *) udata, values, 10);
+    return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( queue_queue_fifo, "cf_queue pops in push order" ) {
+    cf_queue * queues[] = {
+        cf_queue_create(sizeof(uint32_t), true),
+        cf_queue_create_ring(sizeof(uint32_t), 16),
+        cf_queue_create_spsc(sizeof(uint32_t), 16)
+    };
+
+    for ( int i = 0; i < 3; i++ ) {
+        cf_queue * q = queues[i];
+        assert_not_null( q );
+        uint32_t v = 0;
+
+        // interleaved, so the positions wrap around many times
+        uint32_t next_push = 0;
+        uint32_t next_pop = 0;
+        for ( int round = 0; round < 1000; round++ ) {
+            for ( int j = 0; j < 11; j++, next_push++ ) {
+                assert_int_eq( cf_queue_push(q, &next_push), CF_QUEUE_OK );
+            }
+            for ( int j = 0; j < 10; j++, next_pop++ ) {
+                assert_int_eq( cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+                assert_int_eq( v, next_pop );
+            }
+            if ( cf_queue_sz(q) > 4 ) {
+                for ( ; next_pop < next_push; next_pop++ ) {
+                    assert_int_eq( cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+                    assert_int_eq( v, next_pop );
+                }
+            }
+            assert_int_eq( cf_queue_sz(q), next_push - next_pop );
+        }
+
+        cf_queue_destroy(q);
+    }
+}
+
+TEST( queue_queue_empty, "cf_queue pop from an empty queue" ) {
+    cf_queue * queues[] = {
+        cf_queue_create(sizeof(uint32_t), true),
+        cf_queue_create_ring(sizeof(uint32_t), 16),
+        cf_queue_create_spsc(sizeof(uint32_t), 16)
+    };
+
+    for ( int i = 0; i < 3; i++ ) {
+        cf_queue * q = queues[i];
+        uint32_t v = 12345;
+
+        assert_int_eq( cf_queue_sz(q), 0 );
+        assert_int_eq( cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY );
+        assert_int_eq( cf_queue_pop(q, &v, 10), CF_QUEUE_EMPTY );
+        assert_int_eq( v, 12345 );
+
+        // emptied again after use
+        v = 1;
+        assert_int_eq( cf_queue_push(q, &v), CF_QUEUE_OK );
+        assert_int_eq( cf_queue_pop(q, &v, 10), CF_QUEUE_OK );
+        assert_int_eq( cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY );
+
+        cf_queue_destroy(q);
+    }
+}
+
+TEST( queue_queue_ring_full, "cf_queue rings are bounded by their capacity" ) {
+    assert_null( cf_queue_create_ring(sizeof(uint32_t), 0) );
+    assert_null( cf_queue_create_ring(0, 16) );
+    assert_null( cf_queue_create_spsc(sizeof(uint32_t), 0) );
+    assert_null( cf_queue_create_spsc(0, 16) );
+
+    // capacity is rounded up to a power of 2
+    cf_queue * queues[] = {
+        cf_queue_create_ring(sizeof(uint32_t), 5),
+        cf_queue_create_spsc(sizeof(uint32_t), 5)
+    };
+
+    for ( int i = 0; i < 2; i++ ) {
+        cf_queue * q = queues[i];
+        assert_not_null( q );
+
+        for ( uint32_t v = 0; v < 8; v++ ) {
+            assert_int_eq( cf_queue_push(q, &v), CF_QUEUE_OK );
+        }
+        uint32_t v = 8;
+        assert_int_eq( cf_queue_push(q, &v), CF_QUEUE_FULL );
+        assert_false( cf_queue_push_limit(q, &v, 100) );
+        assert_int_eq( cf_queue_sz(q), 8 );
+
+        // a freed slot can be pushed to again
+        assert_int_eq( cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+        assert_int_eq( v, 0 );
+        assert_false( cf_queue_push_limit(q, &v, 7) );
+        v = 8;
+        assert_true( cf_queue_push_limit(q, &v, 8) );
+        assert_int_eq( cf_queue_push(q, &v), CF_QUEUE_FULL );
+
+        for ( uint32_t j = 1; j <= 8; j++ ) {
+            assert_int_eq( cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+            assert_int_eq( v, j );
+        }
+        assert_int_eq( cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY );
+
+        cf_queue_destroy(q);
+    }
+}
+
+TEST( queue_queue_limit, "cf_queue push_limit on a growable queue" ) {
+    cf_queue * q = cf_queue_create(sizeof(uint32_t), true);
+
+    for ( uint32_t v = 0; v < 100; v++ ) {
+        assert_true( cf_queue_push_limit(q, &v, 100) );
+    }
+    uint32_t v = 100;
+    assert_false( cf_queue_push_limit(q, &v, 100) );
+    assert_int_eq( cf_queue_sz(q), 100 );
+
+    // growable queues are never full
+    assert_int_eq( cf_queue_push(q, &v), CF_QUEUE_OK );
+    assert_int_eq( cf_queue_sz(q), 101 );
+
+    cf_queue_destroy(q);
+}
+
+TEST( queue_queue_push_n, "cf_queue push_n and pop_n" ) {
+    cf_queue * queues[] = {
+        cf_queue_create(sizeof(uint32_t), true),
+        cf_queue_create_ring(sizeof(uint32_t), 128),
+        cf_queue_create_spsc(sizeof(uint32_t), 128)
+    };
+
+    uint32_t values[100];
+    uint32_t got[100];
+    for ( uint32_t i = 0; i < 100; i++ ) {
+        values[i] = i;
+    }
+
+    for ( int i = 0; i < 3; i++ ) {
+        cf_queue * q = queues[i];
+
+        // nothing to do, and no waiting for it
+        assert_int_eq( cf_queue_push_n(q, values, 0), 0 );
+        assert_int_eq( cf_queue_pop_n(q, got, 0, CF_QUEUE_FOREVER), 0 );
+        assert_int_eq( cf_queue_sz(q), 0 );
+
+        assert_int_eq( cf_queue_push_n(q, values, 100), 100 );
+        assert_int_eq( cf_queue_sz(q), 100 );
+
+        // single and batched pops take from the same order
+        assert_int_eq( cf_queue_pop(q, got, CF_QUEUE_NOWAIT), CF_QUEUE_OK );
+        assert_int_eq( got[0], 0 );
+        assert_int_eq( cf_queue_pop_n(q, got, 30, CF_QUEUE_NOWAIT), 30 );
+        for ( uint32_t j = 0; j < 30; j++ ) {
+            assert_int_eq( got[j], j + 1 );
+        }
+
+        // a pop_n takes whatever there is
+        assert_int_eq( cf_queue_pop_n(q, got, 100, CF_QUEUE_NOWAIT), 69 );
+        for ( uint32_t j = 0; j < 69; j++ ) {
+            assert_int_eq( got[j], j + 31 );
+        }
+        assert_int_eq( cf_queue_pop_n(q, got, 100, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY );
+        assert_int_eq( cf_queue_pop_n(q, got, 100, 10), CF_QUEUE_EMPTY );
+
+        // a waiting pop_n is woken by a push_n
+        pthread_t thread;
+        pthread_create(&thread, NULL, queue_queue_push_later, q);
+        int n = cf_queue_pop_n(q, got, 100, CF_QUEUE_FOREVER);
+        pthread_join(thread, NULL);
+        assert_true( n >= 1 && n <= 10 );
+        assert_int_eq( got[0], 0 );
+        if ( n < 10 ) {
+            assert_int_eq( cf_queue_pop_n(q, got + n, 100, CF_QUEUE_NOWAIT), 10 - n );
+        }
+        assert_int_eq( got[9], 9 );
+
+        cf_queue_destroy(q);
+    }
+}
+
+TEST( queue_queue_ring_push_n, "cf_queue ring push_n takes what fits" ) {
+    cf_queue * queues[] = {
+        cf_queue_create_ring(sizeof(uint32_t), 8),
+        cf_queue_create_spsc(sizeof(uint32_t), 8)
+    };
+
+    uint32_t values[10];
+    uint32_t got[10];
+    for ( uint32_t i = 0; i < 10; i++ ) {
+        values[i] = i;
+    }
+
+    for ( int i = 0; i < 2; i++ ) {
+        cf_queue * q = queues[i];
+
+        assert_int_eq( cf_queue_push_n(q, values, 5), 5 );
+        assert_int_eq( cf_queue_push_n(q, values + 5, 5), 3 );
+        assert_int_eq( cf_queue_push_n(q, values + 8, 2), CF_QUEUE_FULL );
+        assert_int_eq( cf_queue_push_n(q, values, 0), 0 );
+        assert_int_eq( cf_queue_sz(q), 8 );
+
+        assert_int_eq( cf_queue_pop_n(q, got, 3, CF_QUEUE_NOWAIT), 3 );
+        assert_int_eq( cf_queue_push_n(q, values + 8, 2), 2 );
+        assert_int_eq( cf_queue_pop_n(q, got + 3, 10, CF_QUEUE_NOWAIT), 7 );
+        for ( uint32_t j = 0; j < 10; j++ ) {
+            assert_int_eq( got[j], j );
+        }
+        assert_int_eq( cf_queue_pop_n(q, got, 10, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY );
+
+        cf_queue_destroy(q);
+    }
+}
+
+TEST( queue_queue_threads, "cf_queue with several producers and consumers" ) {
+    cf_queue * q = cf_queue_create(sizeof(uint32_t), true);
+    assert_true( queue_queue_run(q, QUEUE_QUEUE_THREADS) );
+    cf_queue_destroy(q);
+
+    // a small ring, so the producers keep finding it full
+    q = cf_queue_create_ring(sizeof(uint32_t), 64);
+    assert_true( queue_queue_run(q, QUEUE_QUEUE_THREADS) );
+    cf_queue_destroy(q);
+
+    // one of each only
+    q = cf_queue_create_spsc(sizeof(uint32_t), 64);
+    assert_true( queue_queue_run(q, 1) );
+    cf_queue_destroy(q);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( queue_queue, "cf_queue" ) {
+    suite_add( queue_queue_fifo );
+    suite_add( queue_queue_empty );
+    suite_add( queue_queue_ring_full );
+    suite_add( queue_queue_limit );
+    suite_add( queue_queue_push_n );
+    suite_add( queue_queue_ring_push_n );
+    suite_add( queue_queue_threads );
+}
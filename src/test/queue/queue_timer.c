@@ -0,0 +1,167 @@
+#include "../test.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <citrusleaf/cf_clock.h>
+#include <citrusleaf/cf_queue_timer.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+    cf_queue_timer *    q;
+    cf_clock            deadline;
+} queue_timer_push_args;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * Push an element with the given deadline, after a short sleep.
+ */
+static void * queue_timer_push_later(void * udata) {
+    queue_timer_push_args * args = (queue_timer_push_args *) udata;
+    usleep(20 * 1000);
+    uint32_t v = 2;
+    cf_queue_timer_push(args->q, &v, args->deadline, NULL);
+    return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( queue_timer_order, "cf_queue_timer elements expire earliest deadline first" ) {
+    cf_queue_timer * q = cf_queue_timer_create(sizeof(uint32_t), true);
+    assert_not_null( q );
+    assert_true( cf_queue_timer_next_deadline(q) == 0 );
+
+    // far enough ahead that nothing expires by itself - the deadlines are
+    // a permutation of base + 0 .. 999
+    cf_clock base = cf_getms() + 1000000;
+    for ( uint32_t i = 0; i < 1000; i++ ) {
+        uint32_t offset = (i * 7919) % 1000;
+        assert_int_eq( cf_queue_timer_push(q, &offset, base + offset, NULL), CF_QUEUE_OK );
+    }
+    assert_int_eq( cf_queue_timer_sz(q), 1000 );
+    assert_true( cf_queue_timer_next_deadline(q) == base );
+
+    uint32_t v = 0;
+    assert_int_eq( cf_queue_timer_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY );
+    assert_int_eq( cf_queue_timer_pop_expired(q, &v, 1, base - 1), 0 );
+
+    // only what has expired by "now", in order
+    uint32_t got[1000];
+    assert_int_eq( cf_queue_timer_pop_expired(q, got, 1000, base + 499), 500 );
+    for ( uint32_t i = 0; i < 500; i++ ) {
+        assert_int_eq( got[i], i );
+    }
+    assert_true( cf_queue_timer_next_deadline(q) == base + 500 );
+
+    // at most n
+    assert_int_eq( cf_queue_timer_pop_expired(q, got, 10, base + 1000), 10 );
+    for ( uint32_t i = 0; i < 10; i++ ) {
+        assert_int_eq( got[i], 500 + i );
+    }
+
+    // an earlier deadline goes to the front
+    v = 9999;
+    assert_int_eq( cf_queue_timer_push(q, &v, base, NULL), CF_QUEUE_OK );
+    assert_true( cf_queue_timer_next_deadline(q) == base );
+    assert_int_eq( cf_queue_timer_pop_expired(q, got, 1000, base + 1000), 491 );
+    assert_int_eq( got[0], 9999 );
+    for ( uint32_t i = 1; i < 491; i++ ) {
+        assert_int_eq( got[i], 509 + i );
+    }
+
+    assert_int_eq( cf_queue_timer_sz(q), 0 );
+    assert_true( cf_queue_timer_next_deadline(q) == 0 );
+
+    cf_queue_timer_destroy(q);
+}
+
+TEST( queue_timer_cancel, "cf_queue_timer cancel" ) {
+    cf_queue_timer * q = cf_queue_timer_create(sizeof(uint32_t), true);
+    cf_clock base = cf_getms() + 1000000;
+
+    cf_queue_timer_handle handles[100];
+    for ( uint32_t i = 0; i < 100; i++ ) {
+        assert_int_eq( cf_queue_timer_push(q, &i, base + i, &handles[i]), CF_QUEUE_OK );
+        assert_true( handles[i] != CF_QUEUE_TIMER_NO_HANDLE );
+    }
+
+    uint32_t v = 0;
+    assert_int_eq( cf_queue_timer_cancel(q, CF_QUEUE_TIMER_NO_HANDLE, &v), CF_QUEUE_NOMATCH );
+
+    // cancel every third, the earliest included
+    for ( uint32_t i = 0; i < 100; i += 3 ) {
+        assert_int_eq( cf_queue_timer_cancel(q, handles[i], &v), CF_QUEUE_OK );
+        assert_int_eq( v, i );
+        assert_int_eq( cf_queue_timer_cancel(q, handles[i], NULL), CF_QUEUE_NOMATCH );
+    }
+    assert_int_eq( cf_queue_timer_sz(q), 66 );
+    assert_true( cf_queue_timer_next_deadline(q) == base + 1 );
+
+    // the cancelled elements' storage is reused, but their handles stay stale
+    for ( uint32_t i = 100; i < 134; i++ ) {
+        assert_int_eq( cf_queue_timer_push(q, &i, base + i, NULL), CF_QUEUE_OK );
+    }
+    for ( uint32_t i = 0; i < 100; i += 3 ) {
+        assert_int_eq( cf_queue_timer_cancel(q, handles[i], NULL), CF_QUEUE_NOMATCH );
+    }
+
+    uint32_t got[100];
+    assert_int_eq( cf_queue_timer_pop_expired(q, got, 100, base + 1000), 100 );
+    uint32_t expect = 1;
+    for ( uint32_t i = 0; i < 100; i++ ) {
+        assert_int_eq( got[i], expect );
+        expect += (expect < 100 && expect % 3 == 2) ? 2 : 1;
+    }
+
+    // popped elements' handles are stale too
+    assert_int_eq( cf_queue_timer_cancel(q, handles[1], NULL), CF_QUEUE_NOMATCH );
+
+    cf_queue_timer_destroy(q);
+}
+
+TEST( queue_timer_wait, "cf_queue_timer pop waits for a deadline" ) {
+    cf_queue_timer * q = cf_queue_timer_create(sizeof(uint32_t), true);
+    uint32_t v = 1;
+
+    cf_clock start = cf_getms();
+    assert_int_eq( cf_queue_timer_pop(q, &v, 20), CF_QUEUE_EMPTY );
+    assert_true( cf_getms() - start >= 19 );
+
+    // not due before the wait runs out
+    assert_int_eq( cf_queue_timer_push(q, &v, cf_getms() + 10000, NULL), CF_QUEUE_OK );
+    assert_int_eq( cf_queue_timer_pop(q, &v, 20), CF_QUEUE_EMPTY );
+
+    // a pop sleeping on a far deadline is woken by the push of an earlier one
+    queue_timer_push_args args = { q, cf_getms() + 50 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, queue_timer_push_later, &args);
+    v = 0;
+    assert_int_eq( cf_queue_timer_pop(q, &v, CF_QUEUE_FOREVER), CF_QUEUE_OK );
+    cf_clock popped = cf_getms();
+    pthread_join(thread, NULL);
+
+    assert_int_eq( v, 2 );
+    assert_true( popped >= args.deadline );
+    assert_true( popped < args.deadline + 5000 );
+    assert_int_eq( cf_queue_timer_sz(q), 1 );
+
+    cf_queue_timer_destroy(q);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( queue_timer, "cf_queue_timer" ) {
+    suite_add( queue_timer_order );
+    suite_add( queue_timer_cancel );
+    suite_add( queue_timer_wait );
+}
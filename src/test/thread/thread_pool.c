@@ -0,0 +1,222 @@
+#include "../test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_thread_pool.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+    cf_thread_pool *    pool;
+    uint                depth;
+    cf_atomic64 *       leaves;
+} thread_pool_tree;
+
+typedef struct {
+    cf_thread_pool *    pool;           // for a parallel_for from a task
+    cf_atomic64         sum;
+    cf_atomic64         chunks;
+    cf_atomic64         oversized;
+    uint64_t            grain;
+    uint8_t *           visits;
+} thread_pool_range;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void thread_pool_count(void * udata) {
+    cf_atomic64_incr((cf_atomic64 *) udata);
+}
+
+static void thread_pool_count_slowly(void * udata) {
+    usleep(1000);
+    cf_atomic64_incr((cf_atomic64 *) udata);
+}
+
+/**
+ * Submit the two halves of the tree as tasks, and wait for them - the
+ * leaves count themselves.
+ */
+static void thread_pool_tree_fn(void * udata) {
+    thread_pool_tree * t = (thread_pool_tree *) udata;
+    if ( t->depth == 0 ) {
+        cf_atomic64_incr(t->leaves);
+        return;
+    }
+
+    thread_pool_tree children[2];
+    cf_thread_pool_group group;
+    cf_thread_pool_group_init(&group);
+    for ( int i = 0; i < 2; i++ ) {
+        children[i].pool = t->pool;
+        children[i].depth = t->depth - 1;
+        children[i].leaves = t->leaves;
+        cf_thread_pool_submit(t->pool, thread_pool_tree_fn, &children[i], &group);
+    }
+    cf_thread_pool_group_wait(t->pool, &group);
+}
+
+static void thread_pool_range_fn(uint64_t begin, uint64_t end, void * udata) {
+    thread_pool_range * r = (thread_pool_range *) udata;
+    uint64_t sum = 0;
+    for ( uint64_t i = begin; i < end; i++ ) {
+        sum += i;
+        if ( r->visits ) {
+            r->visits[i]++;
+        }
+    }
+    cf_atomic64_add(&r->sum, (int64_t) sum);
+    cf_atomic64_incr(&r->chunks);
+    if ( end - begin > r->grain ) {
+        cf_atomic64_incr(&r->oversized);
+    }
+}
+
+/**
+ * Run a parallel_for from inside a pool task.
+ */
+static void thread_pool_nested_for(void * udata) {
+    thread_pool_range * r = (thread_pool_range *) udata;
+    cf_thread_pool_parallel_for(r->pool, 0, 100000, r->grain, thread_pool_range_fn, r);
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( thread_pool_group_wait, "cf_thread_pool group wait" ) {
+    assert_null( cf_thread_pool_create(0) );
+    cf_thread_pool * pool = cf_thread_pool_create(4);
+    assert_not_null( pool );
+
+    cf_atomic64 fast = 0;
+    cf_atomic64 slow = 0;
+    cf_thread_pool_group fast_group;
+    cf_thread_pool_group slow_group;
+    cf_thread_pool_group_init(&fast_group);
+    cf_thread_pool_group_init(&slow_group);
+
+    for ( int i = 0; i < 100; i++ ) {
+        assert_int_eq( cf_thread_pool_submit(pool, thread_pool_count_slowly, (void *) &slow, &slow_group), CF_THREAD_POOL_OK );
+    }
+    for ( int i = 0; i < 10000; i++ ) {
+        assert_int_eq( cf_thread_pool_submit(pool, thread_pool_count, (void *) &fast, &fast_group), CF_THREAD_POOL_OK );
+    }
+
+    // each wait covers its own group's tasks
+    cf_thread_pool_group_wait(pool, &fast_group);
+    assert_int_eq( cf_atomic64_get(fast), 10000 );
+    cf_thread_pool_group_wait(pool, &slow_group);
+    assert_int_eq( cf_atomic64_get(slow), 100 );
+
+    // a finished group can be waited for again, and reused
+    cf_thread_pool_group_wait(pool, &fast_group);
+    for ( int i = 0; i < 100; i++ ) {
+        cf_thread_pool_submit(pool, thread_pool_count, (void *) &fast, &fast_group);
+    }
+    cf_thread_pool_group_wait(pool, &fast_group);
+    assert_int_eq( cf_atomic64_get(fast), 10100 );
+
+    // an empty group doesn't wait
+    cf_thread_pool_group empty;
+    cf_thread_pool_group_init(&empty);
+    cf_thread_pool_group_wait(pool, &empty);
+
+    cf_thread_pool_destroy(pool);
+}
+
+TEST( thread_pool_nested, "cf_thread_pool tasks waiting for their own tasks" ) {
+    // fewer threads than levels of waiting tasks - waiters must run tasks
+    uint n_threads[] = { 1, 2, 4 };
+
+    for ( int i = 0; i < 3; i++ ) {
+        cf_thread_pool * pool = cf_thread_pool_create(n_threads[i]);
+        cf_atomic64 leaves = 0;
+
+        thread_pool_tree root = { pool, 12, &leaves };
+        cf_thread_pool_group group;
+        cf_thread_pool_group_init(&group);
+        assert_int_eq( cf_thread_pool_submit(pool, thread_pool_tree_fn, &root, &group), CF_THREAD_POOL_OK );
+        cf_thread_pool_group_wait(pool, &group);
+        assert_int_eq( cf_atomic64_get(leaves), 1 << 12 );
+
+        cf_thread_pool_destroy(pool);
+    }
+}
+
+TEST( thread_pool_parallel_for, "cf_thread_pool parallel_for" ) {
+    cf_thread_pool * pool = cf_thread_pool_create(4);
+
+    // every index exactly once, in chunks of at most grain
+    const uint64_t begin = 17;
+    const uint64_t end = 1000017;
+    thread_pool_range r;
+    memset(&r, 0, sizeof(r));
+    r.grain = 1000;
+    r.visits = (uint8_t *) calloc(end, 1);
+
+    assert_int_eq( cf_thread_pool_parallel_for(pool, begin, end, r.grain, thread_pool_range_fn, &r), CF_THREAD_POOL_OK );
+    assert_true( cf_atomic64_get(r.sum) == (int64_t) ((end * (end - 1) - begin * (begin - 1)) / 2) );
+    assert_true( cf_atomic64_get(r.chunks) >= 1000 );
+    assert_int_eq( cf_atomic64_get(r.oversized), 0 );
+    uint64_t bad = 0;
+    for ( uint64_t i = 0; i < end; i++ ) {
+        bad += r.visits[i] != (i >= begin ? 1 : 0);
+    }
+    assert_int_eq( bad, 0 );
+    free(r.visits);
+
+    // grain 0 means 1
+    memset(&r, 0, sizeof(r));
+    r.grain = 1;
+    assert_int_eq( cf_thread_pool_parallel_for(pool, 0, 100, 0, thread_pool_range_fn, &r), CF_THREAD_POOL_OK );
+    assert_int_eq( cf_atomic64_get(r.chunks), 100 );
+    assert_int_eq( cf_atomic64_get(r.sum), 4950 );
+
+    // an empty range calls nothing
+    memset(&r, 0, sizeof(r));
+    assert_int_eq( cf_thread_pool_parallel_for(pool, 10, 10, 1, thread_pool_range_fn, &r), CF_THREAD_POOL_OK );
+    assert_int_eq( cf_thread_pool_parallel_for(pool, 10, 5, 1, thread_pool_range_fn, &r), CF_THREAD_POOL_OK );
+    assert_int_eq( cf_atomic64_get(r.chunks), 0 );
+
+    // from inside a task
+    memset(&r, 0, sizeof(r));
+    r.grain = 100;
+    r.pool = pool;
+    cf_thread_pool_group group;
+    cf_thread_pool_group_init(&group);
+    cf_thread_pool_submit(pool, thread_pool_nested_for, &r, &group);
+    cf_thread_pool_group_wait(pool, &group);
+    assert_true( cf_atomic64_get(r.sum) == 100000ll * 99999 / 2 );
+    assert_int_eq( cf_atomic64_get(r.oversized), 0 );
+
+    cf_thread_pool_destroy(pool);
+}
+
+TEST( thread_pool_destroy, "cf_thread_pool destroy runs the tasks submitted" ) {
+    cf_thread_pool * pool = cf_thread_pool_create(2);
+    cf_atomic64 count = 0;
+
+    for ( int i = 0; i < 200; i++ ) {
+        assert_int_eq( cf_thread_pool_submit(pool, thread_pool_count_slowly, (void *) &count, NULL), CF_THREAD_POOL_OK );
+    }
+    cf_thread_pool_destroy(pool);
+    assert_int_eq( cf_atomic64_get(count), 200 );
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( thread_pool, "cf_thread_pool" ) {
+    suite_add( thread_pool_group_wait );
+    suite_add( thread_pool_nested );
+    suite_add( thread_pool_parallel_for );
+    suite_add( thread_pool_destroy );
+}
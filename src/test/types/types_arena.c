@@ -0,0 +1,156 @@
+#include "../test.h"
+
+#include <string.h>
+
+#include <aerospike/as_arena.h>
+#include <aerospike/as_arraylist.h>
+#include <aerospike/as_bytes.h>
+#include <aerospike/as_hashmap.h>
+#include <aerospike/as_integer.h>
+#include <aerospike/as_pair.h>
+#include <aerospike/as_string.h>
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( types_arena_alloc, "as_arena allocations" ) {
+    as_arena arena;
+    as_arena_init(&arena, 256);
+
+    // small allocations share a block
+    uint8_t * a = (uint8_t *) as_arena_alloc(&arena, 3);
+    uint8_t * b = (uint8_t *) as_arena_alloc(&arena, 8);
+    assert_not_null( a );
+    assert_not_null( b );
+    assert( ((uintptr_t) b & 7) == 0 );
+    assert( b - a == 8 );
+
+    // a large allocation doesn't take over the current block
+    uint8_t * c = (uint8_t *) as_arena_alloc(&arena, 4096);
+    assert_not_null( c );
+    memset(c, 1, 4096);
+    uint8_t * d = (uint8_t *) as_arena_alloc(&arena, 8);
+    assert( d - b == 8 );
+
+    as_arena_reset(&arena);
+    assert( (uint8_t *) as_arena_alloc(&arena, 8) == a );
+
+    as_arena_destroy(&arena);
+}
+
+TEST( types_arena_scalars, "as_integer, as_string, as_bytes and as_pair from an arena" ) {
+    as_arena * arena = as_arena_new(0);
+
+    as_integer * i = as_integer_new_arena(arena, 123);
+    assert( as_integer_get(i) == 123 );
+    assert_true( ((as_val *) i)->arena );
+
+    as_string * s = as_string_new_arena(arena, "abcdef", 3);
+    assert_string_eq( as_string_get(s), "abc" );
+    assert( as_string_len(s) == 3 );
+
+    as_bytes * b = as_bytes_new_arena(arena, 4);
+    assert_true( as_bytes_append(b, (uint8_t *) "wxyz", 4) );
+    assert( as_bytes_size(b) == 4 );
+    assert_false( as_bytes_ensure(b, 8, true) );
+
+    as_pair * p = as_pair_new_arena(arena, (as_val *) i, (as_val *) s);
+    assert( as_pair_1(p) == (as_val *) i );
+
+    // destroying only drops the reference, the arena releases the memory
+    as_val_reserve(s);
+    assert_not_null( as_val_destroy(s) );
+    as_val_destroy(p);
+    as_val_destroy(b);
+    assert( as_string_len(s) == 3 );
+
+    as_arena_destroy(arena);
+}
+
+TEST( types_arena_list, "as_arraylist from an arena" ) {
+    as_arena arena;
+    as_arena_init(&arena, 0);
+
+    as_arraylist * l = as_arraylist_new_arena(&arena, 2, 2);
+    for ( int i = 0; i < 100; i++ ) {
+        assert_int_eq( as_arraylist_append(l, (as_val *) as_integer_new_arena(&arena, i)), AS_ARRAYLIST_OK );
+    }
+    assert_int_eq( as_arraylist_size(l), 100 );
+    assert_int_eq( as_arraylist_get_int64(l, 99), 99 );
+
+    as_arraylist_set(l, 0, (as_val *) as_string_new_arena(&arena, "a", 1));
+    assert_string_eq( as_arraylist_get_str(l, 0), "a" );
+
+    as_arraylist_destroy(l);
+    as_arena_destroy(&arena);
+}
+
+TEST( types_arena_list_typed, "as_arraylist typed helpers allocate from the list's arena" ) {
+    as_arena arena;
+    as_arena_init(&arena, 0);
+
+    as_arraylist * l = as_arraylist_new_arena(&arena, 2, 2);
+    assert_int_eq( as_arraylist_append_str(l, "b"), AS_ARRAYLIST_OK );
+    assert_int_eq( as_arraylist_prepend_str(l, "a"), AS_ARRAYLIST_OK );
+    assert_int_eq( as_arraylist_append_int64(l, 1), AS_ARRAYLIST_OK );
+    assert_int_eq( as_arraylist_prepend_int64(l, INT64_MAX), AS_ARRAYLIST_OK );
+    assert_int_eq( as_arraylist_set_str(l, 4, "e"), AS_ARRAYLIST_OK );
+    assert_int_eq( as_arraylist_set_int64(l, 5, INT64_MIN), AS_ARRAYLIST_OK );
+    assert_int_eq( as_arraylist_size(l), 6 );
+
+    assert_int_eq( as_arraylist_get_int64(l, 0), INT64_MAX );
+    assert_string_eq( as_arraylist_get_str(l, 1), "a" );
+    assert_string_eq( as_arraylist_get_str(l, 2), "b" );
+    assert_int_eq( as_arraylist_get_int64(l, 3), 1 );
+    assert_string_eq( as_arraylist_get_str(l, 4), "e" );
+    assert_int_eq( as_arraylist_get_int64(l, 5), INT64_MIN );
+
+    // small integers are immediate, everything else comes from the arena
+    assert_true( as_val_isimm(as_arraylist_get(l, 3)) );
+    assert_true( as_arraylist_get(l, 0)->arena );
+    assert_true( as_arraylist_get(l, 1)->arena );
+    assert_true( as_arraylist_get(l, 2)->arena );
+    assert_true( as_arraylist_get(l, 4)->arena );
+    assert_true( as_arraylist_get(l, 5)->arena );
+
+    // replacing an arena element leaves it to the arena
+    assert_int_eq( as_arraylist_set_str(l, 1, "z"), AS_ARRAYLIST_OK );
+    assert_string_eq( as_arraylist_get_str(l, 1), "z" );
+
+    as_arraylist_destroy(l);
+    as_arena_destroy(&arena);
+}
+
+TEST( types_arena_map, "as_hashmap from an arena" ) {
+    as_arena arena;
+    as_arena_init(&arena, 0);
+
+    as_hashmap * m = as_hashmap_new_arena(&arena, 0);
+    for ( int i = 0; i < 1000; i++ ) {
+        as_hashmap_set(m, (as_val *) as_integer_new_arena(&arena, i), (as_val *) as_integer_new_arena(&arena, i * 2));
+    }
+    assert_int_eq( as_hashmap_size(m), 1000 );
+
+    as_integer k;
+    as_integer_init(&k, 500);
+    assert_int_eq( as_integer_get(as_integer_fromval(as_hashmap_get(m, (as_val *) &k))), 1000 );
+
+    as_hashmap_remove(m, (as_val *) &k);
+    assert_int_eq( as_hashmap_size(m), 999 );
+
+    as_hashmap_destroy(m);
+    as_arena_destroy(&arena);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( types_arena, "as_arena" ) {
+    suite_add( types_arena_alloc );
+    suite_add( types_arena_scalars );
+    suite_add( types_arena_list );
+    suite_add( types_arena_list_typed );
+    suite_add( types_arena_map );
+}
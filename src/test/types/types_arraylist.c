@@ -1,5 +1,7 @@
 #include "../test.h"
 
+#include <pthread.h>
+
 #include <aerospike/as_arraylist.h>
 #include <aerospike/as_arraylist_iterator.h>
 #include <aerospike/as_integer.h>
@@ -341,6 +343,52 @@ TEST( types_arraylist_msgpack, "as_arraylist msgpack" ) {
     // as_list_destroy(l2);
 }
 
+static void * types_arraylist_local_fn(void * udata) {
+    as_arraylist * l = (as_arraylist *) udata;
+    for ( int i = 0; i < 1000; i++ ) {
+        as_val_reserve(as_arraylist_get(l, i % 10));
+        as_val_destroy(as_arraylist_get(l, i % 10));
+    }
+    return NULL;
+}
+
+TEST( types_arraylist_local, "as_arraylist with local reference counts" ) {
+
+    bool prev = as_val_set_local(true);
+    as_arraylist * l = as_arraylist_new(10, 10);
+    as_arraylist * l2 = as_arraylist_new(1, 1);
+    as_arraylist_append_str(l2, "a");
+    as_arraylist_append(l, (as_val *) l2);
+    for ( int i = 1; i < 10; i++ ) {
+        as_arraylist_append_str(l, "b");
+    }
+    as_val_set_local(prev);
+
+    assert_true( ((as_val *) l)->local );
+    assert_true( as_arraylist_get(l, 5)->local );
+
+    as_val_reserve(l);
+    assert_int_eq( ((as_val *) l)->count, 2 );
+    as_val_destroy(l);
+    assert_int_eq( ((as_val *) l)->count, 1 );
+
+    as_val_share(l);
+    assert_false( ((as_val *) l)->local );
+    assert_false( as_arraylist_get(l, 5)->local );
+    assert_false( as_arraylist_get(l2, 0)->local );
+
+    pthread_t threads[2];
+    for ( int i = 0; i < 2; i++ ) {
+        pthread_create(&threads[i], NULL, types_arraylist_local_fn, l);
+    }
+    for ( int i = 0; i < 2; i++ ) {
+        pthread_join(threads[i], NULL);
+    }
+    assert_int_eq( as_arraylist_get(l, 5)->count, 1 );
+
+    as_arraylist_destroy(l);
+}
+
 /******************************************************************************
  * TEST SUITE
  *****************************************************************************/
@@ -353,4 +401,5 @@ SUITE( types_arraylist, "as_arraylist" ) {
     suite_add( types_arraylist_list );
     suite_add( types_arraylist_iterator );
     suite_add( types_arraylist_msgpack );
+    suite_add( types_arraylist_local );
 }
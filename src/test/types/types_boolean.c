@@ -3,6 +3,7 @@
 #include <aerospike/as_boolean.h>
 #include <aerospike/as_buffer.h>
 #include <aerospike/as_msgpack.h>
+#include <aerospike/as_nil.h>
 #include <aerospike/as_serializer.h>
 
 /******************************************************************************
@@ -43,6 +44,20 @@ TEST( types_boolean_false_new, "as_boolean is false (new)" ) {
 	as_boolean_destroy(b);
 }
 
+TEST( types_boolean_imm, "as_boolean immediate values" ) {
+	as_val * t = as_boolean_new_imm(true);
+	as_val * f = as_boolean_new_imm(false);
+	assert_int_eq( as_val_type(t), AS_BOOLEAN );
+	assert_int_eq( as_val_type(f), AS_BOOLEAN );
+	assert( as_boolean_get(as_boolean_fromval(t)) == true );
+	assert( as_boolean_get(as_boolean_fromval(f)) == false );
+	assert_int_eq( as_val_hashcode(t), as_val_hashcode(&as_true) );
+	assert_int_eq( as_val_hashcode(f), as_val_hashcode(&as_false) );
+	assert_int_eq( as_val_type(as_nil_imm), AS_NIL );
+	as_val_destroy(t);
+	as_val_destroy(f);
+}
+
 TEST( types_boolean_true_msgpack, "as_boolean is true w/ msgpack" ) {
 
     as_serializer ser;
@@ -99,6 +114,7 @@ SUITE( types_boolean, "as_boolean" ) {
 	suite_add( types_boolean_false );
 	suite_add( types_boolean_true_new );
 	suite_add( types_boolean_false_new );
+	suite_add( types_boolean_imm );
 	suite_add( types_boolean_true_msgpack );
 	suite_add( types_boolean_false_msgpack );
 }
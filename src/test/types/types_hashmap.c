@@ -10,6 +10,8 @@
 #include <aerospike/as_msgpack.h>
 #include <aerospike/as_serializer.h>
 
+#include <pthread.h>
+
 /******************************************************************************
  * TEST CASES
  *****************************************************************************/
@@ -267,6 +269,101 @@ TEST( types_hashmap_foreach, "as_hashmap_foreach" ) {
 }
 
 
+TEST( types_hashmap_collision, "as_hashmap keys with the same hashcode" ) {
+
+	// the hashcode of an as_integer is its value truncated to 32 bits
+	as_integer * a = as_integer_new(1);
+	as_integer * b = as_integer_new(1 + (1L << 32));
+
+	assert_int_eq( as_val_hashcode(a), as_val_hashcode(b) );
+
+	as_hashmap * m = as_hashmap_new(0);
+	as_hashmap_set(m, (as_val *) as_integer_new(1), (as_val *) as_integer_new(10));
+	as_hashmap_set(m, (as_val *) as_integer_new(1 + (1L << 32)), (as_val *) as_integer_new(20));
+
+	assert_int_eq( as_hashmap_size(m), 2 );
+	assert_int_eq( as_integer_get((as_integer *) as_hashmap_get(m, (as_val *) a)), 10 );
+	assert_int_eq( as_integer_get((as_integer *) as_hashmap_get(m, (as_val *) b)), 20 );
+
+	as_hashmap_remove(m, (as_val *) a);
+	assert_int_eq( as_hashmap_size(m), 1 );
+	assert_null( as_hashmap_get(m, (as_val *) a) );
+	assert_int_eq( as_integer_get((as_integer *) as_hashmap_get(m, (as_val *) b)), 20 );
+
+	as_hashmap_destroy(m);
+	as_integer_destroy(a);
+	as_integer_destroy(b);
+}
+
+TEST( types_hashmap_grow, "as_hashmap grows past the initial capacity" ) {
+
+	as_hashmap * m = as_hashmap_new(4);
+
+	for ( int64_t i = 0; i < 10000; i++ ) {
+		as_hashmap_set(m, (as_val *) as_integer_new(i), (as_val *) as_integer_new(i * 2));
+	}
+	assert_int_eq( as_hashmap_size(m), 10000 );
+
+	for ( int64_t i = 0; i < 10000; i += 2 ) {
+		as_integer k;
+		as_integer_init(&k, i);
+		as_hashmap_remove(m, (as_val *) &k);
+	}
+	assert_int_eq( as_hashmap_size(m), 5000 );
+
+	for ( int64_t i = 0; i < 10000; i++ ) {
+		as_integer k;
+		as_integer_init(&k, i);
+		as_integer * v = (as_integer *) as_hashmap_get(m, (as_val *) &k);
+		if ( i % 2 == 0 ) {
+			assert_null( v );
+		}
+		else {
+			assert_not_null( v );
+			assert_int_eq( as_integer_get(v), i * 2 );
+		}
+	}
+
+	int count = 0;
+	as_hashmap_iterator it;
+	as_hashmap_iterator_init(&it, m);
+	while ( as_hashmap_iterator_has_next(&it) ) {
+		as_pair * p = (as_pair *) as_hashmap_iterator_next(&it);
+		assert_int_eq( as_integer_get((as_integer *) as_pair_1(p)) % 2, 1 );
+		count++;
+	}
+	as_hashmap_iterator_destroy(&it);
+	assert_int_eq( count, 5000 );
+
+	as_hashmap_destroy(m);
+}
+
+static void * types_hashmap_concurrent_fn(void * udata) {
+	as_hashmap * m = (as_hashmap *) udata;
+	for ( int64_t i = 0; i < 1000; i++ ) {
+		as_hashmap_set(m, (as_val *) as_integer_new(i), (as_val *) as_integer_new(i));
+	}
+	return NULL;
+}
+
+TEST( types_hashmap_concurrent, "as_hashmap shared between threads" ) {
+
+	as_hashmap m;
+	as_hashmap_init_concurrent(&m, 0);
+
+	pthread_t threads[4];
+	for ( int i = 0; i < 4; i++ ) {
+		pthread_create(&threads[i], NULL, types_hashmap_concurrent_fn, &m);
+	}
+	for ( int i = 0; i < 4; i++ ) {
+		pthread_join(threads[i], NULL);
+	}
+
+	assert_int_eq( as_hashmap_size(&m), 1000 );
+
+	as_hashmap_destroy(&m);
+}
+
 TEST( types_hashmap_msgpack, "as_hashmap msgpack" ) {
 
 	as_hashmap * m1 = as_hashmap_new(10);
@@ -314,5 +411,8 @@ SUITE( types_hashmap, "as_hashmap" ) {
 	suite_add( types_hashmap_map_ops );
 	suite_add( types_hashmap_iterator );
 	suite_add( types_hashmap_foreach );
+	suite_add( types_hashmap_collision );
+	suite_add( types_hashmap_grow );
+	suite_add( types_hashmap_concurrent );
 	suite_add( types_hashmap_msgpack );
 }
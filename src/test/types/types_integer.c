@@ -2,6 +2,7 @@
 #include "../test.h"
 
 #include <limits.h>
+#include <pthread.h>
 
 #include <aerospike/as_integer.h>
 
@@ -45,6 +46,59 @@ TEST( types_integer_long_min, "as_integer containing LONG_MIN" ) {
     assert( as_integer_toint(&i) == LONG_MIN );
 }
 
+static void * types_integer_destroy_fn(void * udata) {
+    as_integer ** values = (as_integer **) udata;
+    for ( int i = 0; i < 10000; i++ ) {
+        as_integer_destroy(values[i]);
+    }
+    return NULL;
+}
+
+TEST( types_integer_new_threads, "as_integer_new values destroyed by another thread" ) {
+    static as_integer * values[10000];
+
+    for ( int r = 0; r < 3; r++ ) {
+        for ( int i = 0; i < 10000; i++ ) {
+            values[i] = as_integer_new(i);
+        }
+        for ( int i = 0; i < 10000; i++ ) {
+            assert_int_eq( as_integer_get(values[i]), i );
+        }
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, types_integer_destroy_fn, values);
+        pthread_join(thread, NULL);
+    }
+}
+
+TEST( types_integer_imm, "as_integer immediate values" ) {
+    as_val * v = as_integer_new_imm(-123);
+    assert_true( as_val_isimm(v) );
+    assert_int_eq( as_val_type(v), AS_INTEGER );
+    assert_int_eq( as_integer_get(as_integer_fromval(v)), -123 );
+
+    as_integer i;
+    as_integer_init(&i, -123);
+    assert_int_eq( as_val_hashcode(v), as_val_hashcode(&i) );
+
+    char * s = as_val_tostring(v);
+    assert_string_eq( s, "-123" );
+    free(s);
+
+    assert( as_val_reserve(v) == v );
+    assert( as_val_destroy(v) == v );
+
+    as_val * min = as_integer_new_imm(AS_VAL_IMM_INT_MIN);
+    assert_true( as_val_isimm(min) );
+    assert_int_eq( as_integer_get((as_integer *) min), AS_VAL_IMM_INT_MIN );
+
+    // too big to be immediate
+    as_val * max = as_integer_new_imm(LONG_MAX);
+    assert_false( as_val_isimm(max) );
+    assert_int_eq( as_integer_get((as_integer *) max), LONG_MAX );
+    as_val_destroy(max);
+}
+
 /******************************************************************************
  * TEST SUITE
  *****************************************************************************/
@@ -56,4 +110,6 @@ SUITE( types_integer, "as_integer" ) {
     suite_add( types_integer_ulong_max );
     suite_add( types_integer_long_max );
     suite_add( types_integer_long_min );
+    suite_add( types_integer_new_threads );
+    suite_add( types_integer_imm );
 }
\ No newline at end of file
@@ -28,6 +28,41 @@ TEST( types_string_random, "as_string containing random values" ) {
     as_string_destroy(&s);
 }
 
+TEST( types_string_strndup, "as_string copies of short and long values" ) {
+    as_string * s = as_string_new_strdup("abc");
+    assert( as_string_len(s) == 3 );
+    assert_string_eq( as_string_get(s), "abc" );
+    assert_false( s->free );
+    as_string_destroy(s);
+
+    const char * value = "abcdefghijklmnopqrstuvwxyz";
+    s = as_string_new_strndup(value, 26);
+    assert( as_string_len(s) == 26 );
+    assert_string_eq( as_string_get(s), value );
+    assert( as_string_get(s) != value );
+    assert_true( s->free );
+    as_string_destroy(s);
+}
+
+TEST( types_string_binary, "as_string containing NULL characters" ) {
+    as_string * a = as_string_new_strndup("ab\0cd", 5);
+    as_string * b = as_string_new_strndup("ab\0ce", 5);
+    as_string c;
+    as_string_init(&c, "ab", false);
+
+    assert( as_string_len(a) == 5 );
+    assert( memcmp(as_string_get(a), "ab\0cd", 6) == 0 );
+    assert( as_val_hashcode(a) != as_val_hashcode(b) );
+    assert( as_val_hashcode(a) != as_val_hashcode(&c) );
+
+    char * str = as_val_tostring(a);
+    assert( memcmp(str, "\"ab\0cd\"", 8) == 0 );
+    free(str);
+
+    as_string_destroy(a);
+    as_string_destroy(b);
+}
+
 /******************************************************************************
  * TEST SUITE
  *****************************************************************************/
@@ -36,4 +71,6 @@ SUITE( types_string, "as_string" ) {
     // suite_add( types_string_null );
     suite_add( types_string_empty );
     suite_add( types_string_random );
+    suite_add( types_string_strndup );
+    suite_add( types_string_binary );
 }
\ No newline at end of file